@@ -0,0 +1,140 @@
+// Answers msgpack-RPC requests on its standard input and output the way
+// nvim --embed does, with nil results, so nvim_rpc_benchmark can measure
+// the transport without Nvim. Like a buffer attached with nvim_buf_attach,
+// it sends an nvim_buf_lines_event for every nvim_buf_set_lines.
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "Msgpack.h"
+
+using namespace VSNvim;
+
+static long ReadInput(char* data, std::size_t size)
+{
+#ifdef _WIN32
+  return _read(0, data, static_cast<unsigned int>(size));
+#else
+  return static_cast<long>(read(STDIN_FILENO, data, size));
+#endif
+}
+
+static bool WriteOutput(const std::string& buffer)
+{
+  for (std::size_t offset = 0; offset < buffer.size();)
+  {
+#ifdef _WIN32
+    const long written = _write(1, buffer.data() + offset,
+                                static_cast<unsigned int>(buffer.size() -
+                                                          offset));
+#else
+    const long written = static_cast<long>(
+      write(STDOUT_FILENO, buffer.data() + offset, buffer.size() - offset));
+#endif
+    if (written <= 0)
+    {
+      return false;
+    }
+    offset += static_cast<std::size_t>(written);
+  }
+  return true;
+}
+
+static void WriteLinesEvent(MsgpackWriter& output, const MsgpackValue& params)
+{
+  if (params.items.size() != 5)
+  {
+    return;
+  }
+  const auto& lines = params.items[4].items;
+  output.WriteArrayHeader(3);
+  output.WriteInteger(2);
+  output.WriteString("nvim_buf_lines_event");
+  output.WriteArrayHeader(6);
+  output.WriteInteger(params.items[0].GetInteger());
+  output.WriteInteger(1);
+  output.WriteInteger(params.items[1].integer);
+  output.WriteInteger(params.items[2].integer);
+  output.WriteArrayHeader(static_cast<std::uint32_t>(lines.size()));
+  for (const auto& line : lines)
+  {
+    output.WriteString(line.bytes);
+  }
+  output.WriteBoolean(false);
+}
+
+int main()
+{
+#ifdef _WIN32
+  _setmode(0, _O_BINARY);
+  _setmode(1, _O_BINARY);
+#endif
+  MsgpackReader reader;
+  MsgpackWriter output;
+  std::vector<char> chunk(64 * 1024);
+  for (;;)
+  {
+    const auto size = ReadInput(chunk.data(), chunk.size());
+    if (size <= 0)
+    {
+      return EXIT_SUCCESS;
+    }
+    reader.Append(chunk.data(), static_cast<std::size_t>(size));
+    MsgpackValue message;
+    MsgpackResult result;
+    while ((result = reader.Read(message)) == MsgpackResult::Value)
+    {
+      // Only requests are answered.
+      if (message.type != MsgpackType::Array || message.items.size() != 4 ||
+          message.items[0].integer != 0)
+      {
+        continue;
+      }
+      const auto& method = message.items[2].bytes;
+      const auto& params = message.items[3];
+      if (method == "nvim_buf_set_lines")
+      {
+        WriteLinesEvent(output, params);
+      }
+      output.WriteArrayHeader(4);
+      output.WriteInteger(1);
+      output.WriteInteger(message.items[1].integer);
+      output.WriteNil();
+      // nvim_call_atomic returns the results and the error.
+      if (method == "nvim_call_atomic" && !params.items.empty())
+      {
+        const auto count =
+          static_cast<std::uint32_t>(params.items[0].items.size());
+        output.WriteArrayHeader(2);
+        output.WriteArrayHeader(count);
+        for (std::uint32_t i = 0; i < count; i++)
+        {
+          output.WriteNil();
+        }
+        output.WriteNil();
+      }
+      else
+      {
+        output.WriteNil();
+      }
+    }
+    if (result == MsgpackResult::Invalid)
+    {
+      std::fprintf(stderr, "fake_nvim_server: invalid input\n");
+      return EXIT_FAILURE;
+    }
+    if (!WriteOutput(output.GetBuffer()))
+    {
+      return EXIT_FAILURE;
+    }
+    output.Clear();
+  }
+}
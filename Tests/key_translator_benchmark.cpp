@@ -0,0 +1,130 @@
+// Checks a few translations of KeyTranslator and measures the cost of a
+// key press with a cold and a warm cache. Off Windows the keyboard layout
+// is the US layout of win32/Winsock2.h.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string_view>
+#include <vector>
+
+#include "KeyTranslator.h"
+
+using namespace VSNvim;
+
+struct KeyPress
+{
+  unsigned int virtual_key;
+  unsigned int modifiers;
+};
+
+static int failures_ = 0;
+
+static void Expect(KeyTranslator& translator, unsigned int virtual_key,
+                   unsigned int modifiers, std::string_view expected)
+{
+  // Translate twice so the cached entry is checked as well.
+  for (auto pass = 0; pass < 2; pass++)
+  {
+    const auto notation =
+      translator.Translate(virtual_key, virtual_key, modifiers, nullptr);
+    if (notation != expected)
+    {
+      std::fprintf(stderr, "key 0x%02X modifiers %u: got \"%.*s\", "
+                   "expected \"%.*s\"\n", virtual_key, modifiers,
+                   static_cast<int>(notation.size()), notation.data(),
+                   static_cast<int>(expected.size()), expected.data());
+      failures_++;
+    }
+  }
+}
+
+// Typing text with a few commands and chords in between.
+static std::vector<KeyPress> CreateKeyPresses()
+{
+  std::vector<KeyPress> keys;
+  const char text[] = "the quick brown fox jumps over the lazy dog 0123456789";
+  for (const auto chr : std::string_view(text))
+  {
+    if (chr == ' ')
+    {
+      keys.push_back({ VK_SPACE, 0 });
+    }
+    else if (chr >= 'a' && chr <= 'z')
+    {
+      keys.push_back({ static_cast<unsigned int>(chr - 32), 0 });
+    }
+    else
+    {
+      keys.push_back({ static_cast<unsigned int>(chr), 0 });
+    }
+  }
+  keys.push_back({ VK_ESCAPE, 0 });
+  keys.push_back({ 'W', Shift });
+  keys.push_back({ 'D', Control });
+  keys.push_back({ VK_OEM_COMMA, Shift });
+  keys.push_back({ VK_F1, Shift });
+  keys.push_back({ VK_RETURN, 0 });
+  return keys;
+}
+
+int main(int argc, char** argv)
+{
+  KeyTranslator translator;
+  Expect(translator, 'A', 0, "a");
+  Expect(translator, 'A', Shift, "A");
+  Expect(translator, 'A', CapsLock, "A");
+  Expect(translator, 'X', Control, "<C-x>");
+  Expect(translator, 'X', Control | Shift, "<C-X>");
+  Expect(translator, 'X', Alt, "<M-x>");
+  Expect(translator, '1', Shift, "!");
+  Expect(translator, VK_OEM_COMMA, Shift, "<lt>");
+  Expect(translator, VK_F1, Shift, "<S-F1>");
+  Expect(translator, VK_F1 + 19, 0, "<F20>");
+  Expect(translator, VK_UP, Control, "<C-Up>");
+  Expect(translator, VK_DELETE, 0, "<Del>");
+  Expect(translator, VK_SHIFT, Shift, "");
+  if (failures_)
+  {
+    return EXIT_FAILURE;
+  }
+
+  const auto rounds = argc > 1 ? std::atoi(argv[1]) : 20000;
+  const auto keys = CreateKeyPresses();
+  std::size_t total_size = 0;
+
+  // A new translator for every round, so each distinct key misses once.
+  auto start = std::chrono::steady_clock::now();
+  for (auto round = 0; round < rounds / 100 + 1; round++)
+  {
+    KeyTranslator cold_translator;
+    for (const auto& key : keys)
+    {
+      total_size += cold_translator.Translate(key.virtual_key,
+                                              key.virtual_key, key.modifiers,
+                                              nullptr).size();
+    }
+  }
+  const auto cold_keys = (rounds / 100 + 1) * keys.size();
+  const auto cold_seconds = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+
+  start = std::chrono::steady_clock::now();
+  for (auto round = 0; round < rounds; round++)
+  {
+    for (const auto& key : keys)
+    {
+      total_size += translator.Translate(key.virtual_key, key.virtual_key,
+                                         key.modifiers, nullptr).size();
+    }
+  }
+  const auto warm_keys = static_cast<std::size_t>(rounds) * keys.size();
+  const auto warm_seconds = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+
+  std::printf("cold cache: %.1f ns/key over %zu keys\n",
+              cold_seconds * 1e9 / cold_keys, cold_keys);
+  std::printf("warm cache: %.1f ns/key over %zu keys (%zu bytes)\n",
+              warm_seconds * 1e9 / warm_keys, warm_keys, total_size);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,258 @@
+// Checks LineIndex against a line-by-line conversion of random UTF-16 text,
+// then measures how long filling the index of a large document takes with
+// 1, 4 and 16 threads. The threads take chunks from a shared counter, like
+// the parallel loop of LineIndexBuilder.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LineIndex.h"
+
+using namespace VSNvim;
+
+// The chunk size of LineIndexBuilder.
+constexpr std::size_t chunk_length_ = 1 << 20;
+
+static bool IsLineBreak(char16_t chr)
+{
+  return chr == '\r' || chr == '\n' || chr == 0x85 || chr == 0x2028 ||
+         chr == 0x2029;
+}
+
+static void AppendUtf8(std::string& text, char32_t code_point)
+{
+  if (code_point < 0x80)
+  {
+    text += static_cast<char>(code_point);
+  }
+  else if (code_point < 0x800)
+  {
+    text += static_cast<char>(0xc0 | code_point >> 6);
+    text += static_cast<char>(0x80 | (code_point & 0x3f));
+  }
+  else if (code_point < 0x10000)
+  {
+    text += static_cast<char>(0xe0 | code_point >> 12);
+    text += static_cast<char>(0x80 | (code_point >> 6 & 0x3f));
+    text += static_cast<char>(0x80 | (code_point & 0x3f));
+  }
+  else
+  {
+    text += static_cast<char>(0xf0 | code_point >> 18);
+    text += static_cast<char>(0x80 | (code_point >> 12 & 0x3f));
+    text += static_cast<char>(0x80 | (code_point >> 6 & 0x3f));
+    text += static_cast<char>(0x80 | (code_point & 0x3f));
+  }
+}
+
+// Splits the text into UTF-8 lines one unit at a time, and returns the
+// offsets at which the lines start.
+static std::vector<std::string> SplitLines(const std::u16string& text,
+                                           std::vector<std::size_t>& starts)
+{
+  std::vector<std::string> lines(1);
+  starts.assign(1, 0);
+  for (std::size_t i = 0; i < text.size();)
+  {
+    const auto chr = text[i++];
+    if (IsLineBreak(chr))
+    {
+      if (chr == '\r' && i < text.size() && text[i] == '\n')
+      {
+        i++;
+      }
+      lines.emplace_back();
+      starts.push_back(i);
+    }
+    else if (chr >= 0xd800 && chr <= 0xdbff && i < text.size() &&
+             text[i] >= 0xdc00 && text[i] <= 0xdfff)
+    {
+      AppendUtf8(lines.back(),
+                 0x10000 + ((chr - 0xd800) << 10) + (text[i++] - 0xdc00));
+    }
+    else if (chr >= 0xd800 && chr <= 0xdfff)
+    {
+      AppendUtf8(lines.back(), 0xfffd);
+    }
+    else
+    {
+      AppendUtf8(lines.back(), chr);
+    }
+  }
+  return lines;
+}
+
+static std::size_t GetChunkEnd(const LineIndex& index, int chunk,
+                               const std::vector<std::size_t>& starts,
+                               std::size_t length)
+{
+  const auto end_line = static_cast<std::size_t>(index.GetChunkEndLine(chunk));
+  return end_line <= starts.size() ? starts[end_line - 1] : length;
+}
+
+static bool CheckRandomText()
+{
+  std::mt19937 random(1);
+  const char16_t specials[] =
+  {
+    ' ', '\t', '\n', '\r', 0xe9, 0x85, 0x2028, 0x2029, 0x4e2d,
+    0xd83d, 0xde00, 0xdc00
+  };
+  for (auto iteration = 0; iteration < 3000; iteration++)
+  {
+    std::u16string text;
+    const auto length = random() % 200;
+    for (std::size_t i = 0; i < length; i++)
+    {
+      text += random() % 4
+        ? static_cast<char16_t>('a' + random() % 26)
+        : specials[random() % (sizeof(specials) / sizeof(specials[0]))];
+    }
+    std::vector<std::size_t> starts;
+    const auto lines = SplitLines(text, starts);
+
+    std::vector<int> chunk_first_lines{ 1 };
+    for (std::size_t lnum = 2; lnum <= starts.size(); lnum++)
+    {
+      if (random() % 3 == 0)
+      {
+        chunk_first_lines.push_back(static_cast<int>(lnum));
+      }
+    }
+    LineIndex index(chunk_first_lines, static_cast<int>(lines.size()));
+    for (auto chunk = 0; chunk < index.GetChunkCount(); chunk++)
+    {
+      const auto start = starts[index.GetChunkFirstLine(chunk) - 1];
+      const auto end = GetChunkEnd(index, chunk, starts, text.size());
+      if (!index.FillChunk(chunk, text.data() + start, end - start))
+      {
+        std::fprintf(stderr, "text %d: chunk %d was not filled\n", iteration,
+                     chunk);
+        return false;
+      }
+    }
+    for (std::size_t lnum = 1; lnum <= lines.size(); lnum++)
+    {
+      const auto line = index.GetLine(static_cast<int>(lnum));
+      if (!line || lines[lnum - 1] != line)
+      {
+        std::fprintf(stderr, "text %d: line %zu differs\n", iteration, lnum);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Source code-like lines, a few of them with non-ASCII characters.
+static std::u16string CreateDocument(std::size_t line_count)
+{
+  const std::u16string lines[] =
+  {
+    u"    const auto value = Compute(index, 42); // the answer\r\n",
+    u"  if (value > limit)\r\n",
+    u"  {\r\n",
+    u"    Report(u8\"déjà vu 中文\", value);\r\n",
+    u"  }\r\n",
+    u"\r\n"
+  };
+  std::u16string text;
+  for (std::size_t i = 0; i < line_count; i++)
+  {
+    text += lines[i % (sizeof(lines) / sizeof(lines[0]))];
+  }
+  return text;
+}
+
+static double FillIndex(const std::u16string& text,
+                        const std::vector<std::size_t>& starts,
+                        int thread_count, std::size_t& size)
+{
+  const auto start_time = std::chrono::steady_clock::now();
+  // Chunks start at the line containing every chunk_length_ th unit.
+  std::vector<int> chunk_first_lines;
+  for (std::size_t position = 0; position < text.size();
+       position += chunk_length_)
+  {
+    const auto lnum = static_cast<int>(
+      std::upper_bound(starts.begin(), starts.end(), position) -
+      starts.begin());
+    if (chunk_first_lines.empty() || chunk_first_lines.back() != lnum)
+    {
+      chunk_first_lines.push_back(lnum);
+    }
+  }
+  LineIndex index(chunk_first_lines, static_cast<int>(starts.size()));
+
+  std::atomic<int> next_chunk{ 0 };
+  std::atomic<bool> has_failed{ false };
+  std::vector<std::thread> threads;
+  for (auto i = 0; i < thread_count; i++)
+  {
+    threads.emplace_back([&]()
+    {
+      for (int chunk; (chunk = next_chunk++) < index.GetChunkCount();)
+      {
+        const auto start = starts[index.GetChunkFirstLine(chunk) - 1];
+        const auto end = GetChunkEnd(index, chunk, starts, text.size());
+        if (!index.FillChunk(chunk, text.data() + start, end - start))
+        {
+          has_failed = true;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads)
+  {
+    thread.join();
+  }
+  const auto elapsed = std::chrono::duration<double, std::milli>(
+    std::chrono::steady_clock::now() - start_time).count();
+  if (has_failed || !index.GetLine(static_cast<int>(starts.size())))
+  {
+    std::fprintf(stderr, "the index of the document is incomplete\n");
+    std::exit(EXIT_FAILURE);
+  }
+  size = index.GetSize();
+  return elapsed;
+}
+
+int main(int argc, char** argv)
+{
+  if (!CheckRandomText())
+  {
+    return EXIT_FAILURE;
+  }
+
+  const auto line_count =
+    argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4000000;
+  const auto text = CreateDocument(line_count);
+  std::vector<std::size_t> starts;
+  for (std::size_t i = 0; i < text.size(); i++)
+  {
+    if (text[i] == '\n')
+    {
+      starts.push_back(i + 1);
+    }
+  }
+  starts.insert(starts.begin(), 0);
+
+  std::printf("%zu lines, %.0f MB of UTF-16, %u hardware threads\n",
+              starts.size(), text.size() * 2 / 1e6,
+              std::thread::hardware_concurrency());
+  for (const auto thread_count : { 1, 4, 16 })
+  {
+    std::size_t size = 0;
+    const auto elapsed = FillIndex(text, starts, thread_count, size);
+    std::printf("%2d threads: %7.1f ms, %.0f MB index\n", thread_count,
+                elapsed, size / 1e6);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,280 @@
+// Checks the msgpack codec and the Windows command lines of NvimRpcClient,
+// then measures requests to an nvim --embed process: one at a time,
+// pipelined, and batched in nvim_call_atomic like RemoteNvimEngine sends
+// the edits of a view. ctest runs it against fake_nvim_server. By hand it
+// takes the request count and the command to run, by default
+//   nvim --embed --headless --clean -n
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Msgpack.h"
+#include "NvimRpc.h"
+
+using namespace VSNvim;
+
+static int failures_ = 0;
+
+static void Check(bool condition, const char* description)
+{
+  if (!condition)
+  {
+    std::fprintf(stderr, "%s\n", description);
+    failures_++;
+  }
+}
+
+// Decodes the bytes, written by hand from the MessagePack specification.
+static MsgpackValue Decode(const char* bytes, std::size_t size)
+{
+  MsgpackReader reader;
+  reader.Append(bytes, size);
+  MsgpackValue value;
+  Check(reader.Read(value) == MsgpackResult::Value, "a value was not decoded");
+  return value;
+}
+
+static void CheckEncodings()
+{
+  Check(Decode("\xcc\xff", 2).integer == 255, "uint 8");
+  Check(Decode("\xcd\xff\xfe", 3).integer == 65534, "uint 16");
+  Check(Decode("\xce\x80\x00\x00\x00", 5).integer == 0x80000000LL, "uint 32");
+  Check(Decode("\xcf\x00\x00\x00\x01\x00\x00\x00\x00", 9).integer ==
+        0x100000000LL, "uint 64");
+  Check(Decode("\xd0\x80", 2).integer == -128, "int 8");
+  Check(Decode("\xd1\x80\x00", 3).integer == -32768, "int 16");
+  Check(Decode("\xe0", 1).integer == -32, "negative fixint");
+  Check(Decode("\xcb\x3f\xf8\x00\x00\x00\x00\x00\x00", 9).real == 1.5,
+        "float 64");
+  Check(Decode("\xc4\x02\x00\x01", 4).bytes == std::string("\0\1", 2),
+        "bin 8");
+  // Nvim sends buffer handles as extension 0.
+  Check(Decode("\xd4\x00\x05", 3).GetInteger() == 5, "buffer handle");
+  Check(Decode("\x81\xa1k\xc3", 4).Find("k")->boolean, "map");
+
+  MsgpackReader reader;
+  reader.Append("\xc1", 1);
+  MsgpackValue value;
+  Check(reader.Read(value) == MsgpackResult::Invalid, "0xc1 is invalid");
+}
+
+// Writes random requests and decodes them from pieces of random sizes, the
+// way the reader thread gets them from the pipe.
+static void CheckRoundTrips()
+{
+  std::mt19937_64 random(1);
+  for (auto iteration = 0; iteration < 2000; iteration++)
+  {
+    std::vector<std::int64_t> integers;
+    std::vector<std::string> strings;
+    const auto count = static_cast<std::uint32_t>(random() % 40);
+    MsgpackWriter writer;
+    writer.WriteArrayHeader(count * 2 + 1);
+    writer.WriteMapHeader(1);
+    writer.WriteString("force");
+    writer.WriteBoolean(true);
+    for (std::uint32_t i = 0; i < count; i++)
+    {
+      switch (random() % 4)
+      {
+      case 0:
+        integers.push_back(static_cast<std::int64_t>(random() % 256) - 128);
+        break;
+      case 1:
+        integers.push_back(static_cast<std::int64_t>(random()));
+        break;
+      case 2:
+        integers.push_back(-static_cast<std::int64_t>(random() % 70000));
+        break;
+      default:
+        integers.push_back(static_cast<std::int64_t>(random() % 100000));
+        break;
+      }
+      writer.WriteInteger(integers.back());
+      // Lengths on both sides of the str 8, 16 and 32 headers.
+      const auto length = random() % 2 ? random() % 70000 : random() % 40;
+      strings.emplace_back(length, static_cast<char>('a' + random() % 26));
+      writer.WriteString(strings.back());
+    }
+
+    const auto& buffer = writer.GetBuffer();
+    MsgpackReader reader;
+    MsgpackValue value;
+    auto result = MsgpackResult::Incomplete;
+    const auto piece = 1 + static_cast<std::size_t>(random() % 4096);
+    std::size_t offset = 0;
+    while (offset < buffer.size() && result == MsgpackResult::Incomplete)
+    {
+      const auto size = (std::min)(piece, buffer.size() - offset);
+      reader.Append(buffer.data() + offset, size);
+      offset += size;
+      result = reader.Read(value);
+    }
+    auto is_equal = result == MsgpackResult::Value &&
+                    offset == buffer.size() &&
+                    value.items.size() == count * 2 + 1 &&
+                    value.items[0].Find("force") &&
+                    value.items[0].Find("force")->boolean;
+    for (std::uint32_t i = 0; is_equal && i < count; i++)
+    {
+      is_equal = value.items[1 + 2 * i].integer == integers[i] &&
+                 value.items[2 + 2 * i].bytes == strings[i];
+    }
+    if (!is_equal)
+    {
+      std::fprintf(stderr, "request %d was not decoded as written\n",
+                   iteration);
+      failures_++;
+      return;
+    }
+  }
+}
+
+// The expected command lines follow the rules CommandLineToArgvW splits
+// them by.
+static void ExpectCommandLine(const std::vector<std::string>& argv,
+                              const char* expected)
+{
+  const auto command_line = CreateCommandLine(argv);
+  if (command_line != expected)
+  {
+    std::fprintf(stderr, "got the command line %s, expected %s\n",
+                 command_line.c_str(), expected);
+    failures_++;
+  }
+}
+
+static void CheckCommandLines()
+{
+  ExpectCommandLine({ "nvim", "--embed" }, "nvim --embed");
+  ExpectCommandLine({ "C:\\Program Files\\nvim.exe", "--clean" },
+                    "\"C:\\Program Files\\nvim.exe\" --clean");
+  ExpectCommandLine({ "nvim", "" }, "nvim \"\"");
+  ExpectCommandLine({ "nvim", "a\\b" }, "nvim a\\b");
+  ExpectCommandLine({ "nvim", "a\"b" }, "nvim \"a\\\"b\"");
+  ExpectCommandLine({ "nvim", "a\\\"b" }, "nvim \"a\\\\\\\"b\"");
+  ExpectCommandLine({ "nvim", "C:\\my dir\\" }, "nvim \"C:\\my dir\\\\\"");
+  ExpectCommandLine({ "nvim", "-c", "echo 'a b'" },
+                    "nvim -c \"echo 'a b'\"");
+  ExpectCommandLine({ "nvim", "tab\there" }, "nvim \"tab\there\"");
+}
+
+static MsgpackWriter CreateSetLinesParams(int first, int last)
+{
+  MsgpackWriter params;
+  params.WriteArrayHeader(5);
+  params.WriteInteger(1);
+  params.WriteInteger(first);
+  params.WriteInteger(last);
+  params.WriteBoolean(false);
+  params.WriteArrayHeader(1);
+  params.WriteString("    const auto value = Compute(index, 42);");
+  return params;
+}
+
+static double GetMicroseconds(std::chrono::steady_clock::duration duration)
+{
+  return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+int main(int argc, char** argv)
+{
+  CheckEncodings();
+  CheckRoundTrips();
+  CheckCommandLines();
+  if (failures_)
+  {
+    return EXIT_FAILURE;
+  }
+
+  const auto count = argc > 1 ? std::atoi(argv[1]) : 20000;
+  std::vector<std::string> command(argv + (std::min)(argc, 2), argv + argc);
+  if (command.empty())
+  {
+    command = { "nvim", "--embed", "--headless", "--clean", "-n" };
+  }
+
+  std::atomic<int> events{ 0 };
+  NvimRpcClient client;
+  if (!client.Start(command,
+                    [&](const std::string& method, const MsgpackValue&)
+                    {
+                      if (method == "nvim_buf_lines_event")
+                      {
+                        events++;
+                      }
+                    }))
+  {
+    std::fprintf(stderr, "%s could not be started\n", command[0].c_str());
+    return EXIT_FAILURE;
+  }
+  // Nvim sends lines events for attached buffers, here without the whole
+  // buffer first.
+  MsgpackWriter attach_params;
+  attach_params.WriteArrayHeader(3);
+  attach_params.WriteInteger(1);
+  attach_params.WriteBoolean(false);
+  attach_params.WriteMapHeader(0);
+  MsgpackValue result;
+  std::string error;
+  if (!client.Call("nvim_buf_attach", attach_params, result, &error))
+  {
+    std::fprintf(stderr, "nvim_buf_attach failed: %s\n", error.c_str());
+    return EXIT_FAILURE;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  for (auto i = 0; i < count; i++)
+  {
+    if (!client.Call("nvim_buf_set_lines",
+                     CreateSetLinesParams(i % 100, i % 100 + 1), result,
+                     &error))
+    {
+      std::fprintf(stderr, "nvim_buf_set_lines failed: %s\n", error.c_str());
+      return EXIT_FAILURE;
+    }
+  }
+  const auto sequential_end = std::chrono::steady_clock::now();
+  for (auto i = 0; i < count; i++)
+  {
+    client.Request("nvim_buf_set_lines",
+                   CreateSetLinesParams(i % 100, i % 100 + 1), nullptr);
+  }
+  client.Wait();
+  const auto pipelined_end = std::chrono::steady_clock::now();
+  for (auto batch = 0; batch < count / 100; batch++)
+  {
+    MsgpackWriter calls;
+    calls.WriteArrayHeader(1);
+    calls.WriteArrayHeader(100);
+    for (auto i = 0; i < 100; i++)
+    {
+      calls.WriteArrayHeader(2);
+      calls.WriteString("nvim_buf_set_lines");
+      calls.WriteRaw(CreateSetLinesParams(i, i + 1).GetBuffer());
+    }
+    client.Request("nvim_call_atomic", calls, nullptr);
+  }
+  client.Wait();
+  const auto atomic_end = std::chrono::steady_clock::now();
+
+  const auto pipelined_us = GetMicroseconds(pipelined_end - sequential_end);
+  std::printf("sequential:  %.2f us/request\n",
+              GetMicroseconds(sequential_end - start) / count);
+  std::printf("pipelined:   %.2f us/request (%.0f requests/s)\n",
+              pipelined_us / count,
+              pipelined_us > 0 ? count / (pipelined_us / 1e6) : 0.);
+  std::printf("atomic x100: %.2f us/line\n",
+              GetMicroseconds(atomic_end - pipelined_end) / count);
+  std::printf("%d lines events, mean latency %.1f us over %llu requests\n",
+              events.load(), client.GetMeanLatencyUs(),
+              static_cast<unsigned long long>(client.GetRequestCount()));
+  client.Stop();
+  return client.IsRunning() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,145 @@
+// Checks the row texts of PopupMenuCandidates, then measures formatting
+// the candidates of a popupmenu_show event into it and looking up the rows
+// a scrolling list shows, in order and at random.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "PopupMenuCandidates.h"
+
+using namespace VSNvim;
+
+static int failures_ = 0;
+
+static void ExpectRow(const PopupMenuCandidates& candidates,
+                      std::size_t index, const char* expected)
+{
+  if (index >= candidates.GetCount() ||
+      candidates.GetRowText(index) != expected)
+  {
+    std::fprintf(stderr, "row %zu: got \"%s\", expected \"%s\"\n", index,
+                 index < candidates.GetCount()
+                 ? std::string(candidates.GetRowText(index)).c_str()
+                 : "", expected);
+    failures_++;
+  }
+}
+
+static void CheckRows()
+{
+  PopupMenuCandidates candidates;
+  candidates.Add("word", "", "");
+  candidates.Add("Compute", "f", "");
+  candidates.Add("value", "", "[buffer]");
+  candidates.Add("h\xC3\xA9llo", "v", "int");
+  candidates.Add("", "", "");
+  ExpectRow(candidates, 0, "word");
+  ExpectRow(candidates, 1, "Compute  f ");
+  ExpectRow(candidates, 2, "value   [buffer]");
+  ExpectRow(candidates, 3, "h\xC3\xA9llo  v int");
+  ExpectRow(candidates, 4, "");
+
+  // A cleared store holds only the rows of the next menu.
+  PopupMenuCandidates next;
+  next.Add("next", "", "");
+  candidates.Swap(next);
+  ExpectRow(candidates, 0, "next");
+  if (candidates.GetCount() != 1 || next.GetCount() != 5)
+  {
+    std::fprintf(stderr, "Swap did not exchange the rows\n");
+    failures_++;
+  }
+  next.Clear();
+  next.Add("again", "", "");
+  ExpectRow(next, 0, "again");
+  if (next.GetCount() != 1)
+  {
+    std::fprintf(stderr, "Clear left rows\n");
+    failures_++;
+  }
+}
+
+struct Candidate
+{
+  std::string word;
+  std::string kind;
+  std::string menu;
+};
+
+static double GetMicroseconds(std::chrono::steady_clock::duration duration)
+{
+  return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+int main(int argc, char** argv)
+{
+  CheckRows();
+  if (failures_)
+  {
+    return EXIT_FAILURE;
+  }
+
+  const auto count =
+    static_cast<std::size_t>(argc > 1 ? std::atoi(argv[1]) : 200000);
+  std::mt19937 random(1);
+  std::vector<Candidate> items(count);
+  std::size_t bytes = 0;
+  for (auto& item : items)
+  {
+    item.word.assign(4 + random() % 28,
+                     static_cast<char>('a' + random() % 26));
+    if (random() % 2)
+    {
+      item.kind = "f";
+      item.menu = "[LSP]";
+    }
+    bytes += item.word.size() + item.kind.size() + item.menu.size() + 3;
+  }
+
+  // Menus are shown again as the typed word narrows them, so the store is
+  // filled several times with its memory reused.
+  const auto fills = 5;
+  PopupMenuCandidates candidates;
+  const auto fill_start = std::chrono::steady_clock::now();
+  for (auto fill = 0; fill < fills; fill++)
+  {
+    candidates.Clear();
+    candidates.Reserve(items.size(), bytes);
+    for (const auto& item : items)
+    {
+      candidates.Add(item.word, item.kind, item.menu);
+    }
+  }
+  const auto fill_end = std::chrono::steady_clock::now();
+
+  // A list box of 20 visible rows scrolled from the top to the bottom.
+  std::size_t total = 0;
+  for (std::size_t first = 0; first < count; first++)
+  {
+    for (std::size_t row = first; row < count && row < first + 20; row++)
+    {
+      total += candidates.GetRowText(row).size();
+    }
+  }
+  const auto scroll_end = std::chrono::steady_clock::now();
+  const auto lookups = count * 20;
+  for (std::size_t i = 0; i < lookups; i++)
+  {
+    total += candidates.GetRowText(random() % count).size();
+  }
+  const auto random_end = std::chrono::steady_clock::now();
+
+  std::printf("fill:   %.1f ns/candidate (%zu candidates)\n",
+              GetMicroseconds(fill_end - fill_start) * 1000 / fills / count,
+              count);
+  std::printf("scroll: %.2f ns/row\n",
+              GetMicroseconds(scroll_end - fill_end) * 1000 / lookups);
+  std::printf("random: %.2f ns/row (%zu bytes read)\n",
+              GetMicroseconds(random_end - scroll_end) * 1000 / lookups,
+              total);
+  return EXIT_SUCCESS;
+}
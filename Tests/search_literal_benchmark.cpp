@@ -0,0 +1,198 @@
+// Checks the literals extracted from Vim patterns and the lines FindLine
+// returns, then compares scanning the chunks of the line index for a
+// literal with searching the lines one by one, as n and N did before.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "LineIndex.h"
+#include "SearchLiteral.h"
+
+using namespace VSNvim;
+
+static int failures_ = 0;
+
+// An empty expected text means the pattern has no literal.
+static void ExpectLiteral(const char* pattern, bool ignore_case,
+                          bool smart_case, const char* expected_text,
+                          bool expected_ignore_case = false)
+{
+  SearchLiteral literal;
+  const auto has_literal =
+    ExtractSearchLiteral(pattern, true, ignore_case, smart_case, literal);
+  if (has_literal != (*expected_text != '\0') ||
+      (has_literal && (literal.text != expected_text ||
+                       literal.ignore_case != expected_ignore_case)))
+  {
+    std::fprintf(stderr, "%s: got \"%s\" (ignore case %d), expected "
+                 "\"%s\" (ignore case %d)\n", pattern,
+                 has_literal ? literal.text.c_str() : "", literal.ignore_case,
+                 expected_text, expected_ignore_case);
+    failures_++;
+  }
+}
+
+static void CheckLiterals()
+{
+  ExpectLiteral("needle", false, false, "needle");
+  ExpectLiteral("^foo$", false, false, "foo");
+  ExpectLiteral("foo*bar", false, false, "bar");
+  ExpectLiteral("\\<word\\>", false, false, "word");
+  ExpectLiteral("foo\\|bar", false, false, "");
+  ExpectLiteral("[abc]xyz", false, false, "xyz");
+  ExpectLiteral("\\Va.b*c", false, false, "a.b*c");
+  ExpectLiteral("\\(abc\\)defg", false, false, "defg");
+  ExpectLiteral("Foo", true, false, "foo", true);
+  ExpectLiteral("Foo", true, true, "Foo", false);
+  ExpectLiteral("foo", true, true, "foo", true);
+  ExpectLiteral("foo\\C", true, false, "foo", false);
+  ExpectLiteral("Foo\\c", false, false, "foo", true);
+  // "*" on "Foo" searches \<Foo\>, which Nvim compiles without
+  // 'smartcase'. The caller passes the case Nvim decided on.
+  ExpectLiteral("\\<Foo\\>", true, false, "foo", true);
+  ExpectLiteral("h\xC3\xA9llo", true, false, "");
+}
+
+static std::vector<std::u16string> CreateLines(std::size_t line_count)
+{
+  std::mt19937 random(1);
+  std::vector<std::u16string> lines(line_count);
+  for (auto& line : lines)
+  {
+    const auto length = random() % 80;
+    for (std::size_t i = 0; i < length; i++)
+    {
+      line += static_cast<char16_t>('a' + random() % 20);
+    }
+    if (random() % 50000 == 0)
+    {
+      line += u"NeEdLe";
+    }
+  }
+  return lines;
+}
+
+static bool ContainsIgnoringCase(const char* line, const char* text)
+{
+  const auto size = std::strlen(text);
+  for (; *line; line++)
+  {
+    auto i = std::size_t(0);
+    while (i < size && line[i] &&
+           (line[i] | 0x20) == (text[i] | 0x20))
+    {
+      i++;
+    }
+    if (i == size)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+int main(int argc, char** argv)
+{
+  CheckLiterals();
+
+  const auto line_count =
+    argc > 1 ? static_cast<int>(std::strtol(argv[1], nullptr, 10)) : 2000000;
+  const auto lines = CreateLines(line_count);
+  std::vector<int> chunk_first_lines;
+  for (auto lnum = 1; lnum <= line_count; lnum += 100000)
+  {
+    chunk_first_lines.push_back(lnum);
+  }
+  LineIndex index(chunk_first_lines, line_count);
+  for (auto chunk = 0; chunk < index.GetChunkCount(); chunk++)
+  {
+    std::u16string text;
+    for (auto lnum = index.GetChunkFirstLine(chunk);
+         lnum < index.GetChunkEndLine(chunk); lnum++)
+    {
+      text += lines[lnum - 1];
+      if (lnum < line_count)
+      {
+        text += u"\n";
+      }
+    }
+    index.FillChunk(chunk, text.data(), text.size());
+  }
+
+  SearchLiteral literal;
+  ExtractSearchLiteral("NeEdLe", true, false, false, literal);
+  SearchLiteral folded_literal;
+  ExtractSearchLiteral("needle", true, true, false, folded_literal);
+
+  std::mt19937 random(2);
+  for (auto i = 0; i < 200; i++)
+  {
+    const auto first_line = 1 + static_cast<int>(random() % line_count);
+    const auto end_line =
+      first_line + 1 + static_cast<int>(random() % (line_count - first_line + 1));
+    const auto is_forward = (i & 1) != 0;
+    const auto is_folded = (i & 2) != 0;
+    auto expected = 0;
+    for (auto lnum = first_line; lnum < end_line && lnum <= line_count; lnum++)
+    {
+      const auto line = index.GetLine(lnum);
+      if (is_folded ? ContainsIgnoringCase(line, "needle")
+                    : std::strstr(line, "NeEdLe") != nullptr)
+      {
+        expected = lnum;
+        if (is_forward)
+        {
+          break;
+        }
+      }
+    }
+    const auto found = index.FindLine(is_folded ? folded_literal : literal,
+                                      first_line, end_line, is_forward);
+    if (found != expected)
+    {
+      std::fprintf(stderr, "lines [%d, %d) %s: found %d, expected %d\n",
+                   first_line, end_line, is_forward ? "forward" : "backward",
+                   found, expected);
+      failures_++;
+    }
+  }
+  if (failures_)
+  {
+    return EXIT_FAILURE;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  auto chunk_matches = 0;
+  for (auto lnum = 1;
+       (lnum = index.FindLine(literal, lnum, line_count + 1, true)) > 0;
+       lnum++)
+  {
+    chunk_matches++;
+  }
+  const auto middle = std::chrono::steady_clock::now();
+  auto line_matches = 0;
+  for (auto lnum = 1; lnum <= line_count; lnum++)
+  {
+    const auto line = index.GetLine(lnum);
+    if (FindSearchLiteral(line, line + std::strlen(line), literal))
+    {
+      line_matches++;
+    }
+  }
+  const auto end = std::chrono::steady_clock::now();
+
+  std::printf("%d lines, %.0f MB index, %d matching lines\n", line_count,
+              index.GetSize() / 1e6, chunk_matches);
+  std::printf("chunk scan:    %.1f ms\n",
+              std::chrono::duration<double, std::milli>(middle - start)
+                .count());
+  std::printf("line by line:  %.1f ms (%d matching lines)\n",
+              std::chrono::duration<double, std::milli>(end - middle).count(),
+              line_matches);
+  return chunk_matches == line_matches ? EXIT_SUCCESS : EXIT_FAILURE;
+}
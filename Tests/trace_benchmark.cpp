@@ -0,0 +1,116 @@
+// Measures the cost of a trace point when tracing is disabled and when it
+// is enabled, and exports the trace while other threads record into it.
+// Checks that the export and ClearTrace see the recorded events and
+// counters.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "Trace.h"
+
+using namespace VSNvim;
+
+static volatile int sink_;
+
+static void TracedWork(int value)
+{
+  VSNVIM_TRACE_SCOPE("TracedWork");
+  sink_ = value;
+}
+
+static void UntracedWork(int value)
+{
+  sink_ = value;
+}
+
+// Calling through a volatile pointer keeps the work from being inlined
+// into the loop, so both variants pay for a call.
+static double MeasureNanoseconds(void (*volatile work)(int), int count)
+{
+  const auto start = std::chrono::steady_clock::now();
+  for (auto i = 0; i < count; i++)
+  {
+    work(i);
+  }
+  return std::chrono::duration<double, std::nano>(
+    std::chrono::steady_clock::now() - start).count() / count;
+}
+
+int main(int argc, char** argv)
+{
+  const auto count = argc > 1 ? std::atoi(argv[1]) : 20000000;
+  SetTraceThreadName("main");
+
+  const auto untraced_ns = MeasureNanoseconds(&UntracedWork, count);
+  const auto disabled_ns = MeasureNanoseconds(&TracedWork, count);
+  std::ostringstream stream;
+  if (WriteChromeTrace(stream))
+  {
+    std::fprintf(stderr, "events were recorded while tracing was off\n");
+    return EXIT_FAILURE;
+  }
+
+  RecordTraceCounter("TracedCounter", 1);
+  SetTracingEnabled(true);
+  const auto enabled_ns = MeasureNanoseconds(&TracedWork, count);
+  RecordTraceCounter("TracedCounter", -42);
+
+  // Export while other threads record.
+  std::vector<std::thread> threads;
+  for (auto i = 0; i < 4; i++)
+  {
+    threads.emplace_back([count]()
+    {
+      for (auto j = 0; j < count / 20; j++)
+      {
+        TracedWork(j);
+      }
+    });
+  }
+  std::size_t events = 0;
+  for (auto i = 0; i < 20; i++)
+  {
+    stream.str(std::string());
+    events = WriteChromeTrace(stream);
+  }
+  for (auto& thread : threads)
+  {
+    thread.join();
+  }
+  SetTracingEnabled(false);
+
+  stream.str(std::string());
+  events = WriteChromeTrace(stream);
+  if (!events || stream.str().find("\"TracedWork\"") == std::string::npos)
+  {
+    std::fprintf(stderr, "the trace has no TracedWork events\n");
+    return EXIT_FAILURE;
+  }
+  // Only the counter recorded while tracing was on is exported.
+  const auto trace = stream.str();
+  const auto counter = trace.find("\"TracedCounter\",\"ph\":\"C\"");
+  if (counter == std::string::npos ||
+      trace.find("\"args\":{\"value\":-42}", counter) == std::string::npos ||
+      trace.find("\"TracedCounter\"", counter + 1) != std::string::npos)
+  {
+    std::fprintf(stderr, "the trace does not have the one TracedCounter\n");
+    return EXIT_FAILURE;
+  }
+  ClearTrace();
+  stream.str(std::string());
+  if (WriteChromeTrace(stream))
+  {
+    std::fprintf(stderr, "events remained after ClearTrace\n");
+    return EXIT_FAILURE;
+  }
+
+  std::printf("call without a trace point: %.2f ns\n", untraced_ns);
+  std::printf("trace point, tracing off:   %.2f ns\n", disabled_ns);
+  std::printf("trace point, tracing on:    %.2f ns\n", enabled_ns);
+  std::printf("%zu events exported from 5 threads\n", events);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+// A stand-in for the few Win32 declarations that the portable VSNvim units
+// use, so they can be built and measured on other platforms. The keyboard
+// functions emulate the US layout without dead keys.
+
+#include <cstdint>
+#include <cstring>
+#include <cwchar>
+
+typedef unsigned char BYTE;
+typedef unsigned int UINT;
+typedef void* HKL;
+
+#define CP_UTF8 65001
+
+#define VK_BACK     0x08
+#define VK_TAB      0x09
+#define VK_RETURN   0x0D
+#define VK_SHIFT    0x10
+#define VK_CONTROL  0x11
+#define VK_MENU     0x12
+#define VK_CAPITAL  0x14
+#define VK_ESCAPE   0x1B
+#define VK_SPACE    0x20
+#define VK_PRIOR    0x21
+#define VK_NEXT     0x22
+#define VK_END      0x23
+#define VK_HOME     0x24
+#define VK_LEFT     0x25
+#define VK_UP       0x26
+#define VK_RIGHT    0x27
+#define VK_DOWN     0x28
+#define VK_INSERT   0x2D
+#define VK_DELETE   0x2E
+#define VK_HELP     0x2F
+#define VK_LWIN     0x5B
+#define VK_RWIN     0x5C
+#define VK_NUMPAD0  0x60
+#define VK_NUMPAD9  0x69
+#define VK_MULTIPLY 0x6A
+#define VK_ADD      0x6B
+#define VK_SUBTRACT 0x6D
+#define VK_DECIMAL  0x6E
+#define VK_DIVIDE   0x6F
+#define VK_F1       0x70
+#define VK_F24      0x87
+#define VK_LSHIFT   0xA0
+#define VK_RSHIFT   0xA1
+#define VK_LCONTROL 0xA2
+#define VK_RCONTROL 0xA3
+#define VK_LMENU    0xA4
+#define VK_RMENU    0xA5
+#define VK_OEM_COMMA  0xBC
+#define VK_OEM_PERIOD 0xBE
+
+inline int WideCharToMultiByte(UINT, unsigned long, const wchar_t* chars,
+                               int count, char* out, int size, const char*,
+                               bool*)
+{
+  char utf8[8];
+  auto len = 0;
+  for (auto i = 0; i < count; i++)
+  {
+    auto code = static_cast<std::uint32_t>(chars[i]);
+    if (code >= 0xD800 && code < 0xDC00 && i + 1 < count)
+    {
+      code = 0x10000 + ((code - 0xD800) << 10) +
+             (static_cast<std::uint32_t>(chars[++i]) - 0xDC00);
+    }
+    auto n = 0;
+    if (code < 0x80)
+    {
+      utf8[n++] = static_cast<char>(code);
+    }
+    else if (code < 0x800)
+    {
+      utf8[n++] = static_cast<char>(0xC0 | code >> 6);
+      utf8[n++] = static_cast<char>(0x80 | (code & 0x3F));
+    }
+    else if (code < 0x10000)
+    {
+      utf8[n++] = static_cast<char>(0xE0 | code >> 12);
+      utf8[n++] = static_cast<char>(0x80 | (code >> 6 & 0x3F));
+      utf8[n++] = static_cast<char>(0x80 | (code & 0x3F));
+    }
+    else
+    {
+      utf8[n++] = static_cast<char>(0xF0 | code >> 18);
+      utf8[n++] = static_cast<char>(0x80 | (code >> 12 & 0x3F));
+      utf8[n++] = static_cast<char>(0x80 | (code >> 6 & 0x3F));
+      utf8[n++] = static_cast<char>(0x80 | (code & 0x3F));
+    }
+    if (out)
+    {
+      if (len + n > size)
+      {
+        return 0;
+      }
+      std::memcpy(out + len, utf8, n);
+    }
+    len += n;
+  }
+  return len;
+}
+
+inline int ToUnicodeEx(UINT virtual_key, UINT, const BYTE* keyboard_state,
+                       wchar_t* chars, int size, UINT, HKL)
+{
+  static const char shifted_digits[] = ")!@#$%^&*(";
+  const auto shift = (keyboard_state[VK_SHIFT] & 0x80) != 0;
+  const auto control = (keyboard_state[VK_CONTROL] & 0x80) != 0;
+  const auto caps_lock = (keyboard_state[VK_CAPITAL] & 0x01) != 0;
+  wchar_t chr = 0;
+  if (virtual_key >= 'A' && virtual_key <= 'Z')
+  {
+    chr = static_cast<wchar_t>(shift != caps_lock ? virtual_key
+                                                  : virtual_key + 32);
+    if (control)
+    {
+      chr = static_cast<wchar_t>(virtual_key & 0x1F);
+    }
+  }
+  else if (virtual_key >= '0' && virtual_key <= '9')
+  {
+    chr = static_cast<wchar_t>(shift ? shifted_digits[virtual_key - '0']
+                                     : virtual_key);
+  }
+  else if (virtual_key == VK_OEM_COMMA)
+  {
+    chr = shift ? L'<' : L',';
+  }
+  else if (virtual_key == VK_OEM_PERIOD)
+  {
+    chr = shift ? L'>' : L'.';
+  }
+  if (!chr || size < 1)
+  {
+    return 0;
+  }
+  chars[0] = chr;
+  return 1;
+}
+
+inline short GetKeyState(int)
+{
+  return 0;
+}
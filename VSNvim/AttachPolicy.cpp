@@ -0,0 +1,324 @@
+#include "AttachPolicy.h"
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <string_view>
+
+#include "Lock.h"
+#include "MemoryUsage.h"
+#include "Trace.h"
+#include "VSNvimBridge.h"
+#include "VSNvimMemory.h"
+
+using namespace System;
+using namespace System::Diagnostics;
+using namespace Microsoft::VisualStudio::Text::Editor;
+
+namespace VSNvim
+{
+// :VSNvimAttach reports, for each category of view, how many views were
+// attached in each mode, how long attaching took and how much memory the
+// attached buffers hold.
+//
+// Views are attached by the first of these rules that matches:
+//   interactive     the interactive window (REPL role)       none
+//   output          the Output window (Output content type)  none
+//   diff            the left or a read-only side of a diff    readonly
+//                   view (DIFF role)
+//   peek            a Peek Definition view                    lazy
+//   too-large       more than g:vsnvim_attach_max_mb (512)    none
+//   read-only       a read-only text buffer                   readonly
+//   non-document    any other view without the Document role  lazy
+//   large-document  more than g:vsnvim_attach_lazy_mb (16)    lazy
+//   document        any other document                        full
+//
+// g:vsnvim_attach maps categories, content types and roles written as
+// 'role:NAME' to 'full', 'lazy', 'readonly' or 'none'. Content types and
+// roles are checked before the rules above, and categories change the mode
+// a rule gives. The settings are read when Nvim starts and by :VSNvimAttach,
+// so they only apply to views created after that.
+static const char* const attach_command_script_ =
+  "command! -nargs=0 VSNvimAttach echo vsnvim#Request('attach', 0, '')";
+
+static constexpr nvim::varnumber_T default_lazy_mb_ = 16;
+static constexpr nvim::varnumber_T default_max_mb_ = 512;
+
+static const char* const mode_names_[] = {
+  "full", "lazy", "readonly", "none"
+};
+static constexpr int mode_count_ =
+  sizeof(mode_names_) / sizeof(mode_names_[0]);
+
+struct AttachSettings
+{
+  // The modes set by g:vsnvim_attach, by category, content type or
+  // 'role:NAME'.
+  std::map<std::string, AttachMode> modes;
+  std::size_t lazy_size = static_cast<std::size_t>(default_lazy_mb_) << 20;
+  std::size_t max_size = static_cast<std::size_t>(default_max_mb_) << 20;
+};
+
+struct CategoryStats
+{
+  int views[mode_count_] = {};
+  int attached = 0;
+  double total_attach_ms = 0;
+  double max_attach_ms = 0;
+};
+
+// Written on the Nvim thread and read on the UI thread.
+static Mutex settings_mutex_;
+static AttachSettings settings_;
+
+// Written on both threads.
+static Mutex stats_mutex_;
+static std::map<std::string, CategoryStats> stats_;
+// The category of each attached buffer, by handle. Only used on the Nvim
+// thread.
+static std::map<int, std::string> buffer_categories_;
+
+static bool ParseMode(std::string_view name, AttachMode& mode)
+{
+  for (auto i = 0; i < mode_count_; i++)
+  {
+    if (name == mode_names_[i])
+    {
+      mode = static_cast<AttachMode>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+static std::size_t GetSizeSetting(const char* name,
+                                  nvim::varnumber_T default_mb)
+{
+  const auto item = nvim::tv_dict_find(nvim::get_globvar_dict(), name, -1);
+  const auto mb = item ? nvim::tv_get_number(&item->di_tv) : default_mb;
+  return mb > 0 ? static_cast<std::size_t>(mb) << 20 : SIZE_MAX;
+}
+
+// Reads the settings from the g: variables. Called on the Nvim thread.
+static void LoadAttachSettings()
+{
+  AttachSettings settings;
+  settings.lazy_size = GetSizeSetting("vsnvim_attach_lazy_mb",
+                                      default_lazy_mb_);
+  settings.max_size = GetSizeSetting("vsnvim_attach_max_mb", default_max_mb_);
+  if (nvim::tv_dict_find(nvim::get_globvar_dict(), "vsnvim_attach", -1))
+  {
+    auto name = std::string("vsnvim_attach");
+    nvim::Error error;
+    auto object = nvim::nvim_get_var(nvim::CreateString(name), &error);
+    if (object.type == nvim::kObjectTypeDictionary)
+    {
+      const auto& dictionary = object.data.dictionary;
+      for (std::size_t i = 0; i < dictionary.size; i++)
+      {
+        const auto& item = dictionary.items[i];
+        AttachMode mode;
+        if (item.value.type == nvim::kObjectTypeString &&
+            ParseMode(std::string_view(item.value.data.string.data,
+                                       item.value.data.string.size),
+                      mode))
+        {
+          settings.modes[std::string(item.key.data, item.key.size)] = mode;
+        }
+      }
+    }
+    nvim::api_free_object(object);
+  }
+
+  LockGuard lock(settings_mutex_);
+  settings_ = std::move(settings);
+}
+
+static void HandleAttachRequest(const nvim::typval_T*);
+
+void InitAttach()
+{
+  RegisterRequestHandler("attach", &HandleAttachRequest);
+  auto script = std::string(attach_command_script_);
+  nvim::Error error;
+  nvim::nvim_command(nvim::CreateString(script), &error);
+  LoadAttachSettings();
+}
+
+// Finds a mode set by content type or role, which takes precedence over
+// the built-in rules.
+static bool FindUserMode(const AttachSettings& settings,
+                         IWpfTextView^ text_view, AttachDecision& decision)
+{
+  const auto content_type = text_view->TextBuffer->ContentType;
+  for (const auto& rule : settings.modes)
+  {
+    const auto key = std::string_view(rule.first);
+    const auto is_role = key.substr(0, 5) == "role:";
+    const auto name = gcnew String(
+      rule.first.c_str() + (is_role ? 5 : 0));
+    if (is_role ? text_view->Roles->Contains(name)
+                : content_type->IsOfType(name))
+    {
+      decision.mode = rule.second;
+      decision.category = rule.first;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void DecideBuiltInMode(const AttachSettings& settings,
+                              IWpfTextView^ text_view,
+                              AttachDecision& decision)
+{
+  const auto roles = text_view->Roles;
+  const auto text_buffer = text_view->TextBuffer;
+  const auto size =
+    static_cast<std::size_t>(text_buffer->CurrentSnapshot->Length);
+  // The roles of the interactive window and of diff views are those of
+  // PredefinedInteractiveTextViewRoles and DifferenceViewerRoles, whose
+  // assemblies are not referenced. The right side of a diff view is
+  // usually the document itself and is attached like it.
+  if (roles->Contains("REPL"))
+  {
+    decision = { AttachMode::None, "interactive" };
+  }
+  else if (text_buffer->ContentType->IsOfType("Output"))
+  {
+    decision = { AttachMode::None, "output" };
+  }
+  else if (roles->Contains("DIFF") &&
+           (roles->Contains("LEFTDIFF") || text_buffer->IsReadOnly(0)))
+  {
+    decision = { AttachMode::ReadOnly, "diff" };
+  }
+  else if (roles->Contains(PredefinedTextViewRoles::EmbeddedPeekTextView))
+  {
+    decision = { AttachMode::Lazy, "peek" };
+  }
+  else if (size > settings.max_size)
+  {
+    decision = { AttachMode::None, "too-large" };
+  }
+  else if (text_buffer->IsReadOnly(0))
+  {
+    decision = { AttachMode::ReadOnly, "read-only" };
+  }
+  else if (!roles->Contains(PredefinedTextViewRoles::Document))
+  {
+    decision = { AttachMode::Lazy, "non-document" };
+  }
+  else if (size > settings.lazy_size)
+  {
+    decision = { AttachMode::Lazy, "large-document" };
+  }
+  else
+  {
+    decision = { AttachMode::Full, "document" };
+  }
+
+  const auto mode = settings.modes.find(decision.category);
+  if (mode != settings.modes.end())
+  {
+    decision.mode = mode->second;
+  }
+}
+
+static void DecideAttachModeAction(IWpfTextView^ text_view,
+                                   IntPtr decision_ptr)
+{
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  auto& decision = *static_cast<AttachDecision*>(decision_ptr.ToPointer());
+  {
+    LockGuard lock(settings_mutex_);
+    if (!FindUserMode(settings_, text_view, decision))
+    {
+      DecideBuiltInMode(settings_, text_view, decision);
+    }
+  }
+  decision.requested = Stopwatch::GetTimestamp();
+}
+
+AttachDecision DecideAttachMode(IWpfTextView^ text_view)
+{
+  AttachDecision decision{ AttachMode::None };
+  const auto dispatcher =
+    System::Windows::Application::Current->Dispatcher;
+  if (dispatcher->CheckAccess())
+  {
+    DecideAttachModeAction(text_view, IntPtr(&decision));
+  }
+  else
+  {
+    dispatcher->Invoke(
+      gcnew Action<IWpfTextView^, IntPtr>(&DecideAttachModeAction),
+      text_view, IntPtr(&decision));
+  }
+  return decision;
+}
+
+void CountView(const AttachDecision& decision)
+{
+  LockGuard lock(stats_mutex_);
+  stats_[decision.category].views[static_cast<int>(decision.mode)]++;
+}
+
+void RecordAttach(const AttachDecision& decision, nvim::buf_T* buffer)
+{
+  const auto attach_ms = (Stopwatch::GetTimestamp() - decision.requested) *
+                         1000. / Stopwatch::Frequency;
+  buffer_categories_[buffer->handle] = decision.category;
+
+  LockGuard lock(stats_mutex_);
+  auto& stats = stats_[decision.category];
+  stats.attached++;
+  stats.total_attach_ms += attach_ms;
+  if (attach_ms > stats.max_attach_ms)
+  {
+    stats.max_attach_ms = attach_ms;
+  }
+}
+
+// Lists each category with the number of views per mode, the number of
+// buffers attached, the mean and maximum attach times in milliseconds and
+// the memory of the buffers still open in KiB.
+static std::string GetAttachReport()
+{
+  std::map<std::string, std::size_t> memory;
+  for (auto buffer = nvim::firstbuf; buffer; buffer = buffer->b_next)
+  {
+    const auto category = buffer_categories_.find(buffer->handle);
+    if (category != buffer_categories_.end())
+    {
+      memory[category->second] += GetBufferMemory(buffer).GetTotal();
+    }
+  }
+
+  std::string report =
+    "category          full  lazy    ro  none  attached   mean ms    max ms"
+    "       KiB";
+  LockGuard lock(stats_mutex_);
+  for (const auto& category : stats_)
+  {
+    const auto& stats = category.second;
+    char line[160];
+    std::snprintf(line, sizeof(line),
+                  "\n%-16s %5d %5d %5d %5d %9d %9.1f %9.1f %9zu",
+                  category.first.c_str(), stats.views[0], stats.views[1],
+                  stats.views[2], stats.views[3], stats.attached,
+                  stats.attached ? stats.total_attach_ms / stats.attached : 0.,
+                  stats.max_attach_ms,
+                  (memory[category.first] + 1023) / 1024);
+    report += line;
+  }
+  return report;
+}
+
+static void HandleAttachRequest(const nvim::typval_T*)
+{
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  LoadAttachSettings();
+  SetRequestResult(GetAttachReport());
+}
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "nvim.h"
+
+namespace VSNvim
+{
+// How a text view is attached to Nvim.
+enum class AttachMode
+{
+  // An Nvim buffer is created when the view is.
+  Full,
+  // An Nvim buffer is created when the view first gets the focus.
+  Lazy,
+  // An Nvim buffer is created when the view is, but it is not modifiable.
+  // It follows the changes made in Visual Studio.
+  ReadOnly,
+  // The view is left to Visual Studio.
+  None
+};
+
+struct AttachDecision
+{
+  AttachMode mode;
+  // The rule that decided the mode, which the attach report groups views
+  // by.
+  std::string category;
+  // When the buffer was asked for, as a Stopwatch timestamp.
+  std::int64_t requested;
+};
+
+// Decides how a view is attached from its roles, content type and size,
+// and the user's settings. Called before any Nvim work is queued for the
+// view.
+AttachDecision DecideAttachMode(
+  Microsoft::VisualStudio::Text::Editor::IWpfTextView^ text_view);
+
+// Counts a view created in the attach report.
+void CountView(const AttachDecision& decision);
+
+// Counts the cost of attaching the current buffer in the attach report.
+// Called on the Nvim thread once the buffer is attached.
+void RecordAttach(const AttachDecision& decision, nvim::buf_T* buffer);
+
+// Defines the :VSNvimAttach command and reads the attach settings. Must be
+// called on the Nvim thread.
+void InitAttach();
+}
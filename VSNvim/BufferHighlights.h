@@ -0,0 +1,207 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <utility>
+#include <vector>
+
+#include "IntervalTree.h"
+#include "Lock.h"
+
+namespace VSNvim
+{
+// A highlighted range of a line. Columns are in UTF-16 code units and the
+// end is exclusive. The attribute is an Nvim attribute id.
+struct HighlightSpan
+{
+  int start_col;
+  int end_col;
+  int attribute;
+
+  bool operator==(const HighlightSpan& other) const
+  {
+    return start_col == other.start_col && end_col == other.end_col &&
+           attribute == other.attribute;
+  }
+};
+
+// The highlights of the lines of a buffer around the viewport, indexed by
+// line number. Nvim computes them on its thread and the classifier reads
+// them on the UI thread.
+//
+// Only the lines that changed are recomputed. An edit makes the lines from
+// the edited line on suspect, since syntax state carries over between
+// lines, but recomputing stops at the first unchanged line after the edit.
+class BufferHighlights
+{
+private:
+  // Caching more lines than this drops the lines outside the viewport.
+  static constexpr int max_cached_lines_ = 10000;
+
+  mutable Mutex mutex_;
+  IntervalTree<int, HighlightSpan> spans_;
+  // The lines whose highlights are cached.
+  int cached_top_ = 0;
+  int cached_bottom_ = -1;
+  // The cached lines from this one on may be out of date.
+  int suspect_from_ = INT_MAX;
+  // The last line that was edited since the highlights were updated.
+  int last_edited_ = 0;
+
+  void MarkEdited(int lnum, int last_lnum)
+  {
+    suspect_from_ = (std::min)(suspect_from_, lnum);
+    last_edited_ = (std::max)(last_edited_, last_lnum);
+  }
+
+  // Replaces the highlights of a line and returns whether they changed.
+  bool SetLine(int lnum, const std::vector<HighlightSpan>& spans)
+  {
+    std::vector<HighlightSpan> old_spans;
+    LockGuard lock(mutex_);
+    spans_.Extract(lnum, lnum + 1,
+      [&old_spans](IntervalTree<int, HighlightSpan>::Interval&& interval)
+      {
+        old_spans.push_back(interval.value);
+      });
+    for (const auto& span : spans)
+    {
+      spans_.Insert(lnum, lnum, span);
+    }
+    return old_spans != spans;
+  }
+
+public:
+  // Lines were inserted before the line.
+  void InsertLines(int lnum, int count)
+  {
+    LockGuard lock(mutex_);
+    spans_.Shift(lnum, count);
+    if (lnum <= cached_bottom_)
+    {
+      cached_bottom_ += count;
+    }
+    MarkEdited(lnum, lnum + count - 1);
+  }
+
+  void DeleteLines(int lnum, int count)
+  {
+    LockGuard lock(mutex_);
+    spans_.Erase(lnum, lnum + count);
+    spans_.Shift(lnum + count, -count);
+    if (lnum <= cached_bottom_)
+    {
+      cached_bottom_ = (std::max)(lnum - 1, cached_bottom_ - count);
+    }
+    MarkEdited(lnum, lnum);
+  }
+
+  void ChangeLine(int lnum)
+  {
+    LockGuard lock(mutex_);
+    MarkEdited(lnum, lnum);
+  }
+
+  // Drops every cached line, e.g. after the syntax was changed.
+  void Clear()
+  {
+    LockGuard lock(mutex_);
+    spans_.Clear();
+    cached_top_ = 0;
+    cached_bottom_ = -1;
+    suspect_from_ = INT_MAX;
+    last_edited_ = 0;
+  }
+
+  // Drops every cached line and frees their memory, e.g. when the buffer
+  // is hidden and memory is short.
+  void Release()
+  {
+    Clear();
+    LockGuard lock(mutex_);
+    spans_.Release();
+  }
+
+  std::size_t GetMemorySize() const
+  {
+    LockGuard lock(mutex_);
+    return spans_.GetMemorySize();
+  }
+
+  // Brings the highlights of the lines in [top, bottom] up to date with the
+  // callback, which fills a vector with the spans of a line. Returns the
+  // range of lines whose highlights changed, or an empty range.
+  template <typename ComputeLine>
+  std::pair<int, int> Update(int top, int bottom, ComputeLine compute_line)
+  {
+    if (top > cached_bottom_ + 1 || bottom < cached_top_ - 1 ||
+        cached_bottom_ - cached_top_ > max_cached_lines_)
+    {
+      Clear();
+    }
+    else if (suspect_from_ < top)
+    {
+      // The suspect lines above the viewport are recomputed when they are
+      // scrolled into view.
+      cached_top_ = (std::max)(cached_top_, top);
+    }
+
+    std::pair<int, int> changed(INT_MAX, INT_MIN);
+    std::vector<HighlightSpan> spans;
+    for (auto lnum = top; lnum <= bottom; lnum++)
+    {
+      const auto is_cached = lnum >= cached_top_ && lnum <= cached_bottom_;
+      if (is_cached && lnum < suspect_from_)
+      {
+        continue;
+      }
+
+      spans.clear();
+      compute_line(lnum, spans);
+      if (!SetLine(lnum, spans))
+      {
+        if (is_cached && lnum > last_edited_)
+        {
+          // The edit no longer affects this line, so the cached lines
+          // after it are still up to date.
+          suspect_from_ = INT_MAX;
+          last_edited_ = 0;
+        }
+        continue;
+      }
+      changed.first = (std::min)(changed.first, lnum);
+      changed.second = (std::max)(changed.second, lnum);
+    }
+
+    LockGuard lock(mutex_);
+    if (cached_bottom_ < cached_top_)
+    {
+      cached_top_ = top;
+      cached_bottom_ = bottom;
+    }
+    else
+    {
+      cached_top_ = (std::min)(cached_top_, top);
+      cached_bottom_ = (std::max)(cached_bottom_, bottom);
+    }
+    if (suspect_from_ <= bottom)
+    {
+      suspect_from_ = bottom + 1;
+    }
+    return changed;
+  }
+
+  // Calls the callback with the line number and span of every highlight
+  // in the lines [first, last].
+  template <typename Callback>
+  void ForEachSpan(int first, int last, Callback callback) const
+  {
+    LockGuard lock(mutex_);
+    spans_.ForEachOverlapping(first, last,
+      [&callback](int lnum, int, const HighlightSpan& span)
+      {
+        callback(lnum, span);
+      });
+  }
+};
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace VSNvim
+{
+// The contents of a clipboard register. The lines are stored in a single
+// UTF-8 buffer separated by '\n' so a large register is held in one block.
+// As in the list Nvim passes, a linewise register ends with an empty line.
+struct ClipboardContents
+{
+  std::string text;
+  // "v", "V", or CTRL-V followed by the block width (e.g. "\x16" "10") for
+  // a blockwise register, as returned by getregtype().
+  std::string regtype;
+
+  std::size_t GetLineCount() const
+  {
+    std::size_t count = 1;
+    for (const auto chr : text)
+    {
+      count += chr == '\n';
+    }
+    return count;
+  }
+};
+
+// The platform side of the clipboard provider. The Nvim side hands it the
+// contents of yanks to the + and * registers and asks it for the contents
+// of the clipboard when those registers are put.
+class ClipboardProvider
+{
+public:
+  virtual ~ClipboardProvider() = default;
+
+  // Makes the contents available to other applications. Implementations
+  // should defer converting them until they are actually requested.
+  virtual void Publish(std::shared_ptr<const ClipboardContents> contents) = 0;
+
+  // Returns the current clipboard contents or nullptr if the clipboard
+  // does not hold text.
+  virtual std::shared_ptr<const ClipboardContents> Read() = 0;
+};
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "IntervalTree.h"
+#include "Lock.h"
+
+namespace VSNvim
+{
+// A range of lines whose first line stays visible while the others are
+// hidden. Line numbers start at one.
+struct FoldRange
+{
+  int first;
+  int last;
+
+  bool operator==(const FoldRange& other) const
+  {
+    return first == other.first && last == other.last;
+  }
+};
+
+// The collapsed regions of a view, kept in an interval tree keyed by line
+// so Nvim can ask whether a line is hidden in O(log n). The UI thread sets
+// them from the outlining manager and the Nvim thread reads them.
+class FoldMap
+{
+private:
+  mutable Mutex mutex_;
+  // Only the outermost collapsed regions are kept, so they never overlap.
+  IntervalTree<int, char> collapsed_;
+  // The closed Nvim folds last sent to the UI thread. Only accessed from
+  // the Nvim thread.
+  std::vector<FoldRange> nvim_folds_;
+  int nvim_folds_top_ = 0;
+  int nvim_folds_bottom_ = 0;
+
+public:
+  // Replaces the collapsed regions. Called on the UI thread.
+  void SetCollapsed(std::vector<FoldRange> ranges)
+  {
+    std::sort(ranges.begin(), ranges.end(),
+      [](const FoldRange& a, const FoldRange& b)
+      {
+        return a.first < b.first || (a.first == b.first && a.last > b.last);
+      });
+
+    LockGuard lock(mutex_);
+    collapsed_.Clear();
+    auto last = 0;
+    for (const auto& range : ranges)
+    {
+      if (range.first > last)
+      {
+        collapsed_.Insert(range.first, range.last, 0);
+        last = range.last;
+      }
+    }
+  }
+
+  // Lines were inserted before the line.
+  void InsertLines(int lnum, int count)
+  {
+    LockGuard lock(mutex_);
+    // A region that contains the line grows with it.
+    FoldRange containing{ 0, 0 };
+    collapsed_.ForEachOverlapping(lnum, lnum,
+      [&containing, lnum](int first, int last, char)
+      {
+        if (first < lnum)
+        {
+          containing = FoldRange{ first, last };
+        }
+      });
+    if (containing.first)
+    {
+      collapsed_.Erase(containing.first, containing.first + 1);
+    }
+    collapsed_.Shift(lnum, count);
+    if (containing.first)
+    {
+      collapsed_.Insert(containing.first, containing.last + count, 0);
+    }
+  }
+
+  void DeleteLines(int lnum, int count)
+  {
+    LockGuard lock(mutex_);
+    // Regions that lose lines are dropped until the outlining manager
+    // reports them again.
+    std::vector<FoldRange> overlapping;
+    collapsed_.ForEachOverlapping(lnum, lnum + count - 1,
+      [&overlapping](int first, int last, char)
+      {
+        overlapping.push_back(FoldRange{ first, last });
+      });
+    for (const auto& range : overlapping)
+    {
+      collapsed_.Erase(range.first, range.first + 1);
+    }
+    collapsed_.Shift(lnum + count, -count);
+  }
+
+  // Returns whether the line is hidden inside a collapsed region.
+  bool IsHidden(int lnum) const
+  {
+    auto is_hidden = false;
+    LockGuard lock(mutex_);
+    collapsed_.ForEachOverlapping(lnum, lnum,
+      [&is_hidden, lnum](int first, int, char)
+      {
+        is_hidden = is_hidden || first < lnum;
+      });
+    return is_hidden;
+  }
+
+  // Returns the collapsed regions that start in [top, bottom].
+  std::vector<FoldRange> GetCollapsed(int top, int bottom) const
+  {
+    std::vector<FoldRange> ranges;
+    LockGuard lock(mutex_);
+    collapsed_.ForEachOverlapping(top, bottom,
+      [&ranges, top](int first, int last, char)
+      {
+        if (first >= top)
+        {
+          ranges.push_back(FoldRange{ first, last });
+        }
+      });
+    return ranges;
+  }
+
+  // Records the closed Nvim folds found in [top, bottom] and returns
+  // whether they differ from the ones recorded last.
+  bool SetNvimFolds(int top, int bottom, std::vector<FoldRange>&& folds)
+  {
+    if (top == nvim_folds_top_ && bottom == nvim_folds_bottom_ &&
+        folds == nvim_folds_)
+    {
+      return false;
+    }
+    nvim_folds_top_ = top;
+    nvim_folds_bottom_ = bottom;
+    nvim_folds_ = std::move(folds);
+    return true;
+  }
+
+  // Forgets the recorded Nvim folds so the next scan is sent again.
+  void ResetNvimFolds()
+  {
+    nvim_folds_top_ = 0;
+    nvim_folds_bottom_ = 0;
+    nvim_folds_.clear();
+  }
+};
+} // namespace VSNvim
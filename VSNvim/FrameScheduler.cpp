@@ -0,0 +1,201 @@
+#include "FrameScheduler.h"
+
+#include <memory>
+#include <string>
+
+#include <msclr/lock.h>
+
+#include "Trace.h"
+#include "VSNvimBridge.h"
+
+using namespace System;
+using namespace System::Collections::Generic;
+using namespace System::Diagnostics;
+
+namespace VSNvim
+{
+static std::int64_t ToMicroseconds(double milliseconds)
+{
+  return static_cast<std::int64_t>(milliseconds * 1000);
+}
+
+array<Queue<FrameScheduler::WorkItem^>^>^ FrameScheduler::CreateLanes()
+{
+  const auto lanes = gcnew array<Queue<WorkItem^>^>(lane_count_);
+  for (auto i = 0; i < lane_count_; i++)
+  {
+    lanes[i] = gcnew Queue<WorkItem^>();
+  }
+  return lanes;
+}
+
+void FrameScheduler::Post(FrameLane lane, Object^ key, Action^ method)
+{
+  {
+    msclr::lock lock(lock_);
+    WorkItem^ item;
+    if (key && keyed_items_->TryGetValue(key, item))
+    {
+      item->method = method;
+      return;
+    }
+
+    item = gcnew WorkItem();
+    item->key = key;
+    item->method = method;
+    lanes_[static_cast<int>(lane)]->Enqueue(item);
+    if (key)
+    {
+      keyed_items_->Add(key, item);
+    }
+    if (is_running_)
+    {
+      return;
+    }
+    is_running_ = true;
+  }
+
+  Windows::Application::Current->Dispatcher->BeginInvoke(
+    gcnew Action(&FrameScheduler::StartAction));
+}
+
+FrameScheduler::WorkItem^ FrameScheduler::Dequeue(FrameLane lane)
+{
+  msclr::lock lock(lock_);
+  const auto queue = lanes_[static_cast<int>(lane)];
+  if (!queue->Count)
+  {
+    return nullptr;
+  }
+  const auto item = queue->Dequeue();
+  if (item->key)
+  {
+    keyed_items_->Remove(item->key);
+  }
+  return item;
+}
+
+bool FrameScheduler::HasPending(FrameLane lane)
+{
+  msclr::lock lock(lock_);
+  return lanes_[static_cast<int>(lane)]->Count != 0;
+}
+
+// Runs the work of an item. An exception is reported in Nvim's message
+// area, and the rest of the frame's work still runs.
+void FrameScheduler::Run(WorkItem^ item)
+{
+  try
+  {
+    item->method();
+  }
+  catch (Exception^ e)
+  {
+    const auto bytes = Text::Encoding::UTF8->GetBytes(
+      e->GetType()->Name + ": " + e->Message);
+    pin_ptr<Byte> data = &bytes[0];
+    ReportError(std::make_unique<std::string>(
+      "VSNvim UI update failed: " +
+      std::string(reinterpret_cast<const char*>(data), bytes->Length)));
+  }
+}
+
+void FrameScheduler::RunLane(FrameLane lane)
+{
+  for (auto item = Dequeue(lane); item; item = Dequeue(lane))
+  {
+    Run(item);
+  }
+}
+
+void FrameScheduler::StartAction()
+{
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  if (!rendering_handler_)
+  {
+    rendering_handler_ = gcnew EventHandler(&FrameScheduler::OnRendering);
+    Windows::Media::CompositionTarget::Rendering += rendering_handler_;
+  }
+}
+
+void FrameScheduler::OnRendering(Object^ sender, EventArgs^ e)
+{
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  const auto start = Stopwatch::GetTimestamp();
+  const auto budget = static_cast<Int64>(
+    frame_budget_ms_ * Stopwatch::Frequency / 1000);
+
+  // Only the work that was pending when the frame started runs in it, so
+  // work that posts more work continues on the next frame.
+  auto counts = gcnew array<int>(lane_count_);
+  {
+    msclr::lock lock(lock_);
+    for (auto i = 0; i < lane_count_; i++)
+    {
+      counts[i] = lanes_[i]->Count;
+    }
+  }
+
+  auto ran_work = false;
+  for (auto i = 0; i < lane_count_; i++)
+  {
+    const auto lane = static_cast<FrameLane>(i);
+    for (auto j = 0; j < counts[i]; j++)
+    {
+      if (lane != FrameLane::InputEcho && ran_work &&
+          Stopwatch::GetTimestamp() - start >= budget)
+      {
+        break;
+      }
+      const auto item = Dequeue(lane);
+      if (!item)
+      {
+        // Another lane's work already ran it.
+        break;
+      }
+      Run(item);
+      ran_work = true;
+    }
+  }
+
+  if (ran_work && is_tracing_enabled_)
+  {
+    RecordFrame((Stopwatch::GetTimestamp() - start) * 1000. /
+                Stopwatch::Frequency);
+  }
+
+  msclr::lock lock(lock_);
+  for each (auto queue in lanes_)
+  {
+    if (queue->Count)
+    {
+      return;
+    }
+  }
+  // Stop running on every frame until more work is posted.
+  Windows::Media::CompositionTarget::Rendering -= rendering_handler_;
+  rendering_handler_ = nullptr;
+  is_running_ = false;
+}
+
+void FrameScheduler::RecordFrame(double milliseconds)
+{
+  frame_times_[frame_count_++] = milliseconds;
+  if (frame_count_ < frame_samples_)
+  {
+    return;
+  }
+  frame_count_ = 0;
+
+  const auto times = safe_cast<array<double>^>(frame_times_->Clone());
+  Array::Sort(times);
+  RecordTraceCounter("Frame work p50 us",
+                     ToMicroseconds(times[frame_samples_ / 2]));
+  RecordTraceCounter("Frame work p95 us",
+                     ToMicroseconds(times[frame_samples_ * 95 / 100]));
+  RecordTraceCounter("Frame work p99 us",
+                     ToMicroseconds(times[frame_samples_ * 99 / 100]));
+  RecordTraceCounter("Frame work max us",
+                     ToMicroseconds(times[frame_samples_ - 1]));
+}
+}
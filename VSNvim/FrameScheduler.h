@@ -0,0 +1,324 @@
+#pragma once
+
+namespace VSNvim
+{
+// The kinds of UI work, in the order they run within a frame.
+public enum class FrameLane
+{
+  // Feedback for what the user is typing: the command line and menus.
+  InputEcho,
+  // Caret, scroll and selection updates.
+  Cursor,
+  // Edits that Nvim does not wait for, e.g. the end of a batch.
+  Edits,
+  // Highlights.
+  Decorations,
+  // Message output.
+  Status
+};
+
+// A delegate bound to the arguments it is posted with, so the scheduler
+// invokes it as a System::Action, without reflection.
+template <typename T1>
+ref class BoundAction1
+{
+private:
+  System::Action<T1>^ method_;
+  T1 arg1_;
+
+public:
+  BoundAction1(System::Action<T1>^ method, T1 arg1)
+    : method_(method), arg1_(arg1)
+  {
+  }
+
+  void Invoke()
+  {
+    method_(arg1_);
+  }
+};
+
+template <typename T1, typename T2>
+ref class BoundAction2
+{
+private:
+  System::Action<T1, T2>^ method_;
+  T1 arg1_;
+  T2 arg2_;
+
+public:
+  BoundAction2(System::Action<T1, T2>^ method, T1 arg1, T2 arg2)
+    : method_(method), arg1_(arg1), arg2_(arg2)
+  {
+  }
+
+  void Invoke()
+  {
+    method_(arg1_, arg2_);
+  }
+};
+
+template <typename T1, typename T2, typename T3>
+ref class BoundAction3
+{
+private:
+  System::Action<T1, T2, T3>^ method_;
+  T1 arg1_;
+  T2 arg2_;
+  T3 arg3_;
+
+public:
+  BoundAction3(System::Action<T1, T2, T3>^ method, T1 arg1, T2 arg2, T3 arg3)
+    : method_(method), arg1_(arg1), arg2_(arg2), arg3_(arg3)
+  {
+  }
+
+  void Invoke()
+  {
+    method_(arg1_, arg2_, arg3_);
+  }
+};
+
+template <typename T1, typename T2, typename T3, typename T4>
+ref class BoundAction4
+{
+private:
+  System::Action<T1, T2, T3, T4>^ method_;
+  T1 arg1_;
+  T2 arg2_;
+  T3 arg3_;
+  T4 arg4_;
+
+public:
+  BoundAction4(System::Action<T1, T2, T3, T4>^ method, T1 arg1, T2 arg2,
+               T3 arg3, T4 arg4)
+    : method_(method), arg1_(arg1), arg2_(arg2), arg3_(arg3), arg4_(arg4)
+  {
+  }
+
+  void Invoke()
+  {
+    method_(arg1_, arg2_, arg3_, arg4_);
+  }
+};
+
+template <typename T1, typename T2, typename T3, typename T4, typename T5>
+ref class BoundAction5
+{
+private:
+  System::Action<T1, T2, T3, T4, T5>^ method_;
+  T1 arg1_;
+  T2 arg2_;
+  T3 arg3_;
+  T4 arg4_;
+  T5 arg5_;
+
+public:
+  BoundAction5(System::Action<T1, T2, T3, T4, T5>^ method, T1 arg1, T2 arg2,
+               T3 arg3, T4 arg4, T5 arg5)
+    : method_(method), arg1_(arg1), arg2_(arg2), arg3_(arg3), arg4_(arg4),
+      arg5_(arg5)
+  {
+  }
+
+  void Invoke()
+  {
+    method_(arg1_, arg2_, arg3_, arg4_, arg5_);
+  }
+};
+
+template <typename T1, typename T2, typename T3, typename T4, typename T5,
+          typename T6>
+ref class BoundAction6
+{
+private:
+  System::Action<T1, T2, T3, T4, T5, T6>^ method_;
+  T1 arg1_;
+  T2 arg2_;
+  T3 arg3_;
+  T4 arg4_;
+  T5 arg5_;
+  T6 arg6_;
+
+public:
+  BoundAction6(System::Action<T1, T2, T3, T4, T5, T6>^ method, T1 arg1,
+               T2 arg2, T3 arg3, T4 arg4, T5 arg5, T6 arg6)
+    : method_(method), arg1_(arg1), arg2_(arg2), arg3_(arg3), arg4_(arg4),
+      arg5_(arg5), arg6_(arg6)
+  {
+  }
+
+  void Invoke()
+  {
+    method_(arg1_, arg2_, arg3_, arg4_, arg5_, arg6_);
+  }
+};
+
+template <typename T1, typename T2, typename T3, typename T4, typename T5,
+          typename T6, typename T7>
+ref class BoundAction7
+{
+private:
+  System::Action<T1, T2, T3, T4, T5, T6, T7>^ method_;
+  T1 arg1_;
+  T2 arg2_;
+  T3 arg3_;
+  T4 arg4_;
+  T5 arg5_;
+  T6 arg6_;
+  T7 arg7_;
+
+public:
+  BoundAction7(System::Action<T1, T2, T3, T4, T5, T6, T7>^ method, T1 arg1,
+               T2 arg2, T3 arg3, T4 arg4, T5 arg5, T6 arg6, T7 arg7)
+    : method_(method), arg1_(arg1), arg2_(arg2), arg3_(arg3), arg4_(arg4),
+      arg5_(arg5), arg6_(arg6), arg7_(arg7)
+  {
+  }
+
+  void Invoke()
+  {
+    method_(arg1_, arg2_, arg3_, arg4_, arg5_, arg6_, arg7_);
+  }
+};
+
+// Runs the UI work posted by the bridge once per frame. The lanes are
+// drained in order until the frame's time budget is spent, and the rest is
+// carried over to the next frame. Input echo always runs in full. Work
+// posted with a key replaces the pending work with the same key, so only
+// the latest caret position is applied.
+public ref class FrameScheduler abstract sealed
+{
+private:
+  literal int lane_count_ = 5;
+  literal double frame_budget_ms_ = 6;
+  // The number of frames whose work time is summarized at once, in trace
+  // counters. Frames are only sampled while tracing is on.
+  literal int frame_samples_ = 512;
+
+  ref class WorkItem
+  {
+  public:
+    System::Object^ key;
+    System::Action^ method;
+  };
+
+  static System::Object^ lock_ = gcnew System::Object();
+  static array<System::Collections::Generic::Queue<WorkItem^>^>^ lanes_ =
+    CreateLanes();
+  static System::Collections::Generic::Dictionary<
+    System::Object^, WorkItem^>^ keyed_items_ = gcnew
+      System::Collections::Generic::Dictionary<System::Object^, WorkItem^>();
+  // Whether the scheduler runs on the next frames. Guarded by the lock.
+  static bool is_running_;
+  static System::EventHandler^ rendering_handler_;
+  static array<double>^ frame_times_ = gcnew array<double>(frame_samples_);
+  static int frame_count_;
+
+  static array<System::Collections::Generic::Queue<WorkItem^>^>^
+    CreateLanes();
+
+  static WorkItem^ Dequeue(FrameLane lane);
+
+  static void Run(WorkItem^ item);
+
+  static void StartAction();
+
+  static void OnRendering(System::Object^ sender, System::EventArgs^ e);
+
+  static void RecordFrame(double milliseconds);
+
+public:
+  // Posts work from any thread. A null key never replaces other work.
+  static void Post(FrameLane lane, System::Object^ key,
+                   System::Action^ method);
+
+  // Posts work that is invoked with the arguments, which are converted to
+  // the parameter types of the delegate.
+  template <typename T1, typename A1>
+  static void Post(FrameLane lane, System::Object^ key,
+                   System::Action<T1>^ method, A1 arg1)
+  {
+    const auto bound = gcnew BoundAction1<T1>(method, arg1);
+    Post(lane, key, gcnew System::Action(
+      bound, &BoundAction1<T1>::Invoke));
+  }
+
+  template <typename T1, typename T2, typename A1, typename A2>
+  static void Post(FrameLane lane, System::Object^ key,
+                   System::Action<T1, T2>^ method, A1 arg1, A2 arg2)
+  {
+    const auto bound = gcnew BoundAction2<T1, T2>(method, arg1, arg2);
+    Post(lane, key, gcnew System::Action(
+      bound, &BoundAction2<T1, T2>::Invoke));
+  }
+
+  template <typename T1, typename T2, typename T3, typename A1, typename A2,
+            typename A3>
+  static void Post(FrameLane lane, System::Object^ key,
+                   System::Action<T1, T2, T3>^ method, A1 arg1, A2 arg2,
+                   A3 arg3)
+  {
+    const auto bound = gcnew BoundAction3<T1, T2, T3>(
+      method, arg1, arg2, arg3);
+    Post(lane, key, gcnew System::Action(
+      bound, &BoundAction3<T1, T2, T3>::Invoke));
+  }
+
+  template <typename T1, typename T2, typename T3, typename T4, typename A1,
+            typename A2, typename A3, typename A4>
+  static void Post(FrameLane lane, System::Object^ key,
+                   System::Action<T1, T2, T3, T4>^ method, A1 arg1, A2 arg2,
+                   A3 arg3, A4 arg4)
+  {
+    const auto bound = gcnew BoundAction4<T1, T2, T3, T4>(
+      method, arg1, arg2, arg3, arg4);
+    Post(lane, key, gcnew System::Action(
+      bound, &BoundAction4<T1, T2, T3, T4>::Invoke));
+  }
+
+  template <typename T1, typename T2, typename T3, typename T4, typename T5,
+            typename A1, typename A2, typename A3, typename A4, typename A5>
+  static void Post(FrameLane lane, System::Object^ key,
+                   System::Action<T1, T2, T3, T4, T5>^ method, A1 arg1,
+                   A2 arg2, A3 arg3, A4 arg4, A5 arg5)
+  {
+    const auto bound = gcnew BoundAction5<T1, T2, T3, T4, T5>(
+      method, arg1, arg2, arg3, arg4, arg5);
+    Post(lane, key, gcnew System::Action(
+      bound, &BoundAction5<T1, T2, T3, T4, T5>::Invoke));
+  }
+
+  template <typename T1, typename T2, typename T3, typename T4, typename T5,
+            typename T6, typename A1, typename A2, typename A3, typename A4,
+            typename A5, typename A6>
+  static void Post(FrameLane lane, System::Object^ key,
+                   System::Action<T1, T2, T3, T4, T5, T6>^ method, A1 arg1,
+                   A2 arg2, A3 arg3, A4 arg4, A5 arg5, A6 arg6)
+  {
+    const auto bound = gcnew BoundAction6<T1, T2, T3, T4, T5, T6>(
+      method, arg1, arg2, arg3, arg4, arg5, arg6);
+    Post(lane, key, gcnew System::Action(
+      bound, &BoundAction6<T1, T2, T3, T4, T5, T6>::Invoke));
+  }
+
+  template <typename T1, typename T2, typename T3, typename T4, typename T5,
+            typename T6, typename T7, typename A1, typename A2, typename A3,
+            typename A4, typename A5, typename A6, typename A7>
+  static void Post(FrameLane lane, System::Object^ key,
+                   System::Action<T1, T2, T3, T4, T5, T6, T7>^ method, A1 arg1,
+                   A2 arg2, A3 arg3, A4 arg4, A5 arg5, A6 arg6, A7 arg7)
+  {
+    const auto bound = gcnew BoundAction7<T1, T2, T3, T4, T5, T6, T7>(
+      method, arg1, arg2, arg3, arg4, arg5, arg6, arg7);
+    Post(lane, key, gcnew System::Action(
+      bound, &BoundAction7<T1, T2, T3, T4, T5, T6, T7>::Invoke));
+  }
+
+  static bool HasPending(FrameLane lane);
+
+  // Runs the pending work of a lane now. Called on the UI thread by work
+  // that must not overtake it, e.g. a caret move after an edit.
+  static void RunLane(FrameLane lane);
+};
+}
@@ -0,0 +1,57 @@
+#include "HighlightTable.h"
+
+namespace VSNvim
+{
+HighlightTable highlight_table_;
+
+void HighlightTable::Define(int id, const HighlightAttributes& attributes)
+{
+  if (id < 0)
+  {
+    return;
+  }
+
+  LockGuard lock(mutex_);
+  auto index = 0;
+  if (const auto it = indices_.find(attributes); it != indices_.end())
+  {
+    index = it->second;
+  }
+  else
+  {
+    index = static_cast<int>(attributes_.size());
+    attributes_.push_back(attributes);
+    indices_.emplace(attributes, index);
+  }
+
+  if (static_cast<std::size_t>(id) >= ids_.size())
+  {
+    ids_.resize(id + 1, 0);
+  }
+  else if (ids_[id] != index)
+  {
+    generation_++;
+  }
+  ids_[id] = index;
+}
+
+int HighlightTable::GetIndex(int id) const
+{
+  LockGuard lock(mutex_);
+  return id >= 0 && static_cast<std::size_t>(id) < ids_.size() ? ids_[id] : 0;
+}
+
+HighlightAttributes HighlightTable::GetAttributes(int index) const
+{
+  LockGuard lock(mutex_);
+  return index >= 0 && static_cast<std::size_t>(index) < attributes_.size()
+         ? attributes_[index]
+         : HighlightAttributes();
+}
+
+std::uint32_t HighlightTable::GetGeneration() const
+{
+  LockGuard lock(mutex_);
+  return generation_;
+}
+}
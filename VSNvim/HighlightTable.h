@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include "Lock.h"
+
+namespace VSNvim
+{
+enum HighlightFlags : std::uint16_t
+{
+  Bold          = 1 << 0,
+  Italic        = 1 << 1,
+  Underline     = 1 << 2,
+  Undercurl     = 1 << 3,
+  Reverse       = 1 << 4,
+  Strikethrough = 1 << 5
+};
+
+// The parts of an Nvim highlight that affect how text is drawn. Colors are
+// 0xRRGGBB or -1 when unset.
+struct HighlightAttributes
+{
+  std::int32_t foreground = -1;
+  std::int32_t background = -1;
+  std::int32_t special = -1;
+  std::uint16_t flags = 0;
+
+  bool operator==(const HighlightAttributes& other) const
+  {
+    return foreground == other.foreground &&
+           background == other.background &&
+           special == other.special &&
+           flags == other.flags;
+  }
+};
+
+struct HighlightAttributesHash
+{
+  std::size_t operator()(const HighlightAttributes& attributes) const
+  {
+    auto hash = std::hash<std::int32_t>()(attributes.foreground);
+    hash = hash * 31 + std::hash<std::int32_t>()(attributes.background);
+    hash = hash * 31 + std::hash<std::int32_t>()(attributes.special);
+    return hash * 31 + attributes.flags;
+  }
+};
+
+// Interns the attributes defined by hl_attr_define. Nvim defines a new
+// attribute id for every combination of highlight groups, but most of them
+// look the same, so each distinct set of attributes gets one compact index
+// and one Visual Studio classification type. Index 0 is the default text.
+class HighlightTable
+{
+private:
+  mutable Mutex mutex_;
+  std::vector<HighlightAttributes> attributes_{ HighlightAttributes() };
+  std::unordered_map<HighlightAttributes, int, HighlightAttributesHash>
+    indices_{ { HighlightAttributes(), 0 } };
+  // The interned index of every Nvim attribute id.
+  std::vector<int> ids_;
+  // Incremented when an attribute id is redefined, e.g. by :colorscheme.
+  std::uint32_t generation_ = 0;
+
+public:
+  // Called from hl_attr_define on the Nvim thread.
+  void Define(int id, const HighlightAttributes& attributes);
+
+  int GetIndex(int id) const;
+
+  HighlightAttributes GetAttributes(int index) const;
+
+  std::uint32_t GetGeneration() const;
+};
+
+extern HighlightTable highlight_table_;
+}
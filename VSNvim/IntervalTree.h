@@ -0,0 +1,285 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace VSNvim
+{
+// A set of closed intervals ordered by their start. It is a treap whose
+// nodes track the largest end in their subtree, so overlap queries visit
+// only the intervals they report plus O(log n) nodes. Shifting every
+// interval after a position is done lazily in O(log n), which keeps line
+// based data aligned with line insertions and deletions.
+template <typename Key, typename Value>
+class IntervalTree
+{
+public:
+  struct Interval
+  {
+    Key start;
+    Key end;
+    Value value;
+  };
+
+private:
+  using Index = std::uint32_t;
+  static constexpr Index none_ = UINT32_MAX;
+
+  struct Node
+  {
+    Interval interval;
+    Key max_end;
+    // A shift that has been applied to this node but not to its children.
+    Key shift;
+    std::uint32_t priority;
+    Index left;
+    Index right;
+  };
+
+  std::vector<Node> nodes_;
+  std::vector<Index> free_nodes_;
+  Index root_ = none_;
+  std::size_t size_ = 0;
+  std::uint32_t seed_ = 2463534242u;
+
+  std::uint32_t NextPriority()
+  {
+    // xorshift32
+    seed_ ^= seed_ << 13;
+    seed_ ^= seed_ >> 17;
+    seed_ ^= seed_ << 5;
+    return seed_;
+  }
+
+  void Apply(Index node, Key delta)
+  {
+    if (node == none_)
+    {
+      return;
+    }
+    auto& n = nodes_[node];
+    n.interval.start += delta;
+    n.interval.end += delta;
+    n.max_end += delta;
+    n.shift += delta;
+  }
+
+  void Push(Index node)
+  {
+    auto& n = nodes_[node];
+    if (n.shift != Key())
+    {
+      Apply(n.left, n.shift);
+      Apply(n.right, n.shift);
+      n.shift = Key();
+    }
+  }
+
+  void Update(Index node)
+  {
+    auto& n = nodes_[node];
+    n.max_end = n.interval.end;
+    if (n.left != none_)
+    {
+      n.max_end = (std::max)(n.max_end, nodes_[n.left].max_end);
+    }
+    if (n.right != none_)
+    {
+      n.max_end = (std::max)(n.max_end, nodes_[n.right].max_end);
+    }
+  }
+
+  // Splits a subtree into the intervals that start before the key and
+  // those that start at or after it.
+  void Split(Index node, Key key, Index& left, Index& right)
+  {
+    if (node == none_)
+    {
+      left = right = none_;
+      return;
+    }
+    Push(node);
+    if (nodes_[node].interval.start < key)
+    {
+      Index rest;
+      Split(nodes_[node].right, key, rest, right);
+      nodes_[node].right = rest;
+      left = node;
+    }
+    else
+    {
+      Index rest;
+      Split(nodes_[node].left, key, left, rest);
+      nodes_[node].left = rest;
+      right = node;
+    }
+    Update(node);
+  }
+
+  Index Merge(Index left, Index right)
+  {
+    if (left == none_)
+    {
+      return right;
+    }
+    if (right == none_)
+    {
+      return left;
+    }
+    if (nodes_[left].priority > nodes_[right].priority)
+    {
+      Push(left);
+      nodes_[left].right = Merge(nodes_[left].right, right);
+      Update(left);
+      return left;
+    }
+    Push(right);
+    nodes_[right].left = Merge(left, nodes_[right].left);
+    Update(right);
+    return right;
+  }
+
+  template <typename Callback>
+  void Release(Index node, Key offset, Callback& callback)
+  {
+    if (node == none_)
+    {
+      return;
+    }
+    const auto& n = nodes_[node];
+    const auto child_offset = offset + n.shift;
+    Release(n.left, child_offset, callback);
+    auto interval = n.interval;
+    interval.start += offset;
+    interval.end += offset;
+    callback(std::move(interval));
+    Release(n.right, child_offset, callback);
+    free_nodes_.push_back(node);
+    size_--;
+  }
+
+  template <typename Callback>
+  void Visit(Index node, Key offset, Key first, Key last,
+             Callback& callback) const
+  {
+    if (node == none_)
+    {
+      return;
+    }
+    const auto& n = nodes_[node];
+    if (n.max_end + offset < first)
+    {
+      return;
+    }
+    const auto child_offset = offset + n.shift;
+    Visit(n.left, child_offset, first, last, callback);
+    const auto start = n.interval.start + offset;
+    if (start > last)
+    {
+      return;
+    }
+    const auto end = n.interval.end + offset;
+    if (end >= first)
+    {
+      callback(start, end, n.interval.value);
+    }
+    Visit(n.right, child_offset, first, last, callback);
+  }
+
+public:
+  std::size_t Size() const
+  {
+    return size_;
+  }
+
+  void Clear()
+  {
+    nodes_.clear();
+    free_nodes_.clear();
+    root_ = none_;
+    size_ = 0;
+  }
+
+  // Clears the tree and frees the memory of its nodes.
+  void Release()
+  {
+    Clear();
+    nodes_.shrink_to_fit();
+    free_nodes_.shrink_to_fit();
+  }
+
+  // Returns the number of bytes the tree holds.
+  std::size_t GetMemorySize() const
+  {
+    return nodes_.capacity() * sizeof(Node) +
+           free_nodes_.capacity() * sizeof(Index);
+  }
+
+  void Insert(Key start, Key end, Value value)
+  {
+    Index node;
+    if (free_nodes_.empty())
+    {
+      node = static_cast<Index>(nodes_.size());
+      nodes_.emplace_back();
+    }
+    else
+    {
+      node = free_nodes_.back();
+      free_nodes_.pop_back();
+    }
+    nodes_[node] = Node
+    {
+      Interval{ start, end, std::move(value) },
+      end, Key(), NextPriority(), none_, none_
+    };
+    size_++;
+
+    Index left;
+    Index right;
+    Split(root_, start, left, right);
+    root_ = Merge(Merge(left, node), right);
+  }
+
+  // Removes the intervals that start in [first, last) and passes them to
+  // the callback in order.
+  template <typename Callback>
+  void Extract(Key first, Key last, Callback callback)
+  {
+    Index left;
+    Index middle;
+    Index right;
+    Split(root_, first, left, middle);
+    Split(middle, last, middle, right);
+    Release(middle, Key(), callback);
+    root_ = Merge(left, right);
+  }
+
+  void Erase(Key first, Key last)
+  {
+    Extract(first, last, [](Interval&&) {});
+  }
+
+  // Adds the delta to the intervals that start at or after the position.
+  // When the delta is negative, no interval may start in
+  // [from + delta, from).
+  void Shift(Key from, Key delta)
+  {
+    Index left;
+    Index right;
+    Split(root_, from, left, right);
+    Apply(right, delta);
+    root_ = Merge(left, right);
+  }
+
+  // Calls the callback with the start, end and value of every interval that
+  // overlaps [first, last], in order of their start.
+  template <typename Callback>
+  void ForEachOverlapping(Key first, Key last, Callback callback) const
+  {
+    Visit(root_, Key(), first, last, callback);
+  }
+};
+}
@@ -0,0 +1,221 @@
+#include "KeyTranslator.h"
+
+namespace VSNvim
+{
+static bool IsModifierKey(unsigned int virtual_key)
+{
+  switch (virtual_key)
+  {
+  case VK_SHIFT:
+  case VK_LSHIFT:
+  case VK_RSHIFT:
+  case VK_CONTROL:
+  case VK_LCONTROL:
+  case VK_RCONTROL:
+  case VK_MENU:
+  case VK_LMENU:
+  case VK_RMENU:
+  case VK_CAPITAL:
+  case VK_LWIN:
+  case VK_RWIN:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Adds the modifier prefixes to a key name, e.g. "<F1>" with Shift
+// becomes "<S-F1>" and "x" with Control becomes "<C-x>".
+static void AppendModifiedKey(std::string& notation, std::string_view name,
+                              unsigned int modifiers)
+{
+  if (name.size() > 2 && name.front() == '<' && name.back() == '>')
+  {
+    name = name.substr(1, name.size() - 2);
+  }
+  notation += '<';
+  if (modifiers & Control)
+  {
+    notation += "C-";
+  }
+  if (modifiers & Alt)
+  {
+    notation += "M-";
+  }
+  if (modifiers & Shift)
+  {
+    notation += "S-";
+  }
+  notation.append(name.data(), name.size());
+  notation += '>';
+}
+
+// Converts the characters produced by a key to UTF-8. "<" must be escaped
+// since it starts a key name in nvim_input.
+static bool AppendCharacters(std::string& notation, const wchar_t* chars,
+                             int count)
+{
+  char utf8_chars[16];
+  const auto utf8_len = WideCharToMultiByte(CP_UTF8, 0, chars, count,
+                                            utf8_chars, sizeof(utf8_chars),
+                                            nullptr, nullptr);
+  if (utf8_len <= 0)
+  {
+    return false;
+  }
+  const auto text = std::string_view(utf8_chars, utf8_len);
+  notation += text == "<" ? "lt" : text;
+  return true;
+}
+
+static int GetCharacters(unsigned int virtual_key, unsigned int scan_code,
+                         unsigned int modifiers, HKL layout, wchar_t* chars,
+                         int size, bool consume_dead_key)
+{
+  BYTE keyboard_state[256] = {};
+  if (modifiers & Shift)
+  {
+    keyboard_state[VK_SHIFT] = 0x80;
+  }
+  if (modifiers & Control)
+  {
+    keyboard_state[VK_CONTROL] = 0x80;
+  }
+  if (modifiers & Alt)
+  {
+    keyboard_state[VK_MENU] = 0x80;
+  }
+  if (modifiers & CapsLock)
+  {
+    keyboard_state[VK_CAPITAL] = 0x01;
+  }
+  // Flag 4 keeps the translation from changing the dead key state of the
+  // keyboard so keys can be looked up ahead of time.
+  return ToUnicodeEx(virtual_key, scan_code, keyboard_state, chars, size,
+                     consume_dead_key ? 0 : 4, layout);
+}
+
+bool KeyTranslator::TranslateUncached(unsigned int virtual_key,
+                                      unsigned int scan_code,
+                                      unsigned int modifiers, HKL layout,
+                                      std::string& notation)
+{
+  notation.clear();
+  if (IsModifierKey(virtual_key))
+  {
+    return true;
+  }
+
+  const auto chord_modifiers = modifiers & (Shift | Control | Alt);
+  if (const auto special_key = special_keys_[virtual_key & 0xFF];
+      !special_key.empty())
+  {
+    if (chord_modifiers)
+    {
+      AppendModifiedKey(notation, special_key, chord_modifiers);
+    }
+    else
+    {
+      notation = special_key;
+    }
+    return true;
+  }
+
+  wchar_t chars[4];
+  const auto dead_key_pending = dead_key_pending_;
+  auto count = GetCharacters(virtual_key, scan_code, modifiers, layout,
+                             chars, 4, dead_key_pending);
+  dead_key_pending_ = count < 0;
+  if (dead_key_pending_)
+  {
+    // The dead key is left to Visual Studio, which records it in the
+    // keyboard state. The next key consumes it and is sent composed.
+    return false;
+  }
+
+  // AltGr is reported as Control and Alt. Keys that produce a printable
+  // character with it are sent as that character.
+  const auto is_alt_gr = (modifiers & (Control | Alt)) == (Control | Alt);
+  if (!(modifiers & (Control | Alt)) ||
+      (is_alt_gr && count > 0 && chars[0] >= L' '))
+  {
+    if (count <= 0 || !AppendCharacters(notation, chars, count))
+    {
+      return false;
+    }
+    if (notation == "lt")
+    {
+      notation = "<lt>";
+    }
+    return !dead_key_pending;
+  }
+
+  // Control and Alt chords are encoded with the character the key produces
+  // without them, e.g. <C-x> instead of the control character.
+  count = GetCharacters(virtual_key, scan_code, modifiers & (Shift | CapsLock),
+                        layout, chars, 4, false);
+  if (count <= 0)
+  {
+    return false;
+  }
+  std::string name;
+  if (!AppendCharacters(name, chars, count))
+  {
+    return false;
+  }
+  // Shift is already part of the character.
+  AppendModifiedKey(notation, name, modifiers & (Control | Alt));
+  return true;
+}
+
+std::string_view KeyTranslator::Translate(unsigned int virtual_key,
+                                          unsigned int scan_code,
+                                          unsigned int modifiers,
+                                          HKL layout)
+{
+  if (layout != layout_)
+  {
+    for (auto& entries : cache_)
+    {
+      for (auto& entry : entries)
+      {
+        entry.valid = false;
+      }
+    }
+    layout_ = layout;
+  }
+
+  auto& entry = cache_[modifiers % modifier_combinations_][virtual_key & 0xFF];
+  if (entry.valid && entry.scan_code == scan_code && !dead_key_pending_)
+  {
+    return entry.notation;
+  }
+
+  entry.valid = TranslateUncached(virtual_key, scan_code, modifiers, layout,
+                                  entry.notation);
+  entry.scan_code = scan_code;
+  return entry.notation;
+}
+
+unsigned int KeyTranslator::GetModifiers()
+{
+  unsigned int modifiers = 0;
+  if (GetKeyState(VK_SHIFT) & 0x8000)
+  {
+    modifiers |= Shift;
+  }
+  if (GetKeyState(VK_CONTROL) & 0x8000)
+  {
+    modifiers |= Control;
+  }
+  if (GetKeyState(VK_MENU) & 0x8000)
+  {
+    modifiers |= Alt;
+  }
+  if (GetKeyState(VK_CAPITAL) & 0x0001)
+  {
+    modifiers |= CapsLock;
+  }
+  return modifiers;
+}
+}
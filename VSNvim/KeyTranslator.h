@@ -0,0 +1,110 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+// Winsock2.h includes Windows.h and must come first for Nvim's headers.
+#include <Winsock2.h>
+
+namespace VSNvim
+{
+enum KeyModifiers : unsigned int
+{
+  Shift    = 1 << 0,
+  Control  = 1 << 1,
+  Alt      = 1 << 2,
+  CapsLock = 1 << 3
+};
+
+constexpr std::size_t modifier_combinations_ = 1 << 4;
+
+// The Nvim names of the virtual keys that do not produce text, indexed by
+// virtual key code.
+constexpr std::array<std::string_view, 256> CreateSpecialKeyTable()
+{
+  std::array<std::string_view, 256> table{};
+  table[VK_BACK]     = "<BS>";
+  table[VK_TAB]      = "<Tab>";
+  table[VK_RETURN]   = "<Return>";
+  table[VK_ESCAPE]   = "<Esc>";
+  table[VK_SPACE]    = "<Space>";
+  table[VK_UP]       = "<Up>";
+  table[VK_DOWN]     = "<Down>";
+  table[VK_LEFT]     = "<Left>";
+  table[VK_RIGHT]    = "<Right>";
+  table[VK_HELP]     = "<Help>";
+  table[VK_INSERT]   = "<Insert>";
+  table[VK_DELETE]   = "<Del>";
+  table[VK_HOME]     = "<Home>";
+  table[VK_END]      = "<End>";
+  table[VK_PRIOR]    = "<PageUp>";
+  table[VK_NEXT]     = "<PageDown>";
+  table[VK_ADD]      = "<kPlus>";
+  table[VK_SUBTRACT] = "<kMinus>";
+  table[VK_MULTIPLY] = "<kMultiply>";
+  table[VK_DIVIDE]   = "<kDivide>";
+  table[VK_DECIMAL]  = "<kPoint>";
+
+  constexpr std::string_view function_keys[] =
+  {
+    "<F1>",  "<F2>",  "<F3>",  "<F4>",  "<F5>",  "<F6>",
+    "<F7>",  "<F8>",  "<F9>",  "<F10>", "<F11>", "<F12>",
+    "<F13>", "<F14>", "<F15>", "<F16>", "<F17>", "<F18>",
+    "<F19>", "<F20>", "<F21>", "<F22>", "<F23>", "<F24>"
+  };
+  for (auto i = 0; i <= VK_F24 - VK_F1; i++)
+  {
+    table[VK_F1 + i] = function_keys[i];
+  }
+
+  constexpr std::string_view keypad_keys[] =
+  {
+    "<k0>", "<k1>", "<k2>", "<k3>", "<k4>",
+    "<k5>", "<k6>", "<k7>", "<k8>", "<k9>"
+  };
+  for (auto i = 0; i <= VK_NUMPAD9 - VK_NUMPAD0; i++)
+  {
+    table[VK_NUMPAD0 + i] = keypad_keys[i];
+  }
+  return table;
+}
+
+inline constexpr auto special_keys_ = CreateSpecialKeyTable();
+
+// Translates key presses into Nvim key notation, e.g. "a", "<lt>", "<C-x>"
+// or "<S-F1>". Translations are cached per modifier combination and
+// virtual key for the current keyboard layout, so a repeated key costs a
+// single array lookup.
+class KeyTranslator
+{
+private:
+  struct CacheEntry
+  {
+    bool valid;
+    unsigned int scan_code;
+    std::string notation;
+  };
+
+  std::array<std::array<CacheEntry, 256>, modifier_combinations_> cache_{};
+  HKL layout_ = nullptr;
+  // Set after a dead key. The next key is composed with it and its
+  // translation must not be cached.
+  bool dead_key_pending_ = false;
+
+  bool TranslateUncached(unsigned int virtual_key, unsigned int scan_code,
+                         unsigned int modifiers, HKL layout,
+                         std::string& notation);
+
+public:
+  // Returns the notation of the key or an empty view if the key should be
+  // handled by Visual Studio.
+  std::string_view Translate(unsigned int virtual_key,
+                             unsigned int scan_code,
+                             unsigned int modifiers,
+                             HKL layout);
+
+  // Returns the modifiers that are currently pressed.
+  static unsigned int GetModifiers();
+};
+}
@@ -0,0 +1,305 @@
+#include "LineIndex.h"
+
+#include "SearchLiteral.h"
+
+#include <algorithm>
+#include <atomic>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define VSNVIM_LINE_INDEX_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace VSNvim
+{
+struct LineIndex::Chunk
+{
+  int first_line;
+  int end_line;
+  std::vector<char> text;
+  std::vector<std::uint32_t> line_starts;
+  std::atomic<bool> is_filled{ false };
+};
+
+LineIndex::LineIndex(const std::vector<int>& chunk_first_lines,
+                     int line_count)
+  : line_count_(line_count)
+{
+  for (std::size_t i = 0; i < chunk_first_lines.size(); i++)
+  {
+    auto chunk = std::make_unique<Chunk>();
+    chunk->first_line = chunk_first_lines[i];
+    chunk->end_line = i + 1 < chunk_first_lines.size()
+                      ? chunk_first_lines[i + 1]
+                      : line_count + 1;
+    chunks_.push_back(std::move(chunk));
+  }
+}
+
+LineIndex::~LineIndex() = default;
+
+int LineIndex::GetChunkCount() const
+{
+  return static_cast<int>(chunks_.size());
+}
+
+int LineIndex::GetChunkFirstLine(int chunk) const
+{
+  return chunks_[chunk]->first_line;
+}
+
+int LineIndex::GetChunkEndLine(int chunk) const
+{
+  return chunks_[chunk]->end_line;
+}
+
+static unsigned int CountTrailingZeros(unsigned int value)
+{
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, value);
+  return index;
+#else
+  return __builtin_ctz(value);
+#endif
+}
+
+static bool IsHighSurrogate(char16_t c)
+{
+  return c >= 0xd800 && c <= 0xdbff;
+}
+
+static bool IsLowSurrogate(char16_t c)
+{
+  return c >= 0xdc00 && c <= 0xdfff;
+}
+
+std::size_t TranscodeLines(const char16_t* text, std::size_t length,
+                           char* output,
+                           std::vector<std::uint32_t>& line_starts)
+{
+  auto out = output;
+  std::size_t i = 0;
+  while (i < length)
+  {
+#ifdef VSNVIM_LINE_INDEX_SSE2
+    // Copies runs of ASCII characters other than CR and LF eight at a time.
+    // The units of a block are packed to bytes even if only a prefix of
+    // them is ASCII, and the rest are overwritten below.
+    const auto non_ascii_mask = _mm_set1_epi16(static_cast<short>(0xff80));
+    const auto lf = _mm_set1_epi16('\n');
+    const auto cr = _mm_set1_epi16('\r');
+    const auto zero = _mm_setzero_si128();
+    while (i + 8 <= length)
+    {
+      const auto units = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(text + i));
+      const auto is_ascii =
+        _mm_cmpeq_epi16(_mm_and_si128(units, non_ascii_mask), zero);
+      const auto is_break = _mm_or_si128(_mm_cmpeq_epi16(units, lf),
+                                         _mm_cmpeq_epi16(units, cr));
+      const auto is_special = _mm_andnot_si128(
+        _mm_andnot_si128(is_break, is_ascii), _mm_set1_epi16(-1));
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(out),
+                       _mm_packus_epi16(units, units));
+      const auto special_mask =
+        static_cast<unsigned int>(_mm_movemask_epi8(is_special));
+      if (!special_mask)
+      {
+        out += 8;
+        i += 8;
+        continue;
+      }
+      const auto ascii_count = CountTrailingZeros(special_mask) / 2;
+      out += ascii_count;
+      i += ascii_count;
+      break;
+    }
+    if (i == length)
+    {
+      break;
+    }
+#endif
+
+    const auto c = text[i++];
+    if (c == '\r' || c == '\n' || c == 0x85 || c == 0x2028 || c == 0x2029)
+    {
+      if (c == '\r' && i < length && text[i] == '\n')
+      {
+        i++;
+      }
+      *out++ = '\0';
+      line_starts.push_back(static_cast<std::uint32_t>(out - output));
+    }
+    else if (c < 0x80)
+    {
+      *out++ = static_cast<char>(c);
+    }
+    else if (c < 0x800)
+    {
+      *out++ = static_cast<char>(0xc0 | c >> 6);
+      *out++ = static_cast<char>(0x80 | (c & 0x3f));
+    }
+    else if (IsHighSurrogate(c) && i < length && IsLowSurrogate(text[i]))
+    {
+      const auto code_point =
+        0x10000 + ((c - 0xd800) << 10) + (text[i++] - 0xdc00);
+      *out++ = static_cast<char>(0xf0 | code_point >> 18);
+      *out++ = static_cast<char>(0x80 | (code_point >> 12 & 0x3f));
+      *out++ = static_cast<char>(0x80 | (code_point >> 6 & 0x3f));
+      *out++ = static_cast<char>(0x80 | (code_point & 0x3f));
+    }
+    else
+    {
+      // A lone surrogate becomes U+FFFD like with Encoding.UTF8.
+      const auto code_point =
+        IsHighSurrogate(c) || IsLowSurrogate(c) ? 0xfffd : c;
+      *out++ = static_cast<char>(0xe0 | code_point >> 12);
+      *out++ = static_cast<char>(0x80 | (code_point >> 6 & 0x3f));
+      *out++ = static_cast<char>(0x80 | (code_point & 0x3f));
+    }
+  }
+  return out - output;
+}
+
+bool LineIndex::FillChunk(int chunk_index, const char16_t* text,
+                          std::size_t length)
+{
+  auto& chunk = *chunks_[chunk_index];
+  const auto line_count =
+    static_cast<std::size_t>(chunk.end_line - chunk.first_line);
+  std::vector<char> buffer(length * 3 + 1);
+  std::vector<std::uint32_t> line_starts;
+  line_starts.reserve(line_count + 1);
+  line_starts.push_back(0);
+  auto size = TranscodeLines(text, length, buffer.data(), line_starts);
+
+  // Only the last chunk may end without a line break, and the line after
+  // the break of the other chunks belongs to the next chunk.
+  if (line_starts.size() == line_count + 1 &&
+      chunk.end_line <= line_count_)
+  {
+    line_starts.pop_back();
+  }
+  else
+  {
+    buffer[size++] = '\0';
+  }
+  if (line_starts.size() != line_count)
+  {
+    return false;
+  }
+
+  chunk.text.assign(buffer.begin(), buffer.begin() + size);
+  chunk.line_starts = std::move(line_starts);
+  chunk.is_filled.store(true, std::memory_order_release);
+  return true;
+}
+
+const char* LineIndex::GetLine(int lnum) const
+{
+  if (lnum < 1 || lnum > line_count_)
+  {
+    return nullptr;
+  }
+  const auto chunk = std::upper_bound(chunks_.begin(), chunks_.end(), lnum,
+    [](int lnum, const std::unique_ptr<Chunk>& chunk)
+    {
+      return lnum < chunk->first_line;
+    }) - 1;
+  if (!(*chunk)->is_filled.load(std::memory_order_acquire))
+  {
+    return nullptr;
+  }
+  return (*chunk)->text.data() +
+         (*chunk)->line_starts[lnum - (*chunk)->first_line];
+}
+
+int LineIndex::FindLine(const SearchLiteral& literal, int first_line,
+                        int end_line, bool is_forward) const
+{
+  first_line = std::max(first_line, 1);
+  end_line = std::min(end_line, line_count_ + 1);
+  auto last_found = 0;
+  for (const auto& chunk : chunks_)
+  {
+    if (chunk->end_line <= first_line || chunk->first_line >= end_line)
+    {
+      continue;
+    }
+    if (!chunk->is_filled.load(std::memory_order_acquire))
+    {
+      return -1;
+    }
+
+    // The lines are separated by NULs, which no literal contains, so a
+    // match never spans two lines.
+    const auto& starts = chunk->line_starts;
+    const char* const text = chunk->text.data();
+    const auto first =
+      text + starts[std::max(first_line, chunk->first_line) -
+                    chunk->first_line];
+    const auto last = end_line < chunk->end_line
+      ? text + starts[end_line - chunk->first_line]
+      : text + chunk->text.size();
+    for (auto p = first;
+         (p = FindSearchLiteral(p, last, literal)) != nullptr;)
+    {
+      const auto line_index = std::upper_bound(
+        starts.begin(), starts.end(),
+        static_cast<std::uint32_t>(p - text)) - starts.begin() - 1;
+      const auto lnum = chunk->first_line + static_cast<int>(line_index);
+      if (is_forward)
+      {
+        return lnum;
+      }
+      last_found = lnum;
+      // Only the last match of a line matters when searching backward.
+      p = line_index + 1 < static_cast<std::ptrdiff_t>(starts.size())
+        ? text + starts[line_index + 1]
+        : last;
+    }
+  }
+  return last_found;
+}
+
+struct CancellationFlag::State
+{
+  std::atomic<bool> is_set{ false };
+};
+
+CancellationFlag::CancellationFlag()
+  : state_(std::make_unique<State>())
+{
+}
+
+CancellationFlag::~CancellationFlag() = default;
+
+void CancellationFlag::Set()
+{
+  state_->is_set.store(true, std::memory_order_relaxed);
+}
+
+bool CancellationFlag::IsSet() const
+{
+  return state_->is_set.load(std::memory_order_relaxed);
+}
+
+std::size_t LineIndex::GetSize() const
+{
+  std::size_t size = 0;
+  for (const auto& chunk : chunks_)
+  {
+    if (chunk->is_filled.load(std::memory_order_acquire))
+    {
+      size += chunk->text.capacity() +
+              chunk->line_starts.capacity() * sizeof(std::uint32_t);
+    }
+  }
+  return size;
+}
+} // namespace VSNvim
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace VSNvim
+{
+struct SearchLiteral;
+
+// A UTF-8 copy of a text snapshot with the start of every line, so Nvim can
+// read a line without asking the text buffer for it. The text is split into
+// chunks at line boundaries that are filled independently, by several
+// threads, and a line can be read as soon as its chunk is filled.
+//
+// Each line is stored without its line break and is followed by a NUL.
+// LineIndex.cpp is compiled without /clr, so it can use <atomic> and SIMD
+// intrinsics.
+class LineIndex
+{
+private:
+  struct Chunk;
+
+  std::vector<std::unique_ptr<Chunk>> chunks_;
+  int line_count_;
+
+public:
+  // Creates an empty index for the lines [1, line_count], split into chunks
+  // that start at the lines, the first of which must be 1.
+  LineIndex(const std::vector<int>& chunk_first_lines, int line_count);
+
+  ~LineIndex();
+
+  LineIndex(const LineIndex&) = delete;
+  LineIndex& operator=(const LineIndex&) = delete;
+
+  int GetChunkCount() const;
+
+  int GetChunkFirstLine(int chunk) const;
+
+  // Returns one past the last line of the chunk.
+  int GetChunkEndLine(int chunk) const;
+
+  // Fills a chunk from its UTF-16 text, including the line breaks, and
+  // makes its lines readable. Returns false, leaving the chunk empty, if
+  // the text does not have the chunk's number of lines. Each chunk may be
+  // filled by a different thread.
+  bool FillChunk(int chunk, const char16_t* text, std::size_t length);
+
+  // Returns the NUL-terminated line, or null if its chunk is not filled.
+  const char* GetLine(int lnum) const;
+
+  // Returns the first line in [first_line, end_line) that contains the
+  // literal, scanning the chunks' text without splitting it into lines, or
+  // the last such line if not forward. Returns 0 if there is none, or -1 if
+  // a chunk in the range is not filled.
+  int FindLine(const SearchLiteral& literal, int first_line, int end_line,
+               bool is_forward) const;
+
+  // Returns the number of bytes the index holds.
+  std::size_t GetSize() const;
+};
+
+// A flag that one thread sets and others poll, e.g. to cancel a build. The
+// atomic is kept in LineIndex.cpp, since /clr units cannot use <atomic>.
+class CancellationFlag
+{
+private:
+  struct State;
+
+  std::unique_ptr<State> state_;
+
+public:
+  CancellationFlag();
+
+  ~CancellationFlag();
+
+  CancellationFlag(const CancellationFlag&) = delete;
+  CancellationFlag& operator=(const CancellationFlag&) = delete;
+
+  void Set();
+
+  bool IsSet() const;
+};
+
+// Converts UTF-16 text to UTF-8. Every line break (CR, LF, CR LF, NEL, LS or
+// PS) is replaced by a NUL and the offset of the next line is appended to
+// the line starts. Returns the number of bytes written to the output, which
+// must hold at least 3 bytes per UTF-16 unit.
+std::size_t TranscodeLines(const char16_t* text, std::size_t length,
+                           char* output,
+                           std::vector<std::uint32_t>& line_starts);
+} // namespace VSNvim
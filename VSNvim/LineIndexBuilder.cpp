@@ -0,0 +1,155 @@
+#include "LineIndexBuilder.h"
+
+#include <vcclr.h>
+#include <vector>
+
+#include "Trace.h"
+
+using namespace System;
+using namespace System::Threading::Tasks;
+using namespace Microsoft::VisualStudio::Text;
+
+namespace VSNvim
+{
+LineIndexBuilder::LineIndexBuilder(ITextSnapshot^ snapshot)
+  : snapshot_(snapshot),
+    is_cancelled_(new CancellationFlag())
+{
+  task_ = Task::Run(gcnew Action(this, &LineIndexBuilder::Build));
+}
+
+LineIndexBuilder::~LineIndexBuilder()
+{
+  // The chunks being filled are finished and the others are skipped.
+  Cancel();
+  try
+  {
+    task_->Wait();
+  }
+  catch (AggregateException^)
+  {
+  }
+  this->!LineIndexBuilder();
+}
+
+LineIndexBuilder::!LineIndexBuilder()
+{
+  delete index_;
+  index_ = nullptr;
+  delete is_cancelled_;
+  is_cancelled_ = nullptr;
+  if (memory_pressure_)
+  {
+    GC::RemoveMemoryPressure(memory_pressure_);
+    memory_pressure_ = 0;
+  }
+}
+
+ITextSnapshot^ LineIndexBuilder::GetSnapshot()
+{
+  return snapshot_;
+}
+
+// The number of threads filling chunks can be limited with the
+// VSNVIM_LOAD_THREADS environment variable to compare load times.
+static int GetMaxThreads()
+{
+  int max_threads;
+  const auto value =
+    Environment::GetEnvironmentVariable("VSNVIM_LOAD_THREADS");
+  return value && Int32::TryParse(value, max_threads) && max_threads > 0
+         ? max_threads
+         : -1;
+}
+
+void LineIndexBuilder::Build()
+{
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+
+  // Chunks start at the line containing every chunk_length_ th unit.
+  std::vector<int> chunk_first_lines;
+  for (auto position = 0; position < snapshot_->Length;
+       position += chunk_length_)
+  {
+    const auto lnum = snapshot_->GetLineNumberFromPosition(position) + 1;
+    if (chunk_first_lines.empty() || chunk_first_lines.back() != lnum)
+    {
+      chunk_first_lines.push_back(lnum);
+    }
+  }
+  if (chunk_first_lines.empty())
+  {
+    chunk_first_lines.push_back(1);
+  }
+  const auto index = new LineIndex(chunk_first_lines, snapshot_->LineCount);
+  index_ = index;
+
+  FillChunk(0);
+  const auto options = gcnew ParallelOptions();
+  options->MaxDegreeOfParallelism = GetMaxThreads();
+  Parallel::For(1, index->GetChunkCount(), options,
+                gcnew Action<int>(this, &LineIndexBuilder::FillChunk));
+
+  // The index is native memory, which the GC would not count when it
+  // decides to collect the builders that were not disposed of.
+  if (index->GetSize())
+  {
+    memory_pressure_ = static_cast<long long>(index->GetSize());
+    GC::AddMemoryPressure(memory_pressure_);
+  }
+
+  // The build's time is recorded by its trace scope.
+  RecordTraceCounter("LineIndex lines", snapshot_->LineCount);
+  RecordTraceCounter("LineIndex chunks", index->GetChunkCount());
+  RecordTraceCounter("LineIndex bytes",
+                     static_cast<std::int64_t>(index->GetSize()));
+}
+
+void LineIndexBuilder::FillChunk(int chunk)
+{
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  if (is_cancelled_->IsSet())
+  {
+    return;
+  }
+  const auto start =
+    snapshot_->GetLineFromLineNumber(index_->GetChunkFirstLine(chunk) - 1)->
+      Start.Position;
+  const auto end_line = index_->GetChunkEndLine(chunk);
+  const auto end = end_line <= snapshot_->LineCount
+    ? snapshot_->GetLineFromLineNumber(end_line - 1)->Start.Position
+    : snapshot_->Length;
+  const auto text = snapshot_->GetText(start, end - start);
+  pin_ptr<const wchar_t> text_ptr = PtrToStringChars(text);
+  index_->FillChunk(chunk, reinterpret_cast<const char16_t*>(text_ptr),
+                    text->Length);
+}
+
+const char* LineIndexBuilder::GetLine(int lnum)
+{
+  const auto index = index_;
+  return index ? index->GetLine(lnum) : nullptr;
+}
+
+int LineIndexBuilder::FindLine(const SearchLiteral& literal, int first_line,
+                               int end_line, bool is_forward)
+{
+  const auto index = index_;
+  return index ? index->FindLine(literal, first_line, end_line, is_forward)
+               : -1;
+}
+
+std::size_t LineIndexBuilder::GetMemorySize()
+{
+  const auto index = index_;
+  return index ? index->GetSize() : 0;
+}
+
+void LineIndexBuilder::Cancel()
+{
+  if (is_cancelled_)
+  {
+    is_cancelled_->Set();
+  }
+}
+}
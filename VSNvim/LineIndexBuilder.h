@@ -0,0 +1,63 @@
+#pragma once
+
+#include "LineIndex.h"
+
+namespace VSNvim
+{
+// Builds the line index of a snapshot on the thread pool. Chunks are filled
+// by a parallel loop, whose work stealing keeps the threads busy when the
+// lines of some chunks are longer, and the chunk of the first lines is
+// filled first so Nvim can use it right away.
+public ref class LineIndexBuilder
+{
+private:
+  // The number of UTF-16 units a chunk holds, give or take a line.
+  literal int chunk_length_ = 1 << 20;
+
+  Microsoft::VisualStudio::Text::ITextSnapshot^ snapshot_;
+  // Set once the chunks are known, then filled as the build progresses.
+  LineIndex* index_;
+  // Set by Cancel on the Nvim thread and read by the threads filling chunks.
+  CancellationFlag* is_cancelled_;
+  System::Threading::Tasks::Task^ task_;
+  // The size of the index reported to the GC once it is built.
+  long long memory_pressure_;
+
+  void Build();
+
+  void FillChunk(int chunk);
+
+public:
+  explicit LineIndexBuilder(
+    Microsoft::VisualStudio::Text::ITextSnapshot^ snapshot);
+
+  // Stops the build and deletes the index. Nvim must no longer use its
+  // lines. Called on the Nvim thread.
+  ~LineIndexBuilder();
+
+  // Deletes the index of a builder that was not disposed of. The running
+  // build keeps the builder alive.
+  !LineIndexBuilder();
+
+  // Documents shorter than this are read from the text buffer directly.
+  literal int min_length_ = 1 << 20;
+
+  Microsoft::VisualStudio::Text::ITextSnapshot^ GetSnapshot();
+
+  // Returns the NUL-terminated UTF-8 line, or null if its chunk is not
+  // built yet.
+  const char* GetLine(int lnum);
+
+  // Returns the first line in [first_line, end_line) that contains the
+  // literal, or the last one if not forward. Returns 0 if there is none, or
+  // -1 if the lines are not indexed yet.
+  int FindLine(const SearchLiteral& literal, int first_line, int end_line,
+               bool is_forward);
+
+  // Returns the number of bytes the chunks filled so far hold.
+  std::size_t GetMemorySize();
+
+  // Stops filling the chunks that have not been started.
+  void Cancel();
+};
+}
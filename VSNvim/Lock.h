@@ -0,0 +1,51 @@
+#pragma once
+
+// Winsock2.h includes Windows.h and must come first for Nvim's headers.
+#include <Winsock2.h>
+
+namespace VSNvim
+{
+// A mutex for native state shared between the Nvim and UI threads. The
+// standard <mutex> and <atomic> headers cannot be used with /clr.
+class Mutex
+{
+private:
+  SRWLOCK lock_ = SRWLOCK_INIT;
+
+public:
+  Mutex() = default;
+  Mutex(const Mutex&) = delete;
+  Mutex& operator=(const Mutex&) = delete;
+
+  void lock()
+  {
+    AcquireSRWLockExclusive(&lock_);
+  }
+
+  void unlock()
+  {
+    ReleaseSRWLockExclusive(&lock_);
+  }
+};
+
+class LockGuard
+{
+private:
+  Mutex& mutex_;
+
+public:
+  explicit LockGuard(Mutex& mutex)
+    : mutex_(mutex)
+  {
+    mutex_.lock();
+  }
+
+  ~LockGuard()
+  {
+    mutex_.unlock();
+  }
+
+  LockGuard(const LockGuard&) = delete;
+  LockGuard& operator=(const LockGuard&) = delete;
+};
+} // namespace VSNvim
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+
+namespace VSNvim
+{
+// What the memory held for a buffer is used for.
+enum class MemoryCategory
+{
+  // Nvim's buf_T.
+  Buffer,
+  // Nvim's undo tree.
+  Undo,
+  // Nvim's syntax state cache.
+  Syntax,
+  // The UTF-8 line index of large documents.
+  LineIndex,
+  Highlights,
+  // The last line Nvim read, pinned while Nvim uses it.
+  PinnedLine,
+  // The handle Nvim keeps to the text view.
+  Handles,
+  Count
+};
+
+// The number of bytes a buffer holds in each category. They are estimates:
+// the allocators' overhead is not counted.
+struct BufferMemory
+{
+  std::size_t bytes[static_cast<int>(MemoryCategory::Count)] = {};
+
+  std::size_t& operator[](MemoryCategory category)
+  {
+    return bytes[static_cast<int>(category)];
+  }
+
+  std::size_t operator[](MemoryCategory category) const
+  {
+    return bytes[static_cast<int>(category)];
+  }
+
+  std::size_t GetTotal() const
+  {
+    std::size_t total = 0;
+    for (const auto size : bytes)
+    {
+      total += size;
+    }
+    return total;
+  }
+};
+}
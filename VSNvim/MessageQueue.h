@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+#include "Lock.h"
+
+namespace VSNvim
+{
+// Lines of Nvim output waiting to be shown. Nvim appends to the queue on
+// its thread and the UI thread takes a batch of lines per frame. When the
+// UI falls behind, new lines are dropped and counted instead of letting the
+// queue grow without bound.
+class MessageQueue
+{
+private:
+  static constexpr std::size_t max_queued_bytes_ = 16 * 1024 * 1024;
+
+  Mutex mutex_;
+  // Complete lines, each terminated by a newline. The lines before the
+  // offset have already been taken.
+  std::string text_;
+  std::size_t offset_ = 0;
+  std::size_t dropped_lines_ = 0;
+
+public:
+  // Appends the lines of a chunk of output. Messages start with a newline
+  // rather than end with one, so a leading newline is skipped and the last
+  // line is terminated. Returns whether the queue was empty, in which case
+  // the consumer needs to be woken up.
+  bool Append(const char* data, std::size_t size)
+  {
+    if (size && *data == '\n')
+    {
+      data++;
+      size--;
+    }
+    if (!size)
+    {
+      return false;
+    }
+
+    LockGuard lock(mutex_);
+    const auto was_empty = offset_ == text_.size() && !dropped_lines_;
+    const auto queued = text_.size() - offset_;
+    auto accepted = size;
+    if (queued + size >= max_queued_bytes_)
+    {
+      // Keep the whole lines that fit and drop the rest.
+      const auto available =
+        queued < max_queued_bytes_ ? max_queued_bytes_ - queued : 0;
+      const auto end = std::string_view(data, (std::min)(available, size))
+                         .rfind('\n');
+      accepted = end == std::string_view::npos ? 0 : end;
+      dropped_lines_ += std::count(data + accepted, data + size, '\n') +
+                        (accepted ? 0 : 1);
+      if (!accepted)
+      {
+        return was_empty;
+      }
+    }
+
+    if (offset_ && offset_ >= text_.size() / 2)
+    {
+      text_.erase(0, offset_);
+      offset_ = 0;
+    }
+    text_.append(data, accepted);
+    text_.push_back('\n');
+    return was_empty;
+  }
+
+  // Moves up to max_lines lines to the output and returns the number of
+  // lines dropped since the last call.
+  std::size_t Take(std::string& output, std::size_t max_lines)
+  {
+    LockGuard lock(mutex_);
+    auto end = offset_;
+    for (std::size_t i = 0; i < max_lines && end < text_.size(); i++)
+    {
+      end = text_.find('\n', end) + 1;
+    }
+    output.assign(text_, offset_, end - offset_);
+    offset_ = end;
+    if (offset_ == text_.size())
+    {
+      text_.clear();
+      offset_ = 0;
+    }
+
+    const auto dropped_lines = dropped_lines_;
+    dropped_lines_ = 0;
+    return dropped_lines;
+  }
+
+  bool IsEmpty()
+  {
+    LockGuard lock(mutex_);
+    return offset_ == text_.size() && !dropped_lines_;
+  }
+};
+} // namespace VSNvim
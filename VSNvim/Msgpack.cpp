@@ -0,0 +1,404 @@
+#include "Msgpack.h"
+
+#include <cstring>
+
+namespace VSNvim
+{
+std::int64_t MsgpackValue::GetInteger() const
+{
+  if (type != MsgpackType::Extension)
+  {
+    return integer;
+  }
+  MsgpackReader reader;
+  reader.Append(bytes.data(), bytes.size());
+  MsgpackValue value;
+  return reader.Read(value) == MsgpackResult::Value ? value.integer : 0;
+}
+
+const MsgpackValue* MsgpackValue::Find(std::string_view key) const
+{
+  if (type != MsgpackType::Map)
+  {
+    return nullptr;
+  }
+  for (std::size_t i = 0; i + 1 < items.size(); i += 2)
+  {
+    if (items[i].type == MsgpackType::String && items[i].bytes == key)
+    {
+      return &items[i + 1];
+    }
+  }
+  return nullptr;
+}
+
+static void AppendBigEndian(std::string& buffer, std::uint64_t value,
+                            int size)
+{
+  for (auto shift = (size - 1) * 8; shift >= 0; shift -= 8)
+  {
+    buffer += static_cast<char>((value >> shift) & 0xff);
+  }
+}
+
+void MsgpackWriter::WriteHeader(std::uint8_t fix, std::uint8_t fix_limit,
+                                std::uint8_t tag16, std::uint8_t tag32,
+                                std::uint32_t size)
+{
+  if (size < fix_limit)
+  {
+    buffer_ += static_cast<char>(fix | size);
+  }
+  else if (size <= 0xffff)
+  {
+    buffer_ += static_cast<char>(tag16);
+    AppendBigEndian(buffer_, size, 2);
+  }
+  else
+  {
+    buffer_ += static_cast<char>(tag32);
+    AppendBigEndian(buffer_, size, 4);
+  }
+}
+
+void MsgpackWriter::WriteNil()
+{
+  buffer_ += '\xc0';
+}
+
+void MsgpackWriter::WriteBoolean(bool value)
+{
+  buffer_ += value ? '\xc3' : '\xc2';
+}
+
+void MsgpackWriter::WriteInteger(std::int64_t value)
+{
+  if (value >= 0 && value < 0x80)
+  {
+    buffer_ += static_cast<char>(value);
+  }
+  else if (value < 0 && value >= -32)
+  {
+    buffer_ += static_cast<char>(value);
+  }
+  else if (value >= INT32_MIN && value <= INT32_MAX)
+  {
+    buffer_ += '\xd2';
+    AppendBigEndian(buffer_, static_cast<std::uint32_t>(value), 4);
+  }
+  else
+  {
+    buffer_ += '\xd3';
+    AppendBigEndian(buffer_, static_cast<std::uint64_t>(value), 8);
+  }
+}
+
+void MsgpackWriter::WriteString(std::string_view value)
+{
+  const auto size = static_cast<std::uint32_t>(value.size());
+  if (size < 32)
+  {
+    buffer_ += static_cast<char>(0xa0 | size);
+  }
+  else if (size <= 0xff)
+  {
+    buffer_ += '\xd9';
+    AppendBigEndian(buffer_, size, 1);
+  }
+  else
+  {
+    WriteHeader(0, 0, 0xda, 0xdb, size);
+  }
+  buffer_ += value;
+}
+
+void MsgpackWriter::WriteArrayHeader(std::uint32_t size)
+{
+  WriteHeader(0x90, 16, 0xdc, 0xdd, size);
+}
+
+void MsgpackWriter::WriteMapHeader(std::uint32_t size)
+{
+  WriteHeader(0x80, 16, 0xde, 0xdf, size);
+}
+
+void MsgpackWriter::WriteRaw(std::string_view bytes)
+{
+  buffer_ += bytes;
+}
+
+void MsgpackReader::Append(const char* data, std::size_t size)
+{
+  // Decoded bytes are dropped once they are most of the buffer.
+  if (offset_ > 4096 && offset_ * 2 > buffer_.size())
+  {
+    buffer_.erase(0, offset_);
+    offset_ = 0;
+  }
+  buffer_.append(data, size);
+}
+
+namespace
+{
+class Decoder
+{
+private:
+  const unsigned char* begin_;
+  const unsigned char* position_;
+  const unsigned char* end_;
+  std::size_t needed_size_ = 0;
+
+  bool Has(std::size_t size)
+  {
+    if (static_cast<std::size_t>(end_ - position_) >= size)
+    {
+      return true;
+    }
+    needed_size_ = (position_ - begin_) + size;
+    return false;
+  }
+
+  std::uint64_t ReadBigEndian(int size)
+  {
+    std::uint64_t value = 0;
+    for (auto i = 0; i < size; i++)
+    {
+      value = (value << 8) | *position_++;
+    }
+    return value;
+  }
+
+  MsgpackResult ReadBytes(std::size_t size, std::string& bytes)
+  {
+    if (!Has(size))
+    {
+      return MsgpackResult::Incomplete;
+    }
+    bytes.assign(reinterpret_cast<const char*>(position_), size);
+    position_ += size;
+    return MsgpackResult::Value;
+  }
+
+  MsgpackResult ReadItems(std::size_t count, MsgpackValue& value, int depth)
+  {
+    // Each item takes at least a byte, which bounds the allocation of a
+    // malformed count.
+    if (!Has(count))
+    {
+      return MsgpackResult::Incomplete;
+    }
+    value.items.resize(count);
+    for (auto& item : value.items)
+    {
+      const auto result = Read(item, depth + 1);
+      if (result != MsgpackResult::Value)
+      {
+        return result;
+      }
+    }
+    return MsgpackResult::Value;
+  }
+
+  // Reads the size that follows a tag, of 1, 2 or 4 bytes.
+  bool ReadSize(int size_bytes, std::size_t& size)
+  {
+    if (!Has(size_bytes))
+    {
+      return false;
+    }
+    size = static_cast<std::size_t>(ReadBigEndian(size_bytes));
+    return true;
+  }
+
+public:
+  Decoder(const char* begin, const char* end)
+    : begin_(reinterpret_cast<const unsigned char*>(begin)),
+      position_(begin_),
+      end_(reinterpret_cast<const unsigned char*>(end))
+  {
+  }
+
+  const char* GetPosition() const
+  {
+    return reinterpret_cast<const char*>(position_);
+  }
+
+  std::size_t GetNeededSize() const
+  {
+    return needed_size_;
+  }
+
+  MsgpackResult Read(MsgpackValue& value, int depth)
+  {
+    if (depth > 64)
+    {
+      return MsgpackResult::Invalid;
+    }
+    if (!Has(1))
+    {
+      return MsgpackResult::Incomplete;
+    }
+    value = MsgpackValue();
+    const auto tag = *position_++;
+    std::size_t size;
+    if (tag <= 0x7f || tag >= 0xe0)
+    {
+      value.type = MsgpackType::Integer;
+      value.integer = static_cast<std::int8_t>(tag);
+      return MsgpackResult::Value;
+    }
+    if ((tag & 0xf0) == 0x80 || (tag & 0xf0) == 0x90)
+    {
+      const auto is_map = (tag & 0xf0) == 0x80;
+      value.type = is_map ? MsgpackType::Map : MsgpackType::Array;
+      return ReadItems((tag & 0x0f) * (is_map ? 2 : 1), value, depth);
+    }
+    if ((tag & 0xe0) == 0xa0)
+    {
+      value.type = MsgpackType::String;
+      return ReadBytes(tag & 0x1f, value.bytes);
+    }
+
+    switch (tag)
+    {
+    case 0xc0:
+      return MsgpackResult::Value;
+    case 0xc2:
+    case 0xc3:
+      value.type = MsgpackType::Boolean;
+      value.boolean = tag == 0xc3;
+      return MsgpackResult::Value;
+    case 0xc4:
+    case 0xc5:
+    case 0xc6:
+      value.type = MsgpackType::Binary;
+      if (!ReadSize(1 << (tag - 0xc4), size))
+      {
+        return MsgpackResult::Incomplete;
+      }
+      return ReadBytes(size, value.bytes);
+    case 0xd9:
+    case 0xda:
+    case 0xdb:
+      value.type = MsgpackType::String;
+      if (!ReadSize(1 << (tag - 0xd9), size))
+      {
+        return MsgpackResult::Incomplete;
+      }
+      return ReadBytes(size, value.bytes);
+    case 0xca:
+    case 0xcb:
+    {
+      const auto size_bytes = tag == 0xca ? 4 : 8;
+      if (!Has(size_bytes))
+      {
+        return MsgpackResult::Incomplete;
+      }
+      const auto bits = ReadBigEndian(size_bytes);
+      value.type = MsgpackType::Float;
+      if (tag == 0xca)
+      {
+        const auto bits32 = static_cast<std::uint32_t>(bits);
+        float real;
+        std::memcpy(&real, &bits32, sizeof(real));
+        value.real = real;
+      }
+      else
+      {
+        std::memcpy(&value.real, &bits, sizeof(value.real));
+      }
+      return MsgpackResult::Value;
+    }
+    case 0xcc:
+    case 0xcd:
+    case 0xce:
+    case 0xcf:
+    case 0xd0:
+    case 0xd1:
+    case 0xd2:
+    case 0xd3:
+    {
+      const auto is_signed = tag >= 0xd0;
+      const auto size_bytes = 1 << ((tag - (is_signed ? 0xd0 : 0xcc)));
+      if (!Has(size_bytes))
+      {
+        return MsgpackResult::Incomplete;
+      }
+      const auto bits = ReadBigEndian(size_bytes);
+      value.type = MsgpackType::Integer;
+      if (is_signed && size_bytes < 8)
+      {
+        // Sign-extends from the size that was read.
+        const auto shift = 64 - size_bytes * 8;
+        value.integer =
+          static_cast<std::int64_t>(bits << shift) >> shift;
+      }
+      else
+      {
+        value.integer = static_cast<std::int64_t>(bits);
+      }
+      return MsgpackResult::Value;
+    }
+    case 0xd4:
+    case 0xd5:
+    case 0xd6:
+    case 0xd7:
+    case 0xd8:
+    case 0xc7:
+    case 0xc8:
+    case 0xc9:
+      value.type = MsgpackType::Extension;
+      if (tag >= 0xd4)
+      {
+        size = std::size_t(1) << (tag - 0xd4);
+      }
+      else if (!ReadSize(1 << (tag - 0xc7), size))
+      {
+        return MsgpackResult::Incomplete;
+      }
+      if (!Has(1))
+      {
+        return MsgpackResult::Incomplete;
+      }
+      value.extension_type = static_cast<std::int8_t>(*position_++);
+      return ReadBytes(size, value.bytes);
+    case 0xdc:
+    case 0xdd:
+    case 0xde:
+    case 0xdf:
+    {
+      const auto is_map = tag >= 0xde;
+      value.type = is_map ? MsgpackType::Map : MsgpackType::Array;
+      if (!ReadSize((tag & 1) ? 4 : 2, size))
+      {
+        return MsgpackResult::Incomplete;
+      }
+      return ReadItems(size * (is_map ? 2 : 1), value, depth);
+    }
+    default:
+      return MsgpackResult::Invalid;
+    }
+  }
+};
+}
+
+MsgpackResult MsgpackReader::Read(MsgpackValue& value)
+{
+  if (buffer_.size() - offset_ < needed_size_)
+  {
+    return MsgpackResult::Incomplete;
+  }
+  Decoder decoder(buffer_.data() + offset_, buffer_.data() + buffer_.size());
+  const auto result = decoder.Read(value, 0);
+  needed_size_ = 0;
+  if (result == MsgpackResult::Value)
+  {
+    offset_ = decoder.GetPosition() - buffer_.data();
+  }
+  else if (result == MsgpackResult::Incomplete)
+  {
+    needed_size_ = decoder.GetNeededSize();
+  }
+  return result;
+}
+}
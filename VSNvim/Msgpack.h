@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace VSNvim
+{
+// The part of MessagePack that Nvim's RPC uses. Msgpack.cpp is plain C++ so
+// the transport can be built and measured outside Visual Studio.
+enum class MsgpackType
+{
+  Nil,
+  Boolean,
+  Integer,
+  Float,
+  String,
+  Binary,
+  Array,
+  Map,
+  Extension
+};
+
+struct MsgpackValue
+{
+  MsgpackType type = MsgpackType::Nil;
+  bool boolean = false;
+  std::int64_t integer = 0;
+  double real = 0;
+  // The bytes of a string, binary or extension value.
+  std::string bytes;
+  std::int8_t extension_type = 0;
+  // The items of an array, or the keys and values of a map in turn.
+  std::vector<MsgpackValue> items;
+
+  bool IsNil() const
+  {
+    return type == MsgpackType::Nil;
+  }
+
+  // Returns the integer, or the integer in the extension, which is how Nvim
+  // sends buffer, window and tabpage handles.
+  std::int64_t GetInteger() const;
+
+  // Returns the value of the key in a map, or nullptr.
+  const MsgpackValue* Find(std::string_view key) const;
+};
+
+class MsgpackWriter
+{
+private:
+  std::string buffer_;
+
+  void WriteHeader(std::uint8_t fix, std::uint8_t fix_limit,
+                   std::uint8_t tag16, std::uint8_t tag32, std::uint32_t size);
+
+public:
+  void WriteNil();
+
+  void WriteBoolean(bool value);
+
+  void WriteInteger(std::int64_t value);
+
+  void WriteString(std::string_view value);
+
+  void WriteArrayHeader(std::uint32_t size);
+
+  void WriteMapHeader(std::uint32_t size);
+
+  // Appends values written by another writer.
+  void WriteRaw(std::string_view bytes);
+
+  const std::string& GetBuffer() const
+  {
+    return buffer_;
+  }
+
+  void Clear()
+  {
+    buffer_.clear();
+  }
+};
+
+enum class MsgpackResult
+{
+  Value,
+  // The bytes so far end inside a value.
+  Incomplete,
+  Invalid
+};
+
+// Decodes the values of a stream that arrives in pieces.
+class MsgpackReader
+{
+private:
+  std::string buffer_;
+  std::size_t offset_ = 0;
+  // The number of bytes after the offset that the last incomplete value
+  // needs at least, so a large value is not decoded again for every piece.
+  std::size_t needed_size_ = 0;
+
+public:
+  void Append(const char* data, std::size_t size);
+
+  // Decodes the next value. Nothing is consumed unless a whole value was
+  // decoded.
+  MsgpackResult Read(MsgpackValue& value);
+};
+}
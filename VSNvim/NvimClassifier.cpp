@@ -0,0 +1,84 @@
+#include "NvimClassifier.h"
+
+#include "BufferHighlights.h"
+#include "HighlightTable.h"
+#include "NvimClassifierProvider.h"
+#include "VSNvimTextView.h"
+
+using namespace System::Collections::Generic;
+using namespace Microsoft::VisualStudio::Text;
+using namespace Microsoft::VisualStudio::Text::Classification;
+
+namespace VSNvim
+{
+NvimClassifier::NvimClassifier(ITextBuffer^ text_buffer)
+  : text_buffer_(text_buffer)
+{
+}
+
+IList<ClassificationSpan^>^ NvimClassifier::GetClassificationSpans(
+  SnapshotSpan span)
+{
+  const auto classification_spans = gcnew List<ClassificationSpan^>();
+  VSNvimTextView^ text_view;
+  if (!text_buffer_->Properties->TryGetProperty<VSNvimTextView^>(
+        VSNvimTextView::typeid, text_view))
+  {
+    return classification_spans;
+  }
+
+  const auto snapshot = span.Snapshot;
+  const auto first_line = snapshot->GetLineNumberFromPosition(span.Start);
+  const auto last_line = snapshot->GetLineNumberFromPosition(span.End);
+
+  // Collect the spans first so the lock is not held while calling into
+  // Visual Studio.
+  std::vector<std::pair<int, HighlightSpan>> highlights;
+  text_view->GetHighlights()->ForEachSpan(first_line + 1, last_line + 1,
+    [&highlights](int lnum, const HighlightSpan& highlight)
+    {
+      highlights.emplace_back(lnum, highlight);
+    });
+
+  for (const auto& [lnum, highlight] : highlights)
+  {
+    if (lnum > snapshot->LineCount)
+    {
+      break;
+    }
+    const auto line = snapshot->GetLineFromLineNumber(lnum - 1);
+    const auto start = (std::min)(highlight.start_col, line->Length);
+    const auto end = (std::min)(highlight.end_col, line->Length);
+    const auto index = highlight_table_.GetIndex(highlight.attribute);
+    if (start == end || !index)
+    {
+      continue;
+    }
+    const auto highlight_span =
+      SnapshotSpan(line->Start + start, end - start);
+    if (!highlight_span.IntersectsWith(span))
+    {
+      continue;
+    }
+    classification_spans->Add(gcnew ClassificationSpan(highlight_span,
+      NvimClassifierProvider::classifier_provider_->
+        GetClassificationType(index)));
+  }
+  return classification_spans;
+}
+
+void NvimClassifier::RaiseClassificationChanged(int first_line, int last_line)
+{
+  const auto snapshot = text_buffer_->CurrentSnapshot;
+  if (!snapshot->LineCount)
+  {
+    return;
+  }
+  const auto first = snapshot->GetLineFromLineNumber(
+    (std::min)(first_line, snapshot->LineCount) - 1);
+  const auto last = snapshot->GetLineFromLineNumber(
+    (std::min)(last_line, snapshot->LineCount) - 1);
+  ClassificationChanged(this, gcnew ClassificationChangedEventArgs(
+    SnapshotSpan(first->Start, last->EndIncludingLineBreak)));
+}
+}
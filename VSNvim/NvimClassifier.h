@@ -0,0 +1,26 @@
+#pragma once
+
+namespace VSNvim
+{
+// Classifies text with the highlights Nvim computed for the buffer.
+public ref class NvimClassifier
+  : Microsoft::VisualStudio::Text::Classification::IClassifier
+{
+private:
+  Microsoft::VisualStudio::Text::ITextBuffer^ text_buffer_;
+
+public:
+  NvimClassifier(Microsoft::VisualStudio::Text::ITextBuffer^ text_buffer);
+
+  virtual event System::EventHandler<
+    Microsoft::VisualStudio::Text::Classification::
+      ClassificationChangedEventArgs^>^ ClassificationChanged;
+
+  virtual System::Collections::Generic::IList<
+    Microsoft::VisualStudio::Text::Classification::ClassificationSpan^>^
+    GetClassificationSpans(Microsoft::VisualStudio::Text::SnapshotSpan span);
+
+  // Reclassifies the lines [first_line, last_line], which are 1-based.
+  void RaiseClassificationChanged(int first_line, int last_line);
+};
+}
@@ -0,0 +1,112 @@
+#include "NvimClassifierProvider.h"
+
+#include <utility>
+
+#include "HighlightTable.h"
+#include "NvimClassifier.h"
+
+using namespace System::Windows;
+using namespace System::Windows::Media;
+using namespace Microsoft::VisualStudio::Text;
+using namespace Microsoft::VisualStudio::Text::Classification;
+using namespace Microsoft::VisualStudio::Text::Formatting;
+
+namespace VSNvim
+{
+NvimClassifierProvider::NvimClassifierProvider()
+  : classification_types_(
+      gcnew System::Collections::Generic::List<IClassificationType^>())
+{
+  classifier_provider_ = this;
+}
+
+IClassifier^ NvimClassifierProvider::GetClassifier(ITextBuffer^ text_buffer)
+{
+  NvimClassifier^ classifier;
+  if (!text_buffer->Properties->TryGetProperty<NvimClassifier^>(
+        NvimClassifier::typeid, classifier))
+  {
+    classifier = gcnew NvimClassifier(text_buffer);
+    text_buffer->Properties->AddProperty(NvimClassifier::typeid, classifier);
+  }
+  return classifier;
+}
+
+static Color GetColor(std::int32_t rgb)
+{
+  return Color::FromRgb(static_cast<System::Byte>(rgb >> 16),
+                        static_cast<System::Byte>(rgb >> 8),
+                        static_cast<System::Byte>(rgb));
+}
+
+static TextFormattingRunProperties^ CreateTextProperties(
+  const HighlightAttributes& attributes)
+{
+  auto foreground = attributes.foreground;
+  auto background = attributes.background;
+  if (attributes.flags & Reverse)
+  {
+    std::swap(foreground, background);
+  }
+
+  auto properties =
+    TextFormattingRunProperties::CreateTextFormattingRunProperties();
+  if (foreground != -1)
+  {
+    properties = properties->SetForeground(GetColor(foreground));
+  }
+  if (background != -1)
+  {
+    properties = properties->SetBackground(GetColor(background));
+  }
+  if (attributes.flags & Bold)
+  {
+    properties = properties->SetBold(true);
+  }
+  if (attributes.flags & Italic)
+  {
+    properties = properties->SetItalic(true);
+  }
+  if (attributes.flags & (Underline | Undercurl | Strikethrough))
+  {
+    // A highlight can be both underlined and struck through.
+    const auto decorations = gcnew TextDecorationCollection();
+    if (attributes.flags & (Underline | Undercurl))
+    {
+      decorations->Add(TextDecorations::Underline);
+    }
+    if (attributes.flags & Strikethrough)
+    {
+      decorations->Add(TextDecorations::Strikethrough);
+    }
+    decorations->Freeze();
+    properties = properties->SetTextDecorations(decorations);
+  }
+  return properties;
+}
+
+IClassificationType^ NvimClassifierProvider::GetClassificationType(int index)
+{
+  while (classification_types_->Count <= index)
+  {
+    classification_types_->Add(nullptr);
+  }
+  if (classification_types_[index])
+  {
+    return classification_types_[index];
+  }
+
+  const auto name = System::String::Format("VSNvim.Highlight.{0}", index);
+  auto classification_type = type_registry_->GetClassificationType(name);
+  if (!classification_type)
+  {
+    classification_type = type_registry_->CreateClassificationType(
+      name, gcnew array<IClassificationType^>(0));
+  }
+  format_map_service_->GetClassificationFormatMap("text")->SetTextProperties(
+    classification_type,
+    CreateTextProperties(highlight_table_.GetAttributes(index)));
+  classification_types_[index] = classification_type;
+  return classification_type;
+}
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+namespace VSNvim
+{
+[System::ComponentModel::Composition::Export(
+  Microsoft::VisualStudio::Text::Classification::
+    IClassifierProvider::typeid)]
+[Microsoft::VisualStudio::Utilities::ContentType("any")]
+public ref class NvimClassifierProvider
+  : Microsoft::VisualStudio::Text::Classification::IClassifierProvider
+{
+private:
+  // The classification type of every interned highlight, created when a
+  // highlight is first displayed.
+  System::Collections::Generic::List<
+    Microsoft::VisualStudio::Text::Classification::IClassificationType^>^
+    classification_types_;
+
+public:
+  [System::ComponentModel::Composition::Import]
+  Microsoft::VisualStudio::Text::Classification::
+    IClassificationTypeRegistryService^ type_registry_;
+
+  [System::ComponentModel::Composition::Import]
+  Microsoft::VisualStudio::Text::Classification::
+    IClassificationFormatMapService^ format_map_service_;
+
+  static NvimClassifierProvider^ classifier_provider_;
+
+  NvimClassifierProvider();
+
+  virtual Microsoft::VisualStudio::Text::Classification::IClassifier^
+    GetClassifier(Microsoft::VisualStudio::Text::ITextBuffer^ text_buffer);
+
+  Microsoft::VisualStudio::Text::Classification::IClassificationType^
+    GetClassificationType(int index);
+};
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "nvim.h"
+
+namespace VSNvim
+{
+public enum class NvimEditKind
+{
+  AppendLine,
+  DeleteLine,
+  DeleteChar,
+  ReplaceLine,
+  ReplaceChar
+};
+
+// A buffer mutation made by Nvim that has not yet been applied to the
+// Visual Studio text buffer.
+public value struct NvimEdit
+{
+  NvimEditKind kind;
+  nvim::linenr_T lnum;
+  nvim::colnr_T col;
+  // The number of consecutive lines covered by an AppendLine or DeleteLine
+  // edit after adjacent edits have been merged.
+  int count;
+  System::String^ text;
+
+  NvimEdit(NvimEditKind kind, nvim::linenr_T lnum, nvim::colnr_T col,
+           System::String^ text)
+    : kind(kind), lnum(lnum), col(col), count(1), text(text)
+  {
+  }
+};
+} // namespace VSNvim
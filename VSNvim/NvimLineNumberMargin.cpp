@@ -0,0 +1,288 @@
+#include "NvimLineNumberMargin.h"
+
+#include "TextViewCreationListener.h"
+#include "Trace.h"
+#include "VSNvimPackage.h"
+
+using namespace System;
+using namespace System::Collections::Generic;
+using namespace System::Windows;
+using namespace System::Windows::Media;
+using namespace Microsoft::VisualStudio::Text;
+using namespace Microsoft::VisualStudio::Text::Classification;
+using namespace Microsoft::VisualStudio::Text::Editor;
+using namespace Microsoft::VisualStudio::Text::Formatting;
+
+namespace VSNvim
+{
+NvimLineNumberMargin::NvimLineNumberMargin(IWpfTextView^ text_view)
+  : text_view_(text_view),
+    texts_(gcnew Dictionary<String^, FormattedText^>()),
+    signs_(gcnew Dictionary<int, String^>())
+{
+  rows_ = gcnew VisualCollection(this);
+  ClipToBounds = true;
+  IsHitTestVisible = false;
+  Visibility = System::Windows::Visibility::Collapsed;
+  text_view_->LayoutChanged +=
+    gcnew EventHandler<TextViewLayoutChangedEventArgs^>(
+      this, &NvimLineNumberMargin::OnLayoutChanged);
+  VSNvimPackage::Enabled +=
+    gcnew EventHandler(this, &NvimLineNumberMargin::OnEnabledChanged);
+  VSNvimPackage::Disabled +=
+    gcnew EventHandler(this, &NvimLineNumberMargin::OnEnabledChanged);
+  text_view_->Properties[NvimLineNumberMargin::typeid] = this;
+}
+
+NvimLineNumberMargin^ NvimLineNumberMargin::GetMargin(ITextView^ text_view)
+{
+  NvimLineNumberMargin^ margin;
+  text_view->Properties->TryGetProperty<NvimLineNumberMargin^>(
+    NvimLineNumberMargin::typeid, margin);
+  return margin;
+}
+
+int NvimLineNumberMargin::VisualChildrenCount::get()
+{
+  return rows_->Count;
+}
+
+Visual^ NvimLineNumberMargin::GetVisualChild(int index)
+{
+  return rows_[index];
+}
+
+// Picks up the editor's font and the colors of Visual Studio's line
+// numbers. Returns whether they changed, which invalidates every row.
+bool NvimLineNumberMargin::UpdateFormat()
+{
+  const auto line_source = text_view_->FormattedLineSource;
+  if (!line_source)
+  {
+    return false;
+  }
+  const auto properties = line_source->DefaultTextProperties;
+  auto number_brush = properties->ForegroundBrush;
+  const auto format_map = TextViewCreationListener::
+    text_view_creation_listener_->format_map_service_->
+    GetEditorFormatMap(text_view_)->GetProperties("Line Number");
+  if (format_map->Contains(EditorFormatDefinition::ForegroundBrushId))
+  {
+    number_brush = safe_cast<Brush^>(
+      format_map[EditorFormatDefinition::ForegroundBrushId]);
+  }
+  if (typeface_ == properties->Typeface &&
+      font_size_ == properties->FontRenderingEmSize &&
+      number_brush_ == number_brush &&
+      sign_brush_ == properties->ForegroundBrush)
+  {
+    return false;
+  }
+
+  typeface_ = properties->Typeface;
+  font_size_ = properties->FontRenderingEmSize;
+  number_brush_ = number_brush;
+  sign_brush_ = properties->ForegroundBrush;
+  texts_->Clear();
+  character_width_ =
+    GetText("0", number_brush_)->WidthIncludingTrailingWhitespace;
+  return true;
+}
+
+FormattedText^ NvimLineNumberMargin::GetText(String^ text, Brush^ brush)
+{
+  FormattedText^ formatted_text;
+  if (texts_->TryGetValue(text, formatted_text))
+  {
+    return formatted_text;
+  }
+  if (texts_->Count >= max_cached_texts_)
+  {
+    texts_->Clear();
+  }
+  formatted_text = gcnew FormattedText(text,
+    Globalization::CultureInfo::InvariantCulture, FlowDirection::LeftToRight,
+    typeface_, font_size_, brush);
+  texts_->Add(text, formatted_text);
+  return formatted_text;
+}
+
+// Returns the number Nvim shows for the line, or null.
+String^ NvimLineNumberMargin::GetNumber(int lnum)
+{
+  if (relative_number_ && lnum != cursor_lnum_)
+  {
+    return Math::Abs(lnum - cursor_lnum_).ToString();
+  }
+  if (number_)
+  {
+    return lnum.ToString();
+  }
+  return relative_number_ ? "0" : nullptr;
+}
+
+void NvimLineNumberMargin::UpdateRows()
+{
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  const auto is_shown = !is_disposed_ && VSNvimPackage::IsEnabled &&
+                        (number_ || relative_number_ || show_signs_);
+  Visibility = is_shown ? System::Windows::Visibility::Visible
+                        : System::Windows::Visibility::Collapsed;
+  if (!is_shown || text_view_->IsClosed || text_view_->InLayout)
+  {
+    return;
+  }
+  const auto is_format_changed = UpdateFormat();
+  if (!typeface_)
+  {
+    return;
+  }
+
+  const auto sign_width = show_signs_ ? character_width_ * 2 : 0;
+  const auto number_width = number_ || relative_number_
+    ? character_width_ * number_width_ + padding_
+    : 0;
+  const auto width = sign_width + number_width + padding_;
+  if (Width != width)
+  {
+    Width = width;
+  }
+
+  // Only the first row of a wrapped line shows its number.
+  auto row_index = 0;
+  for each (auto line in text_view_->TextViewLines)
+  {
+    if (!line->IsFirstTextViewLineForSnapshotLine ||
+        line->VisibilityState == VisibilityState::Unattached)
+    {
+      continue;
+    }
+    const auto lnum = line->Start.GetContainingLine()->LineNumber + 1;
+    const auto number = GetNumber(lnum);
+    String^ sign = nullptr;
+    if (show_signs_)
+    {
+      signs_->TryGetValue(lnum, sign);
+    }
+    const auto top = line->TextTop - text_view_->ViewportTop;
+
+    MarginRow^ row;
+    if (row_index < rows_->Count)
+    {
+      row = safe_cast<MarginRow^>(rows_[row_index]);
+    }
+    else
+    {
+      row = gcnew MarginRow();
+      rows_->Add(row);
+    }
+    row_index++;
+    if (!is_format_changed && row->top == top && row->width == width &&
+        String::Equals(row->number, number) &&
+        String::Equals(row->sign, sign))
+    {
+      continue;
+    }
+    row->number = number;
+    row->sign = sign;
+    row->top = top;
+    row->width = width;
+
+    const auto context = row->RenderOpen();
+    if (sign)
+    {
+      context->DrawText(GetText(sign, sign_brush_), Point(0, top));
+    }
+    if (number)
+    {
+      // Like Nvim, the number of the cursor line is left aligned when both
+      // 'number' and 'relativenumber' are set.
+      const auto text = GetText(number, number_brush_);
+      const auto is_left_aligned =
+        number_ && relative_number_ && lnum == cursor_lnum_;
+      const auto x = is_left_aligned
+        ? sign_width
+        : sign_width + number_width - padding_ -
+          text->WidthIncludingTrailingWhitespace;
+      context->DrawText(text, Point(x, top));
+    }
+    context->Close();
+  }
+  if (row_index < rows_->Count)
+  {
+    rows_->RemoveRange(row_index, rows_->Count - row_index);
+  }
+}
+
+void NvimLineNumberMargin::SetState(
+  bool number, bool relative_number, bool show_signs, int cursor_lnum,
+  int number_width, array<int>^ sign_lines, array<String^>^ sign_texts)
+{
+  number_ = number;
+  relative_number_ = relative_number;
+  show_signs_ = show_signs;
+  cursor_lnum_ = cursor_lnum;
+  number_width_ = number_width;
+  signs_->Clear();
+  for (auto i = 0; i < sign_lines->Length; i++)
+  {
+    signs_[sign_lines[i]] = sign_texts[i];
+  }
+  UpdateRows();
+}
+
+void NvimLineNumberMargin::OnLayoutChanged(
+  Object^ sender, TextViewLayoutChangedEventArgs^ e)
+{
+  UpdateRows();
+}
+
+void NvimLineNumberMargin::OnEnabledChanged(Object^ sender, EventArgs^ e)
+{
+  UpdateRows();
+}
+
+FrameworkElement^ NvimLineNumberMargin::VisualElement::get()
+{
+  return this;
+}
+
+double NvimLineNumberMargin::MarginSize::get()
+{
+  return Visibility == System::Windows::Visibility::Visible ? ActualWidth : 0;
+}
+
+bool NvimLineNumberMargin::Enabled::get()
+{
+  return !is_disposed_;
+}
+
+ITextViewMargin^ NvimLineNumberMargin::GetTextViewMargin(String^ margin_name)
+{
+  return String::Equals(margin_name, margin_name_) ? this : nullptr;
+}
+
+NvimLineNumberMargin::~NvimLineNumberMargin()
+{
+  if (is_disposed_)
+  {
+    return;
+  }
+  is_disposed_ = true;
+  text_view_->LayoutChanged -=
+    gcnew EventHandler<TextViewLayoutChangedEventArgs^>(
+      this, &NvimLineNumberMargin::OnLayoutChanged);
+  VSNvimPackage::Enabled -=
+    gcnew EventHandler(this, &NvimLineNumberMargin::OnEnabledChanged);
+  VSNvimPackage::Disabled -=
+    gcnew EventHandler(this, &NvimLineNumberMargin::OnEnabledChanged);
+  text_view_->Properties->RemoveProperty(NvimLineNumberMargin::typeid);
+  rows_->Clear();
+}
+
+IWpfTextViewMargin^ NvimLineNumberMarginProvider::CreateMargin(
+  IWpfTextViewHost^ host, IWpfTextViewMargin^ container)
+{
+  return gcnew NvimLineNumberMargin(host->TextView);
+}
+}
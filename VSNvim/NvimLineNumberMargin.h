@@ -0,0 +1,158 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace VSNvim
+{
+// The Nvim options and signs that the margin displays. Built on the Nvim
+// thread, which only posts it to the margin when it changed.
+struct MarginState
+{
+  bool number = false;
+  bool relative_number = false;
+  bool show_signs = false;
+  // Only set with 'relativenumber', since the numbers of the other lines
+  // do not depend on it.
+  int cursor_lnum = 0;
+  // The number of columns of the numbers.
+  int number_width = 0;
+  // The signs of the lines around the viewport, by line number.
+  std::vector<std::pair<int, std::string>> signs;
+
+  bool operator==(const MarginState& other) const
+  {
+    return number == other.number &&
+           relative_number == other.relative_number &&
+           show_signs == other.show_signs &&
+           cursor_lnum == other.cursor_lnum &&
+           number_width == other.number_width && signs == other.signs;
+  }
+
+  bool operator!=(const MarginState& other) const
+  {
+    return !(*this == other);
+  }
+};
+
+// Shows Nvim's line numbers and signs to the left of the text. Only the
+// visible lines have a visual, and a visual is only redrawn when its text
+// or position changed, so moving the cursor with 'relativenumber' redraws
+// the numbers on screen but never depends on the size of the file. The
+// formatted text of every distinct number is cached.
+public ref class NvimLineNumberMargin
+  : System::Windows::FrameworkElement,
+    Microsoft::VisualStudio::Text::Editor::IWpfTextViewMargin
+{
+private:
+  // The formatted texts are dropped when there are more than this many.
+  literal int max_cached_texts_ = 4096;
+  literal double padding_ = 4;
+
+  ref class MarginRow : System::Windows::Media::DrawingVisual
+  {
+  public:
+    System::String^ number;
+    System::String^ sign;
+    double top;
+    double width;
+  };
+
+  Microsoft::VisualStudio::Text::Editor::IWpfTextView^ text_view_;
+  System::Windows::Media::VisualCollection^ rows_;
+  System::Collections::Generic::Dictionary<
+    System::String^, System::Windows::Media::FormattedText^>^ texts_;
+  System::Windows::Media::Typeface^ typeface_;
+  double font_size_;
+  System::Windows::Media::Brush^ number_brush_;
+  System::Windows::Media::Brush^ sign_brush_;
+  double character_width_;
+  bool is_disposed_;
+
+  bool number_;
+  bool relative_number_;
+  bool show_signs_;
+  int cursor_lnum_;
+  int number_width_;
+  System::Collections::Generic::Dictionary<int, System::String^>^ signs_;
+
+  bool UpdateFormat();
+
+  System::Windows::Media::FormattedText^ GetText(
+    System::String^ text, System::Windows::Media::Brush^ brush);
+
+  System::String^ GetNumber(int lnum);
+
+  void UpdateRows();
+
+  void OnLayoutChanged(System::Object^ sender,
+    Microsoft::VisualStudio::Text::Editor::TextViewLayoutChangedEventArgs^ e);
+
+  void OnEnabledChanged(System::Object^ sender, System::EventArgs^ e);
+
+protected:
+  property int VisualChildrenCount
+  {
+    virtual int get() override;
+  }
+
+  virtual System::Windows::Media::Visual^ GetVisualChild(int index) override;
+
+public:
+  literal System::String^ margin_name_ = "VSNvimLineNumbers";
+
+  NvimLineNumberMargin(
+    Microsoft::VisualStudio::Text::Editor::IWpfTextView^ text_view);
+
+  // Returns the margin of the view, or null if it has none.
+  static NvimLineNumberMargin^ GetMargin(
+    Microsoft::VisualStudio::Text::Editor::ITextView^ text_view);
+
+  void SetState(bool number, bool relative_number, bool show_signs,
+                int cursor_lnum, int number_width,
+                array<int>^ sign_lines, array<System::String^>^ sign_texts);
+
+  property System::Windows::FrameworkElement^ VisualElement
+  {
+    virtual System::Windows::FrameworkElement^ get();
+  }
+
+  property double MarginSize
+  {
+    virtual double get();
+  }
+
+  property bool Enabled
+  {
+    virtual bool get();
+  }
+
+  virtual Microsoft::VisualStudio::Text::Editor::ITextViewMargin^
+    GetTextViewMargin(System::String^ margin_name);
+
+  ~NvimLineNumberMargin();
+};
+
+[System::ComponentModel::Composition::Export(
+  Microsoft::VisualStudio::Text::Editor::IWpfTextViewMarginProvider::typeid)]
+[Microsoft::VisualStudio::Utilities::Name(
+  NvimLineNumberMargin::margin_name_)]
+[Microsoft::VisualStudio::Text::Editor::MarginContainer(
+  Microsoft::VisualStudio::Text::Editor::PredefinedMarginNames::Left)]
+[Microsoft::VisualStudio::Utilities::Order(
+  After = Microsoft::VisualStudio::Text::Editor::
+    PredefinedMarginNames::LineNumber)]
+[Microsoft::VisualStudio::Utilities::ContentType("any")]
+[Microsoft::VisualStudio::Text::Editor::TextViewRole(
+  Microsoft::VisualStudio::Text::Editor::PredefinedTextViewRoles::Editable)]
+public ref class NvimLineNumberMarginProvider
+  : Microsoft::VisualStudio::Text::Editor::IWpfTextViewMarginProvider
+{
+public:
+  virtual Microsoft::VisualStudio::Text::Editor::IWpfTextViewMargin^
+    CreateMargin(
+      Microsoft::VisualStudio::Text::Editor::IWpfTextViewHost^ host,
+      Microsoft::VisualStudio::Text::Editor::IWpfTextViewMargin^ container);
+};
+}
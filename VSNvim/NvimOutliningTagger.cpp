@@ -0,0 +1,99 @@
+#include "NvimOutliningTagger.h"
+
+using namespace System::Collections::Generic;
+using namespace Microsoft::VisualStudio::Text;
+using namespace Microsoft::VisualStudio::Text::Tagging;
+
+namespace VSNvim
+{
+NvimOutliningTagger::NvimOutliningTagger(ITextBuffer^ text_buffer)
+  : text_buffer_(text_buffer),
+    regions_(gcnew List<ITrackingSpan^>())
+{
+}
+
+SnapshotSpan NvimOutliningTagger::GetLinesSpan(int first_line, int last_line)
+{
+  const auto snapshot = text_buffer_->CurrentSnapshot;
+  const auto first = snapshot->GetLineFromLineNumber(
+    System::Math::Min(first_line, snapshot->LineCount) - 1);
+  const auto last = snapshot->GetLineFromLineNumber(
+    System::Math::Min(last_line, snapshot->LineCount) - 1);
+  return SnapshotSpan(first->End, last->End);
+}
+
+void NvimOutliningTagger::RaiseTagsChanged(SnapshotSpan span)
+{
+  TagsChanged(this, gcnew SnapshotSpanEventArgs(span));
+}
+
+IEnumerable<ITagSpan<IOutliningRegionTag^>^>^ NvimOutliningTagger::GetTags(
+  NormalizedSnapshotSpanCollection^ spans)
+{
+  const auto tags = gcnew List<ITagSpan<IOutliningRegionTag^>^>();
+  if (!spans->Count || !regions_->Count)
+  {
+    return tags;
+  }
+
+  const auto snapshot = spans[0].Snapshot;
+  for each (auto region in regions_)
+  {
+    const auto span = region->GetSpan(snapshot);
+    auto is_requested = false;
+    for each (auto requested_span in spans)
+    {
+      is_requested = is_requested || requested_span.IntersectsWith(span);
+    }
+    if (!is_requested)
+    {
+      continue;
+    }
+    tags->Add(gcnew TagSpan<IOutliningRegionTag^>(span,
+      gcnew OutliningRegionTag(false, false, "...", span.GetText())));
+  }
+  return tags;
+}
+
+void NvimOutliningTagger::AddRegion(int first_line, int last_line)
+{
+  const auto span = GetLinesSpan(first_line, last_line);
+  regions_->Add(span.Snapshot->CreateTrackingSpan(
+    span, SpanTrackingMode::EdgeExclusive));
+  RaiseTagsChanged(span);
+}
+
+void NvimOutliningTagger::RemoveRegions(int first_line)
+{
+  const auto snapshot = text_buffer_->CurrentSnapshot;
+  for (auto i = regions_->Count - 1; i >= 0; i--)
+  {
+    const auto span = regions_[i]->GetSpan(snapshot);
+    if (span.Start.GetContainingLine()->LineNumber + 1 == first_line)
+    {
+      regions_->RemoveAt(i);
+      RaiseTagsChanged(span);
+    }
+  }
+}
+
+generic <typename T> where T : ITag
+ITagger<T>^ NvimOutliningTaggerProvider::CreateTagger(ITextBuffer^ text_buffer)
+{
+  return safe_cast<ITagger<T>^>(
+    static_cast<System::Object^>(GetTagger(text_buffer)));
+}
+
+NvimOutliningTagger^ NvimOutliningTaggerProvider::GetTagger(
+  ITextBuffer^ text_buffer)
+{
+  NvimOutliningTagger^ tagger;
+  if (!text_buffer->Properties->TryGetProperty<NvimOutliningTagger^>(
+        NvimOutliningTagger::typeid, tagger))
+  {
+    tagger = gcnew NvimOutliningTagger(text_buffer);
+    text_buffer->Properties->AddProperty(NvimOutliningTagger::typeid, tagger);
+  }
+  return tagger;
+}
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+namespace VSNvim
+{
+// Provides outlining regions for Nvim folds that Visual Studio has no
+// region for, so they can be collapsed in the editor.
+public ref class NvimOutliningTagger
+  : Microsoft::VisualStudio::Text::Tagging::ITagger<
+      Microsoft::VisualStudio::Text::Tagging::IOutliningRegionTag^>
+{
+private:
+  Microsoft::VisualStudio::Text::ITextBuffer^ text_buffer_;
+  System::Collections::Generic::List<
+    Microsoft::VisualStudio::Text::ITrackingSpan^>^ regions_;
+
+  Microsoft::VisualStudio::Text::SnapshotSpan GetLinesSpan(
+    int first_line, int last_line);
+
+  void RaiseTagsChanged(Microsoft::VisualStudio::Text::SnapshotSpan span);
+
+public:
+  NvimOutliningTagger(Microsoft::VisualStudio::Text::ITextBuffer^ text_buffer);
+
+  virtual event System::EventHandler<
+    Microsoft::VisualStudio::Text::SnapshotSpanEventArgs^>^ TagsChanged;
+
+  virtual System::Collections::Generic::IEnumerable<
+    Microsoft::VisualStudio::Text::Tagging::ITagSpan<
+      Microsoft::VisualStudio::Text::Tagging::IOutliningRegionTag^>^>^
+    GetTags(Microsoft::VisualStudio::Text::NormalizedSnapshotSpanCollection^
+      spans);
+
+  // Adds a region for the lines [first_line, last_line], which are
+  // 1-based. The first line stays visible when it is collapsed.
+  void AddRegion(int first_line, int last_line);
+
+  // Removes the regions that start at the line.
+  void RemoveRegions(int first_line);
+};
+
+[System::ComponentModel::Composition::Export(
+  Microsoft::VisualStudio::Text::Tagging::ITaggerProvider::typeid)]
+[Microsoft::VisualStudio::Text::Tagging::TagType(
+  Microsoft::VisualStudio::Text::Tagging::IOutliningRegionTag::typeid)]
+[Microsoft::VisualStudio::Utilities::ContentType("any")]
+public ref class NvimOutliningTaggerProvider
+  : Microsoft::VisualStudio::Text::Tagging::ITaggerProvider
+{
+public:
+  generic <typename T>
+    where T : Microsoft::VisualStudio::Text::Tagging::ITag
+  virtual Microsoft::VisualStudio::Text::Tagging::ITagger<T>^ CreateTagger(
+    Microsoft::VisualStudio::Text::ITextBuffer^ text_buffer);
+
+  // Returns the tagger of the buffer, creating it if needed.
+  static NvimOutliningTagger^ GetTagger(
+    Microsoft::VisualStudio::Text::ITextBuffer^ text_buffer);
+};
+}
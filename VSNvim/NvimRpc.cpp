@@ -0,0 +1,614 @@
+#include "NvimRpc.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#ifdef _WIN32
+#include <Winsock2.h>
+#else
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace VSNvim
+{
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+enum RpcMessageType
+{
+  kRpcRequest = 0,
+  kRpcResponse = 1,
+  kRpcNotification = 2
+};
+
+struct PendingRequest
+{
+  NvimRpcClient::ResponseHandler on_response;
+  Clock::time_point sent;
+};
+
+// The pipes to and from the child process.
+class ChildProcess
+{
+private:
+#ifdef _WIN32
+  HANDLE process_ = nullptr;
+  HANDLE input_ = nullptr;
+  HANDLE output_ = nullptr;
+#else
+  pid_t pid_ = -1;
+  int input_ = -1;
+  int output_ = -1;
+#endif
+
+public:
+  ~ChildProcess()
+  {
+    CloseInput();
+    Wait();
+  }
+
+#ifdef _WIN32
+  bool Start(const std::vector<std::string>& argv)
+  {
+    SECURITY_ATTRIBUTES attributes{ sizeof(attributes), nullptr, TRUE };
+    HANDLE child_input;
+    HANDLE child_output;
+    if (!CreatePipe(&child_input, &input_, &attributes, 0))
+    {
+      return false;
+    }
+    if (!CreatePipe(&output_, &child_output, &attributes, 0))
+    {
+      CloseHandle(child_input);
+      CloseHandle(input_);
+      input_ = nullptr;
+      return false;
+    }
+    SetHandleInformation(input_, HANDLE_FLAG_INHERIT, 0);
+    SetHandleInformation(output_, HANDLE_FLAG_INHERIT, 0);
+    // Visual Studio's error output is often not inheritable, or missing.
+    HANDLE child_error = nullptr;
+    const auto error = GetStdHandle(STD_ERROR_HANDLE);
+    if (error && error != INVALID_HANDLE_VALUE)
+    {
+      DuplicateHandle(GetCurrentProcess(), error, GetCurrentProcess(),
+                      &child_error, 0, TRUE, DUPLICATE_SAME_ACCESS);
+    }
+
+    // The child inherits only its ends of the pipes and the error output,
+    // not every inheritable handle Visual Studio has open.
+    HANDLE inherited[] = { child_input, child_output, child_error };
+    const auto inherited_count = child_error ? 3 : 2;
+    SIZE_T attributes_size = 0;
+    InitializeProcThreadAttributeList(nullptr, 1, 0, &attributes_size);
+    std::vector<char> attributes_buffer(attributes_size);
+    const auto attribute_list = reinterpret_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(
+      attributes_buffer.data());
+    auto is_started = false;
+    PROCESS_INFORMATION process_info;
+    if (InitializeProcThreadAttributeList(attribute_list, 1, 0,
+                                          &attributes_size))
+    {
+      if (UpdateProcThreadAttribute(attribute_list, 0,
+                                    PROC_THREAD_ATTRIBUTE_HANDLE_LIST,
+                                    inherited,
+                                    inherited_count * sizeof(HANDLE),
+                                    nullptr, nullptr))
+      {
+        STARTUPINFOEXA startup_info{};
+        startup_info.StartupInfo.cb = sizeof(startup_info);
+        startup_info.StartupInfo.dwFlags = STARTF_USESTDHANDLES;
+        startup_info.StartupInfo.hStdInput = child_input;
+        startup_info.StartupInfo.hStdOutput = child_output;
+        startup_info.StartupInfo.hStdError = child_error;
+        startup_info.lpAttributeList = attribute_list;
+        auto command_line = CreateCommandLine(argv);
+        is_started = CreateProcessA(
+          nullptr, &command_line[0], nullptr, nullptr, TRUE,
+          CREATE_NO_WINDOW | EXTENDED_STARTUPINFO_PRESENT, nullptr, nullptr,
+          &startup_info.StartupInfo, &process_info) != FALSE;
+      }
+      DeleteProcThreadAttributeList(attribute_list);
+    }
+    CloseHandle(child_input);
+    CloseHandle(child_output);
+    if (child_error)
+    {
+      CloseHandle(child_error);
+    }
+    if (!is_started)
+    {
+      CloseInput();
+      CloseHandle(output_);
+      output_ = nullptr;
+      return false;
+    }
+    CloseHandle(process_info.hThread);
+    process_ = process_info.hProcess;
+    return true;
+  }
+
+  bool Write(const char* data, std::size_t size)
+  {
+    while (size)
+    {
+      DWORD written;
+      if (!WriteFile(input_, data, static_cast<DWORD>(size), &written,
+                     nullptr))
+      {
+        return false;
+      }
+      data += written;
+      size -= written;
+    }
+    return true;
+  }
+
+  // Returns the number of bytes read, or 0 once the process has exited.
+  std::size_t Read(char* data, std::size_t size)
+  {
+    DWORD read;
+    return ReadFile(output_, data, static_cast<DWORD>(size), &read, nullptr)
+      ? read
+      : 0;
+  }
+
+  void CloseInput()
+  {
+    if (input_)
+    {
+      CloseHandle(input_);
+      input_ = nullptr;
+    }
+  }
+
+  void Wait()
+  {
+    if (process_)
+    {
+      // Nvim exits once its input is closed.
+      if (WaitForSingleObject(process_, 5000) != WAIT_OBJECT_0)
+      {
+        TerminateProcess(process_, 1);
+      }
+      CloseHandle(process_);
+      process_ = nullptr;
+    }
+    if (output_)
+    {
+      CloseHandle(output_);
+      output_ = nullptr;
+    }
+  }
+#else
+  bool Start(const std::vector<std::string>& argv)
+  {
+    int child_input[2];
+    int child_output[2];
+    if (pipe(child_input) != 0)
+    {
+      return false;
+    }
+    if (pipe(child_output) != 0)
+    {
+      close(child_input[0]);
+      close(child_input[1]);
+      return false;
+    }
+    pid_ = fork();
+    if (pid_ == 0)
+    {
+      dup2(child_input[0], STDIN_FILENO);
+      dup2(child_output[1], STDOUT_FILENO);
+      close(child_input[0]);
+      close(child_input[1]);
+      close(child_output[0]);
+      close(child_output[1]);
+      std::vector<char*> args;
+      for (const auto& arg : argv)
+      {
+        args.push_back(const_cast<char*>(arg.c_str()));
+      }
+      args.push_back(nullptr);
+      execvp(args[0], args.data());
+      _exit(127);
+    }
+    close(child_input[0]);
+    close(child_output[1]);
+    input_ = child_input[1];
+    output_ = child_output[0];
+    if (pid_ < 0)
+    {
+      CloseInput();
+      close(output_);
+      output_ = -1;
+      return false;
+    }
+    // A write after the process exited fails instead of raising SIGPIPE.
+    signal(SIGPIPE, SIG_IGN);
+    return true;
+  }
+
+  bool Write(const char* data, std::size_t size)
+  {
+    while (size)
+    {
+      const auto written = write(input_, data, size);
+      if (written <= 0)
+      {
+        return false;
+      }
+      data += written;
+      size -= static_cast<std::size_t>(written);
+    }
+    return true;
+  }
+
+  std::size_t Read(char* data, std::size_t size)
+  {
+    const auto count = read(output_, data, size);
+    return count > 0 ? static_cast<std::size_t>(count) : 0;
+  }
+
+  void CloseInput()
+  {
+    if (input_ >= 0)
+    {
+      close(input_);
+      input_ = -1;
+    }
+  }
+
+  void Wait()
+  {
+    if (pid_ > 0)
+    {
+      waitpid(pid_, nullptr, 0);
+      pid_ = -1;
+    }
+    if (output_ >= 0)
+    {
+      close(output_);
+      output_ = -1;
+    }
+  }
+#endif
+};
+}
+
+struct NvimRpcClient::Impl
+{
+  ChildProcess process;
+  std::thread reader;
+  NotificationHandler on_notification;
+  std::atomic<bool> is_running{ false };
+
+  // Serializes the messages written to the process.
+  std::mutex write_mutex;
+  MsgpackWriter message;
+
+  std::mutex requests_mutex;
+  std::condition_variable requests_done;
+  std::unordered_map<std::uint32_t, PendingRequest> requests;
+  std::uint32_t next_id = 0;
+  std::uint64_t request_count = 0;
+  double total_latency_us = 0;
+
+  bool Send(const MsgpackWriter& header, const MsgpackWriter& params)
+  {
+    std::lock_guard<std::mutex> lock(write_mutex);
+    message.Clear();
+    message.WriteRaw(header.GetBuffer());
+    message.WriteRaw(params.GetBuffer());
+    const auto& buffer = message.GetBuffer();
+    return process.Write(buffer.data(), buffer.size());
+  }
+
+  void HandleMessage(const MsgpackValue& value)
+  {
+    if (value.type != MsgpackType::Array || value.items.empty())
+    {
+      return;
+    }
+    const auto& items = value.items;
+    switch (items[0].integer)
+    {
+    case kRpcResponse:
+      if (items.size() == 4)
+      {
+        HandleResponse(static_cast<std::uint32_t>(items[1].integer),
+                       items[2], items[3]);
+      }
+      break;
+    case kRpcNotification:
+      if (items.size() == 3 && on_notification)
+      {
+        on_notification(items[1].bytes, items[2]);
+      }
+      break;
+    case kRpcRequest:
+      // Nvim only sends requests to clients that registered methods, which
+      // this one does not.
+      if (items.size() == 4)
+      {
+        MsgpackWriter header;
+        header.WriteArrayHeader(4);
+        header.WriteInteger(kRpcResponse);
+        header.WriteInteger(items[1].integer);
+        header.WriteString("Not supported by Visual Studio");
+        header.WriteNil();
+        Send(header, MsgpackWriter());
+      }
+      break;
+    }
+  }
+
+  void HandleResponse(std::uint32_t id, const MsgpackValue& error,
+                      const MsgpackValue& result)
+  {
+    ResponseHandler on_response;
+    {
+      std::lock_guard<std::mutex> lock(requests_mutex);
+      const auto request = requests.find(id);
+      if (request == requests.end())
+      {
+        return;
+      }
+      on_response = std::move(request->second.on_response);
+      total_latency_us += std::chrono::duration<double, std::micro>(
+        Clock::now() - request->second.sent).count();
+      request_count++;
+      requests.erase(request);
+    }
+    if (on_response)
+    {
+      on_response(error, result);
+    }
+    requests_done.notify_all();
+  }
+
+  void FailRequests()
+  {
+    std::unordered_map<std::uint32_t, PendingRequest> failed;
+    {
+      std::lock_guard<std::mutex> lock(requests_mutex);
+      failed.swap(requests);
+    }
+    MsgpackValue error;
+    error.type = MsgpackType::String;
+    error.bytes = "Nvim exited";
+    for (auto& request : failed)
+    {
+      if (request.second.on_response)
+      {
+        request.second.on_response(error, MsgpackValue());
+      }
+    }
+    requests_done.notify_all();
+  }
+
+  void ReadMessages()
+  {
+    MsgpackReader reader;
+    std::vector<char> chunk(64 * 1024);
+    for (;;)
+    {
+      const auto size = process.Read(chunk.data(), chunk.size());
+      if (!size)
+      {
+        break;
+      }
+      reader.Append(chunk.data(), size);
+      MsgpackValue value;
+      MsgpackResult result;
+      while ((result = reader.Read(value)) == MsgpackResult::Value)
+      {
+        HandleMessage(value);
+      }
+      if (result == MsgpackResult::Invalid)
+      {
+        break;
+      }
+    }
+    is_running = false;
+    FailRequests();
+  }
+};
+
+NvimRpcClient::NvimRpcClient()
+  : impl_(std::make_unique<Impl>())
+{
+}
+
+NvimRpcClient::~NvimRpcClient()
+{
+  Stop();
+}
+
+bool NvimRpcClient::Start(const std::vector<std::string>& argv,
+                          NotificationHandler on_notification)
+{
+  if (impl_->is_running || !impl_->process.Start(argv))
+  {
+    return false;
+  }
+  impl_->on_notification = std::move(on_notification);
+  impl_->is_running = true;
+  impl_->reader = std::thread([impl = impl_.get()]()
+  {
+    impl->ReadMessages();
+  });
+  return true;
+}
+
+bool NvimRpcClient::IsRunning() const
+{
+  return impl_->is_running;
+}
+
+bool NvimRpcClient::Request(std::string_view method,
+                            const MsgpackWriter& params,
+                            ResponseHandler on_response)
+{
+  if (!impl_->is_running)
+  {
+    return false;
+  }
+  std::uint32_t id;
+  {
+    std::lock_guard<std::mutex> lock(impl_->requests_mutex);
+    id = impl_->next_id++;
+    impl_->requests.emplace(
+      id, PendingRequest{ std::move(on_response), Clock::now() });
+  }
+  MsgpackWriter header;
+  header.WriteArrayHeader(4);
+  header.WriteInteger(kRpcRequest);
+  header.WriteInteger(id);
+  header.WriteString(method);
+  if (!impl_->Send(header, params))
+  {
+    std::lock_guard<std::mutex> lock(impl_->requests_mutex);
+    impl_->requests.erase(id);
+    return false;
+  }
+  return true;
+}
+
+void NvimRpcClient::Notify(std::string_view method,
+                           const MsgpackWriter& params)
+{
+  if (!impl_->is_running)
+  {
+    return;
+  }
+  MsgpackWriter header;
+  header.WriteArrayHeader(3);
+  header.WriteInteger(kRpcNotification);
+  header.WriteString(method);
+  impl_->Send(header, params);
+}
+
+bool NvimRpcClient::Call(std::string_view method,
+                         const MsgpackWriter& params, MsgpackValue& result,
+                         std::string* error)
+{
+  std::mutex mutex;
+  std::condition_variable done;
+  auto is_done = false;
+  auto is_ok = false;
+  const auto is_sent = Request(method, params,
+    [&](const MsgpackValue& response_error,
+        const MsgpackValue& response_result)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      is_ok = response_error.IsNil();
+      if (is_ok)
+      {
+        result = response_result;
+      }
+      else if (error)
+      {
+        *error = GetRpcErrorMessage(response_error);
+      }
+      is_done = true;
+      done.notify_one();
+    });
+  if (!is_sent)
+  {
+    if (error)
+    {
+      *error = "Nvim is not running";
+    }
+    return false;
+  }
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [&]() { return is_done; });
+  return is_ok;
+}
+
+void NvimRpcClient::Wait()
+{
+  std::unique_lock<std::mutex> lock(impl_->requests_mutex);
+  impl_->requests_done.wait(lock, [this]()
+  {
+    return impl_->requests.empty();
+  });
+}
+
+void NvimRpcClient::Stop()
+{
+  impl_->process.CloseInput();
+  if (impl_->reader.joinable())
+  {
+    impl_->reader.join();
+  }
+  impl_->process.Wait();
+}
+
+std::uint64_t NvimRpcClient::GetRequestCount() const
+{
+  std::lock_guard<std::mutex> lock(impl_->requests_mutex);
+  return impl_->request_count;
+}
+
+double NvimRpcClient::GetMeanLatencyUs() const
+{
+  std::lock_guard<std::mutex> lock(impl_->requests_mutex);
+  return impl_->request_count
+    ? impl_->total_latency_us / impl_->request_count
+    : 0;
+}
+
+std::string CreateCommandLine(const std::vector<std::string>& argv)
+{
+  std::string command_line;
+  for (const auto& arg : argv)
+  {
+    if (!command_line.empty())
+    {
+      command_line += ' ';
+    }
+    if (!arg.empty() && arg.find_first_of(" \t\n\v\"") == std::string::npos)
+    {
+      command_line += arg;
+      continue;
+    }
+    // Backslashes are literal unless they precede a quote, so only those
+    // and the ones before the closing quote are doubled.
+    command_line += '"';
+    std::size_t backslashes = 0;
+    for (const auto c : arg)
+    {
+      if (c == '\\')
+      {
+        backslashes++;
+        continue;
+      }
+      command_line.append(c == '"' ? backslashes * 2 + 1 : backslashes, '\\');
+      command_line += c;
+      backslashes = 0;
+    }
+    command_line.append(backslashes * 2, '\\');
+    command_line += '"';
+  }
+  return command_line;
+}
+
+std::string GetRpcErrorMessage(const MsgpackValue& error)
+{
+  if (error.type == MsgpackType::Array && error.items.size() == 2)
+  {
+    return error.items[1].bytes;
+  }
+  return error.type == MsgpackType::String ? error.bytes : "Unknown error";
+}
+}
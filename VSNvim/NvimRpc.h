@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Msgpack.h"
+
+namespace VSNvim
+{
+// A msgpack-RPC client of an Nvim process started with --embed, which it
+// talks to over the process's standard input and output.
+//
+// Requests are written as soon as they are made, without waiting for the
+// responses to the previous ones, and responses are matched to their
+// requests by id. Responses and notifications are handled on a thread that
+// reads the output of the process.
+//
+// NvimRpc.cpp is compiled without /clr, since it uses <thread> and <mutex>.
+// It also builds on POSIX, so Tests/nvim_rpc_benchmark can measure the
+// transport against a local nvim outside Visual Studio.
+class NvimRpcClient
+{
+public:
+  // Called on the reader thread with the error, which is nil if the request
+  // succeeded, and the result.
+  using ResponseHandler =
+    std::function<void(const MsgpackValue& error, const MsgpackValue& result)>;
+
+  // Called on the reader thread with the method and parameters of a
+  // notification.
+  using NotificationHandler =
+    std::function<void(const std::string& method, const MsgpackValue& params)>;
+
+  NvimRpcClient();
+
+  ~NvimRpcClient();
+
+  NvimRpcClient(const NvimRpcClient&) = delete;
+  NvimRpcClient& operator=(const NvimRpcClient&) = delete;
+
+  // Starts the process with the arguments, the first of which is the
+  // program. Returns false if it could not be started.
+  bool Start(const std::vector<std::string>& argv,
+             NotificationHandler on_notification);
+
+  bool IsRunning() const;
+
+  // Sends a request. The parameters are the items of an array, already
+  // written with their header. Returns false if the process is not running,
+  // in which case the handler is not called.
+  bool Request(std::string_view method, const MsgpackWriter& params,
+               ResponseHandler on_response);
+
+  void Notify(std::string_view method, const MsgpackWriter& params);
+
+  // Sends a request and waits for its response. Returns false if it failed,
+  // with its error message. Must not be called on the reader thread.
+  bool Call(std::string_view method, const MsgpackWriter& params,
+            MsgpackValue& result, std::string* error = nullptr);
+
+  // Waits until every request sent so far has been answered.
+  void Wait();
+
+  // Closes the process's input, which makes it exit, and waits for the
+  // reader thread. Requests that are still pending fail.
+  void Stop();
+
+  // The number of requests sent and the mean time they took to be
+  // answered, in microseconds.
+  std::uint64_t GetRequestCount() const;
+
+  double GetMeanLatencyUs() const;
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+// Joins the arguments into a Windows command line, quoting them so that
+// CommandLineToArgvW and the C runtime split it back into the same
+// arguments.
+std::string CreateCommandLine(const std::vector<std::string>& argv);
+
+// Returns the error message of an error sent by Nvim, which is an array of
+// its type and message.
+std::string GetRpcErrorMessage(const MsgpackValue& error);
+}
@@ -0,0 +1,79 @@
+#include "PasteCommandFilter.h"
+
+#include <memory>
+#include <string>
+#include <vcclr.h> // PtrToStringChars
+
+#include "VSNvimBridge.h"
+#include "VSNvimPackage.h"
+
+using namespace System;
+using namespace System::Text;
+using namespace Microsoft::VisualStudio;
+using namespace Microsoft::VisualStudio::OLE::Interop;
+using namespace Microsoft::VisualStudio::TextManager::Interop;
+
+namespace VSNvim
+{
+PasteCommandFilter::PasteCommandFilter(IVsTextView^ text_view)
+{
+  text_view->AddCommandFilter(this, next_target_);
+}
+
+int PasteCommandFilter::QueryStatus(Guid% command_group, UInt32 count,
+  array<OLECMD>^ commands, IntPtr command_text)
+{
+  return next_target_->QueryStatus(command_group, count, commands,
+                                   command_text);
+}
+
+int PasteCommandFilter::Exec(Guid% command_group, UInt32 command_id,
+  UInt32 options, IntPtr in, IntPtr out)
+{
+  if (VSNvimPackage::IsEnabled &&
+      command_group == VSConstants::GUID_VSStandardCommandSet97 &&
+      command_id == static_cast<UInt32>(VSConstants::VSStd97CmdID::Paste) &&
+      System::Windows::Clipboard::ContainsText())
+  {
+    PasteText(System::Windows::Clipboard::GetText());
+    return VSConstants::S_OK;
+  }
+  return next_target_->Exec(command_group, command_id, options, in, out);
+}
+
+void PasteCommandFilter::PasteText(String^ text)
+{
+  if (String::IsNullOrEmpty(text))
+  {
+    return;
+  }
+
+  // The encoder never splits a surrogate pair, so every chunk holds
+  // complete UTF-8 sequences.
+  const auto encoder = Encoding::UTF8->GetEncoder();
+  const pin_ptr<const wchar_t> chars = PtrToStringChars(text);
+  auto chars_left = text->Length;
+  auto phase = PastePhase::Start;
+  while (chars_left)
+  {
+    auto chunk = std::make_unique<std::string>(chunk_size_, '\0');
+    int chars_used;
+    int bytes_used;
+    bool completed;
+    encoder->Convert(
+      const_cast<wchar_t*>(chars + (text->Length - chars_left)), chars_left,
+      reinterpret_cast<unsigned char*>(chunk->data()), chunk_size_, true,
+      chars_used, bytes_used, completed);
+    chunk->resize(bytes_used);
+    chars_left -= chars_used;
+
+    if (!chars_left)
+    {
+      phase = phase == PastePhase::Start ? PastePhase::Single
+                                         : PastePhase::End;
+    }
+    VSNvim::Paste(std::move(chunk), phase);
+    phase = PastePhase::Continue;
+  }
+}
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+namespace VSNvim
+{
+// Intercepts the Visual Studio paste command and streams the clipboard
+// contents to Nvim in fixed-size UTF-8 chunks.
+public ref class PasteCommandFilter
+  : Microsoft::VisualStudio::OLE::Interop::IOleCommandTarget
+{
+private:
+  Microsoft::VisualStudio::OLE::Interop::IOleCommandTarget^ next_target_;
+
+  static void PasteText(System::String^ text);
+
+public:
+  // The size of the chunks the clipboard text is split into.
+  literal int chunk_size_ = 64 * 1024;
+
+  PasteCommandFilter(
+    Microsoft::VisualStudio::TextManager::Interop::IVsTextView^ text_view);
+
+  virtual int QueryStatus(System::Guid% command_group, System::UInt32 count,
+    array<Microsoft::VisualStudio::OLE::Interop::OLECMD>^ commands,
+    System::IntPtr command_text);
+
+  virtual int Exec(System::Guid% command_group, System::UInt32 command_id,
+    System::UInt32 options, System::IntPtr in, System::IntPtr out);
+};
+}
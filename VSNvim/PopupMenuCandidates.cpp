@@ -0,0 +1,49 @@
+#include "PopupMenuCandidates.h"
+
+namespace VSNvim
+{
+void PopupMenuCandidates::Clear()
+{
+  text_.clear();
+  rows_.clear();
+}
+
+void PopupMenuCandidates::Reserve(std::size_t count, std::size_t bytes)
+{
+  rows_.reserve(count);
+  text_.reserve(bytes);
+}
+
+void PopupMenuCandidates::Add(std::string_view word, std::string_view kind,
+                              std::string_view menu)
+{
+  const auto start = text_.size();
+  text_.append(word);
+  if (!kind.empty() || !menu.empty())
+  {
+    text_.append("  ");
+    text_.append(kind);
+    text_.push_back(' ');
+    text_.append(menu);
+  }
+  rows_.push_back({ static_cast<std::uint32_t>(start),
+                    static_cast<std::uint32_t>(text_.size() - start) });
+}
+
+std::size_t PopupMenuCandidates::GetCount() const
+{
+  return rows_.size();
+}
+
+std::string_view PopupMenuCandidates::GetRowText(std::size_t index) const
+{
+  const auto& row = rows_[index];
+  return std::string_view(text_.data() + row.start, row.size);
+}
+
+void PopupMenuCandidates::Swap(PopupMenuCandidates& other)
+{
+  text_.swap(other.text_);
+  rows_.swap(other.rows_);
+}
+} // namespace VSNvim
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace VSNvim
+{
+// The rows of a completion menu. Each candidate's row text is formatted
+// once, when the menu is shown, into one buffer, so a row is looked up by
+// its index in constant time and only the rows the list shows are
+// converted to managed strings. PopupMenuCandidates.cpp is compiled
+// without /clr, so Tests/popup_menu_benchmark can build it.
+class PopupMenuCandidates
+{
+private:
+  struct Row
+  {
+    std::uint32_t start;
+    std::uint32_t size;
+  };
+
+  std::string text_;
+  std::vector<Row> rows_;
+
+public:
+  // Removes the rows and keeps the memory for the next menu.
+  void Clear();
+
+  void Reserve(std::size_t count, std::size_t bytes);
+
+  // Appends the row of a candidate. The kind and the menu text follow the
+  // word if either is set.
+  void Add(std::string_view word, std::string_view kind,
+           std::string_view menu);
+
+  std::size_t GetCount() const;
+
+  // Returns the UTF-8 text of the row, which must exist.
+  std::string_view GetRowText(std::size_t index) const;
+
+  void Swap(PopupMenuCandidates& other);
+};
+} // namespace VSNvim
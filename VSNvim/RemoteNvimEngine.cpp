@@ -0,0 +1,696 @@
+#include "RemoteNvimEngine.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "FrameScheduler.h"
+#include "NvimRpc.h"
+#include "Trace.h"
+
+using namespace System;
+using namespace System::Collections::Generic;
+using namespace System::Diagnostics;
+using namespace System::Text;
+using namespace System::Windows::Threading;
+using namespace Microsoft::VisualStudio::Text;
+using namespace Microsoft::VisualStudio::Text::Editor;
+
+namespace VSNvim
+{
+static NvimRpcClient* rpc_client_;
+// The calls of the next nvim_call_atomic. Only used on the UI thread.
+static MsgpackWriter pending_calls_;
+static std::uint32_t pending_call_count_;
+
+static void RequestBuffer(Int64 token);
+
+static void SendCalls(std::uint32_t count, const std::string& calls);
+
+static void SendKeys(const std::string& notation);
+
+static std::string ToUtf8(String^ text)
+{
+  const auto bytes = Encoding::UTF8->GetBytes(text);
+  if (bytes->Length == 0)
+  {
+    return std::string();
+  }
+  pin_ptr<Byte> data = &bytes[0];
+  return std::string(reinterpret_cast<const char*>(data), bytes->Length);
+}
+
+static String^ ToManagedString(const std::string& text)
+{
+  return gcnew String(text.data(), 0, static_cast<int>(text.size()),
+                      Encoding::UTF8);
+}
+
+// A view attached to a buffer of the child Nvim. The view's changes are
+// sent as nvim_buf_set_lines calls, batched in one nvim_call_atomic per
+// dispatcher pass, and the buffer's changes come back as the lines events
+// of nvim_buf_attach.
+ref class RemoteTextView
+{
+private:
+  // Lines sent to Nvim, whose lines event has not come back yet.
+  ref class SentLines
+  {
+  public:
+    int first;
+    int last;
+    array<String^>^ lines;
+
+    bool Matches(int event_first, int event_last,
+                 array<String^>^ event_lines)
+    {
+      if (event_first != first || event_last != last ||
+          event_lines->Length != lines->Length)
+      {
+        return false;
+      }
+      for (auto i = 0; i < lines->Length; i++)
+      {
+        if (!String::Equals(event_lines[i], lines[i]))
+        {
+          return false;
+        }
+      }
+      return true;
+    }
+  };
+
+  static Dictionary<Int64, RemoteTextView^>^ text_views_ =
+    gcnew Dictionary<Int64, RemoteTextView^>();
+  // The views whose buffers were asked for, by the token of the request.
+  static Dictionary<Int64, RemoteTextView^>^ creating_text_views_ =
+    gcnew Dictionary<Int64, RemoteTextView^>();
+  static Int64 next_token_;
+  static RemoteTextView^ focused_text_view_;
+  // The buffer that Nvim was last known to have current.
+  static Int64 current_buffer_;
+  static bool is_flush_posted_;
+  static Object^ cursor_key_ = gcnew Object();
+
+  IWpfTextView^ text_view_;
+  // Zero until Nvim created the buffer, and after it was deleted.
+  Int64 buffer_;
+  bool is_read_only_;
+  bool is_closed_;
+  // Whether the view is applying a change made in Nvim, which is not sent
+  // back.
+  bool is_applying_;
+  Queue<SentLines^>^ sent_lines_;
+  // Where the caret was last moved to follow the cursor, so a move made in
+  // Visual Studio is sent before the next keys.
+  int cursor_position_;
+
+  static void BeginCall(const char* method, std::uint32_t param_count)
+  {
+    pending_calls_.WriteArrayHeader(2);
+    pending_calls_.WriteString(method);
+    pending_calls_.WriteArrayHeader(param_count);
+    pending_call_count_++;
+    if (!is_flush_posted_)
+    {
+      is_flush_posted_ = true;
+      System::Windows::Application::Current->Dispatcher->BeginInvoke(
+        DispatcherPriority::Background,
+        gcnew Action(&RemoteTextView::FlushAction));
+    }
+  }
+
+  static void FlushAction()
+  {
+    VSNVIM_TRACE_SCOPE(__FUNCTION__);
+    is_flush_posted_ = false;
+    Flush();
+  }
+
+  static void QueueBufferDelete(Int64 buffer)
+  {
+    BeginCall("nvim_buf_delete", 2);
+    pending_calls_.WriteInteger(buffer);
+    pending_calls_.WriteMapHeader(1);
+    pending_calls_.WriteString("force");
+    pending_calls_.WriteBoolean(true);
+  }
+
+  static array<String^>^ GetLines(ITextSnapshot^ snapshot, int first,
+                                  int end)
+  {
+    auto lines = gcnew array<String^>(end - first);
+    for (auto i = first; i < end; i++)
+    {
+      lines[i - first] = snapshot->GetLineFromLineNumber(i)->GetText();
+    }
+    return lines;
+  }
+
+  static String^ GetNewLine(ITextSnapshot^ snapshot)
+  {
+    const auto new_line = snapshot->GetLineFromLineNumber(0)->
+      GetLineBreakText();
+    return new_line->Length > 0 ? new_line : Environment::NewLine;
+  }
+
+  void SetBufferOption(const char* name, bool value)
+  {
+    BeginCall("nvim_buf_set_option", 3);
+    pending_calls_.WriteInteger(buffer_);
+    pending_calls_.WriteString(name);
+    pending_calls_.WriteBoolean(value);
+  }
+
+  void SetBufferOption(const char* name, Int64 value)
+  {
+    BeginCall("nvim_buf_set_option", 3);
+    pending_calls_.WriteInteger(buffer_);
+    pending_calls_.WriteString(name);
+    pending_calls_.WriteInteger(value);
+  }
+
+  void QueueSetLines(int first, int last, array<String^>^ lines)
+  {
+    // A read-only buffer is modifiable only while it follows the view.
+    if (is_read_only_)
+    {
+      SetBufferOption("modifiable", true);
+    }
+    BeginCall("nvim_buf_set_lines", 5);
+    pending_calls_.WriteInteger(buffer_);
+    pending_calls_.WriteInteger(first);
+    pending_calls_.WriteInteger(last);
+    pending_calls_.WriteBoolean(false);
+    pending_calls_.WriteArrayHeader(lines->Length);
+    for each (auto line in lines)
+    {
+      pending_calls_.WriteString(ToUtf8(line));
+    }
+    if (is_read_only_)
+    {
+      SetBufferOption("modifiable", false);
+    }
+  }
+
+  void SendText()
+  {
+    VSNVIM_TRACE_SCOPE(__FUNCTION__);
+    const auto snapshot = text_view_->TextBuffer->CurrentSnapshot;
+    // Loading the text is not a change that can be undone. -123456 makes
+    // the buffer use the global 'undolevels' again.
+    SetBufferOption("undolevels", Int64(-1));
+    QueueSetLines(0, -1, GetLines(snapshot, 0, snapshot->LineCount));
+    SetBufferOption("undolevels", Int64(-123456));
+    if (is_read_only_)
+    {
+      SetBufferOption("readonly", true);
+    }
+    // Attached after the text is set, so the text does not come back.
+    BeginCall("nvim_buf_attach", 3);
+    pending_calls_.WriteInteger(buffer_);
+    pending_calls_.WriteBoolean(false);
+    pending_calls_.WriteMapHeader(0);
+  }
+
+  void MakeCurrent()
+  {
+    if (buffer_ == current_buffer_)
+    {
+      return;
+    }
+    current_buffer_ = buffer_;
+    cursor_position_ = -1;
+    BeginCall("nvim_set_current_buf", 1);
+    pending_calls_.WriteInteger(buffer_);
+  }
+
+  void SendCaret()
+  {
+    const auto position = text_view_->Caret->Position.BufferPosition;
+    if (position.Position == cursor_position_)
+    {
+      return;
+    }
+    cursor_position_ = position.Position;
+    const auto line = position.GetContainingLine();
+    const auto text = line->GetText();
+    const auto column = Encoding::UTF8->GetByteCount(text->Substring(0,
+      Math::Min(position.Position - line->Start.Position, text->Length)));
+    BeginCall("nvim_win_set_cursor", 2);
+    pending_calls_.WriteInteger(0);
+    pending_calls_.WriteArrayHeader(2);
+    pending_calls_.WriteInteger(line->LineNumber + 1);
+    pending_calls_.WriteInteger(column);
+  }
+
+  void MoveCaret(Int64 row, Int64 byte_column)
+  {
+    VSNVIM_TRACE_SCOPE(__FUNCTION__);
+    // The cursor is where the keys left it, after their edits.
+    FrameScheduler::RunLane(FrameLane::Edits);
+    const auto snapshot = text_view_->TextBuffer->CurrentSnapshot;
+    const auto line = snapshot->GetLineFromLineNumber(static_cast<int>(
+      Math::Max(Int64(0), Math::Min(row - 1, Int64(snapshot->LineCount - 1)))));
+    const auto bytes = Encoding::UTF8->GetBytes(line->GetText());
+    const auto column = Encoding::UTF8->GetCharCount(bytes, 0,
+      static_cast<int>(Math::Max(Int64(0),
+        Math::Min(byte_column, Int64(bytes->Length)))));
+    text_view_->Caret->MoveTo(
+      SnapshotPoint(snapshot, line->Start.Position + column));
+    text_view_->Caret->EnsureVisible();
+    cursor_position_ = text_view_->Caret->Position.BufferPosition.Position;
+  }
+
+  void ApplyLines(int first, int last, array<String^>^ lines)
+  {
+    VSNVIM_TRACE_SCOPE(__FUNCTION__);
+    // Nvim sends back the lines set by the view too, in the order they
+    // were sent.
+    if (sent_lines_->Count > 0 &&
+        sent_lines_->Peek()->Matches(first, last, lines))
+    {
+      sent_lines_->Dequeue();
+      return;
+    }
+    if (is_read_only_)
+    {
+      return;
+    }
+
+    const auto snapshot = text_view_->TextBuffer->CurrentSnapshot;
+    const auto line_count = snapshot->LineCount;
+    const auto new_line = GetNewLine(snapshot);
+    auto text = String::Join(new_line, lines);
+    first = Math::Min(first, line_count);
+    if (last < 0 || last > line_count)
+    {
+      last = line_count;
+    }
+    int start;
+    int end;
+    if (last < line_count)
+    {
+      start = snapshot->GetLineFromLineNumber(first)->Start.Position;
+      end = snapshot->GetLineFromLineNumber(last)->Start.Position;
+      if (lines->Length > 0)
+      {
+        text += new_line;
+      }
+    }
+    else if (first > 0)
+    {
+      // Lines replaced up to the end take the break before them.
+      start = snapshot->GetLineFromLineNumber(first - 1)->End.Position;
+      end = snapshot->Length;
+      if (lines->Length > 0)
+      {
+        text = new_line + text;
+      }
+    }
+    else
+    {
+      start = 0;
+      end = snapshot->Length;
+    }
+
+    is_applying_ = true;
+    const auto text_edit = text_view_->TextBuffer->CreateEdit();
+    try
+    {
+      text_edit->Replace(start, end - start, text);
+      text_edit->Apply();
+    }
+    finally
+    {
+      delete text_edit;
+      is_applying_ = false;
+    }
+  }
+
+  void OnChanged(Object^ sender, TextContentChangedEventArgs^ e)
+  {
+    VSNVIM_TRACE_SCOPE(__FUNCTION__);
+    if (is_applying_ || buffer_ == 0 || e->Changes->Count == 0)
+    {
+      return;
+    }
+    // The lines the changes touched, which are replaced with their new
+    // text in one call.
+    const auto before = e->Before;
+    const auto after = e->After;
+    auto first = Int32::MaxValue;
+    auto last = 0;
+    for each (auto change in e->Changes)
+    {
+      first = Math::Min(first,
+        before->GetLineNumberFromPosition(change->OldPosition));
+      last = Math::Max(last,
+        before->GetLineNumberFromPosition(change->OldEnd) + 1);
+    }
+    auto sent = gcnew SentLines();
+    sent->first = first;
+    sent->last = last;
+    sent->lines = GetLines(after, first,
+                           last + after->LineCount - before->LineCount);
+    sent_lines_->Enqueue(sent);
+    QueueSetLines(first, last, sent->lines);
+  }
+
+  void OnGotAggregateFocus(Object^ sender, EventArgs^ e)
+  {
+    focused_text_view_ = this;
+    if (buffer_ != 0)
+    {
+      MakeCurrent();
+    }
+  }
+
+  void OnClosed(Object^ sender, EventArgs^ e)
+  {
+    VSNVIM_TRACE_SCOPE(__FUNCTION__);
+    text_view_->TextBuffer->Changed -=
+      gcnew EventHandler<TextContentChangedEventArgs^>(
+        this, &RemoteTextView::OnChanged);
+    text_view_->GotAggregateFocus -=
+      gcnew EventHandler(this, &RemoteTextView::OnGotAggregateFocus);
+    text_view_->Closed -=
+      gcnew EventHandler(this, &RemoteTextView::OnClosed);
+    is_closed_ = true;
+    if (focused_text_view_ == this)
+    {
+      focused_text_view_ = nullptr;
+    }
+    if (buffer_ != 0)
+    {
+      text_views_->Remove(buffer_);
+      QueueBufferDelete(buffer_);
+      if (current_buffer_ == buffer_)
+      {
+        current_buffer_ = 0;
+      }
+      buffer_ = 0;
+    }
+  }
+
+  static void OnBufferCreatedAction(Int64 token, Int64 buffer)
+  {
+    VSNVIM_TRACE_SCOPE(__FUNCTION__);
+    RemoteTextView^ text_view;
+    if (!creating_text_views_->TryGetValue(token, text_view))
+    {
+      return;
+    }
+    creating_text_views_->Remove(token);
+    if (buffer == 0)
+    {
+      return;
+    }
+    if (text_view->is_closed_)
+    {
+      QueueBufferDelete(buffer);
+      return;
+    }
+    text_view->buffer_ = buffer;
+    text_views_[buffer] = text_view;
+    text_view->SendText();
+    if (focused_text_view_ == text_view)
+    {
+      text_view->MakeCurrent();
+    }
+  }
+
+  static void OnLinesEventAction(Int64 buffer, Int64 first, Int64 last,
+                                 array<String^>^ lines)
+  {
+    RemoteTextView^ text_view;
+    if (text_views_->TryGetValue(buffer, text_view))
+    {
+      text_view->ApplyLines(static_cast<int>(first), static_cast<int>(last),
+                            lines);
+    }
+  }
+
+  static void OnDetachAction(Int64 buffer)
+  {
+    // The buffer was deleted in Nvim, which leaves the view to Visual
+    // Studio.
+    RemoteTextView^ text_view;
+    if (text_views_->TryGetValue(buffer, text_view))
+    {
+      text_views_->Remove(buffer);
+      text_view->buffer_ = 0;
+      text_view->sent_lines_->Clear();
+    }
+  }
+
+  static void OnCursorAction(Int64 buffer, Int64 row, Int64 column)
+  {
+    current_buffer_ = buffer;
+    const auto text_view = focused_text_view_;
+    if (text_view && text_view->buffer_ == buffer)
+    {
+      text_view->MoveCaret(row, column);
+    }
+  }
+
+  static void OnBatchFailedAction(String^ message)
+  {
+    Debug::WriteLine(String::Format("VSNvim: nvim_call_atomic failed: {0}",
+                                    message));
+    // The calls after the failed one did not run, so their lines do not
+    // come back.
+    for each (auto text_view in text_views_->Values)
+    {
+      text_view->sent_lines_->Clear();
+    }
+  }
+
+public:
+  RemoteTextView(IWpfTextView^ text_view, bool is_read_only)
+    : text_view_(text_view),
+      is_read_only_(is_read_only),
+      sent_lines_(gcnew Queue<SentLines^>()),
+      cursor_position_(-1)
+  {
+    text_view_->TextBuffer->Changed +=
+      gcnew EventHandler<TextContentChangedEventArgs^>(
+        this, &RemoteTextView::OnChanged);
+    text_view_->GotAggregateFocus +=
+      gcnew EventHandler(this, &RemoteTextView::OnGotAggregateFocus);
+    text_view_->Closed +=
+      gcnew EventHandler(this, &RemoteTextView::OnClosed);
+    if (text_view_->HasAggregateFocus)
+    {
+      focused_text_view_ = this;
+    }
+    const auto token = ++next_token_;
+    creating_text_views_->Add(token, this);
+    RequestBuffer(token);
+  }
+
+  // Sends the calls queued so far in one nvim_call_atomic.
+  static void Flush()
+  {
+    if (pending_call_count_ == 0)
+    {
+      return;
+    }
+    SendCalls(pending_call_count_, pending_calls_.GetBuffer());
+    pending_calls_.Clear();
+    pending_call_count_ = 0;
+  }
+
+  static void SendInput(const std::string& notation)
+  {
+    VSNVIM_TRACE_SCOPE(__FUNCTION__);
+    const auto text_view = focused_text_view_;
+    if (text_view && text_view->buffer_ != 0)
+    {
+      text_view->MakeCurrent();
+      text_view->SendCaret();
+    }
+    // The keys act on the changes made in Visual Studio before them.
+    Flush();
+    SendKeys(notation);
+  }
+
+  // The Post methods are called on the RPC reader thread.
+  static void PostBufferCreated(Int64 token, Int64 buffer)
+  {
+    FrameScheduler::Post(FrameLane::Edits, nullptr,
+      gcnew Action<Int64, Int64>(&RemoteTextView::OnBufferCreatedAction),
+      token, buffer);
+  }
+
+  static void PostLinesEvent(Int64 buffer, Int64 first, Int64 last,
+                             array<String^>^ lines)
+  {
+    FrameScheduler::Post(FrameLane::Edits, nullptr,
+      gcnew Action<Int64, Int64, Int64, array<String^>^>(
+        &RemoteTextView::OnLinesEventAction),
+      buffer, first, last, lines);
+  }
+
+  static void PostDetach(Int64 buffer)
+  {
+    FrameScheduler::Post(FrameLane::Edits, nullptr,
+      gcnew Action<Int64>(&RemoteTextView::OnDetachAction), buffer);
+  }
+
+  static void PostCursor(Int64 buffer, Int64 row, Int64 column)
+  {
+    FrameScheduler::Post(FrameLane::Cursor, cursor_key_,
+      gcnew Action<Int64, Int64, Int64>(&RemoteTextView::OnCursorAction),
+      buffer, row, column);
+  }
+
+  static void PostBatchFailed(const std::string& message)
+  {
+    FrameScheduler::Post(FrameLane::Edits, nullptr,
+      gcnew Action<String^>(&RemoteTextView::OnBatchFailedAction),
+      ToManagedString(message));
+  }
+};
+
+static void RequestBuffer(Int64 token)
+{
+  MsgpackWriter params;
+  params.WriteArrayHeader(2);
+  params.WriteBoolean(true);
+  params.WriteBoolean(false);
+  rpc_client_->Request("nvim_create_buf", params,
+    [token](const MsgpackValue& error, const MsgpackValue& result)
+    {
+      if (!error.IsNil())
+      {
+        Debug::WriteLine(String::Format(
+          "VSNvim: nvim_create_buf failed: {0}",
+          ToManagedString(GetRpcErrorMessage(error))));
+      }
+      RemoteTextView::PostBufferCreated(
+        token, error.IsNil() ? result.GetInteger() : 0);
+    });
+}
+
+static void SendCalls(std::uint32_t count, const std::string& calls)
+{
+  MsgpackWriter params;
+  params.WriteArrayHeader(1);
+  params.WriteArrayHeader(count);
+  params.WriteRaw(calls);
+  rpc_client_->Request("nvim_call_atomic", params,
+    [](const MsgpackValue& error, const MsgpackValue& result)
+    {
+      // The result holds the results of the calls that ran and, if one
+      // failed, its index, type and message, which stops the rest.
+      if (!error.IsNil())
+      {
+        RemoteTextView::PostBatchFailed(GetRpcErrorMessage(error));
+      }
+      else if (result.items.size() == 2 && !result.items[1].IsNil())
+      {
+        const auto& failure = result.items[1].items;
+        RemoteTextView::PostBatchFailed(
+          failure.size() == 3 ? failure[2].bytes : std::string());
+      }
+    });
+}
+
+static void SendKeys(const std::string& notation)
+{
+  MsgpackWriter params;
+  params.WriteArrayHeader(1);
+  params.WriteString(notation);
+  rpc_client_->Notify("nvim_input", params);
+
+  // Asked for right after the keys, without waiting for them.
+  MsgpackWriter calls;
+  calls.WriteArrayHeader(1);
+  calls.WriteArrayHeader(2);
+  calls.WriteArrayHeader(2);
+  calls.WriteString("nvim_get_current_buf");
+  calls.WriteArrayHeader(0);
+  calls.WriteArrayHeader(2);
+  calls.WriteString("nvim_win_get_cursor");
+  calls.WriteArrayHeader(1);
+  calls.WriteInteger(0);
+  rpc_client_->Request("nvim_call_atomic", calls,
+    [](const MsgpackValue& error, const MsgpackValue& result)
+    {
+      if (!error.IsNil() || result.items.empty() ||
+          result.items[0].items.size() < 2)
+      {
+        return;
+      }
+      const auto& results = result.items[0].items;
+      const auto& cursor = results[1].items;
+      if (cursor.size() == 2)
+      {
+        RemoteTextView::PostCursor(results[0].GetInteger(),
+                                   cursor[0].integer, cursor[1].integer);
+      }
+    });
+}
+
+// Called on the RPC reader thread.
+static void OnNotification(const std::string& method,
+                           const MsgpackValue& params)
+{
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  const auto& items = params.items;
+  if (method == "nvim_buf_lines_event" && items.size() >= 5)
+  {
+    // The buffer, changedtick, first line, end of the replaced lines and
+    // the new lines.
+    const auto& line_values = items[4].items;
+    auto lines = gcnew array<String^>(static_cast<int>(line_values.size()));
+    for (auto i = 0; i < lines->Length; i++)
+    {
+      lines[i] = ToManagedString(line_values[i].bytes);
+    }
+    RemoteTextView::PostLinesEvent(items[0].GetInteger(), items[2].integer,
+                                   items[3].integer, lines);
+  }
+  else if (method == "nvim_buf_detach_event" && !items.empty())
+  {
+    RemoteTextView::PostDetach(items[0].GetInteger());
+  }
+}
+
+bool IsRemoteEngineEnabled()
+{
+  const auto engine = Environment::GetEnvironmentVariable("VSNVIM_ENGINE");
+  return engine &&
+         engine->Equals("embed", StringComparison::OrdinalIgnoreCase);
+}
+
+bool StartRemoteEngine()
+{
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  const auto path = Environment::GetEnvironmentVariable("VSNVIM_NVIM_PATH");
+  const std::vector<std::string> argv = {
+    path ? ToUtf8(path) : std::string("nvim"), "--embed", "--headless" };
+  auto rpc_client = std::make_unique<NvimRpcClient>();
+  if (!rpc_client->Start(argv, &OnNotification))
+  {
+    Debug::WriteLine(String::Format("VSNvim: could not start {0}",
+                                    ToManagedString(argv[0])));
+    return false;
+  }
+  rpc_client_ = rpc_client.release();
+  return true;
+}
+
+void AttachRemoteView(IWpfTextView^ text_view, bool is_read_only)
+{
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  gcnew RemoteTextView(text_view, is_read_only);
+}
+
+void SendRemoteInput(const std::string& notation)
+{
+  RemoteTextView::SendInput(notation);
+}
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+
+namespace VSNvim
+{
+// Whether VSNVIM_ENGINE is "embed", in which case Nvim runs as a child
+// process started with --embed instead of on a thread of Visual Studio, and
+// the views talk to it over msgpack-RPC.
+bool IsRemoteEngineEnabled();
+
+// Starts the child Nvim, which is VSNVIM_NVIM_PATH or the nvim on the
+// path. Returns false if it could not be started. Called on the UI thread.
+bool StartRemoteEngine();
+
+// Creates a buffer in the child Nvim for a view and keeps the two in sync.
+// A read-only buffer follows the view but is not modifiable in Nvim.
+// Called on the UI thread.
+void AttachRemoteView(
+  Microsoft::VisualStudio::Text::Editor::IWpfTextView^ text_view,
+  bool is_read_only);
+
+// Sends keys to the child Nvim and moves the caret of the focused view to
+// where they leave the cursor. Called on the UI thread.
+void SendRemoteInput(const std::string& notation);
+}
@@ -0,0 +1,374 @@
+#include "SearchLiteral.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace VSNvim
+{
+static char FoldCase(char c)
+{
+  return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+static bool IsContinuationByte(char c)
+{
+  return (static_cast<unsigned char>(c) & 0xc0) == 0x80;
+}
+
+// Removes the last character of the run, which a quantifier made optional.
+static void PopCharacter(std::string& run)
+{
+  while (!run.empty() && IsContinuationByte(run.back()))
+  {
+    run.pop_back();
+  }
+  if (!run.empty())
+  {
+    run.pop_back();
+  }
+}
+
+static bool HasUppercase(std::string_view pattern)
+{
+  for (std::size_t i = 0; i < pattern.size(); i++)
+  {
+    if (pattern[i] == '\\')
+    {
+      i++;
+    }
+    else if (pattern[i] >= 'A' && pattern[i] <= 'Z')
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns the end of the character class that starts at the position, or
+// npos if it is not closed.
+static std::size_t SkipCharacterClass(std::string_view pattern,
+                                      std::size_t start)
+{
+  auto i = start + 1;
+  if (i < pattern.size() && pattern[i] == '^')
+  {
+    i++;
+  }
+  if (i < pattern.size() && pattern[i] == ']')
+  {
+    i++;
+  }
+  for (; i < pattern.size(); i++)
+  {
+    if (pattern[i] == '\\')
+    {
+      i++;
+    }
+    else if (pattern[i] == ']')
+    {
+      return i + 1;
+    }
+  }
+  return std::string_view::npos;
+}
+
+bool ExtractSearchLiteral(std::string_view pattern, bool magic,
+                          bool ignore_case, bool smart_case,
+                          SearchLiteral& literal)
+{
+  // The longest run of plain characters outside of groups. The runs are
+  // concatenated, so every match contains each of them.
+  std::string best;
+  std::string run;
+  // Without 'magic' or after \M or \V, *, ., [ and ~ are only special
+  // after a backslash.
+  auto is_nomagic = !magic;
+  // After \V, ^ and $ are only anchors after a backslash.
+  auto is_very_nomagic = false;
+  auto is_at_start = true;
+  auto group_depth = 0;
+  auto case_flag = 0;
+  const auto end_run = [&]()
+  {
+    if (group_depth == 0 && run.size() > best.size())
+    {
+      best = run;
+    }
+    run.clear();
+  };
+  const auto add = [&](char c)
+  {
+    if (group_depth == 0)
+    {
+      run += c;
+    }
+  };
+
+  for (std::size_t i = 0; i < pattern.size(); i++)
+  {
+    const auto c = pattern[i];
+    const auto was_at_start = is_at_start;
+    is_at_start = false;
+    if (c != '\\')
+    {
+      const auto is_special = !is_nomagic &&
+        (c == '*' || c == '.' || c == '[' || c == '~');
+      const auto is_anchor = !is_very_nomagic &&
+        ((c == '^' && was_at_start) ||
+         (c == '$' && i + 1 == pattern.size()));
+      if (is_anchor)
+      {
+        end_run();
+      }
+      else if (!is_special)
+      {
+        add(c);
+      }
+      else if (c == '*')
+      {
+        PopCharacter(run);
+        end_run();
+      }
+      else if (c == '[')
+      {
+        end_run();
+        const auto class_end = SkipCharacterClass(pattern, i);
+        if (class_end == std::string_view::npos)
+        {
+          return false;
+        }
+        i = class_end - 1;
+      }
+      else
+      {
+        end_run();
+      }
+      continue;
+    }
+
+    if (++i == pattern.size())
+    {
+      return false;
+    }
+    const auto escaped = pattern[i];
+    switch (escaped)
+    {
+    case '\\':
+    case '/':
+    case ']':
+      add(escaped);
+      break;
+    case '^':
+    case '$':
+      if (is_very_nomagic)
+      {
+        end_run();
+      }
+      else
+      {
+        add(escaped);
+      }
+      break;
+    case '.':
+    case '*':
+    case '[':
+    case '~':
+      if (!is_nomagic)
+      {
+        add(escaped);
+      }
+      else if (escaped == '*')
+      {
+        PopCharacter(run);
+        end_run();
+      }
+      else if (escaped == '[')
+      {
+        end_run();
+        const auto class_end = SkipCharacterClass(pattern, i);
+        if (class_end == std::string_view::npos)
+        {
+          return false;
+        }
+        i = class_end - 1;
+      }
+      else
+      {
+        end_run();
+      }
+      break;
+    case 't':
+      add('\t');
+      break;
+    case 'e':
+      add('\x1b');
+      break;
+    case 'r':
+      add('\r');
+      break;
+    case 'c':
+    case 'C':
+      case_flag = escaped == 'c' ? 1 : -1;
+      is_at_start = was_at_start;
+      break;
+    case 'm':
+    case 'M':
+    case 'V':
+      is_nomagic = escaped != 'm';
+      is_very_nomagic = escaped == 'V';
+      is_at_start = was_at_start;
+      break;
+    case '+':
+    case '=':
+    case '?':
+    case '@':
+      PopCharacter(run);
+      end_run();
+      if (escaped == '@')
+      {
+        // The lookaround kinds are \@=, \@!, \@>, \@<= and \@<!.
+        while (i + 1 < pattern.size() &&
+               std::strchr("0123456789<=!>", pattern[i + 1]))
+        {
+          i++;
+        }
+      }
+      break;
+    case '{':
+      PopCharacter(run);
+      end_run();
+      while (i < pattern.size() && pattern[i] != '}')
+      {
+        i++;
+      }
+      break;
+    case '(':
+      end_run();
+      group_depth++;
+      break;
+    case ')':
+      end_run();
+      if (--group_depth < 0)
+      {
+        return false;
+      }
+      break;
+    case '%':
+      // Only non-capturing groups are understood.
+      if (i + 1 < pattern.size() && pattern[i + 1] == '(')
+      {
+        end_run();
+        group_depth++;
+        i++;
+        break;
+      }
+      return false;
+    case '|':
+    case '&':
+    case 'n':
+    case '_':
+    case 'z':
+    case 'v':
+    case 'Z':
+      return false;
+    default:
+      // Character classes, word boundaries and back references.
+      end_run();
+      break;
+    }
+  }
+  if (group_depth)
+  {
+    return false;
+  }
+  end_run();
+  if (best.empty())
+  {
+    return false;
+  }
+
+  literal.ignore_case = case_flag
+    ? case_flag > 0
+    : ignore_case && !(smart_case && HasUppercase(pattern));
+  if (literal.ignore_case)
+  {
+    // Vim folds the case of every letter, so only ASCII is handled.
+    if (std::any_of(best.begin(), best.end(),
+                    [](char c) { return static_cast<unsigned char>(c) >= 0x80; }))
+    {
+      return false;
+    }
+    std::transform(best.begin(), best.end(), best.begin(), &FoldCase);
+  }
+  literal.text = std::move(best);
+  return true;
+}
+
+const char* FindSearchLiteral(const char* first, const char* last,
+                              const SearchLiteral& literal)
+{
+  const auto& text = literal.text;
+  if (static_cast<std::size_t>(last - first) < text.size())
+  {
+    return nullptr;
+  }
+  if (literal.ignore_case)
+  {
+    // Both cases of the first letter are looked for with memchr, and the
+    // earlier of the two is compared.
+    const auto lower = text[0];
+    const auto upper = lower >= 'a' && lower <= 'z'
+      ? static_cast<char>(lower - 'a' + 'A')
+      : lower;
+    const auto size = text.size();
+    const auto find = [&](const char* p, char c)
+    {
+      return static_cast<std::size_t>(last - p) < size
+        ? nullptr
+        : static_cast<const char*>(
+            std::memchr(p, c, (last - p) - size + 1));
+    };
+    auto next_lower = find(first, lower);
+    auto next_upper = upper != lower ? find(first, upper) : nullptr;
+    while (next_lower || next_upper)
+    {
+      const auto p = !next_upper || (next_lower && next_lower < next_upper)
+        ? next_lower
+        : next_upper;
+      if (std::equal(p + 1, p + size, text.begin() + 1,
+                     [](char a, char b) { return FoldCase(a) == b; }))
+      {
+        return p;
+      }
+      if (p == next_lower)
+      {
+        next_lower = find(p + 1, lower);
+      }
+      else
+      {
+        next_upper = find(p + 1, upper);
+      }
+    }
+    return nullptr;
+  }
+
+  // memchr is vectorized by the C runtime, so the scan mostly runs at
+  // memory speed and only the positions of the first byte are compared.
+  const auto first_byte = text[0];
+  const auto size = text.size();
+  for (auto p = first; static_cast<std::size_t>(last - p) >= size; p++)
+  {
+    p = static_cast<const char*>(
+      std::memchr(p, first_byte, (last - p) - size + 1));
+    if (!p)
+    {
+      return nullptr;
+    }
+    if (std::memcmp(p + 1, text.data() + 1, size - 1) == 0)
+    {
+      return p;
+    }
+  }
+  return nullptr;
+}
+} // namespace VSNvim
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace VSNvim
+{
+// A string that every match of a search pattern contains. Lines without it
+// cannot match, so they are skipped without running the regex engine.
+struct SearchLiteral
+{
+  std::string text;
+  // Only ASCII letters are folded.
+  bool ignore_case = false;
+};
+
+// Extracts the literal of a Vim search pattern with the 'magic',
+// 'ignorecase' and 'smartcase' options. Returns false if the pattern has
+// no literal that every match contains, e.g. because of an alternation, a
+// multi-line item or a leading character class.
+bool ExtractSearchLiteral(std::string_view pattern, bool magic,
+                          bool ignore_case, bool smart_case,
+                          SearchLiteral& literal);
+
+// Returns the first occurrence of the literal in [first, last), or null.
+const char* FindSearchLiteral(const char* first, const char* last,
+                              const SearchLiteral& literal);
+} // namespace VSNvim
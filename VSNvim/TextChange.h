@@ -0,0 +1,36 @@
+#pragma once
+
+namespace VSNvim
+{
+// A position in Nvim's coordinates: the line starts at one and the column
+// is a byte offset into the UTF-8 line.
+struct MarkPosition
+{
+  int line;
+  int col;
+
+  bool operator==(const MarkPosition& other) const
+  {
+    return line == other.line && col == other.col;
+  }
+
+  bool operator!=(const MarkPosition& other) const
+  {
+    return !(*this == other);
+  }
+
+  bool operator<(const MarkPosition& other) const
+  {
+    return line < other.line || (line == other.line && col < other.col);
+  }
+};
+
+// A change that replaced the text in [start, old_end) with text that ends
+// at new_end.
+struct TextChange
+{
+  MarkPosition start;
+  MarkPosition old_end;
+  MarkPosition new_end;
+};
+}
@@ -2,9 +2,12 @@
 
 #include <vcclr.h>
 #include <memory>
-#include <unordered_map>
 
 #include "nvim.h"
+#include "AttachPolicy.h"
+#include "KeyTranslator.h"
+#include "RemoteNvimEngine.h"
+#include "Trace.h"
 #include "VSNvimBridge.h"
 #include "VSNvimTextView.h"
 #include "VSNvimPackage.h"
@@ -15,71 +18,18 @@ using namespace Microsoft::VisualStudio::TextManager::Interop;
 
 namespace VSNvim
 {
-static std::unordered_map<int, std::string> special_keys_
-{
-  {VK_BACK, "<BS>"},
-  {VK_TAB, "<Tab>"},
-  {VK_RETURN, "<Return>"},
-  {VK_ESCAPE, "<Esc>"},
-  {VK_SPACE, "<Space>"},
-  {VK_UP, "<Up>"},
-  {VK_DOWN, "<Down>"},
-  {VK_LEFT, "<Left>"},
-  {VK_RIGHT, "<Right>"},
-  {VK_F1, "<F1>"},
-  {VK_F2, "<F2>"},
-  {VK_F3, "<F3>"},
-  {VK_F4, "<F4>"},
-  {VK_F5, "<F5>"},
-  {VK_F6, "<F6>"},
-  {VK_F7, "<F7>"},
-  {VK_F8, "<F8>"},
-  {VK_F9, "<F9>"},
-  {VK_F10, "<F10>"},
-  {VK_F11, "<F11>"},
-  {VK_F12, "<F12>"},
-  {VK_F13, "<F13>"},
-  {VK_F14, "<F14>"},
-  {VK_F15, "<F15>"},
-  {VK_F16, "<F16>"},
-  {VK_F17, "<F17>"},
-  {VK_F18, "<F18>"},
-  {VK_F19, "<F19>"},
-  {VK_F20, "<F10>"},
-  {VK_F21, "<F21>"},
-  {VK_F22, "<F22>"},
-  {VK_F23, "<F23>"},
-  {VK_F24, "<F24>"},
-  {VK_HELP, "<Help>"},
-  {VK_INSERT, "<Insert>"},
-  {VK_HOME, "<Home>"},
-  {VK_END, "<End>"},
-  {VK_PRIOR, "<PageUp>"},
-  {VK_NEXT, "<PageDown>"},
-  {VK_ADD, "<kPlus>"},
-  {VK_SUBTRACT, "<kMinus>"},
-  {VK_MULTIPLY, "<kMultiply>"},
-  {VK_DIVIDE, "<kDivide>"},
-  {VK_DECIMAL, "<kPoint>"},
-  {VK_NUMPAD0, "<k0>"},
-  {VK_NUMPAD1, "<k1>"},
-  {VK_NUMPAD2, "<k2>"},
-  {VK_NUMPAD3, "<k3>"},
-  {VK_NUMPAD4, "<k4>"},
-  {VK_NUMPAD5, "<k5>"},
-  {VK_NUMPAD6, "<k6>"},
-  {VK_NUMPAD7, "<k7>"},
-  {VK_NUMPAD8, "<k8>"},
-  {VK_NUMPAD9, "<k9>"},
-};
+static KeyTranslator key_translator_;
 
 HHOOK keyboard_hook_;
 bool is_text_view_focused_ = false;
 bool is_nvim_running = false;
+// Whether Nvim runs as a child process, see IsRemoteEngineEnabled.
+static bool is_remote_engine_ = false;
 
 static LRESULT CALLBACK KeyboardHookHandler(
   int code, WPARAM w_param, LPARAM l_param)
 {
+  VSNVIM_TRACE_SCOPE("KeyboardHookHandler");
   struct KeyFlags
   {
     unsigned int RepCnt : 16;
@@ -96,32 +46,20 @@ static LRESULT CALLBACK KeyboardHookHandler(
   {
     return CallNextHookEx(keyboard_hook_, code, w_param, l_param);
   }
-  if (const auto special_key = special_keys_.find(w_param);
-      special_key != special_keys_.end())
+  const auto notation = key_translator_.Translate(
+    static_cast<unsigned int>(w_param), key_flags->ScanCode,
+    KeyTranslator::GetModifiers(), GetKeyboardLayout(0));
+  if (notation.empty())
   {
-    VSNvim::SendInput(std::make_unique<std::string>(special_key->second));
-    return 1;
+    return CallNextHookEx(keyboard_hook_, code, w_param, l_param);
   }
-  BYTE keyboard_state_[256];
-  GetKeyboardState(keyboard_state_);
-  WCHAR awAnsiCode[2];
-  const auto utf16_chars =
-    ToUnicode(w_param, key_flags->ScanCode, keyboard_state_, awAnsiCode,
-                  sizeof(awAnsiCode), 0);
-  if (utf16_chars)
+  if (is_remote_engine_)
   {
-    char utf8_chars[10];
-    const auto utf8_len
-        = WideCharToMultiByte(CP_UTF8, 0, awAnsiCode, utf16_chars, utf8_chars,
-                              sizeof(utf8_chars), NULL, NULL);
-    if (!utf8_len)
-    {
-      return CallNextHookEx(keyboard_hook_, code, w_param, l_param);
-    }
-    VSNvim::SendInput(std::make_unique<std::string>(utf8_chars));
+    SendRemoteInput(notation);
     return 1;
   }
-  return CallNextHookEx(keyboard_hook_, code, w_param, l_param);
+  VSNvim::SendInput(std::make_unique<std::string>(notation));
+  return 1;
 }
 
 void StartNvim()
@@ -142,18 +80,102 @@ static void OnKeyboardFocusedChanged(System::Object^ sender,
   is_text_view_focused_ = static_cast<bool>(e.NewValue);
 }
 
+// Creates the buffer of a view attached lazily when the view first gets
+// the focus.
+ref class LazyAttachHandler
+{
+private:
+  IWpfTextView^ text_view_;
+  AttachDecision* decision_;
+
+public:
+  LazyAttachHandler(IWpfTextView^ text_view, const AttachDecision& decision)
+    : text_view_(text_view),
+      decision_(new AttachDecision(decision))
+  {
+    text_view_->GotAggregateFocus +=
+      gcnew System::EventHandler(this, &LazyAttachHandler::OnGotAggregateFocus);
+  }
+
+  !LazyAttachHandler()
+  {
+    delete decision_;
+    decision_ = nullptr;
+  }
+
+  void OnGotAggregateFocus(System::Object^ sender, System::EventArgs^ e)
+  {
+    VSNVIM_TRACE_SCOPE(__FUNCTION__);
+    text_view_->GotAggregateFocus -=
+      gcnew System::EventHandler(this, &LazyAttachHandler::OnGotAggregateFocus);
+    const auto visual_element = text_view_->VisualElement;
+    visual_element->IsKeyboardFocusedChanged +=
+      gcnew System::Windows::DependencyPropertyChangedEventHandler(
+        &OnKeyboardFocusedChanged);
+    is_text_view_focused_ = visual_element->IsKeyboardFocused;
+    auto decision = *decision_;
+    delete decision_;
+    decision_ = nullptr;
+    decision.requested = System::Diagnostics::Stopwatch::GetTimestamp();
+    VSNvim::CreateBuffer(
+      std::make_unique<gcroot<IWpfTextView^>>(text_view_),
+      std::move(decision));
+  }
+};
+
 void TextViewCreationListener::TextViewCreated(IWpfTextView^ text_view)
 {
-  text_view->VisualElement->IsKeyboardFocusedChanged +=
-    gcnew System::Windows::DependencyPropertyChangedEventHandler(
-      &OnKeyboardFocusedChanged);
+  // The policy is applied before anything is queued, so views that are not
+  // attached, or not yet, cost Nvim nothing.
+  const auto decision = DecideAttachMode(text_view);
+  CountView(decision);
+  if (!is_nvim_running && !is_remote_engine_ && IsRemoteEngineEnabled())
+  {
+    // If the child cannot be started, Nvim runs in process as usual.
+    SetTraceThreadName("UI");
+    is_remote_engine_ = StartRemoteEngine();
+    if (is_remote_engine_)
+    {
+      keyboard_hook_ = SetWindowsHookEx(WH_KEYBOARD, &KeyboardHookHandler,
+                                        NULL, GetCurrentThreadId());
+    }
+  }
+  if (is_remote_engine_)
+  {
+    // Lazy views are attached at once too, since the child's buffers do
+    // not take memory from Visual Studio.
+    if (decision.mode != AttachMode::None)
+    {
+      text_view->VisualElement->IsKeyboardFocusedChanged +=
+        gcnew System::Windows::DependencyPropertyChangedEventHandler(
+          &OnKeyboardFocusedChanged);
+      AttachRemoteView(text_view, decision.mode == AttachMode::ReadOnly);
+    }
+    return;
+  }
+  if (decision.mode == AttachMode::Lazy && is_nvim_running)
+  {
+    gcnew LazyAttachHandler(text_view, decision);
+    return;
+  }
+  if (decision.mode != AttachMode::None)
+  {
+    text_view->VisualElement->IsKeyboardFocusedChanged +=
+      gcnew System::Windows::DependencyPropertyChangedEventHandler(
+        &OnKeyboardFocusedChanged);
+  }
 
   if (is_nvim_running)
   {
-    VSNvim::CreateBuffer(std::make_unique<gcroot<IWpfTextView^>>(text_view));
+    if (decision.mode != AttachMode::None)
+    {
+      VSNvim::CreateBuffer(
+        std::make_unique<gcroot<IWpfTextView^>>(text_view), decision);
+    }
     return;
   }
 
+  SetTraceThreadName("UI");
   keyboard_hook_ = SetWindowsHookEx(WH_KEYBOARD, &KeyboardHookHandler, NULL,
                                     GetCurrentThreadId());
 
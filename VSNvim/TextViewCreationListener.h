@@ -18,6 +18,10 @@ public:
   [System::ComponentModel::Composition::Import]
   Microsoft::VisualStudio::Shell::SVsServiceProvider^ service_provider_;
 
+  [System::ComponentModel::Composition::Import]
+  Microsoft::VisualStudio::Text::Outlining::
+    IOutliningManagerService^ outlining_manager_service_;
+
   [System::ComponentModel::Composition::Import]
   Microsoft::VisualStudio::Editor
     ::IVsEditorAdaptersFactoryService^ editor_adaptor_;
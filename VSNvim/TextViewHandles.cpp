@@ -0,0 +1,121 @@
+#include "TextViewHandles.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vcclr.h>
+#include <vector>
+
+#include "Trace.h"
+#include "VSNvimBridge.h"
+#include "VSNvimTextView.h"
+
+using namespace System;
+
+namespace VSNvim
+{
+// A handle packs the slot index in its low bits and the generation above
+// them, in 32 bits so that it fits a pointer on x86 too. A slot's
+// generation is odd while a view is stored in it and even while it is free,
+// so handles are never null.
+static constexpr unsigned int index_bits_ = 12;
+static constexpr std::uintptr_t slot_count_ = std::uintptr_t(1) << index_bits_;
+static constexpr std::uintptr_t index_mask_ = slot_count_ - 1;
+static constexpr std::uintptr_t generation_mask_ =
+  (std::uintptr_t(1) << (32 - index_bits_)) - 1;
+
+struct TextViewSlot
+{
+  volatile LONG generation;
+  // Created the first time the slot is used and kept after that, so readers
+  // never see it freed.
+  gcroot<VSNvimTextView^>* root;
+};
+
+static TextViewSlot slots_[slot_count_];
+// The slots that were used and released, and the number of slots used so
+// far. Only used on the Nvim thread.
+static std::vector<std::uint32_t> free_indices_;
+static std::uint32_t used_slot_count_;
+
+void* CreateTextViewHandle(VSNvimTextView^ text_view)
+{
+  std::uint32_t index;
+  if (!free_indices_.empty())
+  {
+    index = free_indices_.back();
+    free_indices_.pop_back();
+  }
+  else if (used_slot_count_ < slot_count_)
+  {
+    index = used_slot_count_++;
+  }
+  else
+  {
+    ReportError(std::make_unique<std::string>(
+      "VSNvim: more than " + std::to_string(slot_count_) +
+      " views are open, Nvim does not edit this one"));
+    return nullptr;
+  }
+
+  auto& slot = slots_[index];
+  if (!slot.root)
+  {
+    slot.root = new gcroot<VSNvimTextView^>();
+  }
+  *slot.root = text_view;
+  // The increment is a full barrier, so the view is visible before the
+  // generation that makes handles to it valid.
+  const auto generation =
+    static_cast<std::uintptr_t>(InterlockedIncrement(&slot.generation));
+  return reinterpret_cast<void*>(
+    ((generation & generation_mask_) << index_bits_) | index);
+}
+
+void ReleaseTextViewHandle(void* handle)
+{
+  const auto value = reinterpret_cast<std::uintptr_t>(handle);
+  const auto index = static_cast<std::uint32_t>(value & index_mask_);
+  auto& slot = slots_[index];
+  if (!handle || LookupTextView(handle) == nullptr)
+  {
+    return;
+  }
+  InterlockedIncrement(&slot.generation);
+  *slot.root = nullptr;
+  free_indices_.push_back(index);
+}
+
+VSNvimTextView^ LookupTextView(void* handle)
+{
+  VSNVIM_TRACE_SCOPE("LookupTextView");
+  const auto value = reinterpret_cast<std::uintptr_t>(handle);
+  const auto& slot = slots_[value & index_mask_];
+  // Volatile reads have acquire semantics, so the view is read after the
+  // first generation and before the second. If the slot was released or
+  // reused in between, the generations differ.
+  const auto generation = slot.generation;
+  if (!value || (generation & 1) == 0 ||
+      (static_cast<std::uintptr_t>(generation) & generation_mask_) !=
+        value >> index_bits_)
+  {
+    return nullptr;
+  }
+  VSNvimTextView^ text_view = *slot.root;
+  if (slot.generation != generation)
+  {
+    return nullptr;
+  }
+  return text_view;
+}
+
+VSNvimTextView^ GetBufferTextView(const nvim::buf_T* buffer)
+{
+  return LookupTextView(buffer->vsnvim_data);
+}
+
+std::size_t GetTextViewHandleSize()
+{
+  return sizeof(TextViewSlot) + sizeof(gcroot<VSNvimTextView^>);
+}
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+
+#include "nvim.h"
+
+namespace VSNvim
+{
+ref class VSNvimTextView;
+
+// The handles stored in buf_T::vsnvim_data. A handle names a slot of a
+// fixed-size table and the generation the slot had when the handle was
+// created. Releasing a handle moves its slot to the next generation, so a
+// handle that outlives its view is rejected instead of reaching a freed
+// object. Each slot keeps one GC handle for its whole life and only changes
+// its target.
+
+// Returns a handle to the view. If every slot is in use, reports an error
+// in Nvim and returns nullptr. Called on the Nvim thread.
+void* CreateTextViewHandle(VSNvimTextView^ text_view);
+
+// Makes the handle stale. Called on the Nvim thread.
+void ReleaseTextViewHandle(void* handle);
+
+// Returns the view of the handle, or nullptr if the handle is null or stale.
+// Takes no lock and may be called on any thread.
+VSNvimTextView^ LookupTextView(void* handle);
+
+// Returns the view attached to the buffer, or nullptr if there is none.
+VSNvimTextView^ GetBufferTextView(const nvim::buf_T* buffer);
+
+// Returns the number of bytes a handle holds in the table.
+std::size_t GetTextViewHandleSize();
+}
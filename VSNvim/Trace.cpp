@@ -0,0 +1,255 @@
+#include "Trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace VSNvim
+{
+volatile bool is_tracing_enabled_ = false;
+
+namespace
+{
+constexpr std::uint64_t ring_capacity_ = 1 << 14;
+// Threads beyond this many are not traced, so a thread pool that keeps
+// creating threads cannot use up memory.
+constexpr std::size_t max_rings_ = 64;
+
+// An event slot. The sequence number is that of the event plus one, or zero
+// while the slot is written, so a reader can tell a slot it read while the
+// owning thread overwrote it.
+struct TraceSlot
+{
+  std::atomic<std::uint64_t> sequence{ 0 };
+  std::atomic<const char*> name{ nullptr };
+  std::atomic<std::uint64_t> start{ 0 };
+  // The value of a counter.
+  std::atomic<std::uint64_t> duration{ 0 };
+  std::atomic<bool> is_counter{ false };
+};
+
+struct TraceRing
+{
+  TraceSlot slots[ring_capacity_];
+  // The number of events the thread recorded. Only the thread writes it.
+  std::atomic<std::uint64_t> head{ 0 };
+  // Events before this one were cleared.
+  std::atomic<std::uint64_t> cleared{ 0 };
+  std::atomic<const char*> thread_name{ nullptr };
+  int thread_id = 0;
+};
+
+struct TraceEvent
+{
+  const char* name;
+  std::uint64_t start;
+  std::uint64_t duration;
+  bool is_counter;
+};
+
+std::mutex rings_mutex_;
+std::vector<std::unique_ptr<TraceRing>> rings_;
+thread_local TraceRing* thread_ring_ = nullptr;
+thread_local bool is_thread_untraced_ = false;
+thread_local const char* thread_name_ = nullptr;
+
+TraceRing* GetThreadRing()
+{
+  if (thread_ring_ || is_thread_untraced_)
+  {
+    return thread_ring_;
+  }
+  std::lock_guard<std::mutex> lock(rings_mutex_);
+  if (rings_.size() == max_rings_)
+  {
+    is_thread_untraced_ = true;
+    return nullptr;
+  }
+  rings_.push_back(std::make_unique<TraceRing>());
+  thread_ring_ = rings_.back().get();
+  thread_ring_->thread_id = static_cast<int>(rings_.size());
+  thread_ring_->thread_name.store(thread_name_, std::memory_order_relaxed);
+  return thread_ring_;
+}
+
+// Copies the events of a ring that are not being overwritten.
+void ReadRing(const TraceRing& ring, std::vector<TraceEvent>& events)
+{
+  const auto head = ring.head.load(std::memory_order_acquire);
+  auto first = head > ring_capacity_ ? head - ring_capacity_ : 0;
+  first = (std::max)(first, ring.cleared.load(std::memory_order_relaxed));
+  for (auto index = first; index < head; index++)
+  {
+    const auto& slot = ring.slots[index % ring_capacity_];
+    if (slot.sequence.load(std::memory_order_acquire) != index + 1)
+    {
+      continue;
+    }
+    const TraceEvent event
+    {
+      slot.name.load(std::memory_order_relaxed),
+      slot.start.load(std::memory_order_relaxed),
+      slot.duration.load(std::memory_order_relaxed),
+      slot.is_counter.load(std::memory_order_relaxed)
+    };
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.sequence.load(std::memory_order_relaxed) == index + 1)
+    {
+      events.push_back(event);
+    }
+  }
+}
+
+void WriteJsonString(std::ostream& stream, const char* text)
+{
+  stream << '"';
+  for (auto c = text; *c; c++)
+  {
+    const auto byte = static_cast<unsigned char>(*c);
+    if (byte == '"' || byte == '\\')
+    {
+      stream << '\\' << *c;
+    }
+    else if (byte < 0x20)
+    {
+      static const char digits[] = "0123456789abcdef";
+      stream << "\\u00" << digits[byte >> 4] << digits[byte & 0xf];
+    }
+    else
+    {
+      stream << *c;
+    }
+  }
+  stream << '"';
+}
+
+// Writes nanoseconds as the microseconds the format expects.
+void WriteMicroseconds(std::ostream& stream, std::uint64_t nanoseconds)
+{
+  const auto fraction = nanoseconds % 1000;
+  stream << nanoseconds / 1000 << '.' << fraction / 100
+         << fraction / 10 % 10 << fraction % 10;
+}
+} // namespace
+
+std::uint64_t GetTraceTime()
+{
+  // Zero means that the scope is not traced.
+  return static_cast<std::uint64_t>(
+    std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count()) | 1;
+}
+
+namespace
+{
+void WriteSlot(const char* name, std::uint64_t start, std::uint64_t duration,
+               bool is_counter)
+{
+  const auto ring = GetThreadRing();
+  if (!ring)
+  {
+    return;
+  }
+  const auto index = ring->head.load(std::memory_order_relaxed);
+  auto& slot = ring->slots[index % ring_capacity_];
+  slot.sequence.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.name.store(name, std::memory_order_relaxed);
+  slot.start.store(start, std::memory_order_relaxed);
+  slot.duration.store(duration, std::memory_order_relaxed);
+  slot.is_counter.store(is_counter, std::memory_order_relaxed);
+  slot.sequence.store(index + 1, std::memory_order_release);
+  ring->head.store(index + 1, std::memory_order_release);
+}
+} // namespace
+
+void RecordTraceEvent(const char* name, std::uint64_t start)
+{
+  const auto end = GetTraceTime();
+  WriteSlot(name, start, end - start, false);
+}
+
+void RecordTraceCounter(const char* name, std::int64_t value)
+{
+  if (is_tracing_enabled_)
+  {
+    WriteSlot(name, GetTraceTime(), static_cast<std::uint64_t>(value), true);
+  }
+}
+
+void SetTracingEnabled(bool is_enabled)
+{
+  is_tracing_enabled_ = is_enabled;
+}
+
+void SetTraceThreadName(const char* name)
+{
+  // The ring is only allocated once the thread records an event.
+  thread_name_ = name;
+  if (thread_ring_)
+  {
+    thread_ring_->thread_name.store(name, std::memory_order_relaxed);
+  }
+}
+
+void ClearTrace()
+{
+  std::lock_guard<std::mutex> lock(rings_mutex_);
+  for (const auto& ring : rings_)
+  {
+    ring->cleared.store(ring->head.load(std::memory_order_acquire),
+                        std::memory_order_relaxed);
+  }
+}
+
+std::size_t WriteChromeTrace(std::ostream& stream)
+{
+  std::size_t count = 0;
+  std::vector<TraceEvent> events;
+  std::lock_guard<std::mutex> lock(rings_mutex_);
+  stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  auto is_first = true;
+  for (const auto& ring : rings_)
+  {
+    if (const auto thread_name =
+          ring->thread_name.load(std::memory_order_relaxed))
+    {
+      stream << (is_first ? "\n" : ",\n")
+             << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+             << ring->thread_id << ",\"args\":{\"name\":";
+      WriteJsonString(stream, thread_name);
+      stream << "}}";
+      is_first = false;
+    }
+
+    events.clear();
+    ReadRing(*ring, events);
+    for (const auto& event : events)
+    {
+      stream << (is_first ? "\n" : ",\n") << "{\"name\":";
+      WriteJsonString(stream, event.name);
+      stream << ",\"ph\":\"" << (event.is_counter ? 'C' : 'X')
+             << "\",\"pid\":1,\"tid\":" << ring->thread_id << ",\"ts\":";
+      WriteMicroseconds(stream, event.start);
+      if (event.is_counter)
+      {
+        stream << ",\"args\":{\"value\":"
+               << static_cast<std::int64_t>(event.duration) << "}}";
+      }
+      else
+      {
+        stream << ",\"dur\":";
+        WriteMicroseconds(stream, event.duration);
+        stream << '}';
+      }
+      is_first = false;
+    }
+    count += events.size();
+  }
+  stream << "\n]}\n";
+  return count;
+}
+} // namespace VSNvim
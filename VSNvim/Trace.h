@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+namespace VSNvim
+{
+// Scoped trace events recorded into a fixed-size ring buffer per thread.
+// The oldest events of a thread are overwritten once its ring is full.
+// Recording takes no lock, and a disabled trace point costs a load and a
+// branch. The core is plain C++ so it does not depend on the CLR.
+//
+// Trace.cpp is compiled without /clr, since it uses <atomic>. The flag is
+// read by the trace points of managed code, so it is a volatile bool; a
+// thread that sees it late only records a few events more or less.
+extern volatile bool is_tracing_enabled_;
+
+// Returns a monotonic timestamp in nanoseconds.
+std::uint64_t GetTraceTime();
+
+// Records an event that started at the timestamp and ends now. The name
+// must be a string with static storage duration, e.g. a literal.
+void RecordTraceEvent(const char* name, std::uint64_t start);
+
+// Records the value of a counter, e.g. a rate or a size, which the trace
+// viewer plots over time. Does nothing while tracing is disabled. The name
+// must be a string with static storage duration.
+void RecordTraceCounter(const char* name, std::int64_t value);
+
+void SetTracingEnabled(bool is_enabled);
+
+// Names the calling thread in the exported trace. The name must be a
+// string with static storage duration.
+void SetTraceThreadName(const char* name);
+
+// Discards the recorded events of every thread.
+void ClearTrace();
+
+// Writes the recorded events in the Chrome trace event format, which
+// chrome://tracing and Perfetto open. Returns the number of events written.
+std::size_t WriteChromeTrace(std::ostream& stream);
+
+// Records the time from its construction to its destruction.
+class TraceScope
+{
+private:
+  const char* name_;
+  std::uint64_t start_;
+
+public:
+  explicit TraceScope(const char* name)
+    : name_(name), start_(is_tracing_enabled_ ? GetTraceTime() : 0)
+  {
+  }
+
+  ~TraceScope()
+  {
+    if (start_)
+    {
+      RecordTraceEvent(name_, start_);
+    }
+  }
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+};
+} // namespace VSNvim
+
+#define VSNVIM_TRACE_CONCAT_(a, b) a##b
+#define VSNVIM_TRACE_CONCAT(a, b) VSNVIM_TRACE_CONCAT_(a, b)
+
+// Traces the rest of the enclosing scope under the name.
+#define VSNVIM_TRACE_SCOPE(name) \
+  ::VSNvim::TraceScope VSNVIM_TRACE_CONCAT(trace_scope_, __LINE__)(name)
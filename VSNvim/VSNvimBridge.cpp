@@ -1,8 +1,25 @@
 #include "VSNvimBridge.h"
 
+#include <algorithm>
+#include <map>
 #include <string_view>
-
+#include <vector>
+
+#include "AttachPolicy.h"
+#include "FrameScheduler.h"
+#include "HighlightTable.h"
+#include "TextViewHandles.h"
+#include "Trace.h"
+#include "VSNvimClipboard.h"
+#include "VSNvimCmdline.h"
+#include "VSNvimCommands.h"
+#include "VSNvimMemory.h"
+#include "VSNvimMessages.h"
+#include "VSNvimPopupMenu.h"
+#include "VSNvimSearch.h"
+#include "VSNvimSoak.h"
 #include "VSNvimTextView.h"
+#include "VSNvimTrace.h"
 #include "TextViewCreationListener.h"
 
 using namespace Microsoft::VisualStudio::Text::Editor;
@@ -12,34 +29,241 @@ nvim::UI* ui;
 
 namespace VSNvim
 {
-template<typename TCallback>
-static void QueueNvimAction(TCallback callback)
+// Sets the height of the window to that of the view showing it. The Nvim
+// fork has no ext_multigrid, so all views share one window on one screen.
+// The screen only grows, to the tallest view, and ui_refresh runs only then.
+// A shorter view shrinks the window through its frame with
+// win_setheight_win, which gives the rows left over to the command line.
+// The command line is drawn by VS, so those rows are never shown. Switching
+// between views of different heights then does not refresh the UI.
+static void ApplyWindowHeight(nvim::win_T* nvim_window, int window_height)
 {
-  static_assert(sizeof(TCallback) <= sizeof(nvim::Event::argv),
-                "The callback is too big.");
+  window_height = (std::max)(window_height, 1);
+  const auto rows = window_height + nvim_window->w_status_height +
+                    nvim::tabline_height() + 1;
+  if (ui->height < rows)
+  {
+    ui->height = rows;
+    nvim::ui_refresh();
+  }
+  if (nvim_window->w_height != window_height)
+  {
+    nvim::win_setheight_win(window_height, nvim_window);
+  }
+}
 
-  nvim::Event event;
-  event.handler = [](void** argv)
+void ResizeWindow(nvim::win_T* nvim_window, nvim::buf_T* buffer,
+                  int top_line, int window_height)
+{
+  QueueNvimAction([nvim_window, buffer, top_line, window_height]()
   {
-    (*reinterpret_cast<TCallback*>(argv))();
-  };
-  new (reinterpret_cast<TCallback*>(&event.argv))
-    TCallback(std::move(callback));
-  nvim::loop_schedule(&nvim::main_loop, event);
+    // Views that share the window only size it while it shows their buffer.
+    // The others are applied when their buffer is switched to.
+    if (nvim_window->w_buffer != buffer)
+    {
+      return;
+    }
+    const auto text_view = GetBufferTextView(buffer);
+    if (!text_view)
+    {
+      return;
+    }
+    ApplyWindowHeight(nvim_window, window_height);
+    // Nvim computes the bottom line from the rows the view gives its lines.
+    nvim::set_topline(nvim_window, top_line);
+    text_view->UpdateMargin();
+  });
 }
 
-void ResizeWindow(nvim::win_T* nvim_window, int top_line,
-            int bottom_line, int window_height)
+void SyncNvimFold(nvim::win_T* nvim_window, nvim::buf_T* buffer,
+                  int generation, int first_line, int last_line,
+                  bool is_collapsed)
 {
-  QueueNvimAction([nvim_window, top_line, bottom_line, window_height]()
+  QueueNvimAction([nvim_window, buffer, generation, first_line, last_line,
+                   is_collapsed]()
   {
-    nvim_window->w_topline = top_line;
-    nvim_window->w_botline = bottom_line;
+    const auto text_view = GetBufferTextView(buffer);
+    if (nvim_window->w_buffer != buffer || !text_view)
+    {
+      return;
+    }
+    // Fold scans started before this change are stale, so the next scan is
+    // sent even if it finds the same folds.
+    text_view->SetNvimFoldGeneration(generation);
+    text_view->GetFolds()->ResetNvimFolds();
+
+    std::string command;
+    nvim::linenr_T first;
+    nvim::linenr_T last;
+    const auto is_closed = nvim::hasFoldingWin(nvim_window, first_line,
+                                               &first, &last, true, nullptr);
+    if (!is_collapsed)
+    {
+      if (!is_closed)
+      {
+        return;
+      }
+      command = "silent! " + std::to_string(first_line) + "foldopen";
+    }
+    else if (is_closed && first == first_line && last == last_line)
+    {
+      return;
+    }
+    else
+    {
+      const auto range =
+        std::to_string(first_line) + "," + std::to_string(last_line);
+      command = "silent! " + range + "foldclose";
+      nvim::Error error;
+      nvim::nvim_command(nvim::CreateString(command), &error);
+      // There is no Nvim fold for a region Visual Studio found. A manual
+      // fold is only created when 'foldmethod' is manual. Other methods
+      // compute their own folds, and :fold would insert markers with
+      // "marker". The region then stays open in Nvim, which counts its
+      // hidden lines as taking no rows.
+      if (nvim::hasFoldingWin(nvim_window, first_line, &first, &last, true,
+                              nullptr) ||
+          !nvim::foldmethodIsManual(nvim_window))
+      {
+        return;
+      }
+      command = "silent! " + range + "fold";
+    }
+    nvim::Error error;
+    nvim::nvim_command(nvim::CreateString(command), &error);
+  });
+}
+
+void ReportError(std::unique_ptr<std::string>&& message)
+{
+  QueueNvimAction([message = std::move(message)]()
+  {
+    nvim::emsg(reinterpret_cast<nvim::char_u*>(message->data()));
+  });
+}
+
+// vsnvim#Request stores the request in a global variable and redraws, which
+// flushes the UI synchronously and hands the request to the bridge. The
+// arguments are passed by reference and are not copied by Vimscript.
+static const char* const request_script_ =
+  "function! vsnvim#Request(name, args, default) abort\n"
+  "  let g:vsnvim_request = [a:name, a:args]\n"
+  "  redraw\n"
+  "  let result = get(g:, 'vsnvim_result', a:default)\n"
+  "  unlet! g:vsnvim_request g:vsnvim_result\n"
+  "  return result\n"
+  "endfunction";
+
+static std::map<std::string, RequestHandler> request_handlers_;
+
+static void InitRequests()
+{
+  auto script = std::string(request_script_);
+  nvim::Error error;
+  nvim::nvim_command(nvim::CreateString(script), &error);
+}
+
+void RegisterRequestHandler(const char* name, RequestHandler handler)
+{
+  request_handlers_[name] = handler;
+}
+
+void SetRequestResult(nvim::Object result)
+{
+  auto name = std::string("vsnvim_result");
+  nvim::Error error;
+  nvim::nvim_set_var(nvim::CreateString(name), result, &error);
+}
+
+void SetRequestResult(std::string result)
+{
+  nvim::Object object;
+  object.type = nvim::kObjectTypeString;
+  object.data.string = nvim::CreateString(result);
+  SetRequestResult(object);
+}
 
-    if (ui->height != window_height)
+static void HandleRequest()
+{
+  const auto request_item =
+    nvim::tv_dict_find(nvim::get_globvar_dict(), "vsnvim_request", -1);
+  if (!request_item || request_item->di_tv.v_type != nvim::VAR_LIST)
+  {
+    return;
+  }
+  const auto request = request_item->di_tv.vval.v_list;
+  const auto name_item = nvim::tv_list_first(request);
+  const auto args_item =
+    name_item ? TV_LIST_ITEM_NEXT(request, name_item) : nullptr;
+  if (!args_item)
+  {
+    return;
+  }
+  const auto handler = request_handlers_.find(
+    nvim::tv_get_string(TV_LIST_ITEM_TV(name_item)));
+  if (handler != request_handlers_.end())
+  {
+    handler->second(TV_LIST_ITEM_TV(args_item));
+  }
+}
+
+void AdjustNvimMarks(nvim::buf_T* buffer,
+                     std::unique_ptr<std::vector<TextChange>>&& changes)
+{
+  QueueNvimAction([buffer, changes = std::move(changes)]()
+  {
+    if (!nvim::buf_valid(buffer) || !buffer->vsnvim_data)
+    {
+      return;
+    }
+    // Nvim adjusts the marks of the current buffer and the jumplist of the
+    // current window, like open_line and do_join do for the lines they
+    // split and join. The buffer is made current in a window showing it,
+    // or in the autocommand window, as for autocommands.
+    const auto text_view = GetBufferTextView(buffer);
+    if (!text_view)
+    {
+      return;
+    }
+    const auto is_current = nvim::curbuf == buffer;
+    nvim::aco_save_T saved_window;
+    if (!is_current)
     {
-      ui->height = window_height;
-      nvim::ui_refresh();
+      nvim::aucmd_prepbuf(&saved_window, buffer);
+    }
+    for (const auto& change : *changes)
+    {
+      const long line_delta = change.new_end.line - change.old_end.line;
+      if (line_delta > 0)
+      {
+        nvim::mark_adjust(change.old_end.line + 1, MAXLNUM, line_delta, 0);
+      }
+      if (line_delta || change.new_end.col != change.old_end.col)
+      {
+        nvim::mark_col_adjust(change.old_end.line, change.old_end.col,
+                              line_delta,
+                              change.new_end.col - change.old_end.col);
+      }
+      if (line_delta < 0)
+      {
+        // The marks of the removed lines are deleted.
+        nvim::mark_adjust(change.new_end.line + 1, change.old_end.line,
+                          MAXLNUM, line_delta);
+      }
+      // The count follows the changes rather than the snapshot they were
+      // made in, which may not have Nvim's pending edits yet.
+      buffer->b_ml.ml_line_count = (std::max)<nvim::linenr_T>(
+        buffer->b_ml.ml_line_count + line_delta, 1);
+      text_view->ApplyExternalChange(change);
+    }
+    text_view->SetBufferFlags();
+    if (!is_current)
+    {
+      nvim::aucmd_restbuf(&saved_window);
+    }
+    if (nvim::curwin->w_buffer == buffer)
+    {
+      nvim::check_cursor();
     }
   });
 }
@@ -55,16 +279,34 @@ void SendInput(std::unique_ptr<std::string>&& input)
 static VSNvimTextView^ CreateVSNvimTextViewAction(
   IWpfTextView^ text_view, System::IntPtr nvim_window)
 {
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
   return gcnew VSNvimTextView(text_view,
     static_cast<nvim::win_T*>(nvim_window.ToPointer()));
 }
 
-void SwitchToBuffer(nvim::buf_T* buffer)
+void SwitchToBuffer(nvim::buf_T* buffer, std::uint64_t switch_start)
 {
-  QueueNvimAction([buffer]()
+  QueueNvimAction([buffer, switch_start]()
   {
+    VSNVIM_TRACE_SCOPE("SwitchToBuffer");
+    // Focus also returns to a view from tool windows and dialogs, which
+    // leaves its buffer current.
+    if (!nvim::buf_valid(buffer) || nvim::curbuf == buffer)
+    {
+      return;
+    }
+    if (const auto previous_text_view = GetBufferTextView(nvim::curbuf))
+    {
+      previous_text_view->SaveWindowState(nvim::curwin);
+    }
     nvim::Error error;
     nvim::nvim_set_current_buf(buffer->handle, &error);
+    const auto text_view = GetBufferTextView(buffer);
+    if (nvim::curbuf == buffer && text_view)
+    {
+      ApplyWindowHeight(nvim::curwin, text_view->GetWindowHeight());
+      text_view->RestoreWindowState(nvim::curwin, switch_start);
+    }
   });
 }
 
@@ -72,12 +314,17 @@ void WipeBuffer(nvim::buf_T* buffer)
 {
   QueueNvimAction([buffer]()
   {
-    const auto vsnvim_text_view_ptr_ = buffer->vsnvim_data;
+    const auto handle = buffer->vsnvim_data;
+    const auto text_view = GetBufferTextView(buffer);
     auto command =
       std::string("bw! ") + std::to_string(buffer->handle);
     nvim::Error error;
     nvim::nvim_command(nvim::CreateString(command), &error);
-    delete vsnvim_text_view_ptr_;
+    if (text_view)
+    {
+      text_view->ReleaseLineIndexes();
+    }
+    ReleaseTextViewHandle(handle);
     buffer->vsnvim_data = nullptr;
   });
 }
@@ -91,9 +338,7 @@ ref struct TextViewClosedHandler
     nvim::buf_T* nvim_buffer)
     : nvim_buffer_(nvim_buffer)
   {
-    auto vsnvim_text_view_ptr = 
-      new gcroot<VSNvim::VSNvimTextView^>(vsnvim_text_view);
-    nvim_buffer->vsnvim_data = reinterpret_cast<void*>(vsnvim_text_view_ptr);
+    nvim_buffer->vsnvim_data = CreateTextViewHandle(vsnvim_text_view);
   }
 
   void OnTextViewClosed(System::Object^ sender, System::EventArgs^ e)
@@ -120,6 +365,19 @@ void InitBuffer(IWpfTextView^ text_view)
     &TextViewClosedHandler::OnTextViewClosed);
 }
 
+// Makes the buffer of a view attached read-only unmodifiable, and counts
+// the attach in the report. The view's buffer must be the current one.
+static void ApplyAttachMode(const AttachDecision& decision)
+{
+  if (decision.mode == AttachMode::ReadOnly)
+  {
+    auto command = std::string("setlocal nomodifiable readonly");
+    nvim::Error error;
+    nvim::nvim_command(nvim::CreateString(command), &error);
+  }
+  RecordAttach(decision, nvim::curbuf);
+}
+
 void InitFirstBuffer()
 {
   const auto service_provider =
@@ -136,17 +394,206 @@ void InitFirstBuffer()
   const auto active_wpf_text_view = static_cast<IWpfTextView^>(
       editor_adapter->GetWpfTextView(active_text_view));
 
+  const auto decision = DecideAttachMode(active_wpf_text_view);
+  if (decision.mode == AttachMode::None)
+  {
+    return;
+  }
   InitBuffer(active_wpf_text_view);
+  ApplyAttachMode(decision);
 }
 
-void CreateBuffer(std::unique_ptr<gcroot<IWpfTextView^>>&& text_view)
+// The state of a paste that is streamed in chunks. Complete lines are
+// written to the buffer as soon as their chunk arrives; the last partial
+// line is carried over to the next chunk.
+struct PasteState
 {
-  QueueNvimAction([text_view = std::move(text_view)]()
+  bool active;
+  // The 0-based row that the next complete line is written to.
+  nvim::Integer row;
+  // Whether the line the cursor was on has been replaced yet.
+  bool replaced_cursor_line;
+  // The text after the cursor on the line the paste started on.
+  std::string suffix;
+  // The partial line that has not been terminated by a newline yet.
+  std::string line;
+  // The trace time the paste started at, or 0 while tracing is off.
+  std::uint64_t start;
+  std::size_t bytes;
+};
+
+static PasteState paste_;
+// Written by the UI thread and the Nvim thread.
+static volatile LONG64 paste_queued_bytes_;
+static std::size_t paste_peak_bytes_;
+
+bool IsPasting()
+{
+  return paste_.active;
+}
+
+static void WritePastedLines(std::vector<nvim::Object>& lines)
+{
+  if (lines.empty())
+  {
+    return;
+  }
+  nvim::Array replacement;
+  replacement.items = lines.data();
+  replacement.size = lines.size();
+  replacement.capacity = lines.size();
+  nvim::Error error;
+  // The first line replaces the line the cursor was on. The others are
+  // inserted after the previously written lines.
+  const auto end = paste_.replaced_cursor_line ? paste_.row : paste_.row + 1;
+  nvim::nvim_buf_set_lines(0, nvim::curbuf->handle, paste_.row, end, false,
+                           replacement, &error);
+  paste_.replaced_cursor_line = true;
+  paste_.row += static_cast<nvim::Integer>(lines.size());
+  lines.clear();
+}
+
+static nvim::Object CreateLineObject(const char* data, std::size_t size)
+{
+  nvim::Object object;
+  object.type = nvim::kObjectTypeString;
+  object.data.string.data = const_cast<char*>(data);
+  object.data.string.size = size;
+  return object;
+}
+
+static void BeginPaste()
+{
+  const auto cursor = nvim::curwin->w_cursor;
+  const auto text = reinterpret_cast<const char*>(nvim::ml_get(cursor.lnum));
+  const auto text_len = std::strlen(text);
+  const auto col = (std::min)(static_cast<std::size_t>(cursor.col), text_len);
+
+  paste_.active = true;
+  paste_.row = cursor.lnum - 1;
+  paste_.replaced_cursor_line = false;
+  paste_.line.assign(text, col);
+  paste_.suffix.assign(text + col, text_len - col);
+  paste_.start = is_tracing_enabled_ ? GetTraceTime() : 0;
+  paste_.bytes = 0;
+  paste_peak_bytes_ = 0;
+
+  // Journal the buffer updates so the whole paste reaches the text buffer
+  // as one coalesced edit.
+  if (const auto text_view = GetBufferTextView(nvim::curbuf))
+  {
+    text_view->BeginBatch();
+  }
+}
+
+static void PasteChunk(const std::string& chunk)
+{
+  std::vector<nvim::Object> lines;
+  std::string_view text(chunk);
+  // The carried over line must be copied once it is complete since it is
+  // reused for the next partial line.
+  std::string first_line;
+  for (auto newline = text.find('\n'); newline != std::string_view::npos;
+       newline = text.find('\n'))
+  {
+    auto line = text.substr(0, newline);
+    text.remove_prefix(newline + 1);
+    if (first_line.empty() && lines.empty())
+    {
+      paste_.line.append(line.data(), line.size());
+      first_line.swap(paste_.line);
+      if (!first_line.empty() && first_line.back() == '\r')
+      {
+        first_line.pop_back();
+      }
+      lines.push_back(CreateLineObject(first_line.data(), first_line.size()));
+      continue;
+    }
+    if (!line.empty() && line.back() == '\r')
+    {
+      line.remove_suffix(1);
+    }
+    lines.push_back(CreateLineObject(line.data(), line.size()));
+  }
+  WritePastedLines(lines);
+  paste_.line.append(text.data(), text.size());
+}
+
+static void EndPaste()
+{
+  if (!paste_.line.empty() && paste_.line.back() == '\r')
+  {
+    paste_.line.pop_back();
+  }
+  const auto cursor_col = static_cast<nvim::colnr_T>(paste_.line.size());
+  paste_.line += paste_.suffix;
+  std::vector<nvim::Object> lines
+  {
+    CreateLineObject(paste_.line.data(), paste_.line.size())
+  };
+  WritePastedLines(lines);
+
+  nvim::curwin->w_cursor.lnum = static_cast<nvim::linenr_T>(paste_.row);
+  nvim::curwin->w_cursor.col = cursor_col;
+  nvim::curwin->w_set_curswant = true;
+
+  paste_.active = false;
+  paste_.line.clear();
+  paste_.line.shrink_to_fit();
+  paste_.suffix.clear();
+  paste_.suffix.shrink_to_fit();
+  VSNvimTextView::EndBatches();
+
+  if (paste_.start)
+  {
+    RecordTraceEvent("Paste", paste_.start);
+    RecordTraceCounter("Paste bytes", static_cast<std::int64_t>(paste_.bytes));
+    RecordTraceCounter("Paste peak queued bytes",
+                       static_cast<std::int64_t>(paste_peak_bytes_));
+  }
+}
+
+void Paste(std::unique_ptr<std::string>&& chunk, PastePhase phase)
+{
+  const auto queued_bytes = static_cast<std::size_t>(InterlockedAdd64(
+    &paste_queued_bytes_, static_cast<LONG64>(chunk->size())));
+  QueueNvimAction([chunk = std::move(chunk), phase, queued_bytes]()
+  {
+    if (phase == PastePhase::Single || phase == PastePhase::Start)
+    {
+      BeginPaste();
+    }
+    else if (!paste_.active)
+    {
+      // The start of the paste was dropped, e.g. the buffer was closed.
+      InterlockedAdd64(&paste_queued_bytes_,
+                       -static_cast<LONG64>(chunk->size()));
+      return;
+    }
+    paste_peak_bytes_ = (std::max)(paste_peak_bytes_,
+      queued_bytes + paste_.line.capacity() + paste_.suffix.capacity());
+    paste_.bytes += chunk->size();
+    PasteChunk(*chunk);
+    InterlockedAdd64(&paste_queued_bytes_,
+                     -static_cast<LONG64>(chunk->size()));
+    if (phase == PastePhase::Single || phase == PastePhase::End)
+    {
+      EndPaste();
+    }
+  });
+}
+
+void CreateBuffer(std::unique_ptr<gcroot<IWpfTextView^>>&& text_view,
+                  AttachDecision decision)
+{
+  QueueNvimAction([text_view = std::move(text_view),
+                   decision = std::move(decision)]()
   {
     auto command = std::string("set hidden | enew");
     nvim::Error error;
     nvim::nvim_command(nvim::CreateString(command), &error);
     InitBuffer(*text_view);
+    ApplyAttachMode(decision);
   });
 }
 } // namespace VSNvim
@@ -155,89 +602,122 @@ extern "C"
 {
 static VSNvim::VSNvimTextView^ GetTextView(void* vsnvim_data)
 {
-  return *reinterpret_cast<gcroot<VSNvim::VSNvimTextView ^>*>(vsnvim_data);
+  return VSNvim::LookupTextView(vsnvim_data);
+}
+
+// True while Nvim is executing keys that were not typed by the user, such as
+// a register (@q), a dot-repeat, :normal or :g, or while a paste is being
+// streamed. View updates and buffer edits
+// are held back until the execution finishes.
+static bool IsExecutingKeys()
+{
+  return nvim::ex_normal_busy || nvim::global_busy ||
+         !nvim::typebuf_typed() || !nvim::stuff_empty() ||
+         VSNvim::IsPasting();
+}
+
+// Returns the text view of the buffer an edit is made to. Edits made while
+// Nvim is executing keys are journaled instead of applied immediately.
+static VSNvim::VSNvimTextView^ GetEditTextView(void* vsnvim_data)
+{
+  const auto text_view = GetTextView(vsnvim_data);
+  if (text_view && IsExecutingKeys())
+  {
+    text_view->BeginBatch();
+  }
+  return text_view;
 }
 
 const nvim::char_u* vsnvim_get_line(void* vsnvim_data, nvim::linenr_T lnum)
 {
-  return GetTextView(vsnvim_data)->GetLine(lnum);
+  VSNVIM_TRACE_SCOPE("vsnvim_get_line");
+  const auto text_view = GetTextView(vsnvim_data);
+  return text_view
+    ? text_view->GetLine(lnum)
+    : reinterpret_cast<const nvim::char_u*>("");
 }
 
 int vsnvim_append_line(
   void* vsnvim_data, nvim::linenr_T lnum, nvim::char_u* line, nvim::colnr_T len)
 {
-  GetTextView(vsnvim_data)->AppendLine(lnum, line, len);
+  VSNVIM_TRACE_SCOPE("vsnvim_append_line");
+  const auto text_view = GetEditTextView(vsnvim_data);
+  if (!text_view)
+  {
+    return false;
+  }
+  text_view->AppendLine(lnum, line, len);
   return true;
 }
 
 int vsnvim_delete_line(void* vsnvim_data, nvim::linenr_T lnum)
 {
-  GetTextView(vsnvim_data)->DeleteLine(lnum);
+  VSNVIM_TRACE_SCOPE("vsnvim_delete_line");
+  const auto text_view = GetEditTextView(vsnvim_data);
+  if (!text_view)
+  {
+    return false;
+  }
+  text_view->DeleteLine(lnum);
   return true;
 }
 
 int vsnvim_delete_char(void* vsnvim_data, nvim::linenr_T lnum,
                        nvim::colnr_T col)
 {
-  GetTextView(vsnvim_data)->DeleteChar(lnum, col);
+  VSNVIM_TRACE_SCOPE("vsnvim_delete_char");
+  const auto text_view = GetEditTextView(vsnvim_data);
+  if (!text_view)
+  {
+    return false;
+  }
+  text_view->DeleteChar(lnum, col);
   return true;
 }
 
 int vsnvim_replace_line(void* vsnvim_data, nvim::linenr_T lnum,
                         nvim::char_u* line)
 {
-  GetTextView(vsnvim_data)->ReplaceLine(lnum, line);
+  VSNVIM_TRACE_SCOPE("vsnvim_replace_line");
+  const auto text_view = GetEditTextView(vsnvim_data);
+  if (!text_view)
+  {
+    return false;
+  }
+  text_view->ReplaceLine(lnum, line);
   return true;
 }
 
 int vsnvim_replace_char(void* vsnvim_data, nvim::linenr_T lnum,
                         nvim::colnr_T col, nvim::char_u chr)
 {
-  GetTextView(vsnvim_data)->ReplaceChar(lnum, col, chr);
+  VSNVIM_TRACE_SCOPE("vsnvim_replace_char");
+  const auto text_view = GetEditTextView(vsnvim_data);
+  if (!text_view)
+  {
+    return false;
+  }
+  text_view->ReplaceChar(lnum, col, chr);
   return true;
 }
 
 void vsnvim_init_buffers()
 {
+  VSNVIM_TRACE_SCOPE("vsnvim_init_buffers");
   VSNvim::InitFirstBuffer();
 }
 
 int vs_plines_win_nofold(void* vs_data, nvim::linenr_T lnum)
 {
-  return GetTextView(vs_data)->GetPhysicalLinesCount(lnum);
+  VSNVIM_TRACE_SCOPE("vs_plines_win_nofold");
+  const auto text_view = GetTextView(vs_data);
+  return text_view ? text_view->GetPhysicalLinesCount(lnum) : 1;
 }
 
 void vsnvim_execute_command(const nvim::char_u* command)
 {
-  const auto chr_ptr = reinterpret_cast<const char*>(command);
-  const auto command_str = gcnew System::String(chr_ptr, 0,
-    std::strlen(chr_ptr), System::Text::Encoding::UTF8);
-  const auto split = command_str->Split(gcnew array<System::String^>{ " " }, 2,
-    System::StringSplitOptions::RemoveEmptyEntries);
-  if (!split->Length)
-  {
-    return;
-  }
-  const auto command_name = split[0];
-  const auto command_args = split->Length == 2
-                            ?  split[1]
-                            : System::String::Empty;
-  const auto service_provider =
-      VSNvim::TextViewCreationListener::text_view_creation_listener_->
-      GetServiceProvider();
-  const auto dte = safe_cast<EnvDTE80::DTE2^>(
-    service_provider->GetService(
-      Microsoft::VisualStudio::Shell::Interop::SDTE::typeid));
-  try
-  {
-    dte->ExecuteCommand(command_name, command_args);
-  }
-  catch (...)
-  {
-    // No information useful is provided in the exception.
-    nvim::emsg(reinterpret_cast<nvim::char_u*>(
-      "Failed to execute Visual Studio command"));
-  }
+  VSNVIM_TRACE_SCOPE("vsnvim_execute_command");
+  VSNvim::ExecuteVSCommands(reinterpret_cast<const char*>(command));
 }
 
 static VSNvim::NvimTextSelection GetSelectionType()
@@ -278,9 +758,13 @@ static void SetCaretOptions(
 static void NvimModeChange(
   nvim::UI* ui, nvim::String mode, nvim::Integer mode_index)
 {
-  const auto text_view =
-    *reinterpret_cast<gcroot<VSNvim::VSNvimTextView^>*>(
-      nvim::curbuf->vsnvim_data);
+  VSNVIM_TRACE_SCOPE("ui->mode_change");
+  // The current buffer has no view when the attach policy left it alone.
+  const auto text_view = VSNvim::GetBufferTextView(nvim::curbuf);
+  if (!text_view)
+  {
+    return;
+  }
   const auto current_mode = cursor_styles_.items[mode_index];
   std::string_view cursor_shape;
   auto cell_percentage = 100ll;
@@ -315,7 +799,8 @@ static void NvimModeChange(
     }
   }
 
-  System::Windows::Application::Current->Dispatcher->Invoke(
+  const auto caret = text_view->GetCaret();
+  VSNvim::FrameScheduler::Post(VSNvim::FrameLane::Cursor, caret,
     gcnew System::Action<VSNvim::VSNvimCaret^,
       bool,
       System::Int64,
@@ -324,7 +809,7 @@ static void NvimModeChange(
       System::Int64,
       System::Int64>
       (&SetCaretOptions),
-    text_view->GetCaret(),
+    caret,
     cursor_enabled_,
     cursor_shape == "horizontal" ? cell_percentage : 100,
     cursor_shape == "vertical"   ? cell_percentage : 100,
@@ -333,17 +818,9 @@ static void NvimModeChange(
     blink_off);
 }
 
-Microsoft::VisualStudio::Shell::Interop::IVsStatusbar^ GetVSStatusBar()
-{
-  const auto service_provider = VSNvim::TextViewCreationListener::
-    text_view_creation_listener_->service_provider_;
-  return static_cast<Microsoft::VisualStudio::Shell::Interop::IVsStatusbar^>(
-      service_provider->GetService(
-        Microsoft::VisualStudio::Shell::Interop::SVsStatusbar::typeid));
-}
-
 void vsnvim_ui_start()
 {
+  VSNVIM_TRACE_SCOPE("vsnvim_ui_start");
   ui = new nvim::UI();
   ui->width = 1;
   ui->height = 1;
@@ -352,10 +829,23 @@ void vsnvim_ui_start()
     nvim::ui_detach_impl(ui);
     delete ui;
   };
-  // This callback must be defined because there are no NULL checks for it.
   ui->hl_attr_define = [](nvim::UI* ui, nvim::Integer id, nvim::HlAttrs attrs,
                           nvim::HlAttrs cterm_attrs, nvim::Array info)
   {
+    VSNvim::HighlightAttributes attributes;
+    attributes.foreground = attrs.rgb_fg_color;
+    attributes.background = attrs.rgb_bg_color;
+    attributes.special = attrs.rgb_sp_color;
+    const auto ae_attr = attrs.rgb_ae_attr;
+    attributes.flags = static_cast<std::uint16_t>(
+      (ae_attr & HL_BOLD ? VSNvim::HighlightFlags::Bold : 0) |
+      (ae_attr & HL_ITALIC ? VSNvim::HighlightFlags::Italic : 0) |
+      (ae_attr & HL_UNDERLINE ? VSNvim::HighlightFlags::Underline : 0) |
+      (ae_attr & HL_UNDERCURL ? VSNvim::HighlightFlags::Undercurl : 0) |
+      (ae_attr & HL_STRIKETHROUGH ? VSNvim::HighlightFlags::Strikethrough
+                                  : 0) |
+      (ae_attr & HL_INVERSE ? VSNvim::HighlightFlags::Reverse : 0));
+    VSNvim::highlight_table_.Define(static_cast<int>(id), attributes);
   };
 
   ui->mode_change = NvimModeChange;
@@ -374,46 +864,117 @@ void vsnvim_ui_start()
   ui->event = [](nvim::UI* ui, char* name,
                  nvim::Array args, bool* args_consumed)
   {
-    if (std::string_view(name) == "cmdline_show")
+    VSNVIM_TRACE_SCOPE("ui->event");
+    if (!VSNvim::HandleCmdlineEvent(name, args))
     {
-      const auto text = args.items[0].data.array
-                            .items[0].data.array
-                            .items[1].data.string;
-      const auto first_char = args.items[2].data.string;
-      const auto cmdline =
-        gcnew System::String(
-          first_char.data, 0, first_char.size, System::Text::Encoding::UTF8)
-        + gcnew System::String(
-          text.data, 0, text.size, System::Text::Encoding::UTF8);
-      GetVSStatusBar()->SetText(cmdline);
-    }
-    else if (std::string_view(name) == "cmdline_hide")
-    {
-      GetVSStatusBar()->Clear();
+      VSNvim::HandlePopupMenuEvent(name, args);
     }
   };
 
   ui->flush = [](nvim::UI* ui)
   {
-    const auto text_view =
-      *reinterpret_cast<gcroot<VSNvim::VSNvimTextView^>*>(
-        nvim::curbuf->vsnvim_data);
-    const auto cursor = &nvim::curwin->w_cursor;
-    text_view->CursorGoto(cursor->lnum, cursor->col);
-    text_view->Scroll(nvim::curwin->w_topline);
+    // Requests redraw to reach the bridge and must be handled even while
+    // view updates are deferred.
+    VSNVIM_TRACE_SCOPE("ui->flush");
+    VSNvim::HandleRequest();
+    VSNvim::CaptureMessages();
+    const auto text_view = VSNvim::GetBufferTextView(nvim::curbuf);
+    if (!text_view)
+    {
+      VSNvim::VSNvimTextView::CommitHeldEdits();
+      VSNvim::CheckMemoryCaps();
+      return;
+    }
+    if (IsExecutingKeys())
+    {
+      text_view->BeginBatch();
+      text_view->DeferFlush();
+      return;
+    }
+    VSNvim::VSNvimTextView::EndBatches();
+    VSNvim::VSNvimTextView::CommitHeldEdits();
+
+    // After a switch that restored the window, the view already shows the
+    // cursor and scroll position.
+    if (!text_view->EndSwitch(nvim::curwin))
+    {
+      const auto cursor = &nvim::curwin->w_cursor;
+      text_view->CursorGoto(cursor->lnum, cursor->col);
+      text_view->Scroll(nvim::curwin->w_topline);
+    }
     if (nvim::VIsual_active)
     {
-      text_view->SelectText(nvim::VIsual, GetSelectionType());
+      text_view->SelectText(nvim::VIsual, nvim::curwin->w_cursor,
+                            GetSelectionType());
     }
     else
     {
       text_view->ClearTextSelection();
     }
+    text_view->UpdateHighlights();
+    text_view->UpdateFolds();
+    text_view->UpdateMargin();
+    VSNvim::CheckMemoryCaps();
   };
 
   memset(ui->ui_ext, 0, sizeof(ui->ui_ext));
   ui->ui_ext[nvim::kUICmdline] = true;
+  ui->ui_ext[nvim::kUIPopupmenu] = true;
 
   nvim::ui_attach_impl(ui);
+
+  VSNvim::QueueNvimAction([]()
+  {
+    VSNvim::InitRequests();
+    VSNvim::InitTrace();
+    VSNvim::InitClipboard();
+    VSNvim::InitMessages();
+    VSNvim::InitSearch();
+    VSNvim::InitMemory();
+    VSNvim::InitSoak();
+    VSNvim::InitAttach();
+  });
 }
 } // extern "C"
+
+// Returns the number of bytes an API object holds, including itself.
+static std::size_t GetObjectMemorySize(const nvim::Object& object)
+{
+  auto size = sizeof(object);
+  switch (object.type)
+  {
+  case nvim::kObjectTypeString:
+    size += object.data.string.size + 1;
+    break;
+  case nvim::kObjectTypeArray:
+    for (std::size_t i = 0; i < object.data.array.size; i++)
+    {
+      size += GetObjectMemorySize(object.data.array.items[i]);
+    }
+    break;
+  case nvim::kObjectTypeDictionary:
+    for (std::size_t i = 0; i < object.data.dictionary.size; i++)
+    {
+      const auto& item = object.data.dictionary.items[i];
+      size += sizeof(item.key) + item.key.size + 1 +
+              GetObjectMemorySize(item.value);
+    }
+    break;
+  default:
+    break;
+  }
+  return size;
+}
+
+namespace VSNvim
+{
+std::size_t GetCursorStylesMemorySize()
+{
+  std::size_t size = 0;
+  for (std::size_t i = 0; i < cursor_styles_.size; i++)
+  {
+    size += GetObjectMemorySize(cursor_styles_.items[i]);
+  }
+  return size;
+}
+}
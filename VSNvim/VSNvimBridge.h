@@ -1,21 +1,96 @@
 #pragma once
 
 #include "nvim.h"
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 #include "nvim.h"
 #include <vcclr.h> // gcroot
+#include "AttachPolicy.h"
+#include "TextChange.h"
+#include "Trace.h"
 
 namespace VSNvim
 {
-void ResizeWindow(nvim::win_T* nvim_window, int top_line,
-            int bottom_line, int window_height);
+// Runs the callback on the Nvim thread after the events queued so far. The
+// callback is moved into the event and destroyed once it has run, which
+// frees what it captured.
+template<typename TCallback>
+void QueueNvimAction(TCallback callback)
+{
+  static_assert(sizeof(TCallback) <= sizeof(nvim::Event::argv),
+                "The callback is too big.");
+  VSNVIM_TRACE_SCOPE("QueueNvimAction");
+
+  nvim::Event event;
+  event.handler = [](void** argv)
+  {
+    VSNVIM_TRACE_SCOPE("NvimAction");
+    const auto callback = reinterpret_cast<TCallback*>(argv);
+    (*callback)();
+    callback->~TCallback();
+  };
+  new (reinterpret_cast<TCallback*>(&event.argv))
+    TCallback(std::move(callback));
+  nvim::loop_schedule(&nvim::main_loop, event);
+}
+
+// The phases of a streamed paste, numbered like those of nvim_paste.
+enum class PastePhase
+{
+  Single = -1,
+  Start = 1,
+  Continue = 2,
+  End = 3
+};
+
+void ResizeWindow(nvim::win_T* nvim_window, nvim::buf_T* buffer,
+                  int top_line, int window_height);
+
+// Opens or closes the Nvim fold of lines a region was collapsed or expanded
+// over in Visual Studio.
+void SyncNvimFold(nvim::win_T* nvim_window, nvim::buf_T* buffer,
+                  int generation, int first_line, int last_line,
+                  bool is_collapsed);
+
+// Moves Nvim's marks, jumplist and cursor with changes Visual Studio made
+// to the text buffer of an Nvim buffer, and updates its line count by the
+// lines the changes added and removed.
+void AdjustNvimMarks(nvim::buf_T* buffer,
+                     std::unique_ptr<std::vector<TextChange>>&& changes);
+
+// Returns the number of bytes held by the copy of the UI's cursor styles.
+// Called on the Nvim thread.
+std::size_t GetCursorStylesMemorySize();
 
 void SendInput(std::unique_ptr<std::string>&& input);
 
+// Shows an error message in Nvim.
+void ReportError(std::unique_ptr<std::string>&& message);
+
+// Handles a request made by vsnvim#Request(name, args, default), which
+// returns the result the handler sets or the default. Handlers are called
+// on the Nvim thread from the flush callback and must not redraw.
+typedef void (*RequestHandler)(const nvim::typval_T* args);
+
+// Must be called on the Nvim thread.
+void RegisterRequestHandler(const char* name, RequestHandler handler);
+
+void SetRequestResult(nvim::Object result);
+void SetRequestResult(std::string result);
+
+// Creates a buffer for the view as the attach policy decided. Views that
+// are not attached must not be passed.
 void CreateBuffer(
   std::unique_ptr<gcroot<
-    Microsoft::VisualStudio::Text::Editor::IWpfTextView^>>&& text_view);
+    Microsoft::VisualStudio::Text::Editor::IWpfTextView^>>&& text_view,
+  AttachDecision decision);
+
+// Makes the buffer current when its view gets the focus at the trace time,
+// which is 0 while tracing is off. Does nothing if it already is.
+void SwitchToBuffer(nvim::buf_T* buffer, std::uint64_t switch_start);
 
-void SwitchToBuffer(nvim::buf_T* buffer);
+void Paste(std::unique_ptr<std::string>&& chunk, PastePhase phase);
 }
@@ -0,0 +1,157 @@
+#include "VSNvimClipboard.h"
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "nvim.h"
+#include "Trace.h"
+#include "VSNvimBridge.h"
+#include "WindowsClipboardProvider.h"
+
+namespace VSNvim
+{
+static std::unique_ptr<ClipboardProvider> clipboard_provider_;
+
+// Nvim calls provider#clipboard#Call for the + and * registers. The lines
+// of a yank are passed to the bridge by reference and are not copied by
+// Vimscript.
+static const char* const clipboard_provider_script_ =
+  "function! provider#clipboard#Call(method, args) abort\n"
+  "  return vsnvim#Request('clipboard', [a:method, a:args], [])\n"
+  "endfunction\n"
+  "let g:loaded_clipboard_provider = 2";
+
+static void CreateClipboardProviderAction()
+{
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  clipboard_provider_ = std::make_unique<WindowsClipboardProvider>();
+}
+
+static void HandleClipboardRequest(const nvim::typval_T* call);
+
+void InitClipboard()
+{
+  System::Windows::Application::Current->Dispatcher->Invoke(
+    gcnew System::Action(&CreateClipboardProviderAction));
+
+  RegisterRequestHandler("clipboard", &HandleClipboardRequest);
+  auto script = std::string(clipboard_provider_script_);
+  nvim::Error error;
+  nvim::nvim_command(nvim::CreateString(script), &error);
+}
+
+static nvim::Object CreateStringObject(const char* data, std::size_t size)
+{
+  nvim::Object object;
+  object.type = nvim::kObjectTypeString;
+  object.data.string.data = const_cast<char*>(data);
+  object.data.string.size = size;
+  return object;
+}
+
+static nvim::Object CreateArrayObject(std::vector<nvim::Object>& items)
+{
+  nvim::Object object;
+  object.type = nvim::kObjectTypeArray;
+  object.data.array.items = items.data();
+  object.data.array.size = items.size();
+  object.data.array.capacity = items.size();
+  return object;
+}
+
+// Returns the clipboard contents to provider#clipboard#Call as a list of
+// lines and a register type. The line objects point into the contents, so
+// the only copy of each line is the one Nvim makes for its register.
+static void SetClipboardResult(const ClipboardContents& contents)
+{
+  std::vector<nvim::Object> lines;
+  lines.reserve(contents.GetLineCount());
+  std::string_view text(contents.text);
+  for (auto newline = text.find('\n'); newline != std::string_view::npos;
+       newline = text.find('\n'))
+  {
+    lines.push_back(CreateStringObject(text.data(), newline));
+    text.remove_prefix(newline + 1);
+  }
+  lines.push_back(CreateStringObject(text.data(), text.size()));
+
+  std::vector<nvim::Object> result
+  {
+    CreateArrayObject(lines),
+    CreateStringObject(contents.regtype.data(), contents.regtype.size())
+  };
+  SetRequestResult(CreateArrayObject(result));
+}
+
+// Joins the yanked lines into a single buffer.
+static std::shared_ptr<const ClipboardContents> GetYankedContents(
+  const nvim::list_T* lines, const char* regtype)
+{
+  auto contents = std::make_shared<ClipboardContents>();
+  contents->regtype = regtype;
+
+  std::size_t size = 0;
+  for (auto item = nvim::tv_list_first(lines); item;
+       item = TV_LIST_ITEM_NEXT(lines, item))
+  {
+    size += std::strlen(nvim::tv_get_string(TV_LIST_ITEM_TV(item))) + 1;
+  }
+  contents->text.reserve(size);
+  for (auto item = nvim::tv_list_first(lines); item;
+       item = TV_LIST_ITEM_NEXT(lines, item))
+  {
+    if (item != nvim::tv_list_first(lines))
+    {
+      contents->text += '\n';
+    }
+    contents->text += nvim::tv_get_string(TV_LIST_ITEM_TV(item));
+  }
+  return contents;
+}
+
+// The call is a list of the method and its arguments.
+static void HandleClipboardRequest(const nvim::typval_T* call)
+{
+  if (call->v_type != nvim::VAR_LIST || !clipboard_provider_)
+  {
+    return;
+  }
+  const auto request = call->vval.v_list;
+  const auto method_item = nvim::tv_list_first(request);
+  const auto args_item = TV_LIST_ITEM_NEXT(request, method_item);
+  if (!method_item || !args_item ||
+      TV_LIST_ITEM_TV(args_item)->v_type != nvim::VAR_LIST)
+  {
+    return;
+  }
+  const auto method =
+    std::string_view(nvim::tv_get_string(TV_LIST_ITEM_TV(method_item)));
+  const auto args = TV_LIST_ITEM_TV(args_item)->vval.v_list;
+
+  if (method == "get")
+  {
+    if (const auto contents = clipboard_provider_->Read())
+    {
+      SetClipboardResult(*contents);
+    }
+  }
+  else if (method == "set")
+  {
+    // The arguments are the lines, the register type and the register.
+    const auto lines_item = nvim::tv_list_first(args);
+    const auto regtype_item =
+      lines_item ? TV_LIST_ITEM_NEXT(args, lines_item) : nullptr;
+    if (!regtype_item ||
+        TV_LIST_ITEM_TV(lines_item)->v_type != nvim::VAR_LIST)
+    {
+      return;
+    }
+    clipboard_provider_->Publish(GetYankedContents(
+      TV_LIST_ITEM_TV(lines_item)->vval.v_list,
+      nvim::tv_get_string(TV_LIST_ITEM_TV(regtype_item))));
+  }
+}
+}
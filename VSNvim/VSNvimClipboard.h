@@ -0,0 +1,8 @@
+#pragma once
+
+namespace VSNvim
+{
+// Registers the built-in clipboard provider with Nvim. Must be called on
+// the Nvim thread.
+void InitClipboard();
+}
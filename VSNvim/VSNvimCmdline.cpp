@@ -0,0 +1,184 @@
+#include "VSNvimCmdline.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "FrameScheduler.h"
+#include "Lock.h"
+#include "TextViewCreationListener.h"
+#include "Trace.h"
+#include "VSNvimMessages.h"
+
+using namespace Microsoft::VisualStudio::Shell::Interop;
+
+namespace VSNvim
+{
+// A command line as described by the cmdline_* events. Nested command
+// lines, e.g. for <C-r>=, have a level above one.
+struct Cmdline
+{
+  std::string content;
+  std::string first_char;
+  std::string prompt;
+  int indent = 0;
+  // The byte offset of the cursor in the content.
+  std::size_t cursor = 0;
+  // The character shown at the cursor while a key like <C-v> is pending.
+  std::string special_char;
+  bool special_char_shift = false;
+};
+
+static Mutex cmdline_mutex_;
+// The visible command lines, indexed by level - 1.
+static std::vector<Cmdline> cmdlines_;
+// Whether a redraw of the status bar has been scheduled and not run yet.
+static bool is_redraw_pending_;
+
+// Marks the cursor in the status bar.
+static const char* const cursor_marker_ = "\xE2\x80\xB8";
+
+static std::string GetString(const nvim::Object& object)
+{
+  return std::string(object.data.string.data, object.data.string.size);
+}
+
+// Builds the status bar text of the innermost command line. Returns an
+// empty string when no command line is visible.
+static std::string RenderCmdline()
+{
+  LockGuard lock(cmdline_mutex_);
+  is_redraw_pending_ = false;
+  if (cmdlines_.empty())
+  {
+    return std::string();
+  }
+
+  const auto& cmdline = cmdlines_.back();
+  auto text = cmdline.first_char + cmdline.prompt +
+              std::string(cmdline.indent, ' ');
+  const auto cursor = (std::min)(cmdline.cursor, cmdline.content.size());
+  text.append(cmdline.content, 0, cursor);
+  text += cursor_marker_;
+  if (!cmdline.special_char.empty())
+  {
+    text += cmdline.special_char;
+    if (!cmdline.special_char_shift && cursor < cmdline.content.size())
+    {
+      // The special character is drawn over the character at the cursor.
+      auto next = cursor + 1;
+      while (next < cmdline.content.size() &&
+             (cmdline.content[next] & 0xC0) == 0x80)
+      {
+        next++;
+      }
+      text.append(cmdline.content, next, std::string::npos);
+      return text;
+    }
+  }
+  text.append(cmdline.content, cursor, std::string::npos);
+  return text;
+}
+
+ref class CmdlineStatusBar abstract sealed
+{
+private:
+  static IVsStatusbar^ status_bar_;
+
+public:
+  // Shows the latest command line. Redraws requested while this one was
+  // pending are coalesced into it.
+  static void RedrawAction()
+  {
+    VSNVIM_TRACE_SCOPE(__FUNCTION__);
+    if (!status_bar_)
+    {
+      const auto service_provider = TextViewCreationListener::
+        text_view_creation_listener_->service_provider_;
+      status_bar_ = static_cast<IVsStatusbar^>(
+        service_provider->GetService(SVsStatusbar::typeid));
+    }
+
+    const auto text = RenderCmdline();
+    if (text.empty())
+    {
+      status_bar_->Clear();
+      return;
+    }
+    status_bar_->SetText(gcnew System::String(
+      text.data(), 0, static_cast<int>(text.size()),
+      System::Text::Encoding::UTF8));
+  }
+};
+
+// Returns the command line at the level, creating the levels up to it.
+static Cmdline& GetCmdline(nvim::Integer level)
+{
+  const auto index = static_cast<std::size_t>((std::max)(level, nvim::Integer(1)) - 1);
+  if (index >= cmdlines_.size())
+  {
+    cmdlines_.resize(index + 1);
+  }
+  return cmdlines_[index];
+}
+
+bool HandleCmdlineEvent(std::string_view name, nvim::Array args)
+{
+  {
+    LockGuard lock(cmdline_mutex_);
+    if (name == "cmdline_show")
+    {
+      auto& cmdline = GetCmdline(args.items[5].data.integer);
+      cmdline.content.clear();
+      const auto& chunks = args.items[0].data.array;
+      for (std::size_t i = 0; i < chunks.size; i++)
+      {
+        const auto& text = chunks.items[i].data.array.items[1].data.string;
+        cmdline.content.append(text.data, text.size);
+      }
+      cmdline.cursor = static_cast<std::size_t>(args.items[1].data.integer);
+      cmdline.first_char = GetString(args.items[2]);
+      cmdline.prompt = GetString(args.items[3]);
+      cmdline.indent = static_cast<int>(args.items[4].data.integer);
+      cmdline.special_char.clear();
+    }
+    else if (name == "cmdline_pos")
+    {
+      auto& cmdline = GetCmdline(args.items[1].data.integer);
+      cmdline.cursor = static_cast<std::size_t>(args.items[0].data.integer);
+    }
+    else if (name == "cmdline_special_char")
+    {
+      auto& cmdline = GetCmdline(args.items[2].data.integer);
+      cmdline.special_char = GetString(args.items[0]);
+      cmdline.special_char_shift = args.items[1].data.boolean;
+    }
+    else if (name == "cmdline_hide")
+    {
+      const auto level = args.size ? args.items[0].data.integer : 1;
+      // Nvim hides the command line before it executes the command, whose
+      // output goes to the output pane.
+      if (level <= 1 && !cmdlines_.empty() &&
+          cmdlines_.front().first_char == ":")
+      {
+        CaptureCommandOutput();
+      }
+      cmdlines_.resize(static_cast<std::size_t>((std::max)(level, nvim::Integer(1)) - 1));
+    }
+    else
+    {
+      return false;
+    }
+
+    if (is_redraw_pending_)
+    {
+      return true;
+    }
+    is_redraw_pending_ = true;
+  }
+
+  FrameScheduler::Post(FrameLane::InputEcho, nullptr,
+    gcnew System::Action(&CmdlineStatusBar::RedrawAction));
+  return true;
+}
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string_view>
+
+#include "nvim.h"
+
+namespace VSNvim
+{
+// Updates the command line model from a cmdline_* UI event and schedules
+// the status bar to be redrawn. Returns false for other events. Called on
+// the Nvim thread.
+bool HandleCmdlineEvent(std::string_view name, nvim::Array args);
+}
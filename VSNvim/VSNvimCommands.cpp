@@ -0,0 +1,217 @@
+#include "VSNvimCommands.h"
+
+#include <cctype>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <vcclr.h>
+
+#include "TextViewCreationListener.h"
+#include "Trace.h"
+#include "VSNvimBridge.h"
+
+namespace VSNvim
+{
+struct VSCommand
+{
+  std::string name;
+  std::string args;
+};
+
+// The names of the Visual Studio commands, keyed by their lowercase UTF-8
+// name. Only accessed from the UI thread.
+static std::unordered_map<std::string, gcroot<System::String^>>
+  command_names_;
+
+static std::string_view Trim(std::string_view text)
+{
+  while (!text.empty() && std::isspace(static_cast<unsigned char>(text[0])))
+  {
+    text.remove_prefix(1);
+  }
+  while (!text.empty() &&
+         std::isspace(static_cast<unsigned char>(text.back())))
+  {
+    text.remove_suffix(1);
+  }
+  return text;
+}
+
+// Returns the position of the first "&&" that stands on its own between
+// commands, or npos. An "&&" inside a word or inside double quotes belongs
+// to the arguments, e.g. of Edit.Find "a && b".
+static std::size_t FindSeparator(std::string_view commands)
+{
+  auto is_quoted = false;
+  for (std::size_t i = 0; i < commands.size(); i++)
+  {
+    if (commands[i] == '"')
+    {
+      is_quoted = !is_quoted;
+    }
+    else if (!is_quoted && commands.compare(i, 2, "&&") == 0 &&
+             (i == 0 ||
+              std::isspace(static_cast<unsigned char>(commands[i - 1]))) &&
+             (i + 2 == commands.size() ||
+              std::isspace(static_cast<unsigned char>(commands[i + 2]))))
+    {
+      return i;
+    }
+  }
+  return std::string_view::npos;
+}
+
+static std::vector<VSCommand> ParseCommands(std::string_view commands)
+{
+  std::vector<VSCommand> parsed_commands;
+  while (!commands.empty())
+  {
+    const auto separator = FindSeparator(commands);
+    const auto command = Trim(commands.substr(0, separator));
+    commands.remove_prefix(
+      separator == std::string_view::npos ? commands.size() : separator + 2);
+    if (command.empty())
+    {
+      continue;
+    }
+
+    const auto name_end = command.find_first_of(" \t");
+    parsed_commands.push_back(VSCommand
+    {
+      std::string(command.substr(0, name_end)),
+      name_end == std::string_view::npos
+        ? std::string()
+        : std::string(Trim(command.substr(name_end)))
+    });
+  }
+  return parsed_commands;
+}
+
+static std::string ToLower(std::string text)
+{
+  for (auto& chr : text)
+  {
+    chr = static_cast<char>(std::tolower(static_cast<unsigned char>(chr)));
+  }
+  return text;
+}
+
+static std::string ToUtf8(System::String^ text)
+{
+  const auto bytes = System::Text::Encoding::UTF8->GetBytes(text);
+  if (!bytes->Length)
+  {
+    return std::string();
+  }
+  pin_ptr<unsigned char> data = &bytes[0];
+  return std::string(reinterpret_cast<const char*>(data), bytes->Length);
+}
+
+static void ReportCommandError(const char* error, const std::string& name)
+{
+  VSNvim::ReportError(std::make_unique<std::string>(error + name));
+}
+
+ref class VSCommandDispatcher abstract sealed
+{
+private:
+  static EnvDTE80::DTE2^ dte_;
+
+  static EnvDTE80::DTE2^ GetDTE()
+  {
+    if (!dte_)
+    {
+      const auto service_provider = TextViewCreationListener::
+        text_view_creation_listener_->service_provider_;
+      dte_ = safe_cast<EnvDTE80::DTE2^>(service_provider->GetService(
+        Microsoft::VisualStudio::Shell::Interop::SDTE::typeid));
+
+      for each (EnvDTE::Command^ command in dte_->Commands)
+      {
+        const auto name = command->Name;
+        if (!System::String::IsNullOrEmpty(name))
+        {
+          command_names_.emplace(ToLower(ToUtf8(name)), name);
+        }
+      }
+    }
+    return dte_;
+  }
+
+  // Returns the name of the command as Visual Studio knows it, or null if
+  // there is no such command.
+  static System::String^ FindCommandName(const std::string& name)
+  {
+    const auto key = ToLower(name);
+    if (const auto it = command_names_.find(key); it != command_names_.end())
+    {
+      return it->second;
+    }
+
+    // Extensions that load later can add commands.
+    const auto managed_name = gcnew System::String(
+      name.data(), 0, static_cast<int>(name.size()),
+      System::Text::Encoding::UTF8);
+    try
+    {
+      const auto command = GetDTE()->Commands->Item(managed_name, -1);
+      command_names_.emplace(key, command->Name);
+      return command->Name;
+    }
+    catch (System::ArgumentException^)
+    {
+      return nullptr;
+    }
+  }
+
+public:
+  static void ExecuteAction(System::IntPtr commands_ptr)
+  {
+    VSNVIM_TRACE_SCOPE(__FUNCTION__);
+    const auto commands = std::unique_ptr<std::vector<VSCommand>>(
+      static_cast<std::vector<VSCommand>*>(commands_ptr.ToPointer()));
+    const auto dte = GetDTE();
+    for (const auto& command : *commands)
+    {
+      const auto name = FindCommandName(command.name);
+      if (!name)
+      {
+        ReportCommandError("Unknown Visual Studio command: ", command.name);
+        return;
+      }
+
+      try
+      {
+        dte->ExecuteCommand(name, command.args.empty()
+          ? System::String::Empty
+          : gcnew System::String(command.args.data(), 0,
+              static_cast<int>(command.args.size()),
+              System::Text::Encoding::UTF8));
+      }
+      catch (System::Exception^)
+      {
+        // The exception does not say why the command failed.
+        ReportCommandError("Failed to execute Visual Studio command: ",
+                           command.name);
+        return;
+      }
+    }
+  }
+};
+
+void ExecuteVSCommands(const char* commands)
+{
+  auto parsed_commands = std::make_unique<std::vector<VSCommand>>(
+    ParseCommands(commands));
+  if (parsed_commands->empty())
+  {
+    return;
+  }
+  System::Windows::Application::Current->Dispatcher->BeginInvoke(
+    gcnew System::Action<System::IntPtr>(
+      &VSCommandDispatcher::ExecuteAction),
+    System::IntPtr(parsed_commands.release()));
+}
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+namespace VSNvim
+{
+// Runs Visual Studio commands on the UI thread without waiting for them.
+// Commands are separated by an "&&" between spaces and run in one call to
+// the UI thread. An "&&" inside a word or in double quotes is part of the
+// arguments. The first command that fails stops the rest and is reported
+// to Nvim by name.
+// Called on the Nvim thread.
+void ExecuteVSCommands(const char* commands);
+}
@@ -0,0 +1,376 @@
+#include "VSNvimMemory.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "nvim.h"
+#include "MemoryUsage.h"
+#include "TextViewHandles.h"
+#include "Trace.h"
+#include "VSNvimBridge.h"
+#include "VSNvimTextView.h"
+
+using namespace System;
+
+namespace VSNvim
+{
+// :VSNvimMemory reports the memory held for each buffer by category.
+// :VSNvimMemory evict frees every cache, and the undo history of hidden
+// buffers without a Visual Studio document, right away.
+//
+// g:vsnvim_memory_cap_mb caps the memory of all buffers and
+// g:vsnvim_buffer_memory_cap_mb that of a single buffer. Zero disables a
+// cap. A line index is about the size of its document, which Visual Studio
+// holds anyway, and would be rebuilt as soon as it is evicted from a
+// visible buffer. So the buffer cap does not count line indexes, and the
+// total cap does not count those of visible buffers. When a cap is
+// exceeded the caches of hidden buffers are evicted first, then the undo
+// history of hidden buffers without a document, with a message, then the
+// highlights of visible buffers. The undo history of documents is kept.
+static const char* const memory_command_script_ =
+  "command! -nargs=? VSNvimMemory "
+  "echo vsnvim#Request('memory', <q-args>, '')";
+
+static constexpr nvim::varnumber_T default_memory_cap_mb_ = 512;
+static constexpr nvim::varnumber_T default_buffer_memory_cap_mb_ = 128;
+static constexpr ULONGLONG check_interval_ms_ = 10000;
+
+static const char* const category_names_[] = {
+  "buf_T", "undo", "syntax", "index", "highlight", "line", "handles"
+};
+static_assert(sizeof(category_names_) / sizeof(category_names_[0]) ==
+                static_cast<int>(MemoryCategory::Count),
+              "Every category must have a name.");
+
+static ULONGLONG last_check_tick_;
+
+// The undo history's size of each buffer, by handle, and the changedtick it
+// was measured at. Undo and redo change the tick too, so the history is
+// only walked again after it changed.
+struct UndoMemorySize
+{
+  nvim::varnumber_T changedtick;
+  std::size_t size;
+};
+
+static std::map<int, UndoMemorySize> undo_memory_sizes_;
+
+static void HandleMemoryRequest(const nvim::typval_T* args);
+
+void InitMemory()
+{
+  RegisterRequestHandler("memory", &HandleMemoryRequest);
+  auto script = std::string(memory_command_script_);
+  nvim::Error error;
+  nvim::nvim_command(nvim::CreateString(script), &error);
+}
+
+// Walks the undo tree: uh_prev leads to the newer header of a branch and
+// uh_alt_next to the next alternative branch.
+static std::size_t WalkUndoTree(const nvim::buf_T* buffer)
+{
+  std::size_t size = 0;
+  std::vector<const nvim::u_header_T*> headers;
+  if (buffer->b_u_oldhead)
+  {
+    headers.push_back(buffer->b_u_oldhead);
+  }
+  while (!headers.empty())
+  {
+    const auto header = headers.back();
+    headers.pop_back();
+    size += sizeof(nvim::u_header_T);
+    for (auto entry = header->uh_entry; entry; entry = entry->ue_next)
+    {
+      size += sizeof(nvim::u_entry_T) +
+              entry->ue_size * sizeof(nvim::char_u*);
+      for (long i = 0; i < entry->ue_size; i++)
+      {
+        size += std::strlen(
+          reinterpret_cast<const char*>(entry->ue_array[i])) + 1;
+      }
+    }
+    if (header->uh_prev.ptr)
+    {
+      headers.push_back(header->uh_prev.ptr);
+    }
+    if (header->uh_alt_next.ptr)
+    {
+      headers.push_back(header->uh_alt_next.ptr);
+    }
+  }
+  return size;
+}
+
+static std::size_t GetUndoMemorySize(nvim::buf_T* buffer)
+{
+  const auto changedtick = nvim::buf_get_changedtick(buffer);
+  const auto cached = undo_memory_sizes_.find(buffer->handle);
+  if (cached != undo_memory_sizes_.end() &&
+      cached->second.changedtick == changedtick)
+  {
+    return cached->second.size;
+  }
+  const auto size = WalkUndoTree(buffer);
+  undo_memory_sizes_[buffer->handle] = UndoMemorySize{ changedtick, size };
+  return size;
+}
+
+// Forgets the sizes of wiped out buffers.
+static void PruneUndoMemorySizes()
+{
+  for (auto it = undo_memory_sizes_.begin(); it != undo_memory_sizes_.end();)
+  {
+    it = nvim::buflist_findnr(it->first) ? std::next(it)
+                                         : undo_memory_sizes_.erase(it);
+  }
+}
+
+BufferMemory GetBufferMemory(nvim::buf_T* buffer)
+{
+  BufferMemory memory;
+  memory[MemoryCategory::Buffer] = sizeof(nvim::buf_T);
+  memory[MemoryCategory::Undo] = GetUndoMemorySize(buffer);
+  if (buffer->b_s.b_sst_array)
+  {
+    memory[MemoryCategory::Syntax] =
+      buffer->b_s.b_sst_len * sizeof(nvim::synstate_T);
+  }
+  if (const auto text_view = GetBufferTextView(buffer))
+  {
+    memory[MemoryCategory::Handles] = GetTextViewHandleSize();
+    text_view->GetMemoryUsage(memory);
+  }
+  return memory;
+}
+
+// Returns the cap in bytes set by the variable, or SIZE_MAX if it is
+// disabled.
+static std::size_t GetMemoryCap(const char* name,
+                                nvim::varnumber_T default_mb)
+{
+  const auto item = nvim::tv_dict_find(nvim::get_globvar_dict(), name, -1);
+  const auto mb = item ? nvim::tv_get_number(&item->di_tv) : default_mb;
+  return mb > 0 ? static_cast<std::size_t>(mb) << 20 : SIZE_MAX;
+}
+
+static std::size_t ToKiB(std::size_t bytes)
+{
+  return (bytes + 1023) / 1024;
+}
+
+struct BufferUsage
+{
+  nvim::buf_T* buffer;
+  BufferMemory memory;
+};
+
+// Returns the memory of a buffer without its line index.
+static std::size_t GetCappedMemory(const BufferMemory& memory)
+{
+  return memory.GetTotal() - memory[MemoryCategory::LineIndex];
+}
+
+static void ReportUndoEviction(const std::vector<int>& buffers)
+{
+  std::string message = "VSNvim: freed the undo history of buffer";
+  message += buffers.size() > 1 ? "s" : "";
+  for (const auto handle : buffers)
+  {
+    message += " " + std::to_string(handle);
+  }
+  message += " to stay under the memory cap\n";
+  QueueNvimAction([message = std::move(message)]()
+  {
+    nvim::nvim_out_write(nvim::CreateString(message));
+  });
+}
+
+// Evicts memory until the buffers are under the caps, or as far as allowed,
+// and returns the number of bytes freed.
+static std::size_t EvictMemory(std::size_t total_cap, std::size_t buffer_cap)
+{
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  std::vector<BufferUsage> usages;
+  auto total = GetCursorStylesMemorySize();
+  auto is_over_cap = false;
+  for (auto buffer = nvim::firstbuf; buffer; buffer = buffer->b_next)
+  {
+    usages.push_back(BufferUsage{ buffer, GetBufferMemory(buffer) });
+    const auto& memory = usages.back().memory;
+    total += buffer->b_nwindows ? GetCappedMemory(memory) : memory.GetTotal();
+    is_over_cap |= GetCappedMemory(memory) > buffer_cap;
+  }
+  if (!is_over_cap && total <= total_cap)
+  {
+    return 0;
+  }
+
+  std::sort(usages.begin(), usages.end(),
+    [](const BufferUsage& a, const BufferUsage& b)
+    {
+      return a.memory.GetTotal() > b.memory.GetTotal();
+    });
+  std::size_t freed = 0;
+  std::vector<int> undo_buffers;
+  // The caches of hidden buffers, then their undo history, then the caches
+  // of visible buffers.
+  for (auto pass = 0; pass < 3; pass++)
+  {
+    const auto is_undo_pass = pass == 1;
+    const auto is_hidden_pass = pass < 2;
+    for (auto& usage : usages)
+    {
+      const auto buffer = usage.buffer;
+      const auto old_total = usage.memory.GetTotal();
+      if ((buffer->b_nwindows == 0) != is_hidden_pass ||
+          (total <= total_cap && GetCappedMemory(usage.memory) <= buffer_cap))
+      {
+        continue;
+      }
+      // Documents share the window, so most are hidden. Undoing in them
+      // must keep working.
+      const auto text_view = GetBufferTextView(buffer);
+      if (is_undo_pass)
+      {
+        if (!buffer->b_u_oldhead || text_view)
+        {
+          continue;
+        }
+        nvim::u_blockfree(buffer);
+        nvim::u_clearall(buffer);
+        // Clearing the history does not change the tick.
+        undo_memory_sizes_.erase(buffer->handle);
+        undo_buffers.push_back(buffer->handle);
+      }
+      else if (text_view)
+      {
+        text_view->EvictCaches(is_hidden_pass);
+      }
+      else
+      {
+        continue;
+      }
+      usage.memory = GetBufferMemory(buffer);
+      const auto new_total = usage.memory.GetTotal();
+      const auto size = old_total - (std::min)(old_total, new_total);
+      total -= size;
+      freed += size;
+      RecordTraceCounter(is_undo_pass ? "Evicted undo bytes"
+                                      : "Evicted cache bytes",
+                         static_cast<std::int64_t>(size));
+    }
+  }
+  if (!undo_buffers.empty())
+  {
+    ReportUndoEviction(undo_buffers);
+  }
+  return freed;
+}
+
+void CheckMemoryCaps()
+{
+  const auto tick = GetTickCount64();
+  if (tick - last_check_tick_ < check_interval_ms_)
+  {
+    return;
+  }
+  last_check_tick_ = tick;
+  PruneUndoMemorySizes();
+  EvictMemory(
+    GetMemoryCap("vsnvim_memory_cap_mb", default_memory_cap_mb_),
+    GetMemoryCap("vsnvim_buffer_memory_cap_mb",
+                 default_buffer_memory_cap_mb_));
+}
+
+static void AppendColumn(std::string& report, std::size_t kib)
+{
+  char column[16];
+  std::snprintf(column, sizeof(column), " %9zu", kib);
+  report += column;
+}
+
+// Lists each buffer's memory in KiB, with an h after the number of hidden
+// buffers.
+static std::string GetMemoryReport()
+{
+  std::string report = "  buf      total";
+  for (const auto name : category_names_)
+  {
+    char column[16];
+    std::snprintf(column, sizeof(column), " %9s", name);
+    report += column;
+  }
+  report += "  name";
+
+  BufferMemory totals;
+  for (auto buffer = nvim::firstbuf; buffer; buffer = buffer->b_next)
+  {
+    const auto memory = GetBufferMemory(buffer);
+    char number[16];
+    std::snprintf(number, sizeof(number), "\n%5d%c",
+                  buffer->handle, buffer->b_nwindows == 0 ? 'h' : ' ');
+    report += number;
+    AppendColumn(report, ToKiB(memory.GetTotal()));
+    for (auto i = 0; i < static_cast<int>(MemoryCategory::Count); i++)
+    {
+      AppendColumn(report, ToKiB(memory.bytes[i]));
+      totals.bytes[i] += memory.bytes[i];
+    }
+    report += "  ";
+    report += buffer->b_fname
+      ? reinterpret_cast<const char*>(buffer->b_fname)
+      : "[No Name]";
+  }
+
+  report += "\n  all ";
+  AppendColumn(report, ToKiB(totals.GetTotal()));
+  for (const auto size : totals.bytes)
+  {
+    AppendColumn(report, ToKiB(size));
+  }
+  report += "\nCursor styles: " +
+    std::to_string(ToKiB(GetCursorStylesMemorySize())) + " KiB";
+
+  const auto total_cap =
+    GetMemoryCap("vsnvim_memory_cap_mb", default_memory_cap_mb_);
+  const auto buffer_cap = GetMemoryCap("vsnvim_buffer_memory_cap_mb",
+                                       default_buffer_memory_cap_mb_);
+  report += "\nCaps: " +
+    (total_cap == SIZE_MAX ? "none" : std::to_string(total_cap >> 20) + " MB") +
+    " in total, " +
+    (buffer_cap == SIZE_MAX ? "none" : std::to_string(buffer_cap >> 20) + " MB") +
+    " per buffer";
+  return report;
+}
+
+static void HandleMemoryRequest(const nvim::typval_T* args)
+{
+  if (args->v_type != nvim::VAR_STRING)
+  {
+    return;
+  }
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  const auto request = std::string_view(nvim::tv_get_string(args));
+
+  if (request == "evict")
+  {
+    const auto freed = EvictMemory(0, 0);
+    SetRequestResult("Freed " + std::to_string(ToKiB(freed)) + " KiB");
+  }
+  else if (request.empty())
+  {
+    SetRequestResult(GetMemoryReport());
+  }
+  else
+  {
+    SetRequestResult("Usage: VSNvimMemory [evict]");
+  }
+}
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "nvim.h"
+#include "MemoryUsage.h"
+
+namespace VSNvim
+{
+// Defines the :VSNvimMemory command. Must be called on the Nvim thread.
+void InitMemory();
+
+// Evicts memory from the buffers if the soft caps are exceeded. Only checks
+// every few seconds. Called from the flush callback on the Nvim thread.
+void CheckMemoryCaps();
+
+// Returns the memory held for the buffer by category. Called on the Nvim
+// thread.
+BufferMemory GetBufferMemory(nvim::buf_T* buffer);
+}
@@ -0,0 +1,133 @@
+#include "VSNvimMessages.h"
+
+#include <string>
+
+#include "nvim.h"
+#include "FrameScheduler.h"
+#include "MessageQueue.h"
+#include "TextViewCreationListener.h"
+#include "Trace.h"
+
+using namespace Microsoft::VisualStudio::Shell::Interop;
+
+namespace VSNvim
+{
+// While an Ex command entered on the command line runs, Nvim appends its
+// output to capture_ga, which is meant for execute(). execute() saves and
+// restores it, so its own capture keeps working. Other messages, e.g. of
+// searches or of the mode, stay in Nvim.
+static nvim::garray_T captured_messages_;
+static MessageQueue message_queue_;
+
+// The output pane that shows Nvim's messages. Lines are written in one
+// batch per frame, so a command that prints millions of lines cannot keep
+// the UI thread busy.
+ref class MessagePane abstract sealed
+{
+private:
+  literal int max_lines_per_frame_ = 2000;
+  static System::Guid pane_guid_ =
+    System::Guid("8C5E4B52-7A0D-4E3A-9D43-2D4C1B5E9F61");
+  static IVsOutputWindowPane^ pane_;
+  // Whether a batch is posted for the next frame.
+  static bool is_writing_;
+
+  static IVsOutputWindowPane^ GetPane()
+  {
+    if (pane_)
+    {
+      return pane_;
+    }
+    const auto service_provider = TextViewCreationListener::
+      text_view_creation_listener_->service_provider_;
+    const auto output_window = static_cast<IVsOutputWindow^>(
+      service_provider->GetService(SVsOutputWindow::typeid));
+    output_window->CreatePane(pane_guid_, "Neovim", 1, 0);
+    output_window->GetPane(pane_guid_, pane_);
+    // The pane is shown once. Afterwards the user picks the pane to show.
+    pane_->Activate();
+    return pane_;
+  }
+
+  static void WriteAction()
+  {
+    VSNVIM_TRACE_SCOPE(__FUNCTION__);
+    std::string lines;
+    const auto dropped_lines =
+      message_queue_.Take(lines, max_lines_per_frame_);
+    const auto pane = GetPane();
+    if (!lines.empty())
+    {
+      pane->OutputStringThreadSafe(gcnew System::String(
+        lines.data(), 0, static_cast<int>(lines.size()),
+        System::Text::Encoding::UTF8));
+    }
+    if (dropped_lines)
+    {
+      pane->OutputStringThreadSafe(System::String::Format(
+        "[{0} lines of output were dropped]\n", dropped_lines));
+    }
+
+    is_writing_ = !message_queue_.IsEmpty();
+    if (is_writing_)
+    {
+      FrameScheduler::Post(FrameLane::Status, nullptr,
+        gcnew System::Action(&MessagePane::WriteAction));
+    }
+  }
+
+public:
+  static void StartAction()
+  {
+    VSNVIM_TRACE_SCOPE(__FUNCTION__);
+    if (is_writing_)
+    {
+      return;
+    }
+    is_writing_ = true;
+    WriteAction();
+  }
+};
+
+void InitMessages()
+{
+  nvim::ga_init(&captured_messages_, 1, 4096);
+
+  // The output is not paged since there is no one to answer the prompt.
+  auto command = std::string("set nomore");
+  nvim::Error error;
+  nvim::nvim_command(nvim::CreateString(command), &error);
+}
+
+void CaptureCommandOutput()
+{
+  nvim::capture_ga = &captured_messages_;
+}
+
+void CaptureMessages()
+{
+  // The command has run once Nvim is no longer executing Ex commands.
+  if (nvim::capture_ga == &captured_messages_ && !nvim::ex_nesting_level)
+  {
+    nvim::capture_ga = nullptr;
+  }
+  if (!captured_messages_.ga_len)
+  {
+    return;
+  }
+  if (message_queue_.Append(
+        static_cast<const char*>(captured_messages_.ga_data),
+        static_cast<std::size_t>(captured_messages_.ga_len)))
+  {
+    FrameScheduler::Post(FrameLane::Status, nullptr,
+      gcnew System::Action(&MessagePane::StartAction));
+  }
+
+  // Keep the memory for the next messages unless a large output grew it.
+  if (captured_messages_.ga_maxlen > 1024 * 1024)
+  {
+    nvim::ga_clear(&captured_messages_);
+  }
+  captured_messages_.ga_len = 0;
+}
+}
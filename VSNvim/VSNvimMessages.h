@@ -0,0 +1,17 @@
+#pragma once
+
+namespace VSNvim
+{
+// Prepares the capture of Ex command output. Must be called on the Nvim
+// thread.
+void InitMessages();
+
+// Captures the output of the Ex command entered on the command line until
+// it has run. Called on the Nvim thread before the command runs.
+void CaptureCommandOutput();
+
+// Moves the output captured since the last call to the message queue and
+// wakes up the output pane. Called from the flush callback on the Nvim
+// thread.
+void CaptureMessages();
+}
@@ -0,0 +1,413 @@
+#include "VSNvimPopupMenu.h"
+
+#include <vcclr.h>
+
+#include "FrameScheduler.h"
+#include "Lock.h"
+#include "PopupMenuCandidates.h"
+#include "TextViewHandles.h"
+#include "Trace.h"
+#include "VSNvimTextView.h"
+
+using namespace Microsoft::VisualStudio::Text::Editor;
+using namespace System::Windows;
+using namespace System::Windows::Controls;
+using namespace System::Windows::Controls::Primitives;
+
+namespace VSNvim
+{
+// The completion menu sent by Nvim. Only the rows that are visible in the
+// list are converted to managed strings.
+struct PopupMenu
+{
+  PopupMenuCandidates candidates;
+  // Incremented every time a new list of candidates is shown.
+  int generation;
+  int selected;
+  bool is_visible;
+  bool is_cmdline;
+  // The view showing the buffer the menu was opened in.
+  gcroot<VSNvimTextView^> text_view;
+};
+
+static Mutex popup_menu_mutex_;
+static PopupMenu popup_menu_;
+// Whether an update of the list has been scheduled and not run yet.
+static bool is_update_pending_;
+// The rows of the next popupmenu_show event. They hold the rows of the
+// menu before the last one, whose memory is reused. Used on the Nvim
+// thread only.
+static PopupMenuCandidates next_candidates_;
+
+static std::string_view GetCandidateString(const nvim::Array& candidate,
+                                           std::size_t index)
+{
+  const auto& string = candidate.items[index].data.string;
+  return std::string_view(string.data, string.size);
+}
+
+// Formats the rows of the [word, kind, menu, info] candidates of a
+// popupmenu_show event.
+static void CreateCandidates(const nvim::Array& items,
+                             PopupMenuCandidates& candidates)
+{
+  std::size_t bytes = 0;
+  for (std::size_t i = 0; i < items.size; i++)
+  {
+    const auto& candidate = items.items[i].data.array;
+    bytes += candidate.items[0].data.string.size +
+             candidate.items[1].data.string.size +
+             candidate.items[2].data.string.size + 3;
+  }
+  candidates.Clear();
+  candidates.Reserve(items.size, bytes);
+  for (std::size_t i = 0; i < items.size; i++)
+  {
+    const auto& candidate = items.items[i].data.array;
+    candidates.Add(GetCandidateString(candidate, 0),
+                   GetCandidateString(candidate, 1),
+                   GetCandidateString(candidate, 2));
+  }
+}
+
+// A row of the list. It is created when the list shows it.
+ref class PopupMenuRow
+{
+public:
+  int generation;
+  int index;
+  System::String^ text;
+
+  PopupMenuRow(int generation, int index, System::String^ text)
+    : generation(generation), index(index), text(text)
+  {
+  }
+
+  virtual bool Equals(System::Object^ other) override
+  {
+    const auto row = dynamic_cast<PopupMenuRow^>(other);
+    return row && row->generation == generation && row->index == index;
+  }
+
+  virtual int GetHashCode() override
+  {
+    return generation * 31 + index;
+  }
+
+  virtual System::String^ ToString() override
+  {
+    return text;
+  }
+};
+
+// A read-only list over the candidates of one popupmenu_show event. Its
+// count and lookups take constant time, which lets the virtualizing list
+// box materialize only the rows it shows.
+ref class PopupMenuRows : System::Collections::IList
+{
+private:
+  int generation_;
+  int count_;
+
+  ref class Enumerator : System::Collections::IEnumerator
+  {
+  private:
+    PopupMenuRows^ rows_;
+    int index_;
+
+  public:
+    Enumerator(PopupMenuRows^ rows)
+      : rows_(rows), index_(-1)
+    {
+    }
+
+    virtual property System::Object^ Current
+    {
+      System::Object^ get() { return rows_->default[index_]; }
+    }
+
+    virtual bool MoveNext()
+    {
+      return ++index_ < rows_->Count;
+    }
+
+    virtual void Reset()
+    {
+      index_ = -1;
+    }
+  };
+
+public:
+  PopupMenuRows(int generation, int count)
+    : generation_(generation), count_(count)
+  {
+  }
+
+  virtual property System::Object^ default[int]
+  {
+    System::Object^ get(int index)
+    {
+      if (index < 0 || index >= count_)
+      {
+        throw gcnew System::ArgumentOutOfRangeException("index");
+      }
+
+      System::String^ text;
+      {
+        LockGuard lock(popup_menu_mutex_);
+        if (popup_menu_.generation != generation_)
+        {
+          // The menu was replaced before this list was.
+          text = System::String::Empty;
+        }
+        else
+        {
+          const auto row_text = popup_menu_.candidates.GetRowText(
+            static_cast<std::size_t>(index));
+          text = gcnew System::String(row_text.data(), 0,
+                                      static_cast<int>(row_text.size()),
+                                      System::Text::Encoding::UTF8);
+        }
+      }
+      return gcnew PopupMenuRow(generation_, index, text);
+    }
+
+    void set(int index, System::Object^ value)
+    {
+      throw gcnew System::NotSupportedException();
+    }
+  }
+
+  property int Generation
+  {
+    int get() { return generation_; }
+  }
+
+  virtual property int Count
+  {
+    int get() { return count_; }
+  }
+
+  virtual property bool IsReadOnly
+  {
+    bool get() { return true; }
+  }
+
+  virtual property bool IsFixedSize
+  {
+    bool get() { return true; }
+  }
+
+  virtual property bool IsSynchronized
+  {
+    bool get() { return false; }
+  }
+
+  virtual property System::Object^ SyncRoot
+  {
+    System::Object^ get() { return this; }
+  }
+
+  virtual int IndexOf(System::Object^ value)
+  {
+    const auto row = dynamic_cast<PopupMenuRow^>(value);
+    return row && row->generation == generation_ ? row->index : -1;
+  }
+
+  virtual bool Contains(System::Object^ value)
+  {
+    return IndexOf(value) != -1;
+  }
+
+  virtual void CopyTo(System::Array^ array, int index)
+  {
+    for (auto i = 0; i < count_; i++)
+    {
+      array->SetValue(this->default[i], index + i);
+    }
+  }
+
+  virtual System::Collections::IEnumerator^ GetEnumerator()
+  {
+    return gcnew Enumerator(this);
+  }
+
+  virtual int Add(System::Object^ value)
+  {
+    throw gcnew System::NotSupportedException();
+  }
+
+  virtual void Clear()
+  {
+    throw gcnew System::NotSupportedException();
+  }
+
+  virtual void Insert(int index, System::Object^ value)
+  {
+    throw gcnew System::NotSupportedException();
+  }
+
+  virtual void Remove(System::Object^ value)
+  {
+    throw gcnew System::NotSupportedException();
+  }
+
+  virtual void RemoveAt(int index)
+  {
+    throw gcnew System::NotSupportedException();
+  }
+};
+
+ref class PopupMenuView abstract sealed
+{
+private:
+  literal double max_height_ = 300;
+  static Popup^ popup_;
+  static ListBox^ list_box_;
+  static PopupMenuRows^ rows_;
+
+  static void CreatePopup()
+  {
+    list_box_ = gcnew ListBox();
+    list_box_->MaxHeight = max_height_;
+    list_box_->Focusable = false;
+    list_box_->FontFamily = gcnew Media::FontFamily("Consolas");
+    VirtualizingPanel::SetIsVirtualizing(list_box_, true);
+    VirtualizingPanel::SetVirtualizationMode(
+      list_box_, VirtualizationMode::Recycling);
+    ScrollViewer::SetCanContentScroll(list_box_, true);
+
+    popup_ = gcnew Popup();
+    popup_->Child = list_box_;
+    popup_->StaysOpen = true;
+    popup_->AllowsTransparency = false;
+  }
+
+  static void Place(IWpfTextView^ text_view, bool is_cmdline)
+  {
+    popup_->PlacementTarget = text_view->VisualElement;
+    if (is_cmdline)
+    {
+      // Command line completion opens above the bottom of the view.
+      popup_->Placement = PlacementMode::Top;
+      popup_->PlacementRectangle =
+        Rect(0, text_view->ViewportHeight, 0, 0);
+      popup_->HorizontalOffset = 0;
+      popup_->VerticalOffset = 0;
+      return;
+    }
+    const auto caret = text_view->Caret;
+    popup_->Placement = PlacementMode::Relative;
+    popup_->PlacementRectangle = Rect::Empty;
+    popup_->HorizontalOffset = caret->Left - text_view->ViewportLeft;
+    popup_->VerticalOffset = caret->Bottom - text_view->ViewportTop;
+  }
+
+public:
+  // Brings the list up to date with the latest menu. Updates requested
+  // while this one was pending are coalesced into it.
+  static void UpdateAction()
+  {
+    VSNVIM_TRACE_SCOPE(__FUNCTION__);
+    int generation;
+    int count;
+    int selected;
+    bool is_visible;
+    bool is_cmdline;
+    VSNvimTextView^ text_view;
+    {
+      LockGuard lock(popup_menu_mutex_);
+      is_update_pending_ = false;
+      generation = popup_menu_.generation;
+      count = popup_menu_.is_visible
+              ? static_cast<int>(popup_menu_.candidates.GetCount())
+              : 0;
+      selected = popup_menu_.selected;
+      is_visible = popup_menu_.is_visible;
+      is_cmdline = popup_menu_.is_cmdline;
+      text_view = popup_menu_.text_view;
+    }
+
+    if (!is_visible)
+    {
+      if (popup_)
+      {
+        popup_->IsOpen = false;
+        list_box_->ItemsSource = nullptr;
+        rows_ = nullptr;
+      }
+      return;
+    }
+
+    if (!popup_)
+    {
+      CreatePopup();
+    }
+    if (!rows_ || rows_->Generation != generation)
+    {
+      rows_ = gcnew PopupMenuRows(generation, count);
+      list_box_->ItemsSource = rows_;
+    }
+
+    list_box_->SelectedIndex = selected < count ? selected : -1;
+    if (list_box_->SelectedIndex >= 0)
+    {
+      list_box_->ScrollIntoView(list_box_->SelectedItem);
+    }
+
+    const auto wpf_text_view =
+      text_view ? dynamic_cast<IWpfTextView^>(text_view->GetTextView())
+                : nullptr;
+    if (wpf_text_view)
+    {
+      Place(wpf_text_view, is_cmdline);
+      popup_->IsOpen = true;
+    }
+  }
+};
+
+bool HandlePopupMenuEvent(std::string_view name, nvim::Array args)
+{
+  // The rows are formatted before the lock is taken, so the UI thread is
+  // not blocked while a long menu is copied.
+  if (name == "popupmenu_show")
+  {
+    CreateCandidates(args.items[0].data.array, next_candidates_);
+  }
+
+  {
+    LockGuard lock(popup_menu_mutex_);
+    if (name == "popupmenu_show")
+    {
+      popup_menu_.candidates.Swap(next_candidates_);
+      popup_menu_.generation++;
+      popup_menu_.selected = static_cast<int>(args.items[1].data.integer);
+      popup_menu_.is_visible = true;
+      popup_menu_.is_cmdline = (nvim::State & CMDLINE) != 0;
+      popup_menu_.text_view = GetBufferTextView(nvim::curbuf);
+    }
+    else if (name == "popupmenu_select")
+    {
+      popup_menu_.selected = static_cast<int>(args.items[0].data.integer);
+    }
+    else if (name == "popupmenu_hide")
+    {
+      popup_menu_.is_visible = false;
+    }
+    else
+    {
+      return false;
+    }
+
+    if (is_update_pending_)
+    {
+      return true;
+    }
+    is_update_pending_ = true;
+  }
+
+  FrameScheduler::Post(FrameLane::InputEcho, nullptr,
+    gcnew System::Action(&PopupMenuView::UpdateAction));
+  return true;
+}
+}
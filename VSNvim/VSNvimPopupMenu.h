@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string_view>
+
+#include "nvim.h"
+
+namespace VSNvim
+{
+// Updates the completion menu from a popupmenu_* UI event. The rows of a
+// popupmenu_show event are formatted into a PopupMenuCandidates. Returns
+// false for other events. Called on the Nvim thread.
+bool HandlePopupMenuEvent(std::string_view name, nvim::Array args);
+}
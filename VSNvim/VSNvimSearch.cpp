@@ -0,0 +1,127 @@
+#include "VSNvimSearch.h"
+
+#include <string>
+
+#include "nvim.h"
+#include "SearchLiteral.h"
+#include "TextViewHandles.h"
+#include "Trace.h"
+#include "VSNvimBridge.h"
+#include "VSNvimTextView.h"
+
+using namespace System;
+
+namespace VSNvim
+{
+// n and N search the current line with search() first, then ask the bridge
+// for the next line that may match. The cursor is put just before that line
+// and n or N itself finds the match, so the options, jumplist and search
+// history behave as usual. A search that wraps around gives the same
+// warning as n and N. Counts, patterns without a literal and buffers that
+// are not indexed use n and N directly. So do searches without a match and
+// searches whose line turns out not to match, so that the error stops
+// macros and mappings like that of n and N.
+static const char* const search_script_ =
+  "function! vsnvim#SearchNext(reverse) abort\n"
+  "  let forward = v:searchforward ? !a:reverse : a:reverse\n"
+  "  let key = a:reverse ? 'N' : 'n'\n"
+  "  let flags = forward ? 'nW' : 'nWb'\n"
+  "  if v:count1 > 1 || empty(@/) || search(@/, flags, line('.'))\n"
+  "    execute 'normal! ' . v:count1 . key\n"
+  "    return\n"
+  "  endif\n"
+  "  let lnum = vsnvim#Request('search', forward, -1)\n"
+  "  if lnum <= 0\n"
+  "    execute 'normal! ' . key\n"
+  "    return\n"
+  "  endif\n"
+  "  let pos = getcurpos()\n"
+  "  let wrapped = forward ? lnum <= pos[1] : lnum >= pos[1]\n"
+  "  normal! m'\n"
+  "  if forward\n"
+  "    let line = lnum > 1 ? lnum - 1 : line('$')\n"
+  "    keepjumps call cursor(line, col([line, '$']))\n"
+  "  else\n"
+  "    keepjumps call cursor(lnum < line('$') ? lnum + 1 : 1, 1)\n"
+  "  endif\n"
+  "  try\n"
+  "    keepjumps execute 'normal! ' . key\n"
+  "  catch\n"
+  "    keepjumps call setpos('.', pos)\n"
+  "    execute 'normal! ' . key\n"
+  "    return\n"
+  "  endtry\n"
+  "  if wrapped && &shortmess !~# 's'\n"
+  "    let side = forward ? ['BOTTOM', 'TOP'] : ['TOP', 'BOTTOM']\n"
+  "    echohl WarningMsg\n"
+  "    echo printf('search hit %s, continuing at %s', side[0], side[1])\n"
+  "    echohl None\n"
+  "  endif\n"
+  "endfunction\n"
+  "if empty(maparg('n', 'n'))\n"
+  "  nnoremap <silent> n :<C-u>call vsnvim#SearchNext(0)<CR>\n"
+  "endif\n"
+  "if empty(maparg('N', 'n'))\n"
+  "  nnoremap <silent> N :<C-u>call vsnvim#SearchNext(1)<CR>\n"
+  "endif";
+
+static void HandleSearchRequest(const nvim::typval_T* args);
+
+void InitSearch()
+{
+  RegisterRequestHandler("search", &HandleSearchRequest);
+  auto script = std::string(search_script_);
+  nvim::Error error;
+  nvim::nvim_command(nvim::CreateString(script), &error);
+}
+
+static void SetSearchResult(int result)
+{
+  nvim::Object object;
+  object.type = nvim::kObjectTypeInteger;
+  object.data.integer = result;
+  SetRequestResult(object);
+}
+
+// Buffers without a view are not indexed and keep the default result.
+static void HandleSearchRequest(const nvim::typval_T* args)
+{
+  VSNvimTextView^ text_view = GetBufferTextView(nvim::curbuf);
+  if (args->v_type != nvim::VAR_NUMBER || !text_view)
+  {
+    return;
+  }
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  const auto is_forward = args->vval.v_number != 0;
+  const auto pattern =
+    reinterpret_cast<const char*>(nvim::last_search_pat());
+
+  // Nvim decides whether the pattern ignores case when it compiles it for
+  // n and N. 'smartcase' does not apply to patterns from * and #.
+  nvim::regmmatch_T regmatch;
+  nvim::last_pat_prog(&regmatch);
+  const auto ignore_case = regmatch.rmm_ic != 0;
+  if (regmatch.regprog)
+  {
+    nvim::vim_regfree(regmatch.regprog);
+  }
+  SearchLiteral literal;
+  if (!pattern || !regmatch.regprog ||
+      !ExtractSearchLiteral(pattern, nvim::p_magic != 0, ignore_case, false,
+                            literal))
+  {
+    SetSearchResult(-1);
+    return;
+  }
+  const auto start = is_tracing_enabled_ ? GetTraceTime() : 0;
+  const auto lnum = nvim::curwin->w_cursor.lnum;
+  const auto result = text_view->FindSearchLine(literal, lnum, is_forward,
+                                                nvim::p_ws != 0);
+  SetSearchResult(result);
+  if (start && result >= 0)
+  {
+    RecordTraceEvent("SearchLineIndex", start);
+    RecordTraceCounter("SearchLineIndex line", result);
+  }
+}
+}
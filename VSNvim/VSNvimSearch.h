@@ -0,0 +1,9 @@
+#pragma once
+
+namespace VSNvim
+{
+// Maps n and N to a search that finds the next line containing the
+// pattern's literal in the line index, instead of having Nvim read every
+// line in between. Must be called on the Nvim thread.
+void InitSearch();
+}
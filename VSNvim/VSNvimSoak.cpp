@@ -0,0 +1,937 @@
+#include "VSNvimSoak.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "nvim.h"
+#include "TextViewHandles.h"
+#include "Trace.h"
+#include "VSNvimBridge.h"
+#include "VSNvimTextView.h"
+
+using namespace System;
+using namespace System::Diagnostics;
+using namespace System::Text;
+using namespace Microsoft::VisualStudio::Text;
+
+namespace VSNvim
+{
+// :VSNvimSoak! [count] [seed] runs a soak test in the current document,
+// whose text it replaces: count random operations, by default 2000, each
+// either an Nvim command or an edit made in Visual Studio. The text has
+// multibyte characters, some of them surrogate pairs in Visual Studio.
+//
+// Every operation is repeated in a reference buffer that Nvim keeps in its
+// own memory, Nvim commands by running them there too and Visual Studio
+// edits with nvim_buf_set_lines. After every operation the text buffer and
+// the lines Nvim reads are compared with the reference, which does not go
+// through Visual Studio. At the end it reports the operations per second
+// and their latency. If they diverge, the operations are shrunk to a
+// minimal sequence that still diverges from the same starting text.
+// :VSNvimSoak stop ends the test.
+//
+// Each operation runs in its own Nvim event, so the changes Visual Studio
+// made have reached Nvim before the next one is checked.
+//
+// The test runs in the extension rather than in Tests, over the RPC
+// transport and fake_nvim_server. What it checks is the in-process bridge:
+// Nvim reading its lines from the Visual Studio text buffer, Visual Studio
+// edits moving Nvim's marks and line count, and Nvim's edits applied to the
+// text buffer. None of these exist outside Visual Studio and the Nvim fork.
+static const char* const soak_command_script_ =
+  "command! -bang -nargs=* VSNvimSoak "
+  "echo vsnvim#Request('soak', (<bang>0 ? '!' : '') . <q-args>, '')";
+
+// vsnvim#SoakReference runs a command in the reference buffer in the
+// current window and switches back. The buffer is created with the local
+// options of the document that affect editing. 'hidden' keeps the document
+// loaded while the reference is shown.
+static const char* const soak_reference_script_ =
+  "function! vsnvim#SoakReference(command) abort\n"
+  "  let view = winsaveview()\n"
+  "  let buffer = bufnr('%')\n"
+  "  let hidden = &hidden\n"
+  "  set hidden\n"
+  "  try\n"
+  "    if bufloaded(get(g:, 'vsnvim_soak_reference', -1))\n"
+  "      execute 'noautocmd keepalt keepjumps buffer'"
+  " g:vsnvim_soak_reference\n"
+  "    else\n"
+  "      noautocmd keepalt keepjumps enew\n"
+  "      setlocal buftype=nofile bufhidden=hide noswapfile nobuflisted\n"
+  "      for name in ['autoindent', 'cindent', 'cinkeys', 'cinoptions',"
+  " 'comments', 'copyindent', 'expandtab', 'formatoptions', 'indentexpr',"
+  " 'indentkeys', 'iskeyword', 'preserveindent', 'shiftwidth',"
+  " 'smartindent', 'softtabstop', 'tabstop', 'textwidth']\n"
+  "        call setbufvar('%', '&' . name, getbufvar(buffer, '&' . name))\n"
+  "      endfor\n"
+  "      let g:vsnvim_soak_reference = bufnr('%')\n"
+  "    endif\n"
+  "    execute a:command\n"
+  "  finally\n"
+  "    execute 'noautocmd keepalt keepjumps buffer' buffer\n"
+  "    let &hidden = hidden\n"
+  "    call winrestview(view)\n"
+  "  endtry\n"
+  "endfunction";
+
+static constexpr int default_soak_ops_ = 2000;
+static constexpr int initial_line_count_ = 100;
+static constexpr int max_shrink_runs_ = 300;
+
+// H and L are left out, they depend on the scroll position of the view.
+static const char* const normal_commands_[] = {
+  "x", "X", "dd", "D", "J", "p", "P", "yyp", "ddp", "~", "u", "\x12",
+  ">>", "<<", "dw", "j", "k", "w", "b", "0", "$", "gg", "G"
+};
+static const char* const insert_commands_[] = {
+  "o", "O", "A", "I", "i", "a", "cw", "s", "cc"
+};
+// Two, three and four byte characters. The last is a surrogate pair in
+// Visual Studio.
+static const char* const letters_[] = {
+  "a", "b", "c", "d", "e", "f", "g", "h", "\xC3\xA9", "\xE4\xB8\xAD",
+  "\xF0\x9F\x98\x80"
+};
+
+enum class SoakOpKind
+{
+  // A command executed by Nvim.
+  Nvim,
+  // An edit made in Visual Studio. Its position and length are reduced to
+  // the text when the operation runs, so it applies to any sequence.
+  Edit
+};
+
+struct SoakOp
+{
+  SoakOpKind kind;
+  std::string text;
+  std::uint32_t line;
+  std::uint32_t col;
+  std::uint32_t length;
+};
+
+ref struct SoakTextEdit
+{
+  static void Replace(ITextBuffer^ text_buffer, int start, int length,
+                      String^ text)
+  {
+    text_buffer->Replace(Span(start, length), text);
+  }
+};
+
+struct SoakState
+{
+  gcroot<VSNvimTextView^> text_view;
+  nvim::buf_T* buffer;
+  // The buffer the operations are repeated in, created by the first run.
+  nvim::buf_T* reference = nullptr;
+  std::uint32_t seed;
+  std::vector<std::string> initial_lines;
+  bool is_stopped = false;
+
+  // The operations of the current run and the next one to run.
+  std::vector<SoakOp> ops;
+  std::size_t next_op = 0;
+  std::vector<std::string> log;
+
+  // The first run and its measurements.
+  std::int64_t start = 0;
+  std::vector<double> nvim_latencies_ms;
+  std::vector<double> edit_latencies_ms;
+
+  // Shrinking removes one of granularity chunks of the failing operations
+  // at a time, and refines the chunks when none can be removed.
+  bool is_shrinking = false;
+  std::string failure;
+  std::vector<SoakOp> failing_ops;
+  std::vector<std::string> failing_log;
+  std::size_t granularity = 2;
+  std::size_t chunk = 0;
+  int shrink_runs = 0;
+};
+
+static std::unique_ptr<SoakState> soak_;
+
+static void RunSoakStep();
+static void HandleSoakRequest(const nvim::typval_T* args);
+
+void InitSoak()
+{
+  RegisterRequestHandler("soak", &HandleSoakRequest);
+  nvim::Error error;
+  for (const auto script : { soak_command_script_, soak_reference_script_ })
+  {
+    auto command = std::string(script);
+    nvim::nvim_command(nvim::CreateString(command), &error);
+  }
+}
+
+static String^ ToManagedString(const std::string& text)
+{
+  return gcnew String(text.data(), 0, static_cast<int>(text.size()),
+                      Encoding::UTF8);
+}
+
+static std::string ToUtf8(String^ text)
+{
+  const auto bytes = Encoding::UTF8->GetBytes(text);
+  if (bytes->Length == 0)
+  {
+    return std::string();
+  }
+  pin_ptr<Byte> data = &bytes[0];
+  return std::string(reinterpret_cast<const char*>(data), bytes->Length);
+}
+
+static void WriteSoakOutput(std::string output)
+{
+  output += '\n';
+  nvim::nvim_out_write(nvim::CreateString(output));
+}
+
+static void QueueSoakStep()
+{
+  QueueNvimAction([]()
+  {
+    RunSoakStep();
+  });
+}
+
+static std::string CreateLetter(std::mt19937& random)
+{
+  return letters_[random() % std::size(letters_)];
+}
+
+static std::string CreateWord(std::mt19937& random)
+{
+  std::string word;
+  const auto length = 1 + random() % 6;
+  for (std::uint32_t i = 0; i < length; i++)
+  {
+    word += random() % (std::size(letters_) + 1) ? CreateLetter(random)
+                                                  : " ";
+  }
+  return word;
+}
+
+static SoakOp CreateNvimOp(std::mt19937& random)
+{
+  SoakOp op{ SoakOpKind::Nvim };
+  const auto count = random() % 4 == 0
+    ? std::to_string(2 + random() % 3)
+    : std::string();
+  switch (random() % 10)
+  {
+  case 0:
+  case 1:
+  case 2:
+  case 3:
+    op.text = "normal! " + count +
+      normal_commands_[random() % std::size(normal_commands_)];
+    break;
+  case 4:
+  case 5:
+  case 6:
+    op.text = std::string("normal! ") +
+      insert_commands_[random() % std::size(insert_commands_)] +
+      CreateWord(random);
+    if (random() % 3 == 0)
+    {
+      op.text += '\r' + CreateWord(random);
+    }
+    op.text += '\x1b';
+    break;
+  case 7:
+    op.text = "normal! r" + CreateLetter(random);
+    break;
+  default:
+  {
+    // A backward range would ask for confirmation.
+    auto first_lnum = 1 + random() % initial_line_count_;
+    auto last_lnum = 1 + random() % initial_line_count_;
+    if (first_lnum > last_lnum)
+    {
+      std::swap(first_lnum, last_lnum);
+    }
+    const auto first = std::to_string(first_lnum);
+    const auto last = std::to_string(last_lnum);
+    const auto letter = CreateLetter(random);
+    switch (random() % 6)
+    {
+    case 0:
+      op.text = "%s/" + letter + "/" + CreateWord(random) + "/g";
+      break;
+    case 1:
+      op.text = first + "," + last + "d";
+      break;
+    case 2:
+      op.text = first + "t.";
+      break;
+    case 3:
+      op.text = first + "m0";
+      break;
+    case 4:
+      op.text = "g/" + letter + "/d";
+      break;
+    default:
+      op.text = first + "," + last + "j";
+      break;
+    }
+    break;
+  }
+  }
+  // The cursor is placed first, so the command does the same in the
+  // document and in the reference. cursor() keeps it in the text.
+  const auto lnum = 1 + random() % initial_line_count_;
+  const auto col = 1 + random() % 40;
+  op.text = "call cursor(" + std::to_string(lnum) + ", " +
+            std::to_string(col) + ") | silent! " + op.text;
+  return op;
+}
+
+static SoakOp CreateEditOp(std::mt19937& random)
+{
+  SoakOp op{ SoakOpKind::Edit };
+  op.line = random();
+  op.col = random();
+  const auto kind = random() % 10;
+  // Half insert, a fifth delete and the rest replace.
+  op.length = kind < 5 ? 0 : random() % 40;
+  if (kind < 5 || kind >= 7)
+  {
+    op.text = CreateWord(random);
+    if (random() % 5 == 0)
+    {
+      op.text += '\n' + CreateWord(random);
+    }
+  }
+  return op;
+}
+
+static std::vector<SoakOp> CreateSoakOps(std::uint32_t seed, int count)
+{
+  std::mt19937 random(seed);
+  std::vector<SoakOp> ops;
+  for (auto i = 0; i < count; i++)
+  {
+    ops.push_back(random() % 4 == 0
+      ? CreateEditOp(random)
+      : CreateNvimOp(random));
+  }
+  return ops;
+}
+
+static std::vector<std::string> CreateInitialLines(std::uint32_t seed)
+{
+  std::mt19937 random(seed ^ 0x9e3779b9u);
+  std::vector<std::string> lines(initial_line_count_);
+  for (auto& line : lines)
+  {
+    const auto words = random() % 8;
+    for (std::uint32_t j = 0; j < words; j++)
+    {
+      line += CreateWord(random);
+    }
+  }
+  return lines;
+}
+
+// Shows control characters the way Nvim's key notation does.
+static std::string DescribeText(std::string_view text)
+{
+  std::string description;
+  for (const auto c : text)
+  {
+    switch (c)
+    {
+    case '\r':
+      description += "<CR>";
+      break;
+    case '\n':
+      description += "<NL>";
+      break;
+    case '\x1b':
+      description += "<Esc>";
+      break;
+    case '\x12':
+      description += "<C-R>";
+      break;
+    default:
+      description += c;
+      break;
+    }
+  }
+  return description;
+}
+
+static bool IsUtf8LeadByte(char c)
+{
+  return (static_cast<unsigned char>(c) & 0xc0) != 0x80;
+}
+
+static std::size_t GetCharCount(std::string_view text)
+{
+  return std::count_if(text.begin(), text.end(), &IsUtf8LeadByte);
+}
+
+// Returns the offset of the byte that starts the count th character.
+static std::size_t GetByteOffset(std::string_view text, std::size_t count)
+{
+  std::size_t offset = 0;
+  for (; offset < text.size(); offset++)
+  {
+    if (IsUtf8LeadByte(text[offset]) && count-- == 0)
+    {
+      break;
+    }
+  }
+  return offset;
+}
+
+// Four byte characters are surrogate pairs in UTF-16.
+static int GetUtf16Length(std::string_view text)
+{
+  auto length = 0;
+  for (const auto c : text)
+  {
+    if (IsUtf8LeadByte(c))
+    {
+      length += static_cast<unsigned char>(c) >= 0xf0 ? 2 : 1;
+    }
+  }
+  return length;
+}
+
+static std::string GetBufferLine(nvim::buf_T* buffer, nvim::linenr_T lnum)
+{
+  return reinterpret_cast<const char*>(nvim::ml_get_buf(buffer, lnum, false));
+}
+
+// Runs a command in the reference buffer, and returns the error of
+// vsnvim#SoakReference, if any. The command itself is silent!.
+static std::string RunInReference(std::string command)
+{
+  nvim::Object argument;
+  argument.type = nvim::kObjectTypeString;
+  argument.data.string = nvim::CreateString(command);
+  nvim::Array arguments;
+  arguments.items = &argument;
+  arguments.size = 1;
+  arguments.capacity = 1;
+  auto name = std::string("vsnvim#SoakReference");
+  nvim::Error error = { nvim::kErrorTypeNone };
+  nvim::api_free_object(nvim::nvim_call_function(nvim::CreateString(name),
+                                                 arguments, &error));
+  if (error.type == nvim::kErrorTypeNone)
+  {
+    return std::string();
+  }
+  auto message = std::string(error.msg);
+  nvim::api_clear_error(&error);
+  return message;
+}
+
+static nvim::buf_T* GetReferenceBuffer()
+{
+  const auto item = nvim::tv_dict_find(nvim::get_globvar_dict(),
+                                       "vsnvim_soak_reference", -1);
+  return item
+    ? nvim::buflist_findnr(static_cast<int>(nvim::tv_get_number(&item->di_tv)))
+    : nullptr;
+}
+
+static void WipeReference(SoakState& soak)
+{
+  if (!soak.reference || !nvim::buf_valid(soak.reference))
+  {
+    return;
+  }
+  auto command = "silent! bwipeout! " +
+                 std::to_string(soak.reference->b_fnum) +
+                 " | unlet! g:vsnvim_soak_reference";
+  nvim::Error error;
+  nvim::nvim_command(nvim::CreateString(command), &error);
+  soak.reference = nullptr;
+}
+
+// Replaces lines [start, end) of the reference, counted from 0. Like the
+// edits Visual Studio makes to the document, this is not added to Nvim's
+// undo history, so u and <C-R> work on the same changes in both.
+static void SetReferenceLines(SoakState& soak, nvim::Integer start,
+                              nvim::Integer end,
+                              const std::vector<std::string>& lines)
+{
+  std::vector<nvim::Object> objects(lines.size());
+  for (std::size_t i = 0; i < lines.size(); i++)
+  {
+    objects[i].type = nvim::kObjectTypeString;
+    objects[i].data.string.data = const_cast<char*>(lines[i].data());
+    objects[i].data.string.size = lines[i].size();
+  }
+  nvim::Array replacement;
+  replacement.items = objects.data();
+  replacement.size = objects.size();
+  replacement.capacity = objects.size();
+
+  const auto handle = soak.reference->handle;
+  auto name = std::string("undolevels");
+  nvim::Object undo_levels;
+  undo_levels.type = nvim::kObjectTypeInteger;
+  nvim::Error error;
+  undo_levels.data.integer = -1;
+  nvim::nvim_buf_set_option(0, handle, nvim::CreateString(name), undo_levels,
+                            &error);
+  nvim::nvim_buf_set_lines(0, handle, start, end, false, replacement, &error);
+  // -123456 makes the buffer use the global 'undolevels' again.
+  undo_levels.data.integer = -123456;
+  nvim::nvim_buf_set_option(0, handle, nvim::CreateString(name), undo_levels,
+                            &error);
+}
+
+// Returns a description of the first difference between the reference,
+// the text buffer and the lines Nvim reads, or an empty string.
+static std::string CheckSoakText(SoakState& soak)
+{
+  VSNvimTextView^ text_view = soak.text_view;
+  text_view->CommitEdits();
+  const auto line_count = soak.reference->b_ml.ml_line_count;
+  const auto snapshot = text_view->GetTextView()->TextBuffer->CurrentSnapshot;
+  if (soak.buffer->b_ml.ml_line_count != line_count)
+  {
+    return "Nvim has " + std::to_string(soak.buffer->b_ml.ml_line_count) +
+           " lines, expected " + std::to_string(line_count);
+  }
+  if (snapshot->LineCount != line_count)
+  {
+    return "Visual Studio has " + std::to_string(snapshot->LineCount) +
+           " lines, expected " + std::to_string(line_count);
+  }
+  for (auto lnum = 1; lnum <= line_count; lnum++)
+  {
+    const auto expected = GetBufferLine(soak.reference, lnum);
+    const auto line = ToUtf8(snapshot->GetLineFromLineNumber(lnum - 1)->GetText());
+    if (line != expected)
+    {
+      return "Visual Studio has \"" + line + "\" on line " +
+             std::to_string(lnum) + ", expected \"" + expected + "\"";
+    }
+    const auto nvim_line = GetBufferLine(soak.buffer, lnum);
+    if (nvim_line != expected)
+    {
+      return "Nvim reads \"" + nvim_line + "\" on line " +
+             std::to_string(lnum) + ", expected \"" + expected + "\"";
+    }
+  }
+  const auto cursor_lnum = nvim::curwin->w_cursor.lnum;
+  if (cursor_lnum < 1 || cursor_lnum > line_count)
+  {
+    return "The cursor is on line " + std::to_string(cursor_lnum) + " of " +
+           std::to_string(line_count);
+  }
+  return std::string();
+}
+
+// Applies an edit to the text buffer on the UI thread, and to the
+// reference. The column and length of the edit count characters.
+static std::string RunEditOp(SoakState& soak, const SoakOp& op)
+{
+  const auto reference = soak.reference;
+  const auto line_count = reference->b_ml.ml_line_count;
+  const auto start_lnum = static_cast<int>(op.line % line_count) + 1;
+  const auto start_line = GetBufferLine(reference, start_lnum);
+  const auto start_col =
+    GetByteOffset(start_line, op.col % (GetCharCount(start_line) + 1));
+
+  // A line break counts as one character.
+  auto end_lnum = start_lnum;
+  auto end_line = start_line;
+  auto end_col = start_col;
+  auto remaining = static_cast<std::size_t>(op.length);
+  while (remaining > 0)
+  {
+    const auto rest = std::string_view(end_line).substr(end_col);
+    const auto available = GetCharCount(rest);
+    if (remaining <= available)
+    {
+      end_col += GetByteOffset(rest, remaining);
+      break;
+    }
+    remaining -= available + 1;
+    if (end_lnum == line_count)
+    {
+      end_col = end_line.size();
+      break;
+    }
+    end_lnum++;
+    end_line = GetBufferLine(reference, end_lnum);
+    end_col = 0;
+  }
+
+  VSNvimTextView^ text_view = soak.text_view;
+  text_view->CommitEdits();
+  const auto snapshot = text_view->GetTextView()->TextBuffer->CurrentSnapshot;
+  const auto start =
+    snapshot->GetLineFromLineNumber(start_lnum - 1)->Start.Position +
+    GetUtf16Length(std::string_view(start_line).substr(0, start_col));
+  const auto end =
+    snapshot->GetLineFromLineNumber(end_lnum - 1)->Start.Position +
+    GetUtf16Length(std::string_view(end_line).substr(0, end_col));
+  auto text = ToManagedString(op.text);
+  text = text->Replace("\n", Environment::NewLine);
+  System::Windows::Application::Current->Dispatcher->Invoke(
+    gcnew Action<ITextBuffer^, int, int, String^>(&SoakTextEdit::Replace),
+    text_view->GetTextView()->TextBuffer, start, end - start, text);
+
+  std::vector<std::string> lines(1, start_line.substr(0, start_col));
+  for (const auto c : op.text)
+  {
+    if (c == '\n')
+    {
+      lines.emplace_back();
+    }
+    else
+    {
+      lines.back() += c;
+    }
+  }
+  lines.back() += end_line.substr(end_col);
+  SetReferenceLines(soak, start_lnum - 1, end_lnum, lines);
+
+  return "edit " + std::to_string(start_lnum) + ":" +
+         std::to_string(start_col) + "-" + std::to_string(end_lnum) + ":" +
+         std::to_string(end_col) + " \"" + DescribeText(op.text) + "\"";
+}
+
+static void FinishSoak(std::string_view reason);
+
+// Restores the initial text and runs the operations.
+static void StartSoakRun(std::vector<SoakOp> ops)
+{
+  auto& soak = *soak_;
+  VSNvimTextView^ text_view = soak.text_view;
+  text_view->CommitEdits();
+  std::string initial_text;
+  for (std::size_t i = 0; i < soak.initial_lines.size(); i++)
+  {
+    if (i)
+    {
+      initial_text += "\r\n";
+    }
+    initial_text += soak.initial_lines[i];
+  }
+  const auto text_buffer = text_view->GetTextView()->TextBuffer;
+  System::Windows::Application::Current->Dispatcher->Invoke(
+    gcnew Action<ITextBuffer^, int, int, String^>(&SoakTextEdit::Replace),
+    text_buffer, 0, text_buffer->CurrentSnapshot->Length,
+    ToManagedString(initial_text));
+
+  // Running a command in the reference creates it.
+  const auto failure = RunInReference(std::string());
+  soak.reference = GetReferenceBuffer();
+  if (!failure.empty() || !soak.reference)
+  {
+    FinishSoak("The reference buffer could not be created: " + failure);
+    return;
+  }
+  SetReferenceLines(soak, 0, -1, soak.initial_lines);
+
+  // Undo, the unnamed register and the cursor would otherwise carry over
+  // from the previous run.
+  for (const auto buffer : { soak.buffer, soak.reference })
+  {
+    nvim::u_blockfree(buffer);
+    nvim::u_clearall(buffer);
+  }
+  auto command = std::string("silent! call setreg('\"', 'soak')");
+  nvim::Error error;
+  nvim::nvim_command(nvim::CreateString(command), &error);
+  command = "silent! call cursor(1, 1)";
+  nvim::nvim_command(nvim::CreateString(command), &error);
+
+  soak.ops = std::move(ops);
+  soak.next_op = 0;
+  soak.log.clear();
+  QueueSoakStep();
+}
+
+static std::string FormatLatencies(std::vector<double>& latencies)
+{
+  if (latencies.empty())
+  {
+    return "none";
+  }
+  std::sort(latencies.begin(), latencies.end());
+  const auto size = latencies.size();
+  char text[128];
+  std::snprintf(text, sizeof(text),
+                "p50 %.2f ms, p95 %.2f ms, p99 %.2f ms, max %.2f ms",
+                latencies[size / 2], latencies[size * 95 / 100],
+                latencies[size * 99 / 100], latencies[size - 1]);
+  return text;
+}
+
+static void ReportSoakThroughput(SoakState& soak, std::size_t op_count)
+{
+  const auto seconds =
+    static_cast<double>(Stopwatch::GetTimestamp() - soak.start) /
+    Stopwatch::Frequency;
+  char text[128];
+  std::snprintf(text, sizeof(text),
+                "VSNvimSoak: %zu operations in %.1f s (%.0f/s), seed %u",
+                op_count, seconds, seconds > 0. ? op_count / seconds : 0.,
+                soak.seed);
+  WriteSoakOutput(text);
+  WriteSoakOutput("  Nvim commands: " +
+                  FormatLatencies(soak.nvim_latencies_ms));
+  WriteSoakOutput("  Visual Studio edits: " +
+                  FormatLatencies(soak.edit_latencies_ms));
+}
+
+static void FinishSoak(std::string_view reason)
+{
+  auto& soak = *soak_;
+  if (!reason.empty())
+  {
+    WriteSoakOutput("VSNvimSoak: " + std::string(reason));
+  }
+  if (soak.is_shrinking)
+  {
+    WriteSoakOutput("VSNvimSoak: " + soak.failure);
+    WriteSoakOutput("Minimal sequence of " +
+                    std::to_string(soak.failing_log.size()) +
+                    " operations, found in " +
+                    std::to_string(soak.shrink_runs) + " runs:");
+    for (std::size_t i = 0; i < soak.failing_log.size(); i++)
+    {
+      WriteSoakOutput("  " + std::to_string(i + 1) + ". " +
+                      soak.failing_log[i]);
+    }
+  }
+  WipeReference(soak);
+  soak_.reset();
+}
+
+static void StartShrinkRun()
+{
+  auto& soak = *soak_;
+  const auto size = soak.failing_ops.size();
+  if (soak.chunk == soak.granularity)
+  {
+    if (soak.granularity >= size)
+    {
+      FinishSoak(std::string_view());
+      return;
+    }
+    soak.granularity = (std::min)(soak.granularity * 2, size);
+    soak.chunk = 0;
+  }
+  if (size <= 1 || soak.shrink_runs >= max_shrink_runs_)
+  {
+    FinishSoak(std::string_view());
+    return;
+  }
+  const auto first = soak.chunk * size / soak.granularity;
+  const auto last = (soak.chunk + 1) * size / soak.granularity;
+  std::vector<SoakOp> ops(soak.failing_ops.begin(),
+                          soak.failing_ops.begin() + first);
+  ops.insert(ops.end(), soak.failing_ops.begin() + last,
+             soak.failing_ops.end());
+  StartSoakRun(std::move(ops));
+}
+
+static void EndSoakRun(const std::string& failure)
+{
+  auto& soak = *soak_;
+  if (!soak.is_shrinking)
+  {
+    ReportSoakThroughput(soak, soak.next_op);
+    if (failure.empty())
+    {
+      FinishSoak("No divergence");
+      return;
+    }
+    soak.is_shrinking = true;
+    soak.failure = "After operation " + std::to_string(soak.next_op) +
+                   ": " + failure;
+    soak.failing_ops.assign(soak.ops.begin(),
+                            soak.ops.begin() + soak.next_op);
+    soak.failing_log = soak.log;
+    StartShrinkRun();
+    return;
+  }
+
+  soak.shrink_runs++;
+  if (!failure.empty())
+  {
+    // The ops after the divergence are not needed either.
+    soak.failing_ops.assign(soak.ops.begin(),
+                            soak.ops.begin() + soak.next_op);
+    soak.failing_log = soak.log;
+    soak.granularity = (std::max)(
+      (std::min)(soak.granularity - 1, soak.failing_ops.size()),
+      std::size_t(2));
+    soak.chunk = 0;
+  }
+  else
+  {
+    soak.chunk++;
+  }
+  StartShrinkRun();
+}
+
+static void RunSoakStep()
+{
+  if (!soak_)
+  {
+    return;
+  }
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  auto& soak = *soak_;
+  if (!nvim::buf_valid(soak.buffer) || !soak.buffer->vsnvim_data)
+  {
+    // The view and its handle are gone.
+    WipeReference(soak);
+    soak_.reset();
+    return;
+  }
+  if (soak.is_stopped)
+  {
+    if (!soak.is_shrinking)
+    {
+      ReportSoakThroughput(soak, soak.next_op);
+    }
+    FinishSoak("Stopped");
+    return;
+  }
+  if (nvim::curbuf != soak.buffer)
+  {
+    FinishSoak("Stopped because the buffer was switched");
+    return;
+  }
+  if (!nvim::buf_valid(soak.reference))
+  {
+    FinishSoak("Stopped because the reference buffer was closed");
+    return;
+  }
+
+  try
+  {
+    // Checks the text the previous operation left, once its changes have
+    // reached Nvim.
+    const auto failure = CheckSoakText(soak);
+    if (!failure.empty() || soak.next_op == soak.ops.size())
+    {
+      EndSoakRun(failure);
+      return;
+    }
+
+    const auto& op = soak.ops[soak.next_op++];
+    const auto start = Stopwatch::GetTimestamp();
+    if (op.kind == SoakOpKind::Nvim)
+    {
+      auto command = op.text;
+      nvim::Error error;
+      nvim::nvim_command(nvim::CreateString(command), &error);
+      const auto reference_failure = RunInReference(op.text);
+      if (!reference_failure.empty())
+      {
+        EndSoakRun(reference_failure);
+        return;
+      }
+      soak.log.push_back(DescribeText(op.text));
+    }
+    else
+    {
+      soak.log.push_back(RunEditOp(soak, op));
+    }
+    if (!soak.is_shrinking)
+    {
+      const auto latency_ms = (Stopwatch::GetTimestamp() - start) * 1000. /
+                              Stopwatch::Frequency;
+      (op.kind == SoakOpKind::Nvim
+        ? soak.nvim_latencies_ms
+        : soak.edit_latencies_ms).push_back(latency_ms);
+    }
+  }
+  catch (Exception^ e)
+  {
+    EndSoakRun(ToUtf8(e->GetType()->Name + ": " + e->Message));
+    return;
+  }
+  QueueSoakStep();
+}
+
+static void HandleSoakRequest(const nvim::typval_T* args)
+{
+  if (args->v_type != nvim::VAR_STRING)
+  {
+    return;
+  }
+  auto request = std::string_view(nvim::tv_get_string(args));
+
+  if (request == "stop")
+  {
+    if (soak_)
+    {
+      soak_->is_stopped = true;
+    }
+    SetRequestResult(soak_ ? "" : "No soak test is running");
+    return;
+  }
+  if (request.empty() || request[0] != '!')
+  {
+    SetRequestResult("VSNvimSoak! replaces the text of the current document, "
+                  "run it in a scratch document");
+    return;
+  }
+  if (soak_)
+  {
+    SetRequestResult("A soak test is running, :VSNvimSoak stop ends it");
+    return;
+  }
+  VSNvimTextView^ text_view = GetBufferTextView(nvim::curbuf);
+  if (!text_view)
+  {
+    SetRequestResult("The current buffer is not a Visual Studio document");
+    return;
+  }
+
+  auto op_count = default_soak_ops_;
+  auto seed = static_cast<std::uint32_t>(GetTickCount());
+  request.remove_prefix(1);
+  if (std::sscanf(std::string(request).c_str(), "%d %u", &op_count,
+                  &seed) >= 1 && op_count <= 0)
+  {
+    SetRequestResult("Usage: VSNvimSoak! [count] [seed]");
+    return;
+  }
+
+  soak_ = std::make_unique<SoakState>();
+  auto& soak = *soak_;
+  soak.text_view = text_view;
+  soak.buffer = nvim::curbuf;
+  soak.seed = seed;
+  soak.initial_lines = CreateInitialLines(seed);
+  soak.ops = CreateSoakOps(seed, op_count);
+  SetRequestResult("Soak test started with seed " + std::to_string(seed));
+
+  // The test runs in its own events rather than in the middle of a redraw.
+  QueueNvimAction([]()
+  {
+    if (soak_)
+    {
+      soak_->start = Stopwatch::GetTimestamp();
+      StartSoakRun(std::move(soak_->ops));
+    }
+  });
+}
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+namespace VSNvim
+{
+// Defines the :VSNvimSoak command. Must be called on the Nvim thread.
+void InitSoak();
+}
@@ -8,8 +8,18 @@
 #include <cliext/adapter>
 #include <cliext/algorithm>
 #include <vcclr.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
 
+#include "FrameScheduler.h"
+#include "HighlightTable.h"
+#include "NvimClassifier.h"
+#include "NvimOutliningTagger.h"
 #include "TextViewCreationListener.h"
+#include "Trace.h"
 #include "VSNvimPackage.h"
 #include "VSNvimBridge.h"
 
@@ -23,9 +33,17 @@ using namespace Microsoft::VisualStudio::Utilities;
 using namespace Microsoft::VisualStudio::Text;
 using namespace Microsoft::VisualStudio::Text::Editor;
 using namespace Microsoft::VisualStudio::Text::Formatting;
+using namespace Microsoft::VisualStudio::Text::Outlining;
 
 namespace VSNvim
 {
+bool VSNvimTextView::IsValidLine(nvim::linenr_T lnum)
+{
+  // Work posted for a line can run after the line was deleted.
+  return lnum >= 1 &&
+         lnum <= text_view_->TextBuffer->CurrentSnapshot->LineCount;
+}
+
 ITextSnapshotLine^ VSNvimTextView::GetLineFromNumber(nvim::linenr_T lnum)
 {
   // Line numbers start at one for Nvim and zero for Visual Studio
@@ -65,113 +83,692 @@ VSNvimTextView::VSNvimTextView(
     gcnew System::EventHandler(this, &VSNvimTextView::OnEnabled);
   VSNvimPackage::Disabled +=
     gcnew System::EventHandler(this, &VSNvimTextView::OnDisabled);
+  text_view->TextBuffer->Changed +=
+    gcnew EventHandler<TextContentChangedEventArgs^>(
+      this, &VSNvimTextView::OnTextBufferChanged);
+  text_view->Selection->SelectionChanged +=
+    gcnew System::EventHandler(this, &VSNvimTextView::OnSelectionChanged);
+
+  pending_edits_ = gcnew System::Collections::Generic::List<NvimEdit>();
+  cursor_key_ = gcnew Object();
+  scroll_key_ = gcnew Object();
+  selection_key_ = gcnew Object();
+  highlights_ = new BufferHighlights();
+  folds_ = new FoldMap();
+  folds_key_ = gcnew Object();
+  margin_state_ = new MarginState();
+  margin_key_ = gcnew Object();
+  search_signature_ = new std::string();
+  outlining_manager_ = TextViewCreationListener::text_view_creation_listener_->
+    outlining_manager_service_->GetOutliningManager(text_view);
+  if (outlining_manager_)
+  {
+    outlining_manager_->RegionsCollapsed +=
+      gcnew EventHandler<RegionsCollapsedEventArgs^>(
+        this, &VSNvimTextView::OnRegionsCollapsed);
+    outlining_manager_->RegionsExpanded +=
+      gcnew EventHandler<RegionsExpandedEventArgs^>(
+        this, &VSNvimTextView::OnRegionsExpanded);
+  }
+  text_view->TextBuffer->Properties[VSNvimTextView::typeid] = this;
+
+  const auto vs_text_view = TextViewCreationListener::
+    text_view_creation_listener_->editor_adaptor_->GetViewAdapter(text_view);
+  if (vs_text_view)
+  {
+    paste_filter_ = gcnew PasteCommandFilter(vs_text_view);
+  }
 
   nvim_buffer_->b_ml.ml_line_count =
     text_view->TextSnapshot->LineCount;
   SetBufferFlags();
+
+  attach_start_ = is_tracing_enabled_ ? GetTraceTime() : 0;
+  if (text_view->TextSnapshot->Length >= LineIndexBuilder::min_length_)
+  {
+    line_index_ = gcnew LineIndexBuilder(text_view->TextSnapshot);
+  }
+}
+
+VSNvimTextView::~VSNvimTextView()
+{
+  this->!VSNvimTextView();
+}
+
+VSNvimTextView::!VSNvimTextView()
+{
+  delete highlights_;
+  highlights_ = nullptr;
+  delete folds_;
+  folds_ = nullptr;
+  delete margin_state_;
+  margin_state_ = nullptr;
+  delete search_signature_;
+  search_signature_ = nullptr;
+}
+
+void VSNvimTextView::QueueEdit(NvimEdit edit)
+{
+  // The saved window may no longer fit the buffer.
+  has_saved_window_ = false;
+  if (!is_batch_active_)
+  {
+    if (edit.kind == NvimEditKind::ReplaceLine)
+    {
+      if (!pending_edits_->Count)
+      {
+        held_text_views_->Add(this);
+      }
+      JournalEdit(edit);
+      SetBufferFlags(edit);
+      return;
+    }
+    if (pending_edits_->Count)
+    {
+      CommitEdits();
+    }
+    System::Windows::Application::Current->Dispatcher->Invoke(
+      gcnew Action<NvimEdit>(this, &VSNvimTextView::ApplyEditAction), edit);
+    SetBufferFlags();
+    return;
+  }
+
+  batch_edits_++;
+  CountBatchKeys();
+  JournalEdit(edit);
+  SetBufferFlags(edit);
+}
+
+void VSNvimTextView::JournalEdit(NvimEdit edit)
+{
+  if (!pending_edits_->Count)
+  {
+    are_pending_edits_in_place_ = true;
+    pending_first_lnum_ = edit.lnum;
+    pending_last_lnum_ = edit.lnum;
+  }
+  if (edit.kind == NvimEditKind::ReplaceLine)
+  {
+    pending_first_lnum_ = Math::Min(pending_first_lnum_, edit.lnum);
+    pending_last_lnum_ = Math::Max(pending_last_lnum_, edit.lnum);
+  }
+  else
+  {
+    are_pending_edits_in_place_ = false;
+  }
+
+  // Merge runs of appended or deleted lines so a macro that adds or removes
+  // many lines results in a single text buffer change. A line replaced
+  // again, as each key typed in Insert mode does, only needs its last text.
+  const auto count = pending_edits_->Count;
+  if (count)
+  {
+    auto last = pending_edits_[count - 1];
+    if (edit.kind == NvimEditKind::AppendLine &&
+        last.kind == NvimEditKind::AppendLine &&
+        edit.lnum == last.lnum + last.count)
+    {
+      last.text += edit.text;
+      last.count++;
+      pending_edits_[count - 1] = last;
+      return;
+    }
+    if (edit.kind == NvimEditKind::DeleteLine &&
+        last.kind == NvimEditKind::DeleteLine &&
+        edit.lnum == last.lnum)
+    {
+      last.count++;
+      pending_edits_[count - 1] = last;
+      return;
+    }
+    if (edit.kind == NvimEditKind::ReplaceLine &&
+        last.kind == NvimEditKind::ReplaceLine &&
+        edit.lnum == last.lnum)
+    {
+      pending_edits_[count - 1] = edit;
+      return;
+    }
+  }
+  pending_edits_->Add(edit);
+}
+
+bool VSNvimTextView::CanReadAroundEdits(nvim::linenr_T lnum)
+{
+  return pending_edits_->Count && are_pending_edits_in_place_ &&
+         (lnum < pending_first_lnum_ || lnum > pending_last_lnum_) &&
+         !FrameScheduler::HasPending(FrameLane::Edits);
+}
+
+void VSNvimTextView::ApplyEditAction(NvimEdit edit)
+{
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  // Edits posted at the end of a batch come first.
+  FrameScheduler::RunLane(FrameLane::Edits);
+  ApplyEdit(edit);
+}
+
+void VSNvimTextView::ApplyEdit(NvimEdit edit)
+{
+  // Nvim has already adjusted its marks for its own edits.
+  is_applying_edit_ = true;
+  try
+  {
+    if (partial_line_ != nullptr &&
+        (edit.lnum != partial_lnum_ ||
+         (edit.kind != NvimEditKind::DeleteChar &&
+          edit.kind != NvimEditKind::ReplaceChar)))
+    {
+      ApplyPartialLine();
+    }
+    switch (edit.kind)
+    {
+    case NvimEditKind::AppendLine:
+      AppendLineAction(edit.lnum, edit.text);
+      break;
+    case NvimEditKind::DeleteLine:
+      DeleteLineAction(edit.lnum, edit.count);
+      break;
+    case NvimEditKind::DeleteChar:
+      DeleteCharAction(edit.lnum, edit.col);
+      break;
+    case NvimEditKind::ReplaceLine:
+      ReplaceLineAction(edit.lnum, edit.text);
+      break;
+    case NvimEditKind::ReplaceChar:
+      ReplaceCharAction(edit.lnum, edit.col, edit.text);
+      break;
+    }
+  }
+  finally
+  {
+    is_applying_edit_ = false;
+  }
+}
+
+void VSNvimTextView::ApplyEditsAction(array<NvimEdit>^ edits)
+{
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  FrameScheduler::RunLane(FrameLane::Edits);
+  ApplyPostedEditsAction(edits);
+}
+
+void VSNvimTextView::ApplyPostedEditsAction(array<NvimEdit>^ edits)
+{
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  for (auto first = 0; first < edits->Length;)
+  {
+    // Lines replaced in a row, e.g. by a visual-block insert or shift, are
+    // replaced in a single text buffer change.
+    auto last = first;
+    while (last + 1 < edits->Length &&
+           edits[first].kind == NvimEditKind::ReplaceLine &&
+           edits[last + 1].kind == NvimEditKind::ReplaceLine)
+    {
+      last++;
+    }
+    if (last > first)
+    {
+      ReplaceLinesAction(edits, first, last - first + 1);
+    }
+    else
+    {
+      ApplyEdit(edits[first]);
+    }
+    first = last + 1;
+  }
 }
 
 void VSNvimTextView::AppendLine(nvim::linenr_T lnum, nvim::char_u* line,
                                 nvim::colnr_T len)
 {
+  const auto length = len == 0
+    ? strlen(reinterpret_cast<const char*>(line))
+    : static_cast<std::size_t>(len);
   const auto utf16_line =
-    Encoding::UTF8->GetString(line, len == 0
-      ?  strlen(reinterpret_cast<const char*>(line))
-      : len) + Environment::NewLine;
-  System::Windows::Application::Current->Dispatcher->Invoke(
-    gcnew Action<nvim::linenr_T, System::String^>(
-      this, &VSNvimTextView::AppendLineAction), lnum, utf16_line);
+    Encoding::UTF8->GetString(line, static_cast<int>(length)) +
+    Environment::NewLine;
+  highlights_->InsertLines(lnum + 1, 1);
+  folds_->InsertLines(lnum + 1, 1);
+  QueueEdit(NvimEdit(NvimEditKind::AppendLine, lnum, 0, utf16_line));
 }
 
 void VSNvimTextView::AppendLineAction(
   nvim::linenr_T lnum, System::String^ line)
 {
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
   const auto text_buffer = text_view_->TextBuffer;
-  const auto buffer_pos =
-    lnum == 0 ? 0
-    : GetLineFromNumber(lnum)->EndIncludingLineBreak.Position;
-  text_buffer->Insert(buffer_pos, line);
-  SetBufferFlags();
+  if (lnum == 0)
+  {
+    text_buffer->Insert(0, line);
+    return;
+  }
+  const auto text_line = GetLineFromNumber(lnum);
+  if (text_line->LineBreakLength == 0)
+  {
+    // The last line has no line break, so the lines are appended after one
+    // and without their last one, or Visual Studio would have an empty line
+    // Nvim does not have.
+    text_buffer->Insert(text_line->End.Position, Environment::NewLine +
+      line->Substring(0, line->Length - Environment::NewLine->Length));
+    return;
+  }
+  text_buffer->Insert(text_line->EndIncludingLineBreak.Position, line);
 }
 
 void VSNvimTextView::ReplaceLine(nvim::linenr_T lnum, nvim::char_u* line)
 {
   const auto utf16_line = Encoding::UTF8->GetString(line,
     strlen(reinterpret_cast<const char*>(line))) + Environment::NewLine;
-  System::Windows::Application::Current->Dispatcher->Invoke(
-    gcnew Action<nvim::linenr_T, System::String^>(
-      this, &VSNvimTextView::ReplaceLineAction), lnum, utf16_line);
+  highlights_->ChangeLine(lnum);
+  QueueEdit(NvimEdit(NvimEditKind::ReplaceLine, lnum, 0, utf16_line));
+}
+
+// Replaces the text of the line, which ends with a line break, in the edit.
+// Only the columns between the common prefix and suffix of the old and new
+// text are replaced, so the line break, and the marks and tags around the
+// change, stay where they are.
+static void ReplaceLineColumns(ITextEdit^ text_edit,
+                               ITextSnapshotLine^ text_line, String^ line)
+{
+  const auto old_text = text_line->GetText();
+  const auto new_length = line->Length - Environment::NewLine->Length;
+  const auto max_common = Math::Min(old_text->Length, new_length);
+  auto prefix = 0;
+  while (prefix < max_common && old_text[prefix] == line[prefix])
+  {
+    prefix++;
+  }
+  auto suffix = 0;
+  while (suffix < max_common - prefix &&
+         old_text[old_text->Length - suffix - 1] ==
+           line[new_length - suffix - 1])
+  {
+    suffix++;
+  }
+  // Surrogate pairs are replaced whole.
+  if (prefix && Char::IsHighSurrogate(old_text[prefix - 1]))
+  {
+    prefix--;
+  }
+  if (suffix && Char::IsLowSurrogate(old_text[old_text->Length - suffix]))
+  {
+    suffix--;
+  }
+  const auto old_length = old_text->Length - prefix - suffix;
+  const auto text = line->Substring(prefix, new_length - prefix - suffix);
+  if (old_length || text->Length)
+  {
+    text_edit->Replace(
+      Span(text_line->Start.Position + prefix, old_length), text);
+  }
 }
 
 void VSNvimTextView::ReplaceLineAction(
   nvim::linenr_T lnum, System::String^ line)
 {
-  const auto text_line = GetLineFromNumber(lnum);
-  const auto line_span = Span(text_line->Start.Position,
-                              text_line->LengthIncludingLineBreak);
-  text_view_->TextBuffer->Replace(line_span, line);
-  SetBufferFlags();
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  const auto text_edit = text_view_->TextBuffer->CreateEdit();
+  try
+  {
+    ReplaceLineColumns(text_edit, GetLineFromNumber(lnum), line);
+    text_edit->Apply();
+  }
+  finally
+  {
+    delete text_edit;
+  }
+}
+
+void VSNvimTextView::ReplaceLinesAction(array<NvimEdit>^ edits, int first,
+                                        int count)
+{
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  // The edit's spans refer to the snapshot it was created on. A line
+  // replaced again is only replaced with its last text, or the spans would
+  // overlap.
+  const auto lines =
+    gcnew System::Collections::Generic::Dictionary<nvim::linenr_T, String^>();
+  for (auto i = first; i < first + count; i++)
+  {
+    lines[edits[i].lnum] = edits[i].text;
+  }
+  is_applying_edit_ = true;
+  if (partial_line_ != nullptr)
+  {
+    ApplyPartialLine();
+  }
+  const auto text_edit = text_view_->TextBuffer->CreateEdit();
+  try
+  {
+    for each (auto line in lines)
+    {
+      if (IsValidLine(line.Key))
+      {
+        ReplaceLineColumns(text_edit, text_edit->Snapshot->
+          GetLineFromLineNumber(line.Key - 1), line.Value);
+      }
+    }
+    text_edit->Apply();
+  }
+  finally
+  {
+    delete text_edit;
+    is_applying_edit_ = false;
+  }
 }
 
 void VSNvimTextView::ReplaceChar(nvim::linenr_T lnum,
                                  nvim::colnr_T col, nvim::char_u chr)
 {
-  const auto utf16_char = Encoding::UTF8->GetString(&chr, 1);
-  System::Windows::Application::Current->Dispatcher->Invoke(
-    gcnew Action<nvim::linenr_T, nvim::colnr_T, System::String^>(
-      this, &VSNvimTextView::ReplaceCharAction), lnum, col, chr);
+  // The byte may be part of a multibyte character, so it is passed as is.
+  highlights_->ChangeLine(lnum);
+  QueueEdit(NvimEdit(NvimEditKind::ReplaceChar, lnum, col,
+                     gcnew String(static_cast<wchar_t>(chr), 1)));
 }
 
 void VSNvimTextView::ReplaceCharAction(nvim::linenr_T lnum,
                                        nvim::colnr_T col, System::String^ chr)
 {
-  const auto text_line = GetLineFromNumber(lnum);
-  const auto line_span = Span(text_line->Start.Position + col, 1);
-  text_view_->TextBuffer->Replace(line_span, chr);
-  SetBufferFlags();
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  EditByteAction(lnum, col, chr[0]);
 }
 
 void VSNvimTextView::DeleteLine(nvim::linenr_T lnum)
 {
-  System::Windows::Application::Current->Dispatcher->Invoke(
-    gcnew Action<nvim::linenr_T>(
-      this, &VSNvimTextView::DeleteLineAction), lnum);
+  highlights_->DeleteLines(lnum, 1);
+  folds_->DeleteLines(lnum, 1);
+  QueueEdit(NvimEdit(NvimEditKind::DeleteLine, lnum, 0, nullptr));
 }
 
-void VSNvimTextView::DeleteLineAction(nvim::linenr_T lnum)
+void VSNvimTextView::DeleteLineAction(nvim::linenr_T lnum, int count)
 {
-  const auto text_line = GetLineFromNumber(lnum);
-  const auto line_span = Span(text_line->Start.Position,
-                              text_line->LengthIncludingLineBreak);
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  const auto first_line = GetLineFromNumber(lnum);
+  const auto last_line = GetLineFromNumber(lnum + count - 1);
+  auto start = first_line->Start.Position;
+  if (last_line->LineBreakLength == 0 && lnum > 1)
+  {
+    // Deleting the last lines also deletes the line break before them, or
+    // Visual Studio would keep an empty last line.
+    start = GetLineFromNumber(lnum - 1)->End.Position;
+  }
+  const auto line_span = Span::FromBounds(start,
+    last_line->EndIncludingLineBreak.Position);
   text_view_->TextBuffer->Delete(line_span);
-  SetBufferFlags();
 }
 
 void VSNvimTextView::DeleteChar(nvim::linenr_T lnum, nvim::colnr_T col)
 {
-  System::Windows::Application::Current->Dispatcher->Invoke(
-    gcnew Action<nvim::linenr_T, nvim::colnr_T>(
-      this, &VSNvimTextView::DeleteCharAction), lnum, col);
+  highlights_->ChangeLine(lnum);
+  QueueEdit(NvimEdit(NvimEditKind::DeleteChar, lnum, col, nullptr));
 }
 
 void VSNvimTextView::DeleteCharAction(nvim::linenr_T lnum, nvim::colnr_T col)
+{
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  EditByteAction(lnum, col, -1);
+}
+
+// Returns whether the bytes are a sequence of whole UTF-8 characters.
+static bool IsWholeUtf8(array<Byte>^ bytes)
+{
+  for (auto i = 0; i < bytes->Length;)
+  {
+    const auto lead = bytes[i++];
+    const auto length = lead < 0x80 ? 0
+                      : lead >= 0xc2 && lead < 0xe0 ? 1
+                      : lead >= 0xe0 && lead < 0xf0 ? 2
+                      : lead >= 0xf0 && lead < 0xf5 ? 3
+                      : -1;
+    if (length < 0 || i + length > bytes->Length)
+    {
+      return false;
+    }
+    for (const auto end = i + length; i < end; i++)
+    {
+      if ((bytes[i] & 0xc0) != 0x80)
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void VSNvimTextView::EditByteAction(nvim::linenr_T lnum, nvim::colnr_T col,
+                                    int byte)
 {
   const auto text_line = GetLineFromNumber(lnum);
-  const auto char_span = Span(text_line->Start.Position + col, 1);
-  text_view_->TextBuffer->Delete(char_span);
+  const auto is_partial = partial_line_ != nullptr && partial_lnum_ == lnum;
+  // While the line up to the column is ASCII, byte and UTF-16 columns are
+  // the same.
+  if (!is_partial && byte < 0x80 && col < text_line->Length)
+  {
+    const auto prefix =
+      text_line->Snapshot->GetText(text_line->Start.Position, col + 1);
+    auto is_ascii = true;
+    for (auto i = 0; i <= col && is_ascii; i++)
+    {
+      is_ascii = prefix[i] < 0x80;
+    }
+    if (is_ascii)
+    {
+      const auto char_span = Span(text_line->Start.Position + col, 1);
+      if (byte < 0)
+      {
+        text_view_->TextBuffer->Delete(char_span);
+      }
+      else
+      {
+        text_view_->TextBuffer->Replace(
+          char_span, gcnew String(static_cast<wchar_t>(byte), 1));
+      }
+      return;
+    }
+  }
+
+  auto line = is_partial ? partial_line_
+                         : Encoding::UTF8->GetBytes(text_line->GetText());
+  if (col >= line->Length)
+  {
+    return;
+  }
+  if (byte < 0)
+  {
+    const auto shorter = gcnew array<Byte>(line->Length - 1);
+    Array::Copy(line, shorter, col);
+    Array::Copy(line, col + 1, shorter, col, shorter->Length - col);
+    line = shorter;
+  }
+  else
+  {
+    line[col] = static_cast<Byte>(byte);
+  }
+  partial_lnum_ = lnum;
+  partial_line_ = line;
+  if (IsWholeUtf8(line))
+  {
+    ApplyPartialLine();
+  }
+}
+
+void VSNvimTextView::ApplyPartialLine()
+{
+  const auto line =
+    Encoding::UTF8->GetString(partial_line_) + Environment::NewLine;
+  const auto lnum = partial_lnum_;
+  partial_line_ = nullptr;
+  if (!IsValidLine(lnum))
+  {
+    return;
+  }
+  const auto text_edit = text_view_->TextBuffer->CreateEdit();
+  try
+  {
+    ReplaceLineColumns(text_edit, GetLineFromNumber(lnum), line);
+    text_edit->Apply();
+  }
+  finally
+  {
+    delete text_edit;
+  }
+}
+
+void VSNvimTextView::BeginBatch()
+{
+  if (is_batch_active_)
+  {
+    return;
+  }
+  is_batch_active_ = true;
+  batch_start_ = is_tracing_enabled_ ? GetTraceTime() : 0;
+  batch_deferred_flushes_ = 0;
+  batch_edits_ = 0;
+  batch_keys_ = 0;
+  batch_typebuf_len_ = nvim::typebuf.tb_len;
+  batch_text_views_->Add(this);
+}
+
+void VSNvimTextView::DeferFlush()
+{
+  batch_deferred_flushes_++;
+  CountBatchKeys();
+}
+
+void VSNvimTextView::CountBatchKeys()
+{
+  // A macro or mapping puts its keys in the typeahead buffer and Nvim takes
+  // them out as it executes them. Keys added since the last sample are not
+  // counted until they are taken out. Keys repeated with "." come from the
+  // stuff buffer and are not counted.
+  const auto typebuf_len = nvim::typebuf.tb_len;
+  if (typebuf_len < batch_typebuf_len_)
+  {
+    batch_keys_ += batch_typebuf_len_ - typebuf_len;
+  }
+  batch_typebuf_len_ = typebuf_len;
+}
+
+void VSNvimTextView::CommitEdits()
+{
+  if (!pending_edits_->Count)
+  {
+    // Nvim is about to read the text buffer, which must include the edits
+    // posted at the end of a batch.
+    if (FrameScheduler::HasPending(FrameLane::Edits))
+    {
+      System::Windows::Application::Current->Dispatcher->Invoke(
+        gcnew Action<FrameLane>(&FrameScheduler::RunLane),
+        FrameLane::Edits);
+    }
+  }
+  else
+  {
+    const auto edits = pending_edits_->ToArray();
+    pending_edits_->Clear();
+    System::Windows::Application::Current->Dispatcher->Invoke(
+      gcnew Action<array<NvimEdit>^>(this,
+                                     &VSNvimTextView::ApplyEditsAction),
+      edits);
+  }
   SetBufferFlags();
 }
 
+void VSNvimTextView::PostEdits()
+{
+  if (!pending_edits_->Count)
+  {
+    return;
+  }
+  const auto edits = pending_edits_->ToArray();
+  pending_edits_->Clear();
+  FrameScheduler::Post(FrameLane::Edits, nullptr,
+    gcnew Action<array<NvimEdit>^>(
+      this, &VSNvimTextView::ApplyPostedEditsAction),
+    edits);
+}
+
+void VSNvimTextView::CommitHeldEdits()
+{
+  for each (auto text_view in held_text_views_)
+  {
+    // A batch started since then applies them with its own edits.
+    if (!text_view->is_batch_active_ && text_view->pending_edits_->Count)
+    {
+      text_view->CommitEdits();
+    }
+  }
+  held_text_views_->Clear();
+}
+
+void VSNvimTextView::EndBatches()
+{
+  for each (auto text_view in batch_text_views_)
+  {
+    // Nvim does not wait for the edits of a finished batch.
+    text_view->PostEdits();
+    text_view->is_batch_active_ = false;
+
+    if (text_view->batch_start_)
+    {
+      // The keys per second are the keys over the duration of the batch.
+      text_view->CountBatchKeys();
+      RecordTraceEvent("KeyBatch", text_view->batch_start_);
+      RecordTraceCounter("KeyBatch keys", text_view->batch_keys_);
+      RecordTraceCounter("KeyBatch edits", text_view->batch_edits_);
+      RecordTraceCounter("KeyBatch deferred redraws",
+                         text_view->batch_deferred_flushes_);
+    }
+  }
+  batch_text_views_->Clear();
+}
+
 void VSNvimTextView::SetBufferFlags()
 {
-  const auto buffer_empty = text_view_->TextSnapshot->Length == 0;
+  const auto buffer_empty =
+    text_view_->TextBuffer->CurrentSnapshot->Length == 0;
+  if (buffer_empty)
+  {
+    nvim_buffer_->b_ml.ml_flags |= ML_EMPTY;
+  }
+  else
+  {
+    nvim_buffer_->b_ml.ml_flags &= ~ML_EMPTY;
+  }
+}
+
+void VSNvimTextView::SetBufferFlags(NvimEdit edit)
+{
+  // The text buffer does not have the journaled edits yet, so the flags
+  // follow from the edit and from the line count of Nvim. Nvim may count
+  // the line of the edit only once the edit returns.
+  const auto line_count = nvim_buffer_->b_ml.ml_line_count;
+  auto buffer_empty = false;
+  switch (edit.kind)
+  {
+  case NvimEditKind::AppendLine:
+  case NvimEditKind::ReplaceChar:
+    break;
+  case NvimEditKind::ReplaceLine:
+    buffer_empty = line_count == 1 && !edit.text->Length;
+    break;
+  case NvimEditKind::DeleteChar:
+  case NvimEditKind::DeleteLine:
+    if (line_count <= (edit.kind == NvimEditKind::DeleteLine ? 2 : 1))
+    {
+      // Whether the last line is empty is only known from the text.
+      CommitEdits();
+      return;
+    }
+    break;
+  }
   if (buffer_empty)
   {
-    nvim::curbuf->b_ml.ml_flags |= ML_EMPTY;
+    nvim_buffer_->b_ml.ml_flags |= ML_EMPTY;
   }
   else
   {
-    nvim::curbuf->b_ml.ml_flags &= ~ML_EMPTY;
+    nvim_buffer_->b_ml.ml_flags &= ~ML_EMPTY;
   }
 }
 
@@ -180,14 +777,757 @@ VSNvimCaret^ VSNvimTextView::GetCaret()
   return %caret_;
 }
 
+ITextView^ VSNvimTextView::GetTextView()
+{
+  return text_view_;
+}
+
+int VSNvimTextView::GetWindowHeight()
+{
+  return window_height_;
+}
+
+void VSNvimTextView::SaveWindowState(const nvim::win_T* window)
+{
+  has_saved_window_ = true;
+  saved_cursor_lnum_ = window->w_cursor.lnum;
+  saved_cursor_col_ = window->w_cursor.col;
+  saved_cursor_coladd_ = window->w_cursor.coladd;
+  saved_curswant_ = window->w_curswant;
+  saved_topline_ = window->w_topline;
+}
+
+void VSNvimTextView::RestoreWindowState(nvim::win_T* window,
+                                        std::uint64_t switch_start)
+{
+  is_switching_ = true;
+  switch_start_ = switch_start;
+  is_window_restored_ = has_saved_window_ &&
+    saved_topline_ <= nvim_buffer_->b_ml.ml_line_count;
+  if (!is_window_restored_)
+  {
+    return;
+  }
+  // The view kept its caret and scroll position while it was in the
+  // background, so the window takes them back as they were.
+  window->w_cursor.lnum = saved_cursor_lnum_;
+  window->w_cursor.col = saved_cursor_col_;
+  window->w_cursor.coladd = saved_cursor_coladd_;
+  window->w_curswant = saved_curswant_;
+  window->w_set_curswant = false;
+  nvim::set_topline(window, saved_topline_);
+  nvim::check_cursor();
+}
+
+bool VSNvimTextView::EndSwitch(const nvim::win_T* window)
+{
+  if (!is_switching_)
+  {
+    return false;
+  }
+  const auto is_unchanged = is_window_restored_ &&
+    window->w_cursor.lnum == saved_cursor_lnum_ &&
+    window->w_cursor.col == saved_cursor_col_ &&
+    window->w_topline == saved_topline_;
+  if (switch_start_)
+  {
+    RecordTraceEvent("BufferSwitch", switch_start_);
+    RecordTraceCounter("BufferSwitch restored", is_unchanged ? 1 : 0);
+  }
+  is_switching_ = false;
+  switch_start_ = 0;
+  is_window_restored_ = false;
+  return is_unchanged;
+}
+
+BufferHighlights* VSNvimTextView::GetHighlights()
+{
+  return highlights_;
+}
+
+// The last search pattern as 'hlsearch' highlights it.
+struct SearchHighlight
+{
+  nvim::regmmatch_T regmatch;
+  SearchLiteral literal;
+  bool has_literal;
+  int attribute;
+};
+
+// Appends the byte ranges of the matches of the search pattern in a line.
+// Lines without the pattern's literal are skipped without running the regex
+// engine, which reads the line again.
+static void FindSearchMatches(nvim::win_T* window, nvim::linenr_T lnum,
+                              std::string_view line, SearchHighlight& search,
+                              std::vector<std::pair<int, int>>& matches)
+{
+  if (search.has_literal &&
+      !FindSearchLiteral(line.data(), line.data() + line.size(),
+                         search.literal))
+  {
+    return;
+  }
+  nvim::colnr_T col = 0;
+  while (col <= static_cast<nvim::colnr_T>(line.size()) &&
+         nvim::vim_regexec_multi(&search.regmatch, window,
+                                 window->w_buffer, lnum, col, nullptr) > 0)
+  {
+    const auto start = search.regmatch.startpos[0];
+    const auto end = search.regmatch.endpos[0];
+    if (start.lnum != 0)
+    {
+      break;
+    }
+    const auto end_col = end.lnum > 0
+      ? static_cast<int>(line.size())
+      : static_cast<int>(end.col);
+    matches.emplace_back(start.col, end_col);
+
+    // An empty match is skipped by one character.
+    col = end_col > start.col ? end_col : start.col + 1;
+    while (col < static_cast<nvim::colnr_T>(line.size()) &&
+           (static_cast<unsigned char>(line[col]) & 0xC0) == 0x80)
+    {
+      col++;
+    }
+  }
+}
+
+// Computes the highlights of a line from the syntax items under each
+// character and the matches of the search pattern, which take precedence.
+// The columns are converted from bytes to UTF-16 code units.
+static void ComputeLineHighlights(nvim::win_T* window, nvim::linenr_T lnum,
+                                  bool has_syntax, SearchHighlight* search,
+                                  std::vector<HighlightSpan>& spans)
+{
+  // The line is copied since the syntax code reads other lines, which
+  // releases the line returned by ml_get.
+  const auto line = std::string(reinterpret_cast<const char*>(
+    nvim::ml_get_buf(window->w_buffer, lnum, false)));
+  std::vector<std::pair<int, int>> matches;
+  if (search)
+  {
+    FindSearchMatches(window, lnum, line, *search, matches);
+  }
+  auto match = matches.begin();
+
+  auto utf16_col = 0;
+  for (std::size_t col = 0; col < line.size(); col++)
+  {
+    const auto byte = static_cast<unsigned char>(line[col]);
+    if ((byte & 0xC0) == 0x80)
+    {
+      continue;
+    }
+    const auto width = byte >= 0xF0 ? 2 : 1;
+    while (match != matches.end() && match->second <= static_cast<int>(col))
+    {
+      ++match;
+    }
+    const auto is_match = match != matches.end() &&
+                          match->first <= static_cast<int>(col) &&
+                          static_cast<int>(col) < match->second;
+    const auto attribute = is_match
+      ? search->attribute
+      : has_syntax
+        ? nvim::syn_id2attr(nvim::syn_get_id(
+            window, lnum, static_cast<nvim::colnr_T>(col), true, nullptr,
+            false))
+        : 0;
+    if (!spans.empty() && spans.back().attribute == attribute &&
+        spans.back().end_col == utf16_col)
+    {
+      spans.back().end_col += width;
+    }
+    else if (attribute)
+    {
+      spans.push_back(HighlightSpan{ utf16_col, utf16_col + width, attribute });
+    }
+    utf16_col += width;
+  }
+}
+
+// Returns what the search highlighting depends on, or an empty string if
+// 'hlsearch' highlights nothing.
+static std::string GetSearchSignature()
+{
+  const auto pattern = nvim::last_search_pat();
+  if (!nvim::p_hls || nvim::no_hlsearch || !pattern || !*pattern)
+  {
+    return std::string();
+  }
+  auto signature = std::string(reinterpret_cast<const char*>(pattern));
+  signature += nvim::p_ic ? 'i' : 'I';
+  signature += nvim::p_scs ? 's' : 'S';
+  signature += nvim::p_magic ? 'm' : 'M';
+  return signature;
+}
+
+void VSNvimTextView::UpdateHighlights()
+{
+  const auto window = nvim_window_;
+  if (window->w_buffer != nvim_buffer_)
+  {
+    return;
+  }
+
+  // Changing the pattern or turning 'hlsearch' on or off may change any
+  // line, so the cached lines are dropped.
+  auto is_search_changed = false;
+  auto signature = GetSearchSignature();
+  if (signature != *search_signature_)
+  {
+    *search_signature_ = std::move(signature);
+    highlights_->Clear();
+    is_search_changed = true;
+  }
+
+  const auto has_syntax = nvim::syntax_present(window) != 0;
+  std::unique_ptr<SearchHighlight> search;
+  if (!search_signature_->empty())
+  {
+    search = std::make_unique<SearchHighlight>();
+    nvim::last_pat_prog(&search->regmatch);
+    if (search->regmatch.regprog)
+    {
+      const auto pattern =
+        reinterpret_cast<const char*>(nvim::last_search_pat());
+      // Nvim has applied 'smartcase', unless the pattern is from * or #.
+      search->has_literal = ExtractSearchLiteral(
+        pattern, nvim::p_magic != 0, search->regmatch.rmm_ic != 0, false,
+        search->literal);
+      search->attribute = nvim::highlight_attr[nvim::HLF_L];
+    }
+    else
+    {
+      search.reset();
+    }
+  }
+
+  std::pair<int, int> changed(INT_MAX, INT_MIN);
+  if (has_syntax || search)
+  {
+    const auto last_line = (std::min)(window->w_botline,
+                                      nvim_buffer_->b_ml.ml_line_count);
+    const auto search_ptr = search.get();
+    changed = highlights_->Update(window->w_topline, last_line,
+      [window, has_syntax, search_ptr](int lnum,
+                                       std::vector<HighlightSpan>& spans)
+      {
+        ComputeLineHighlights(window, lnum, has_syntax, search_ptr, spans);
+      });
+  }
+  if (search)
+  {
+    nvim::vim_regfree(search->regmatch.regprog);
+  }
+
+  const auto generation = highlight_table_.GetGeneration();
+  if (generation != highlight_generation_ || is_search_changed)
+  {
+    // Attribute ids were redefined or the search highlights changed, so
+    // every line may look different.
+    highlight_generation_ = generation;
+    FrameScheduler::Post(FrameLane::Decorations, nullptr,
+      gcnew Action<int, int>(
+        this, &VSNvimTextView::RaiseClassificationChangedAction),
+      1, nvim_buffer_->b_ml.ml_line_count);
+  }
+  else if (changed.first <= changed.second)
+  {
+    FrameScheduler::Post(FrameLane::Decorations, nullptr,
+      gcnew Action<int, int>(
+        this, &VSNvimTextView::RaiseClassificationChangedAction),
+      changed.first, changed.second);
+  }
+}
+
+void VSNvimTextView::RaiseClassificationChangedAction(
+  int first_line, int last_line)
+{
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  NvimClassifier^ classifier;
+  if (text_view_->TextBuffer->Properties->TryGetProperty<NvimClassifier^>(
+        NvimClassifier::typeid, classifier))
+  {
+    classifier->RaiseClassificationChanged(first_line, last_line);
+  }
+}
+
+// Collects the options and signs the margin shows and posts them when they
+// changed. Called on the Nvim thread after a flush and after the viewport
+// moved.
+void VSNvimTextView::UpdateMargin()
+{
+  const auto window = nvim_window_;
+  if (window->w_buffer != nvim_buffer_)
+  {
+    return;
+  }
+
+  MarginState state;
+  state.number = window->w_p_nu != 0;
+  state.relative_number = window->w_p_rnu != 0;
+  if (state.relative_number)
+  {
+    state.cursor_lnum = window->w_cursor.lnum;
+  }
+  if (state.number || state.relative_number)
+  {
+    auto digits = 1;
+    for (auto count = nvim_buffer_->b_ml.ml_line_count; count >= 10;
+         count /= 10)
+    {
+      digits++;
+    }
+    state.number_width =
+      (std::max)(digits, static_cast<int>(window->w_p_nuw) - 1);
+  }
+  const auto sign_column =
+    std::string_view(reinterpret_cast<const char*>(window->w_p_scl));
+  state.show_signs = sign_column == "yes" ||
+    (sign_column == "auto" && nvim_buffer_->b_signlist);
+
+  // Signs are sent for a screen above and below the viewport, so scrolling
+  // a little shows them before Nvim catches up.
+  const auto height = (std::max)(window_height_, 1);
+  const auto first = window->w_topline - height;
+  const auto last = window->w_botline + height;
+  if (state.show_signs)
+  {
+    // Nvim keeps the sign list sorted by line, and the first sign of a line
+    // is the one shown. The fork has no generation for the list, so it is
+    // read up to the end of the range instead of to its end.
+    for (auto sign = nvim_buffer_->b_signlist;
+         sign && sign->lnum <= last; sign = sign->next)
+    {
+      if (sign->lnum < first ||
+          (!state.signs.empty() && state.signs.back().first == sign->lnum))
+      {
+        continue;
+      }
+      if (const auto text = nvim::sign_get_text(sign->typenr))
+      {
+        state.signs.emplace_back(sign->lnum,
+                                 reinterpret_cast<const char*>(text));
+      }
+    }
+  }
+  if (state == *margin_state_)
+  {
+    return;
+  }
+
+  const auto sign_count = static_cast<int>(state.signs.size());
+  const auto sign_lines = gcnew array<int>(sign_count);
+  const auto sign_texts = gcnew array<String^>(sign_count);
+  for (auto i = 0; i < sign_count; i++)
+  {
+    auto& text = state.signs[i].second;
+    sign_lines[i] = state.signs[i].first;
+    sign_texts[i] = Encoding::UTF8->GetString(
+      reinterpret_cast<unsigned char*>(text.data()),
+      static_cast<int>(text.size()));
+  }
+  FrameScheduler::Post(FrameLane::Decorations, margin_key_,
+    gcnew Action<bool, bool, bool, int, int, array<int>^, array<String^>^>(
+      this, &VSNvimTextView::UpdateMarginAction),
+    state.number, state.relative_number, state.show_signs, state.cursor_lnum,
+    state.number_width, sign_lines, sign_texts);
+  *margin_state_ = std::move(state);
+}
+
+void VSNvimTextView::UpdateMarginAction(
+  bool number, bool relative_number, bool show_signs, int cursor_lnum,
+  int number_width, array<int>^ sign_lines, array<String^>^ sign_texts)
+{
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  FrameScheduler::RunLane(FrameLane::Edits);
+  if (const auto margin = NvimLineNumberMargin::GetMargin(text_view_))
+  {
+    margin->SetState(number, relative_number, show_signs, cursor_lnum,
+                     number_width, sign_lines, sign_texts);
+  }
+}
+
+FoldMap* VSNvimTextView::GetFolds()
+{
+  return folds_;
+}
+
+void VSNvimTextView::SetNvimFoldGeneration(int generation)
+{
+  nvim_fold_generation_ = generation;
+}
+
+// Scans the visible lines for closed folds and posts them to the UI thread
+// when they changed. Lines outside the viewport are synchronized when they
+// are scrolled into view.
+void VSNvimTextView::UpdateFolds()
+{
+  const auto window = nvim_window_;
+  if (window->w_buffer != nvim_buffer_)
+  {
+    return;
+  }
+
+  const auto top = window->w_topline;
+  const auto bottom = (std::min)(window->w_botline,
+                                 nvim_buffer_->b_ml.ml_line_count);
+  std::vector<FoldRange> folds;
+  for (auto lnum = top; lnum <= bottom; lnum++)
+  {
+    nvim::linenr_T first;
+    nvim::linenr_T last;
+    if (nvim::hasFoldingWin(window, lnum, &first, &last, true, nullptr))
+    {
+      folds.push_back(FoldRange{ first, last });
+      lnum = last;
+    }
+  }
+  if (!folds_->SetNvimFolds(top, bottom, std::vector<FoldRange>(folds)))
+  {
+    return;
+  }
+
+  const auto fold_lines = gcnew array<int>(static_cast<int>(folds.size()) * 2);
+  for (auto i = 0; i < static_cast<int>(folds.size()); i++)
+  {
+    fold_lines[i * 2] = folds[i].first;
+    fold_lines[i * 2 + 1] = folds[i].last;
+  }
+  FrameScheduler::Post(FrameLane::Decorations, folds_key_,
+    gcnew Action<int, int, int, array<int>^>(
+      this, &VSNvimTextView::SyncFoldsAction),
+    nvim_fold_generation_, top, bottom, fold_lines);
+}
+
+void VSNvimTextView::UpdateCollapsedRegions()
+{
+  const auto snapshot = text_view_->TextBuffer->CurrentSnapshot;
+  std::vector<FoldRange> ranges;
+  for each (auto region in outlining_manager_->GetCollapsedRegions(
+    SnapshotSpan(snapshot, 0, snapshot->Length)))
+  {
+    const auto span = region->Extent->GetSpan(snapshot);
+    ranges.push_back(FoldRange
+    {
+      span.Start.GetContainingLine()->LineNumber + 1,
+      span.End.GetContainingLine()->LineNumber + 1
+    });
+  }
+  folds_->SetCollapsed(std::move(ranges));
+}
+
+// Collapses the region with exactly these lines and returns whether there
+// was one.
+bool VSNvimTextView::CollapseRegion(int first_line, int last_line)
+{
+  const auto snapshot = text_view_->TextBuffer->CurrentSnapshot;
+  if (last_line > snapshot->LineCount)
+  {
+    return false;
+  }
+  const auto span = SnapshotSpan(
+    GetLineFromNumber(first_line)->Start, GetLineFromNumber(last_line)->End);
+  for each (auto region in outlining_manager_->GetAllRegions(span))
+  {
+    const auto extent = region->Extent->GetSpan(snapshot);
+    if (extent.Start.GetContainingLine()->LineNumber + 1 == first_line &&
+        extent.End.GetContainingLine()->LineNumber + 1 == last_line)
+    {
+      if (!region->IsCollapsed)
+      {
+        outlining_manager_->TryCollapse(region);
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+void VSNvimTextView::CollapseRegionAction(
+  int first_line, int last_line, int attempts)
+{
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  // The outlining manager picks up new regions from the tagger later, so
+  // collapsing is retried on the next frames.
+  is_syncing_folds_ = true;
+  const auto collapsed = CollapseRegion(first_line, last_line);
+  is_syncing_folds_ = false;
+  if (collapsed)
+  {
+    UpdateCollapsedRegions();
+  }
+  else if (attempts > 1)
+  {
+    FrameScheduler::Post(FrameLane::Decorations, nullptr,
+      gcnew Action<int, int, int>(
+        this, &VSNvimTextView::CollapseRegionAction),
+      first_line, last_line, attempts - 1);
+  }
+}
+
+void VSNvimTextView::ExpandRegions(int first_line)
+{
+  const auto line = GetLineFromNumber(first_line);
+  for each (auto collapsed in outlining_manager_->GetCollapsedRegions(
+    SnapshotSpan(line->Start, line->EndIncludingLineBreak)))
+  {
+    const auto extent =
+      collapsed->Extent->GetSpan(text_view_->TextBuffer->CurrentSnapshot);
+    if (extent.Start.GetContainingLine()->LineNumber + 1 == first_line)
+    {
+      outlining_manager_->Expand(collapsed);
+    }
+  }
+  NvimOutliningTaggerProvider::GetTagger(text_view_->TextBuffer)->
+    RemoveRegions(first_line);
+}
+
+void VSNvimTextView::SyncFoldsAction(int generation, int top, int bottom,
+                                     array<int>^ folds)
+{
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  FrameScheduler::RunLane(FrameLane::Edits);
+  if (!outlining_manager_ || text_view_->IsClosed ||
+      generation != vs_fold_generation_ || !IsValidLine(top) ||
+      !IsValidLine(bottom))
+  {
+    return;
+  }
+
+  is_syncing_folds_ = true;
+  const auto collapsed = folds_->GetCollapsed(top, bottom);
+  for (auto i = 0; i < folds->Length; i += 2)
+  {
+    const auto fold = FoldRange{ folds[i], folds[i + 1] };
+    if (std::find(collapsed.begin(), collapsed.end(), fold) != collapsed.end())
+    {
+      continue;
+    }
+    if (!CollapseRegion(fold.first, fold.last))
+    {
+      NvimOutliningTaggerProvider::GetTagger(text_view_->TextBuffer)->
+        AddRegion(fold.first, fold.last);
+      FrameScheduler::Post(FrameLane::Decorations, nullptr,
+        gcnew Action<int, int, int>(
+          this, &VSNvimTextView::CollapseRegionAction),
+        fold.first, fold.last, 10);
+    }
+  }
+  for (const auto& range : collapsed)
+  {
+    auto is_folded = false;
+    for (auto i = 0; i < folds->Length; i += 2)
+    {
+      is_folded = is_folded || folds[i] == range.first;
+    }
+    if (!is_folded)
+    {
+      ExpandRegions(range.first);
+    }
+  }
+  is_syncing_folds_ = false;
+  UpdateCollapsedRegions();
+}
+
+void VSNvimTextView::OnRegionsCollapsed(
+  Object^ sender, RegionsCollapsedEventArgs^ e)
+{
+  UpdateCollapsedRegions();
+  if (is_syncing_folds_)
+  {
+    return;
+  }
+
+  vs_fold_generation_++;
+  const auto snapshot = text_view_->TextBuffer->CurrentSnapshot;
+  for each (auto region in e->CollapsedRegions)
+  {
+    const auto span = region->Extent->GetSpan(snapshot);
+    VSNvim::SyncNvimFold(nvim_window_, nvim_buffer_, vs_fold_generation_,
+      span.Start.GetContainingLine()->LineNumber + 1,
+      span.End.GetContainingLine()->LineNumber + 1, true);
+  }
+}
+
+void VSNvimTextView::OnRegionsExpanded(
+  Object^ sender, RegionsExpandedEventArgs^ e)
+{
+  UpdateCollapsedRegions();
+  if (is_syncing_folds_ || e->RemovalPending)
+  {
+    return;
+  }
+
+  vs_fold_generation_++;
+  const auto snapshot = text_view_->TextBuffer->CurrentSnapshot;
+  for each (auto region in e->ExpandedRegions)
+  {
+    const auto span = region->Extent->GetSpan(snapshot);
+    VSNvim::SyncNvimFold(nvim_window_, nvim_buffer_, vs_fold_generation_,
+      span.Start.GetContainingLine()->LineNumber + 1,
+      span.End.GetContainingLine()->LineNumber + 1, false);
+  }
+}
+
+// Returns the line from the line index, or null if the index of the
+// snapshot is not built yet.
+const nvim::char_u* VSNvimTextView::GetIndexedLine(ITextSnapshot^ snapshot,
+                                                   nvim::linenr_T lnum)
+{
+  if (snapshot != last_snapshot_)
+  {
+    last_snapshot_ = snapshot;
+    last_snapshot_tick_ = Environment::TickCount;
+  }
+  if (!line_index_ || line_index_->GetSnapshot() != snapshot)
+  {
+    if (snapshot->Length < LineIndexBuilder::min_length_ ||
+        Environment::TickCount - last_snapshot_tick_ < line_index_delay_ms_)
+    {
+      return nullptr;
+    }
+    if (line_index_)
+    {
+      ReleaseLineIndex(line_index_);
+    }
+    line_index_ = gcnew LineIndexBuilder(snapshot);
+  }
+
+  const auto line = line_index_->GetLine(lnum);
+  if (line)
+  {
+    // Keeps the index alive while Nvim uses the line.
+    last_line_index_ = line_index_;
+  }
+  return reinterpret_cast<const nvim::char_u*>(line);
+}
+
+int VSNvimTextView::FindSearchLine(const SearchLiteral& literal,
+                                   nvim::linenr_T lnum, bool is_forward,
+                                   bool wraps)
+{
+  CommitEdits();
+  const auto snapshot = text_view_->TextBuffer->CurrentSnapshot;
+  // Starts building the index if the buffer is large enough.
+  GetIndexedLine(snapshot, lnum);
+  if (!line_index_ || line_index_->GetSnapshot() != snapshot)
+  {
+    return -1;
+  }
+
+  // The cursor line itself is only searched after wrapping around, since
+  // the caller has searched it already.
+  const auto end_line = snapshot->LineCount + 1;
+  auto found = is_forward
+    ? line_index_->FindLine(literal, lnum + 1, end_line, true)
+    : line_index_->FindLine(literal, 1, lnum, false);
+  if (found == 0 && wraps)
+  {
+    found = is_forward
+      ? line_index_->FindLine(literal, 1, lnum + 1, true)
+      : line_index_->FindLine(literal, lnum, end_line, false);
+  }
+  return found;
+}
+
+void VSNvimTextView::GetMemoryUsage(BufferMemory& memory)
+{
+  if (line_index_)
+  {
+    memory[MemoryCategory::LineIndex] += line_index_->GetMemorySize();
+  }
+  // The index of the line Nvim uses is kept alive after a new one is built.
+  if (last_line_index_ && last_line_index_ != line_index_)
+  {
+    memory[MemoryCategory::LineIndex] += last_line_index_->GetMemorySize();
+  }
+  memory[MemoryCategory::Highlights] += highlights_->GetMemorySize();
+  if (last_line_ != nullptr)
+  {
+    memory[MemoryCategory::PinnedLine] +=
+      safe_cast<array<Byte>^>(last_line_->Target)->Length;
+  }
+}
+
+void VSNvimTextView::ReleaseLineIndex(LineIndexBuilder^ line_index)
+{
+  if (line_index == last_line_index_)
+  {
+    line_index->Cancel();
+  }
+  else
+  {
+    delete line_index;
+  }
+}
+
+std::size_t VSNvimTextView::EvictCaches(bool evicts_line_index)
+{
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  auto size = highlights_->GetMemorySize();
+  highlights_->Release();
+  if (line_index_ && evicts_line_index)
+  {
+    size += line_index_->GetMemorySize();
+    ReleaseLineIndex(line_index_);
+    line_index_ = nullptr;
+  }
+  return size;
+}
+
+void VSNvimTextView::ReleaseLineIndexes()
+{
+  if (last_line_index_ != line_index_)
+  {
+    delete last_line_index_;
+  }
+  last_line_index_ = nullptr;
+  delete line_index_;
+  line_index_ = nullptr;
+}
+
 const nvim::char_u* VSNvimTextView::GetLine(nvim::linenr_T lnum)
 {
+  // Nvim must see its own journaled edits when it reads the buffer. Lines
+  // that are only replaced do not move the others, which Nvim reads while
+  // it replaces them one after another.
+  if (!CanReadAroundEdits(lnum))
+  {
+    CommitEdits();
+  }
+
   if (last_line_ != nullptr)
   {
     last_line_->Free();
+    last_line_ = nullptr;
+  }
+  if (last_line_index_ != line_index_)
+  {
+    delete last_line_index_;
+  }
+  last_line_index_ = nullptr;
+
+  if (partial_line_ != nullptr && partial_lnum_ == lnum)
+  {
+    // Nvim reads back the bytes it wrote before they are whole characters.
+    const auto bytes = gcnew array<Byte>(partial_line_->Length + 1);
+    Array::Copy(partial_line_, bytes, partial_line_->Length);
+    last_line_ = GCHandle::Alloc(bytes, GCHandleType::Pinned);
+    return static_cast<const nvim::char_u*>(
+      last_line_->AddrOfPinnedObject().ToPointer());
+  }
+
+  const auto snapshot = text_view_->TextBuffer->CurrentSnapshot;
+  if (const auto line = GetIndexedLine(snapshot, lnum))
+  {
+    return line;
   }
 
-  const auto utf16_line = GetLineFromNumber(lnum)->GetText();
+  const auto utf16_line =
+    snapshot->GetLineFromLineNumber(lnum - 1)->GetText();
   const auto utf8_line = Encoding::UTF8->GetBytes(utf16_line);
   last_line_ = GCHandle::Alloc(utf8_line, GCHandleType::Pinned);
   return static_cast<const nvim::char_u*>(
@@ -196,7 +1536,7 @@ const nvim::char_u* VSNvimTextView::GetLine(nvim::linenr_T lnum)
 
 void VSNvimTextView::CursorGoto(nvim::linenr_T lnum, nvim::colnr_T col)
 {
-  System::Windows::Application::Current->Dispatcher->Invoke(
+  FrameScheduler::Post(FrameLane::Cursor, cursor_key_,
     gcnew Action<nvim::linenr_T, nvim::colnr_T>(
       this, &VSNvimTextView::CursorGotoAction),
     lnum, col);
@@ -204,13 +1544,23 @@ void VSNvimTextView::CursorGoto(nvim::linenr_T lnum, nvim::colnr_T col)
 
 void VSNvimTextView::CursorGotoAction(nvim::linenr_T lnum, nvim::colnr_T col)
 {
-  if (text_view_->IsClosed || text_view_->InLayout)
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  FrameScheduler::RunLane(FrameLane::Edits);
+  if (text_view_->IsClosed || text_view_->InLayout || !IsValidLine(lnum))
   {
     return;
   }
 
   auto line_start = GetLineFromNumber(lnum)->Start;
   text_view_->Caret->MoveTo(line_start.Add(col));
+
+  if (attach_start_ && lnum != 1)
+  {
+    RecordTraceEvent("FirstMotion", attach_start_);
+    RecordTraceCounter("FirstMotion lines",
+                       text_view_->TextSnapshot->LineCount);
+    attach_start_ = 0;
+  }
 }
 
 static bool IsLineFullyVisible(ITextViewLine^ line)
@@ -218,11 +1568,6 @@ static bool IsLineFullyVisible(ITextViewLine^ line)
   return line->VisibilityState.Equals(VisibilityState::FullyVisible);
 }
 
-static bool IsLineNotFullyVisible(ITextViewLine^ line)
-{
-  return !IsLineFullyVisible(line);
-}
-
 void VSNvimTextView::OnEnabled(System::Object ^ sender, System::EventArgs^ e)
 {
   caret_.Enable();
@@ -236,7 +1581,80 @@ void VSNvimTextView::OnDisabled(System::Object ^ sender, System::EventArgs^ e)
 void VSNvimTextView::OnGotAggregateFocus(
   System::Object^ sender, System::EventArgs^ e)
 {
-  VSNvim::SwitchToBuffer(nvim_buffer_);
+  VSNvim::SwitchToBuffer(nvim_buffer_,
+                         is_tracing_enabled_ ? GetTraceTime() : 0);
+}
+
+// Returns where text inserted at the position ends, in Nvim's coordinates.
+static MarkPosition GetEndPosition(MarkPosition start, String^ text)
+{
+  auto line_breaks = 0;
+  auto last_break = -1;
+  for (auto i = 0; i < text->Length; i++)
+  {
+    const auto c = text[i];
+    // A CR followed by an LF ends its line at the LF.
+    const auto is_break =
+      c == '\n' || c == 0x85 || c == 0x2028 || c == 0x2029 ||
+      (c == '\r' && (i + 1 == text->Length || text[i + 1] != '\n'));
+    if (is_break)
+    {
+      line_breaks++;
+      last_break = i;
+    }
+  }
+  if (!line_breaks)
+  {
+    return MarkPosition{ start.line,
+                         start.col + Encoding::UTF8->GetByteCount(text) };
+  }
+  return MarkPosition{ start.line + line_breaks,
+    Encoding::UTF8->GetByteCount(text->Substring(last_break + 1)) };
+}
+
+// Sends the changes made by Visual Studio to Nvim, which does not see them
+// otherwise and moves its marks with them.
+void VSNvimTextView::OnTextBufferChanged(Object^ sender,
+                                         TextContentChangedEventArgs^ e)
+{
+  if (is_applying_edit_)
+  {
+    return;
+  }
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  // Each change is at its position after the earlier changes were made, so
+  // the text before it is that of the new snapshot.
+  auto changes = std::make_unique<std::vector<TextChange>>();
+  changes->reserve(e->Changes->Count);
+  for each (auto change in e->Changes)
+  {
+    const auto line = e->After->GetLineFromPosition(change->NewPosition);
+    const auto prefix = e->After->GetText(
+      line->Start.Position, change->NewPosition - line->Start.Position);
+    const auto start = MarkPosition{ line->LineNumber + 1,
+                                     Encoding::UTF8->GetByteCount(prefix) };
+    changes->push_back(TextChange{ start,
+                                   GetEndPosition(start, change->OldText),
+                                   GetEndPosition(start, change->NewText) });
+  }
+  AdjustNvimMarks(nvim_buffer_, std::move(changes));
+}
+
+void VSNvimTextView::ApplyExternalChange(const TextChange& change)
+{
+  has_saved_window_ = false;
+  const auto line_delta = change.new_end.line - change.old_end.line;
+  highlights_->ChangeLine(change.start.line);
+  if (line_delta > 0)
+  {
+    highlights_->InsertLines(change.old_end.line + 1, line_delta);
+    folds_->InsertLines(change.old_end.line + 1, line_delta);
+  }
+  else if (line_delta < 0)
+  {
+    highlights_->DeleteLines(change.new_end.line + 1, -line_delta);
+    folds_->DeleteLines(change.new_end.line + 1, -line_delta);
+  }
 }
 
 void VSNvimTextView::OnLayoutChanged(
@@ -256,29 +1674,37 @@ void VSNvimTextView::OnLayoutChanged(
       lines_adapter.end() - 1, &IsLineFullyVisible).get_cref();
   const auto top_line_number =
     first_visible_line->Start.GetContainingLine()->LineNumber + 1;
-  if (top_line_ == top_line_number)
+  const auto window_height =
+    static_cast<int>(text_view_->ViewportHeight) / text_view_->LineHeight;
+  if (top_line_ == top_line_number && window_height_ == window_height)
   {
     return;
   }
   top_line_ = top_line_number;
+  window_height_ = window_height;
 
-  const auto last_visible_line_index =
-    lines->GetIndexOfTextLine(lines->LastVisibleLine);
-  const auto first_hidden_line =
-    cliext::find_if(lines_adapter.begin() + last_visible_line_index,
-      lines_adapter.end() - 1, &IsLineNotFullyVisible).get_cref();
-  const auto bottom_line_number =
-    first_hidden_line->Start.GetContainingLine()->LineNumber + 1;
-
-  const auto window_height =
-    static_cast<int>(text_view_->ViewportHeight) / text_view_->LineHeight;
-  VSNvim::ResizeWindow(nvim_window_, top_line_number,
-                 bottom_line_number, window_height);
+  VSNvim::ResizeWindow(nvim_window_, nvim_buffer_, top_line_number,
+                       window_height);
 }
 
 int VSNvimTextView::GetPhysicalLinesCount(nvim::linenr_T lnum)
 {
+  CommitEdits();
+
+  // Lines hidden in a collapsed region take no rows. Lines outside the
+  // formatted part of the view take one row, since asking the layout about
+  // them would format them.
+  if (folds_->IsHidden(lnum))
+  {
+    return 0;
+  }
   const auto line = GetLineFromNumber(lnum);
+  const auto formatted_span = text_view_->TextViewLines->FormattedSpan;
+  if (formatted_span.Snapshot != line->Snapshot ||
+      !formatted_span.IntersectsWith(line->Extent))
+  {
+    return 1;
+  }
   const auto line_span = SnapshotSpan(line->Start, line->End);
   const auto physical_lines = text_view_->TextViewLines->
     GetTextViewLinesIntersectingSpan(line_span)->Count;
@@ -287,63 +1713,157 @@ int VSNvimTextView::GetPhysicalLinesCount(nvim::linenr_T lnum)
 
 void VSNvimTextView::Scroll(nvim::linenr_T lnum)
 {
-  System::Windows::Application::Current->Dispatcher->
-    Invoke(gcnew Action<nvim::linenr_T>(
-      this, &VSNvimTextView::ScrollAction), lnum);
+  FrameScheduler::Post(FrameLane::Cursor, scroll_key_,
+    gcnew Action<nvim::linenr_T>(this, &VSNvimTextView::ScrollAction), lnum);
 }
 
 void VSNvimTextView::ScrollAction(nvim::linenr_T lnum)
 {
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  FrameScheduler::RunLane(FrameLane::Edits);
+  if (text_view_->IsClosed || !IsValidLine(lnum))
+  {
+    return;
+  }
   const auto line_start = GetLineFromNumber(lnum)->Start;
   text_view_->DisplayTextLineContainingBufferPosition(
     line_start, 0, ViewRelativePosition::Top);
 }
 
-void VSNvimTextView::SelectText(nvim::pos_T position, NvimTextSelection mode)
+void VSNvimTextView::SelectText(nvim::pos_T anchor, nvim::pos_T active,
+                                NvimTextSelection mode)
 {
-  System::Windows::Application::Current->Dispatcher->
-    Invoke(gcnew Action<nvim::linenr_T, nvim::colnr_T, NvimTextSelection>(
+  // Visual mode redraws on every flush, but the selection usually has not
+  // changed.
+  if (!TakeSelectionChange() && has_published_selection_ &&
+      published_anchor_lnum_ == anchor.lnum &&
+      published_anchor_col_ == anchor.col &&
+      published_active_lnum_ == active.lnum &&
+      published_active_col_ == active.col &&
+      published_selection_mode_ == mode)
+  {
+    return;
+  }
+  has_published_selection_ = true;
+  published_anchor_lnum_ = anchor.lnum;
+  published_anchor_col_ = anchor.col;
+  published_active_lnum_ = active.lnum;
+  published_active_col_ = active.col;
+  published_selection_mode_ = mode;
+
+  FrameScheduler::Post(FrameLane::Cursor, selection_key_,
+    gcnew Action<nvim::linenr_T, nvim::colnr_T, nvim::linenr_T,
+                 nvim::colnr_T, NvimTextSelection>(
       this, &VSNvimTextView::SelectTextAction),
-      position.lnum, position.col, mode);
+    anchor.lnum, anchor.col, active.lnum, active.col, mode);
+}
+
+// Returns the point at the column of the line, or at its end.
+static SnapshotPoint GetPointInLine(ITextSnapshotLine^ line, int col)
+{
+  return line->Start.Add((cliext::min)(col, line->LengthIncludingLineBreak));
 }
 
 void VSNvimTextView::SelectTextAction(
-  nvim::linenr_T line, nvim::colnr_T col, NvimTextSelection mode)
+  nvim::linenr_T anchor_lnum, nvim::colnr_T anchor_col,
+  nvim::linenr_T active_lnum, nvim::colnr_T active_col,
+  NvimTextSelection mode)
 {
-  SnapshotPoint position1;
-  SnapshotPoint position2;
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  FrameScheduler::RunLane(FrameLane::Edits);
+  if (text_view_->IsClosed || !IsValidLine(anchor_lnum) ||
+      !IsValidLine(active_lnum))
+  {
+    return;
+  }
+
+  const auto anchor_line = GetLineFromNumber(anchor_lnum);
+  const auto active_line = GetLineFromNumber(active_lnum);
+  SnapshotPoint anchor;
+  SnapshotPoint active;
   if (mode == NvimTextSelection::Line)
   {
-    position1 = text_view_->Caret->Position
-                                  .BufferPosition.GetContainingLine()->End;
-    position2 = GetLineFromNumber(line)->Start;
+    const auto is_forward = active_lnum >= anchor_lnum;
+    anchor = is_forward ? anchor_line->Start : anchor_line->End;
+    active = is_forward ? active_line->End : active_line->Start;
   }
   else
   {
-    // Add one to include the character at the position of the caret.
-    position1 = text_view_->Caret->Position.BufferPosition + 1;
-    position2 = GetLineFromNumber(line)->Start.Add(col);
+    // The character at the rightmost end is included in the selection.
+    const auto is_forward = mode == NvimTextSelection::Block
+      ? active_col >= anchor_col
+      : active_lnum > anchor_lnum ||
+        (active_lnum == anchor_lnum && active_col >= anchor_col);
+    anchor = GetPointInLine(anchor_line, anchor_col + (is_forward ? 0 : 1));
+    active = GetPointInLine(active_line, active_col + (is_forward ? 1 : 0));
+  }
+
+  // Changing the mode recomputes the selection, so it is only set when it
+  // differs, and before the endpoints.
+  const auto selection = text_view_->Selection;
+  const auto selection_mode = mode == NvimTextSelection::Block
+                              ? TextSelectionMode::Box
+                              : TextSelectionMode::Stream;
+  is_applying_selection_ = true;
+  try
+  {
+    if (selection->Mode != selection_mode)
+    {
+      selection->Mode = selection_mode;
+    }
+    if (selection->AnchorPoint.Position != anchor ||
+        selection->ActivePoint.Position != active)
+    {
+      selection->Select(VirtualSnapshotPoint(anchor),
+                        VirtualSnapshotPoint(active));
+    }
+  }
+  finally
+  {
+    is_applying_selection_ = false;
   }
-  const auto reversed = position1 > position2;
-  text_view_->Selection->Select(
-    reversed
-    ? SnapshotSpan(position2, position1)
-    : SnapshotSpan(position1, position2),
-    reversed);
-  text_view_->Selection->Mode =
-    mode == NvimTextSelection::Block
-    ? TextSelectionMode::Box
-    : TextSelectionMode::Stream;
 }
 
 void VSNvimTextView::ClearTextSelection()
 {
-  System::Windows::Application::Current->Dispatcher->
-    Invoke(gcnew Action(this, &VSNvimTextView::ClearTextSelectionAction));
+  if (!TakeSelectionChange() && !has_published_selection_)
+  {
+    return;
+  }
+  has_published_selection_ = false;
+  FrameScheduler::Post(FrameLane::Cursor, selection_key_,
+    gcnew Action(this, &VSNvimTextView::ClearTextSelectionAction));
 }
 
 void VSNvimTextView::ClearTextSelectionAction()
 {
-  text_view_->Selection->Clear();
+  VSNVIM_TRACE_SCOPE(__FUNCTION__);
+  if (!text_view_->Selection->IsEmpty)
+  {
+    is_applying_selection_ = true;
+    try
+    {
+      text_view_->Selection->Clear();
+    }
+    finally
+    {
+      is_applying_selection_ = false;
+    }
+  }
+}
+
+bool VSNvimTextView::TakeSelectionChange()
+{
+  return System::Threading::Interlocked::Exchange(
+           is_selection_changed_, 0) != 0;
+}
+
+void VSNvimTextView::OnSelectionChanged(System::Object^ sender,
+                                        System::EventArgs^ e)
+{
+  if (!is_applying_selection_)
+  {
+    System::Threading::Interlocked::Exchange(is_selection_changed_, 1);
+  }
 }
 } // namespace VSNvim
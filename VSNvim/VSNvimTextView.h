@@ -1,7 +1,17 @@
 #pragma once
 
+#include <cstdint>
 #include "nvim.h"
+#include "BufferHighlights.h"
+#include "FoldMap.h"
+#include "LineIndexBuilder.h"
+#include "MemoryUsage.h"
+#include "NvimLineNumberMargin.h"
+#include "NvimEdit.h"
 #include "NvimTextSelection.h"
+#include "PasteCommandFilter.h"
+#include "SearchLiteral.h"
+#include "TextChange.h"
 #include "VSNvimCaret.h"
 
 namespace VSNvim
@@ -14,22 +24,180 @@ private:
   nvim::buf_T* nvim_buffer_;
   nvim::win_T* nvim_window_;
   int top_line_;
+  // The number of lines that fit in the viewport.
+  int window_height_;
+  PasteCommandFilter^ paste_filter_;
+  BufferHighlights* highlights_;
+  std::uint32_t highlight_generation_;
+  // The search pattern and options the highlights were computed with, or
+  // an empty string if 'hlsearch' was off. Only accessed from the Nvim
+  // thread.
+  std::string* search_signature_;
+
+  // The collapsed outlining regions and the state of their synchronization
+  // with Nvim's folds. The generation counts the regions collapsed or
+  // expanded in Visual Studio. Nvim's scans of its folds are only applied
+  // once Nvim has caught up with it.
+  FoldMap* folds_;
+  Microsoft::VisualStudio::Text::Outlining::IOutliningManager^
+    outlining_manager_;
+  bool is_syncing_folds_;
+  int vs_fold_generation_;
+  int nvim_fold_generation_;
+  System::Object^ folds_key_;
+
+  // The margin state last posted to the UI thread. Only accessed from the
+  // Nvim thread.
+  MarginState* margin_state_;
+  System::Object^ margin_key_;
+
+  // Set while an edit made by Nvim is applied to the text buffer.
+  bool is_applying_edit_;
+
+  // A UTF-8 line that byte edits left in the middle of a multibyte
+  // character, which the text buffer cannot hold, and its number. It is
+  // applied once its bytes form whole characters again. Only accessed on
+  // the UI thread.
+  array<System::Byte>^ partial_line_;
+  nvim::linenr_T partial_lnum_;
 
   // Holds a reference to the last accessed line
   // to prevent it from being garbage collected
   System::Runtime::InteropServices::GCHandle^ last_line_;
+  LineIndexBuilder^ last_line_index_;
+
+  // The UTF-8 lines of large documents. The index is rebuilt once the
+  // buffer has not changed for a while. Only accessed from the Nvim thread.
+  literal int line_index_delay_ms_ = 1000;
+  LineIndexBuilder^ line_index_;
+  Microsoft::VisualStudio::Text::ITextSnapshot^ last_snapshot_;
+  int last_snapshot_tick_;
+
+  // The trace time the view was attached at, until the cursor first moved
+  // off the first line, or 0 while tracing is off. Only accessed from the
+  // UI thread.
+  std::uint64_t attach_start_;
+
+  // Edits made by Nvim while a batch is active. They are applied to the
+  // text buffer in a single dispatcher call when the batch ends or when
+  // Nvim needs to read the buffer again.
+  System::Collections::Generic::List<NvimEdit>^ pending_edits_;
+  // Whether the pending edits only replace lines, which does not move the
+  // others, and the first and last lines they replace.
+  bool are_pending_edits_in_place_;
+  nvim::linenr_T pending_first_lnum_;
+  nvim::linenr_T pending_last_lnum_;
+  bool is_batch_active_;
+  // The trace time the batch started at, or 0 while tracing is off. The
+  // batch and its counts are recorded in the trace when it ends.
+  std::uint64_t batch_start_;
+  int batch_deferred_flushes_;
+  int batch_edits_;
+  // The keys Nvim took out of the typeahead buffer during the batch, and
+  // the length of the typeahead buffer when it was last sampled.
+  int batch_keys_;
+  int batch_typebuf_len_;
+
+  // Keys that coalesce the caret, scroll and selection updates posted to
+  // the frame scheduler.
+  System::Object^ cursor_key_;
+  System::Object^ scroll_key_;
+  System::Object^ selection_key_;
+
+  // The last selection posted to the UI thread. Only accessed from the Nvim
+  // thread.
+  bool has_published_selection_;
+  nvim::linenr_T published_anchor_lnum_;
+  nvim::colnr_T published_anchor_col_;
+  nvim::linenr_T published_active_lnum_;
+  nvim::colnr_T published_active_col_;
+  NvimTextSelection published_selection_mode_;
+  // Set on the UI thread when the selection is changed by something other
+  // than Nvim, so the published selection is no longer the one shown.
+  int is_selection_changed_;
+  // Set on the UI thread while it applies a selection published by Nvim.
+  bool is_applying_selection_;
+
+  // The cursor and scroll position of the window when the buffer was last
+  // switched away from. They are restored when it is switched to again,
+  // unless Nvim edited the buffer meanwhile. Only accessed from the Nvim
+  // thread.
+  bool has_saved_window_;
+  nvim::linenr_T saved_cursor_lnum_;
+  nvim::colnr_T saved_cursor_col_;
+  nvim::colnr_T saved_cursor_coladd_;
+  nvim::colnr_T saved_curswant_;
+  nvim::linenr_T saved_topline_;
+  // Whether the buffer was switched to and not flushed since, the trace
+  // time the view got the focus at, or 0 while tracing is off, and whether
+  // the switch restored the saved window. Only accessed from the Nvim
+  // thread.
+  bool is_switching_;
+  std::uint64_t switch_start_;
+  bool is_window_restored_;
+
+  // Text views with an active batch. Only accessed from the Nvim thread.
+  static System::Collections::Generic::List<VSNvimTextView^>^
+    batch_text_views_ =
+      gcnew System::Collections::Generic::List<VSNvimTextView^>();
+
+  // Text views holding line replacements made outside a batch. Commands
+  // such as a visual-block insert or shift replace many lines in a row,
+  // which are applied together at the next flush, or before anything else
+  // needs them. Only accessed from the Nvim thread.
+  static System::Collections::Generic::List<VSNvimTextView^>^
+    held_text_views_ =
+      gcnew System::Collections::Generic::List<VSNvimTextView^>();
+
+  bool IsValidLine(nvim::linenr_T lnum);
 
   Microsoft::VisualStudio::Text::ITextSnapshotLine^
     GetLineFromNumber(nvim::linenr_T lnum);
 
+  // Deletes the index, or only stops its build while Nvim uses one of its
+  // lines. The next read deletes it then.
+  void ReleaseLineIndex(LineIndexBuilder^ line_index);
+
+  const nvim::char_u* GetIndexedLine(
+    Microsoft::VisualStudio::Text::ITextSnapshot^ snapshot,
+    nvim::linenr_T lnum);
+
+  void QueueEdit(NvimEdit edit);
+
+  void JournalEdit(NvimEdit edit);
+
+  // Whether Nvim can read the line from the text buffer without the pending
+  // edits being applied first.
+  bool CanReadAroundEdits(nvim::linenr_T lnum);
+
+  void ApplyEdit(NvimEdit edit);
+
+  void ApplyEditAction(NvimEdit edit);
+
+  void ApplyEditsAction(array<NvimEdit>^ edits);
+
+  void ApplyPostedEditsAction(array<NvimEdit>^ edits);
+
+  void PostEdits();
+
   void AppendLineAction(nvim::linenr_T lnum, System::String^ line);
 
-  void DeleteLineAction(nvim::linenr_T lnum);
+  void DeleteLineAction(nvim::linenr_T lnum, int count);
 
   void DeleteCharAction(nvim::linenr_T lnum, nvim::colnr_T col);
 
+  // Deletes the byte at the byte column if byte is negative, or replaces
+  // it. Nvim edits multibyte characters one byte at a time.
+  void EditByteAction(nvim::linenr_T lnum, nvim::colnr_T col, int byte);
+
+  // Applies the partial line as it is, with its incomplete characters
+  // replaced.
+  void ApplyPartialLine();
+
   void ReplaceLineAction(nvim::linenr_T lnum, System::String^ line);
 
+  void ReplaceLinesAction(array<NvimEdit>^ edits, int first, int count);
+
   void ReplaceCharAction(nvim::linenr_T lnum, nvim::colnr_T col,
                          System::String^ chr);
 
@@ -38,10 +206,36 @@ private:
   void ScrollAction(nvim::linenr_T lnum);
 
   void SelectTextAction(
-    nvim::linenr_T line, nvim::colnr_T col, NvimTextSelection mode);
+    nvim::linenr_T anchor_lnum, nvim::colnr_T anchor_col,
+    nvim::linenr_T active_lnum, nvim::colnr_T active_col,
+    NvimTextSelection mode);
 
   void ClearTextSelectionAction();
 
+  void RaiseClassificationChangedAction(int first_line, int last_line);
+
+  void UpdateMarginAction(bool number, bool relative_number, bool show_signs,
+                          int cursor_lnum, int number_width,
+                          array<int>^ sign_lines,
+                          array<System::String^>^ sign_texts);
+
+  void UpdateCollapsedRegions();
+
+  void SyncFoldsAction(int generation, int top, int bottom,
+                       array<int>^ folds);
+
+  bool CollapseRegion(int first_line, int last_line);
+
+  void CollapseRegionAction(int first_line, int last_line, int attempts);
+
+  void ExpandRegions(int first_line);
+
+  void OnRegionsCollapsed(System::Object^ sender,
+    Microsoft::VisualStudio::Text::Outlining::RegionsCollapsedEventArgs^ e);
+
+  void OnRegionsExpanded(System::Object^ sender,
+    Microsoft::VisualStudio::Text::Outlining::RegionsExpandedEventArgs^ e);
+
   void OnEnabled(System::Object^ sender, System::EventArgs^ e);
 
   void OnDisabled(System::Object^ sender, System::EventArgs^ e);
@@ -52,13 +246,75 @@ private:
   void OnLayoutChanged(System::Object^ sender,
     Microsoft::VisualStudio::Text::Editor::TextViewLayoutChangedEventArgs^ e);
 
+  void OnTextBufferChanged(System::Object^ sender,
+    Microsoft::VisualStudio::Text::TextContentChangedEventArgs^ e);
+
 public:
   VSNvimTextView(
     Microsoft::VisualStudio::Text::Editor::IWpfTextView^ text_view,
     nvim::win_T* nvim_window);
 
+  ~VSNvimTextView();
+
+  !VSNvimTextView();
+
   VSNvimCaret^ GetCaret();
 
+  Microsoft::VisualStudio::Text::Editor::ITextView^ GetTextView();
+
+  int GetWindowHeight();
+
+  // Saves the cursor and scroll position of the window, which shows the
+  // view's buffer and is about to show another one. Called on the Nvim
+  // thread.
+  void SaveWindowState(const nvim::win_T* window);
+
+  // Restores the state saved when the window last showed the view's
+  // buffer, without recomputing the scroll position, and starts timing the
+  // switch. Called on the Nvim thread once the buffer is current.
+  void RestoreWindowState(nvim::win_T* window, std::uint64_t switch_start);
+
+  // Ends the switch to the buffer at the first flush after it. Returns true
+  // if the window is still where the view was left, so the cursor and
+  // scroll position need not be posted again. Called on the Nvim thread.
+  bool EndSwitch(const nvim::win_T* window);
+
+  BufferHighlights* GetHighlights();
+
+  void UpdateHighlights();
+
+  void UpdateMargin();
+
+  FoldMap* GetFolds();
+
+  void UpdateFolds();
+
+  void SetNvimFoldGeneration(int generation);
+
+  // Returns the first line after the cursor line, or the last one before it
+  // if not forward, that contains the literal, wrapping around the end of
+  // the buffer if wraps. Returns 0 if no line contains it, or -1 if the
+  // buffer is not indexed. Called on the Nvim thread.
+  int FindSearchLine(const SearchLiteral& literal, nvim::linenr_T lnum,
+                     bool is_forward, bool wraps);
+
+  // Shifts the cached highlights and folds for a change made by Visual
+  // Studio. Called on the Nvim thread.
+  void ApplyExternalChange(const TextChange& change);
+
+  // Adds the bytes held by the view's caches to the buffer's usage. Called
+  // on the Nvim thread.
+  void GetMemoryUsage(BufferMemory& memory);
+
+  // Frees the highlights, and the line index if evicts_line_index, which
+  // are rebuilt when the buffer is read or shown again. Returns the number
+  // of bytes freed. Called on the Nvim thread.
+  std::size_t EvictCaches(bool evicts_line_index);
+
+  // Deletes the line indexes once Nvim no longer reads the buffer. Called
+  // on the Nvim thread.
+  void ReleaseLineIndexes();
+
   const nvim::char_u* GetLine(nvim::linenr_T lnum);
 
   void AppendLine(nvim::linenr_T lnum, nvim::char_u* line, nvim::colnr_T len);
@@ -75,12 +331,39 @@ public:
 
   void Scroll(nvim::linenr_T lnum);
 
-  void SelectText(nvim::pos_T position, NvimTextSelection mode);
+  void SelectText(nvim::pos_T anchor, nvim::pos_T active,
+                  NvimTextSelection mode);
 
   void ClearTextSelection();
 
+  // Returns whether the selection was changed outside Nvim since the last
+  // call. Called on the Nvim thread.
+  bool TakeSelectionChange();
+
+  void OnSelectionChanged(System::Object^ sender, System::EventArgs^ e);
+
   int GetPhysicalLinesCount(nvim::linenr_T lnum);
 
+  // Updates the flags of the Nvim buffer that depend on the text buffer.
+  // The edits are applied on the UI thread, but the Nvim buffer is only
+  // changed on the Nvim thread.
   void SetBufferFlags();
+
+  // Updates the flags after an edit that was journaled instead of applied.
+  void SetBufferFlags(NvimEdit edit);
+
+  void CountBatchKeys();
+
+  void BeginBatch();
+
+  void DeferFlush();
+
+  void CommitEdits();
+
+  static void EndBatches();
+
+  // Applies the line replacements held outside a batch. Called on the Nvim
+  // thread when it flushes.
+  static void CommitHeldEdits();
 };
 } // namespace VSNvim
@@ -0,0 +1,84 @@
+#include "VSNvimTrace.h"
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "nvim.h"
+#include "Trace.h"
+#include "VSNvimBridge.h"
+
+namespace VSNvim
+{
+// :VSNvimTrace on, off and clear start, stop and discard the trace.
+// :VSNvimTrace [file] writes it to the file, by default vsnvim-trace.json in
+// the temporary directory.
+static const char* const trace_command_script_ =
+  "command! -nargs=? -complete=file VSNvimTrace "
+  "echo vsnvim#Request('trace', <q-args>, '')";
+
+static void HandleTraceRequest(const nvim::typval_T* args);
+
+void InitTrace()
+{
+  SetTraceThreadName("Nvim");
+
+  RegisterRequestHandler("trace", &HandleTraceRequest);
+  auto script = std::string(trace_command_script_);
+  nvim::Error error;
+  nvim::nvim_command(nvim::CreateString(script), &error);
+}
+
+static std::string GetDefaultTracePath()
+{
+  char directory[MAX_PATH + 1];
+  const auto length = GetTempPathA(sizeof(directory), directory);
+  if (length == 0 || length > sizeof(directory))
+  {
+    return "vsnvim-trace.json";
+  }
+  return std::string(directory, length) + "vsnvim-trace.json";
+}
+
+static void HandleTraceRequest(const nvim::typval_T* args)
+{
+  if (args->v_type != nvim::VAR_STRING)
+  {
+    return;
+  }
+  const auto request = std::string_view(nvim::tv_get_string(args));
+
+  if (request == "on")
+  {
+    SetTracingEnabled(true);
+    SetRequestResult("Tracing started");
+  }
+  else if (request == "off")
+  {
+    SetTracingEnabled(false);
+    SetRequestResult("Tracing stopped");
+  }
+  else if (request == "clear")
+  {
+    ClearTrace();
+    SetRequestResult("Trace cleared");
+  }
+  else
+  {
+    const auto path =
+      request.empty() ? GetDefaultTracePath() : std::string(request);
+    std::ofstream stream(path, std::ios::binary);
+    const auto count = WriteChromeTrace(stream);
+    stream.close();
+    if (!stream)
+    {
+      ReportError(std::make_unique<std::string>(
+        "E482: Can't create file " + path));
+      return;
+    }
+    SetRequestResult("Wrote " + std::to_string(count) +
+                     " trace events to " + path);
+  }
+}
+}
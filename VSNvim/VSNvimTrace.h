@@ -0,0 +1,7 @@
+#pragma once
+
+namespace VSNvim
+{
+// Defines the :VSNvimTrace command. Must be called on the Nvim thread.
+void InitTrace();
+}
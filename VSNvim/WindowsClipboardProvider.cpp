@@ -0,0 +1,190 @@
+#include "WindowsClipboardProvider.h"
+
+#include <algorithm>
+
+namespace VSNvim
+{
+static const wchar_t* const window_class_name_ = L"VSNvimClipboard";
+
+WindowsClipboardProvider::WindowsClipboardProvider()
+{
+  WNDCLASSEXW window_class = { sizeof(window_class) };
+  window_class.lpfnWndProc = &WindowProc;
+  window_class.hInstance = GetModuleHandleW(nullptr);
+  window_class.lpszClassName = window_class_name_;
+  RegisterClassExW(&window_class);
+
+  // A message-only window is enough to own the clipboard.
+  window_ = CreateWindowExW(0, window_class_name_, nullptr, 0, 0, 0, 0, 0,
+                            HWND_MESSAGE, nullptr, window_class.hInstance,
+                            nullptr);
+  SetWindowLongPtrW(window_, GWLP_USERDATA,
+                    reinterpret_cast<LONG_PTR>(this));
+}
+
+WindowsClipboardProvider::~WindowsClipboardProvider()
+{
+  DestroyWindow(window_);
+}
+
+LRESULT CALLBACK WindowsClipboardProvider::WindowProc(
+  HWND window, UINT message, WPARAM w_param, LPARAM l_param)
+{
+  const auto provider = reinterpret_cast<WindowsClipboardProvider*>(
+    GetWindowLongPtrW(window, GWLP_USERDATA));
+  switch (message)
+  {
+  case WM_RENDERFORMAT:
+    if (provider && w_param == CF_UNICODETEXT)
+    {
+      provider->Render();
+    }
+    return 0;
+  case WM_RENDERALLFORMATS:
+    // The window is being destroyed while it still owns the clipboard.
+    if (provider && OpenClipboard(window))
+    {
+      if (GetClipboardOwner() == window)
+      {
+        provider->Render();
+      }
+      CloseClipboard();
+    }
+    return 0;
+  case WM_DESTROYCLIPBOARD:
+    if (provider)
+    {
+      LockGuard lock(provider->mutex_);
+      provider->published_.reset();
+    }
+    return 0;
+  default:
+    return DefWindowProcW(window, message, w_param, l_param);
+  }
+}
+
+void WindowsClipboardProvider::Render()
+{
+  std::shared_ptr<const ClipboardContents> contents;
+  {
+    LockGuard lock(mutex_);
+    contents = published_;
+  }
+  if (!contents)
+  {
+    return;
+  }
+
+  // Each '\n' becomes "\r\n". A linewise register already ends with one.
+  const auto& text = contents->text;
+  const auto line_breaks = contents->GetLineCount() - 1;
+  const auto utf16_len = MultiByteToWideChar(
+    CP_UTF8, 0, text.data(), static_cast<int>(text.size()), nullptr, 0);
+  const auto size = (utf16_len + line_breaks + 1) * sizeof(wchar_t);
+  const auto global = GlobalAlloc(GMEM_MOVEABLE, size);
+  if (!global)
+  {
+    return;
+  }
+
+  auto out = static_cast<wchar_t*>(GlobalLock(global));
+  auto line_start = text.data();
+  const auto text_end = text.data() + text.size();
+  for (;;)
+  {
+    const auto line_end = std::find(line_start, text_end, '\n');
+    out += MultiByteToWideChar(CP_UTF8, 0, line_start,
+                               static_cast<int>(line_end - line_start), out,
+                               static_cast<int>(utf16_len));
+    if (line_end == text_end)
+    {
+      break;
+    }
+    *out++ = L'\r';
+    *out++ = L'\n';
+    line_start = line_end + 1;
+  }
+  *out = L'\0';
+  GlobalUnlock(global);
+
+  if (!SetClipboardData(CF_UNICODETEXT, global))
+  {
+    GlobalFree(global);
+  }
+}
+
+void WindowsClipboardProvider::Publish(
+  std::shared_ptr<const ClipboardContents> contents)
+{
+  if (!OpenClipboard(window_))
+  {
+    return;
+  }
+  EmptyClipboard();
+  {
+    LockGuard lock(mutex_);
+    published_ = std::move(contents);
+  }
+  // Passing no data defers the conversion until WM_RENDERFORMAT.
+  SetClipboardData(CF_UNICODETEXT, nullptr);
+  CloseClipboard();
+}
+
+std::shared_ptr<const ClipboardContents> WindowsClipboardProvider::Read()
+{
+  {
+    // Registers yanked in Nvim are returned as they were published, with
+    // their register type, and without a round trip through UTF-16.
+    LockGuard lock(mutex_);
+    if (published_ && GetClipboardOwner() == window_)
+    {
+      return published_;
+    }
+  }
+
+  const auto sequence_number = GetClipboardSequenceNumber();
+  if (read_ && read_sequence_number_ == sequence_number)
+  {
+    return read_;
+  }
+  if (!IsClipboardFormatAvailable(CF_UNICODETEXT) || !OpenClipboard(nullptr))
+  {
+    return nullptr;
+  }
+
+  std::shared_ptr<ClipboardContents> contents;
+  if (const auto global = GetClipboardData(CF_UNICODETEXT))
+  {
+    const auto utf16_text = static_cast<const wchar_t*>(GlobalLock(global));
+    const auto utf16_len = static_cast<int>(wcslen(utf16_text));
+    contents = std::make_shared<ClipboardContents>();
+    auto& text = contents->text;
+    text.resize(WideCharToMultiByte(CP_UTF8, 0, utf16_text, utf16_len,
+                                    nullptr, 0, nullptr, nullptr));
+    WideCharToMultiByte(CP_UTF8, 0, utf16_text, utf16_len, text.data(),
+                        static_cast<int>(text.size()), nullptr, nullptr);
+    GlobalUnlock(global);
+
+    // Convert "\r\n" to "\n" in place.
+    auto out = text.begin();
+    for (auto in = text.begin(); in != text.end(); ++in)
+    {
+      if (*in == '\r' && in + 1 != text.end() && in[1] == '\n')
+      {
+        continue;
+      }
+      *out++ = *in;
+    }
+    text.erase(out, text.end());
+
+    // Text that ends with a line break is put linewise.
+    contents->regtype =
+      !text.empty() && text.back() == '\n' ? "V" : "v";
+  }
+  CloseClipboard();
+
+  read_ = contents;
+  read_sequence_number_ = sequence_number;
+  return contents;
+}
+}
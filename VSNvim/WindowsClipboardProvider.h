@@ -0,0 +1,41 @@
+#pragma once
+
+// Winsock2.h includes Windows.h and must come first for Nvim's headers.
+#include <Winsock2.h>
+
+#include "ClipboardProvider.h"
+#include "Lock.h"
+
+namespace VSNvim
+{
+// Publishes registers to the Windows clipboard with delayed rendering. The
+// UTF-16 text is only created when another application pastes it.
+class WindowsClipboardProvider : public ClipboardProvider
+{
+private:
+  HWND window_ = nullptr;
+  Mutex mutex_;
+  // The contents published by Nvim while it owns the clipboard.
+  std::shared_ptr<const ClipboardContents> published_;
+  // The contents last read from another application and the clipboard
+  // sequence number they were read at.
+  std::shared_ptr<const ClipboardContents> read_;
+  DWORD read_sequence_number_ = 0;
+
+  static LRESULT CALLBACK WindowProc(
+    HWND window, UINT message, WPARAM w_param, LPARAM l_param);
+
+  void Render();
+
+public:
+  // Must be called on the UI thread since the clipboard owner window
+  // receives its render requests there.
+  WindowsClipboardProvider();
+
+  ~WindowsClipboardProvider() override;
+
+  void Publish(std::shared_ptr<const ClipboardContents> contents) override;
+
+  std::shared_ptr<const ClipboardContents> Read() override;
+};
+}
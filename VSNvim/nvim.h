@@ -21,19 +21,38 @@ extern "C" {
 #define _Bool bool
 #define this this_
 
+#include <nvim/api/buffer.h>
 #include <nvim/api/private/helpers.h>
 #include <nvim/api/ui.h>
 #include <nvim/api/vim.h>
 #include <nvim/ascii.h>
+#include <nvim/buffer.h>
 #include <nvim/buffer_defs.h>
+#include <nvim/cursor.h>
+#include <nvim/eval.h>
+#include <nvim/eval/typval.h>
+#include <nvim/ex_cmds.h>
 #include <nvim/event/defs.h>
+#include <nvim/fileio.h>
+#include <nvim/fold.h>
+#include <nvim/garray.h>
+#include <nvim/getchar.h>
 #include <nvim/globals.h>
+#include <nvim/highlight_defs.h>
 #include <nvim/main.h>
+#include <nvim/mark.h>
+#include <nvim/memline.h>
 #include <nvim/move.h>
+#include <nvim/option_defs.h>
 #include <nvim/pos.h>
+#include <nvim/regexp.h>
 #include <nvim/screen.h>
+#include <nvim/search.h>
+#include <nvim/syntax.h>
 #include <nvim/types.h>
 #include <nvim/ui.h>
+#include <nvim/undo.h>
+#include <nvim/vim.h>
 #include <nvim/window.h>
 
 // Undefine macros with names of keywords so they may be used again.